@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * CRC32C (Castagnoli), the polynomial of the SSE4.2 crc32 instruction
+ *
+ * The portable version is slicing-by-8. On x86 the crc32 instruction does
+ * 8 bytes per cycle, but with a latency of 3 cycles, so large buffers are
+ * split into three streams checksummed at once and the partial results
+ * are folded together with a carry-less multiply (PCLMULQDQ).
+ */
+
+#include "crc32c.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CRC32C_POLY_LE	0x82f63b78
+
+/* bytes per stream in the three stream loop */
+#define CRC32C_BLOCK	256
+
+static u32 crc32c_table[8][256];
+
+/*
+ * multiply two polynomials modulo the crc polynomial, both in the bit
+ * reflected representation: bit 31 is x^0
+ */
+static u32 crc32c_multmodp(u32 a, u32 b)
+{
+	u32 m = (u32)1 << 31;
+	u32 p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY_LE : b >> 1;
+	}
+	return p;
+}
+
+/* x^n modulo the crc polynomial */
+static u32 crc32c_xpow(size_t n)
+{
+	u32 p = (u32)1 << 31;		/* x^0 */
+	u32 x2k = (u32)1 << 30;		/* x^1 */
+
+	while (n) {
+		if (n & 1)
+			p = crc32c_multmodp(x2k, p);
+		x2k = crc32c_multmodp(x2k, x2k);
+		n >>= 1;
+	}
+	return p;
+}
+
+u32 crc32c_shift(u32 crc, size_t length)
+{
+	return crc32c_multmodp(crc32c_xpow(length * 8), crc);
+}
+
+static inline u32 crc32c_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static u32 crc32c_sw(u32 crc, const void *address, size_t length)
+{
+	const unsigned char *p = address;
+	u32 (*t)[256] = crc32c_table;
+
+	while (length >= 8) {
+		u32 lo = crc ^ crc32c_le32(p);
+		u32 hi = crc32c_le32(p + 4);
+
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+		      t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+		      t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+		      t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		length -= 8;
+	}
+	while (length--)
+		crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static u32 crc32c_copy_sw(u32 crc, void *dst, const void *src, size_t length)
+{
+	/* checksum each chunk right after copying it, while it is cache hot */
+	while (length) {
+		size_t l = length < 256 ? length : 256;
+
+		memcpy(dst, src, l);
+		crc = crc32c_sw(crc, dst, l);
+		dst += l;
+		src += l;
+		length -= l;
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* x^(8 * CRC32C_BLOCK - 33) and x^(16 * CRC32C_BLOCK - 33), see below */
+static u32 crc32c_k1, crc32c_k2;
+
+static __always_inline __attribute__((target("sse4.2")))
+u32 crc32c_sse42_tail(u32 crc, unsigned char *d, const unsigned char *s,
+		size_t length, bool copy)
+{
+	uint64_t c = crc;
+	uint64_t v;
+
+	while (length >= 8) {
+		memcpy(&v, s, 8);
+		if (copy)
+			memcpy(d, &v, 8);
+		c = _mm_crc32_u64(c, v);
+		s += 8;
+		d += 8;
+		length -= 8;
+	}
+	crc = c;
+	while (length--) {
+		if (copy)
+			*d++ = *s;
+		crc = _mm_crc32_u8(crc, *s++);
+	}
+	return crc;
+}
+
+/*
+ * crc32c_fold - multiply crc by x^(n + 33) with k = x^n
+ *
+ * clmul of two bit reflected 32 bit values gives their product times x in
+ * the low 64 bits, and crc32 of a 64 bit word multiplies by x^32 while
+ * reducing, so k = x^(8 * bytes - 33) shifts crc over that many bytes.
+ */
+static __always_inline __attribute__((target("sse4.2,pclmul")))
+u32 crc32c_fold(u32 crc, u32 k)
+{
+	__m128i p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+					 _mm_cvtsi32_si128(k), 0);
+
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(p));
+}
+
+static __always_inline __attribute__((target("sse4.2,pclmul")))
+u32 crc32c_hw(u32 crc, unsigned char *d, const unsigned char *s,
+		size_t length, bool copy)
+{
+	while (length >= 3 * CRC32C_BLOCK) {
+		uint64_t c0 = crc, c1 = 0, c2 = 0;
+		uint64_t v0, v1, v2;
+		size_t i;
+
+		for (i = 0; i < CRC32C_BLOCK; i += 8) {
+			memcpy(&v0, s + i, 8);
+			memcpy(&v1, s + CRC32C_BLOCK + i, 8);
+			memcpy(&v2, s + 2 * CRC32C_BLOCK + i, 8);
+			if (copy) {
+				memcpy(d + i, &v0, 8);
+				memcpy(d + CRC32C_BLOCK + i, &v1, 8);
+				memcpy(d + 2 * CRC32C_BLOCK + i, &v2, 8);
+			}
+			c0 = _mm_crc32_u64(c0, v0);
+			c1 = _mm_crc32_u64(c1, v1);
+			c2 = _mm_crc32_u64(c2, v2);
+		}
+		crc = crc32c_fold(c0, crc32c_k2) ^ crc32c_fold(c1, crc32c_k1) ^ c2;
+		s += 3 * CRC32C_BLOCK;
+		d += 3 * CRC32C_BLOCK;
+		length -= 3 * CRC32C_BLOCK;
+	}
+	return crc32c_sse42_tail(crc, d, s, length, copy);
+}
+
+static __attribute__((target("sse4.2,pclmul")))
+u32 crc32c_x86(u32 crc, const void *address, size_t length)
+{
+	return crc32c_hw(crc, NULL, address, length, false);
+}
+
+static __attribute__((target("sse4.2,pclmul")))
+u32 crc32c_copy_x86(u32 crc, void *dst, const void *src, size_t length)
+{
+	return crc32c_hw(crc, dst, src, length, true);
+}
+
+static __attribute__((target("sse4.2")))
+u32 crc32c_sse42(u32 crc, const void *address, size_t length)
+{
+	return crc32c_sse42_tail(crc, NULL, address, length, false);
+}
+
+static __attribute__((target("sse4.2")))
+u32 crc32c_copy_sse42(u32 crc, void *dst, const void *src, size_t length)
+{
+	return crc32c_sse42_tail(crc, dst, src, length, true);
+}
+#endif
+
+static u32 (*crc32c_impl)(u32, const void *, size_t) = crc32c_sw;
+static u32 (*crc32c_copy_impl)(u32, void *, const void *, size_t) =
+	crc32c_copy_sw;
+
+/* fill the tables and pick the implementation before main() runs */
+static void __attribute__((constructor)) crc32c_init(void)
+{
+	unsigned int i, j;
+	u32 crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY_LE : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.2"))
+		return;
+	if (__builtin_cpu_supports("pclmul")) {
+		crc32c_k1 = crc32c_xpow(8 * CRC32C_BLOCK - 33);
+		crc32c_k2 = crc32c_xpow(16 * CRC32C_BLOCK - 33);
+		crc32c_impl = crc32c_x86;
+		crc32c_copy_impl = crc32c_copy_x86;
+	} else {
+		crc32c_impl = crc32c_sse42;
+		crc32c_copy_impl = crc32c_copy_sse42;
+	}
+#endif
+}
+
+u32 crc32c(u32 crc, const void *address, size_t length)
+{
+	return crc32c_impl(crc, address, length);
+}
+
+u32 crc32c_copy(u32 crc, void *dst, const void *src, size_t length)
+{
+	return crc32c_copy_impl(crc, dst, src, length);
+}
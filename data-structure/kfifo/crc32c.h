@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_CRC32C_H
+#define _LINUX_CRC32C_H
+
+#include <linux/types.h>
+#include <stddef.h>
+
+typedef __u32 u32;
+
+/**
+ * crc32c - Castagnoli CRC of a buffer
+ * @crc: seed, ~0 to start a new checksum
+ * @address: the data
+ * @length: size of the data in bytes
+ *
+ * Like in the kernel the result is not inverted, the caller finishes the
+ * checksum with ~. Uses the SSE4.2 crc32 instruction when the cpu has it.
+ */
+extern u32 crc32c(u32 crc, const void *address, size_t length);
+
+/**
+ * crc32c_copy - copy a buffer and compute its crc32c in the same pass
+ * @crc: seed, ~0 to start a new checksum
+ * @dst: where to copy the data to, must not overlap @src
+ * @src: the data
+ * @length: size of the data in bytes
+ *
+ * Every word is checksummed while it is in a register anyway, so this
+ * costs little more than the memcpy() alone.
+ */
+extern u32 crc32c_copy(u32 crc, void *dst, const void *src, size_t length);
+
+/**
+ * crc32c_shift - checksum of the data followed by zero bytes
+ * @crc: checksum of the data, not inverted
+ * @length: number of zero bytes appended
+ *
+ * crc32c(c, a ++ b) == crc32c_shift(crc32c(c, a), len(b)) ^ crc32c(0, b),
+ * which lets independent parts of a buffer be checksummed in parallel.
+ */
+extern u32 crc32c_shift(u32 crc, size_t length);
+
+#endif	/* _LINUX_CRC32C_H */
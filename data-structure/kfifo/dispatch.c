@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * A key partitioned dispatcher built on record kfifos, see dispatch.h
+ */
+
+#define _GNU_SOURCE
+#include "dispatch.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rwonce.h"
+
+static unsigned long long dispatch_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int dispatch_len(struct dispatch_worker *w)
+{
+	return READ_ONCE(w->fifo.in) - READ_ONCE(w->fifo.out);
+}
+
+int dispatch_init(struct dispatch *d, unsigned int nr_workers,
+		unsigned int fifo_size, unsigned int max_record,
+		dispatch_fn_t fn, void *priv)
+{
+	unsigned int i;
+
+	memset(d, 0, sizeof(*d));
+
+	if (!nr_workers || nr_workers > DISPATCH_MAX_WORKERS || !fn ||
+	    !max_record || max_record > DISPATCH_MAX_RECORD ||
+	    max_record + DISPATCH_RECSIZE > fifo_size)
+		return -EINVAL;
+
+	d->nr_workers = nr_workers;
+	d->fifo_size = fifo_size;
+	d->max_record = max_record;
+	d->batch = 16;
+	d->budget_ns = 50000;
+	d->fn = fn;
+	d->priv = priv;
+	for (i = 0; i < nr_workers; i++) {
+		d->worker[i].id = i;
+		d->worker[i].cpu = -1;
+		d->worker[i].d = d;
+	}
+	return 0;
+}
+
+void dispatch_set_batch(struct dispatch *d, unsigned int batch,
+		unsigned long long budget_ns)
+{
+	d->batch = batch ? batch : 1;
+	d->budget_ns = budget_ns;
+}
+
+void dispatch_set_cpu(struct dispatch *d, unsigned int worker, int cpu)
+{
+	d->worker[worker].cpu = cpu;
+}
+
+static void dispatch_pin(struct dispatch_worker *w)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+
+	if (w->cpu < 0 || nr_cpus <= 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu % nr_cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *dispatch_worker_thread(void *arg)
+{
+	struct dispatch_worker *w = arg;
+	struct dispatch *d = w->d;
+	unsigned long long start;
+	unsigned int spins = 0;
+	unsigned int n;
+
+	dispatch_pin(w);
+	start = dispatch_now_ns();
+
+	for (;;) {
+		n = dispatch_len(w);
+		if (!n) {
+			/* eof is set after the last in index, check again */
+			if (smp_load_acquire(&w->eof) && !dispatch_len(w))
+				break;
+			w->stats.starves++;
+			spin_relax(&spins);
+			continue;
+		}
+		spins = 0;
+		if (n > w->stats.depth_max)
+			w->stats.depth_max = n;
+
+		n = __kfifo_out_r(&w->fifo, w->buf, d->max_record,
+				  DISPATCH_RECSIZE);
+		w->stats.done++;
+		if (d->fn(d->priv, w->id, w->buf, n) < 0)
+			break;
+	}
+
+	/* let the producer fail instead of waiting on a fifo nobody reads */
+	WRITE_ONCE(w->closed, 1);
+	w->stats.ns = dispatch_now_ns() - start;
+	return NULL;
+}
+
+void dispatch_destroy(struct dispatch *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->nr_workers; i++) {
+		struct dispatch_worker *w = &d->worker[i];
+
+		free(w->buf);
+		w->buf = NULL;
+		__kfifo_free(&w->fifo);
+	}
+}
+
+int dispatch_start(struct dispatch *d)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < d->nr_workers; i++) {
+		struct dispatch_worker *w = &d->worker[i];
+
+		memset(&w->stats, 0, sizeof(w->stats));
+		w->eof = 0;
+		w->closed = 0;
+		ret = __kfifo_alloc(&w->fifo, d->fifo_size, 1, DISPATCH_RECSIZE, 0);
+		if (ret)
+			goto err;
+		/* publish a quarter of the fifo at the latest to keep it flowing */
+		ret = __kfifo_stage_init(&w->fifo, &w->stage,
+					 (w->fifo.mask + 1) / 4, d->batch,
+					 d->budget_ns);
+		if (ret)
+			goto err;
+		w->buf = malloc(d->max_record);
+		if (!w->buf) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	for (i = 0; i < d->nr_workers; i++) {
+		ret = -pthread_create(&d->worker[i].thread, NULL,
+				      dispatch_worker_thread, &d->worker[i]);
+		if (ret)
+			goto err_threads;
+	}
+	return 0;
+
+err_threads:
+	while (i--) {
+		WRITE_ONCE(d->worker[i].eof, 1);
+		pthread_join(d->worker[i].thread, NULL);
+	}
+err:
+	dispatch_destroy(d);
+	return ret;
+}
+
+int dispatch_submit_hash(struct dispatch *d, u32 hash, const void *rec,
+		unsigned int len)
+{
+	/* multiply and shift maps the hash onto the workers without a divide */
+	unsigned int i = ((unsigned long long)hash * d->nr_workers) >> 32;
+	struct dispatch_worker *w = &d->worker[i];
+	unsigned int spins = 0;
+	unsigned int in = w->stage.in;
+
+	if (len > d->max_record)
+		return -EMSGSIZE;
+
+	/* a zero length record is stored too, so watch the index */
+	__kfifo_stage_in(&w->fifo, &w->stage, rec, len, DISPATCH_RECSIZE);
+	if (w->stage.in == in) {
+		w->stats.stalls++;
+		do {
+			if (READ_ONCE(w->closed))
+				return -EPIPE;
+			spin_relax(&spins);
+			__kfifo_stage_in(&w->fifo, &w->stage, rec, len,
+					 DISPATCH_RECSIZE);
+		} while (w->stage.in == in);
+	}
+
+	w->stats.records++;
+	w->stats.bytes += len;
+	if (!w->stage.records)
+		w->stats.flushes++;
+	return i;
+}
+
+int dispatch_submit(struct dispatch *d, const void *key, size_t key_len,
+		const void *rec, unsigned int len)
+{
+	return dispatch_submit_hash(d, crc32c(~0U, key, key_len), rec, len);
+}
+
+void dispatch_flush(struct dispatch *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->nr_workers; i++) {
+		struct dispatch_worker *w = &d->worker[i];
+
+		if (__kfifo_flush(&w->fifo, &w->stage))
+			w->stats.flushes++;
+	}
+}
+
+void dispatch_poll(struct dispatch *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->nr_workers; i++) {
+		struct dispatch_worker *w = &d->worker[i];
+
+		if (__kfifo_stage_poll(&w->fifo, &w->stage))
+			w->stats.flushes++;
+	}
+}
+
+void dispatch_stop(struct dispatch *d)
+{
+	unsigned int i;
+
+	dispatch_flush(d);
+	/* a worker that sees eof sees the last in index too */
+	for (i = 0; i < d->nr_workers; i++)
+		smp_store_release(&d->worker[i].eof, 1);
+	for (i = 0; i < d->nr_workers; i++)
+		pthread_join(d->worker[i].thread, NULL);
+}
+
+unsigned int dispatch_skew(const struct dispatch *d)
+{
+	unsigned long long total = 0, max = 0;
+	unsigned int i;
+
+	for (i = 0; i < d->nr_workers; i++) {
+		unsigned long long n = d->worker[i].stats.records;
+
+		total += n;
+		if (n > max)
+			max = n;
+	}
+	if (!total)
+		return 100;
+	return max * 100 * d->nr_workers / total;
+}
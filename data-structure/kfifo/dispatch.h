@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * A key partitioned dispatcher built on record kfifos
+ *
+ * Records are routed by a hash of their key to one of N workers. Every
+ * worker reads from its own single producer/single consumer record kfifo,
+ * so records with the same key are processed in order by the same thread
+ * and the fifos need no locking.
+ */
+
+#ifndef _LINUX_KFIFO_DISPATCH_H
+#define _LINUX_KFIFO_DISPATCH_H
+
+#include "kfifo.h"
+#include "crc32c.h"
+
+#define DISPATCH_MAX_WORKERS	64
+
+/* length field of the records in the partition fifos */
+#define DISPATCH_RECSIZE	2
+
+/* longest record a partition fifo can hold */
+#define DISPATCH_MAX_RECORD	((1U << (DISPATCH_RECSIZE * 8)) - 1)
+
+/**
+ * dispatch_fn_t - record handler of a worker
+ * @priv: private data passed to dispatch_init()
+ * @worker: index of the calling worker
+ * @rec: the record
+ * @len: length of @rec in bytes
+ *
+ * Return 0 to go on, a negative value stops the worker.
+ */
+typedef int (*dispatch_fn_t)(void *priv, unsigned int worker,
+			     const void *rec, unsigned int len);
+
+struct dispatch_stats {
+	unsigned long long	records;	/* records routed to the worker */
+	unsigned long long	bytes;		/* payload bytes routed to it */
+	unsigned long long	stalls;		/* submits waiting on a full fifo */
+	unsigned long long	flushes;	/* batches published */
+	unsigned long long	done;		/* records handled by the worker */
+	unsigned long long	starves;	/* waits on an empty fifo */
+	unsigned int		depth_max;	/* most bytes queued seen */
+	unsigned long long	ns;		/* lifetime of the worker thread */
+};
+
+struct dispatch_worker {
+	struct __kfifo		fifo;
+	struct kfifo_stage	stage;		/* owned by the producer */
+	int			eof;		/* producer will not write again */
+	int			closed;		/* worker will not read again */
+	int			cpu;		/* -1 to leave the thread unpinned */
+	unsigned int		id;
+	void			*buf;
+	pthread_t		thread;
+	struct dispatch		*d;
+	struct dispatch_stats	stats;
+};
+
+struct dispatch {
+	struct dispatch_worker	worker[DISPATCH_MAX_WORKERS];
+	unsigned int		nr_workers;
+	unsigned int		fifo_size;	/* bytes per partition */
+	unsigned int		batch;		/* records staged before publishing */
+	unsigned long long	budget_ns;	/* max. time a record stays staged */
+	unsigned int		max_record;	/* longest record handled */
+	dispatch_fn_t		fn;
+	void			*priv;
+};
+
+/**
+ * dispatch_init - initialize a dispatcher
+ * @d: the dispatcher
+ * @nr_workers: number of workers and partitions
+ * @fifo_size: bytes of every partition fifo, rounded up to a power of 2
+ * @max_record: longest record that will be submitted
+ * @fn: record handler run by the workers
+ * @priv: private data of @fn
+ *
+ * Records are staged per partition and published every 16 records or
+ * after 50us, see dispatch_set_batch().
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int dispatch_init(struct dispatch *d, unsigned int nr_workers,
+	unsigned int fifo_size, unsigned int max_record, dispatch_fn_t fn,
+	void *priv);
+
+/**
+ * dispatch_set_batch - set how records are batched per partition
+ * @d: the dispatcher, not started yet
+ * @batch: publish once this many records are staged, 1 publishes each one
+ * @budget_ns: publish once the oldest staged record is this old
+ */
+extern void dispatch_set_batch(struct dispatch *d, unsigned int batch,
+	unsigned long long budget_ns);
+
+/**
+ * dispatch_set_cpu - pin a worker to a cpu
+ * @d: the dispatcher, not started yet
+ * @worker: index of the worker
+ * @cpu: the cpu, -1 for no pinning
+ */
+extern void dispatch_set_cpu(struct dispatch *d, unsigned int worker, int cpu);
+
+/**
+ * dispatch_start - allocate the partitions and start all worker threads
+ * @d: the dispatcher
+ *
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int dispatch_start(struct dispatch *d);
+
+/**
+ * dispatch_submit - route a record to the worker owning its key
+ * @d: the dispatcher
+ * @key: the key, records with equal keys are handled in submit order
+ * @key_len: length of @key in bytes
+ * @rec: the record
+ * @len: length of @rec in bytes
+ *
+ * Waits while the partition is full. Only one thread may submit, several
+ * producers have to serialize their calls.
+ * Return the index of the worker, -EMSGSIZE for a record longer than the
+ * max_record passed to dispatch_init() or -EPIPE if the worker stopped.
+ */
+extern int dispatch_submit(struct dispatch *d, const void *key,
+	size_t key_len, const void *rec, unsigned int len);
+
+/**
+ * dispatch_submit_hash - like dispatch_submit() for an already hashed key
+ * @d: the dispatcher
+ * @hash: 32 bit hash of the key
+ * @rec: the record
+ * @len: length of @rec in bytes
+ */
+extern int dispatch_submit_hash(struct dispatch *d, u32 hash,
+	const void *rec, unsigned int len);
+
+/**
+ * dispatch_flush - publish the staged records of all partitions
+ * @d: the dispatcher
+ */
+extern void dispatch_flush(struct dispatch *d);
+
+/**
+ * dispatch_poll - publish the partitions whose time budget ran out
+ * @d: the dispatcher
+ *
+ * Call it from the producer when it goes idle.
+ */
+extern void dispatch_poll(struct dispatch *d);
+
+/**
+ * dispatch_stop - flush, let the workers drain their fifos and wait for them
+ * @d: the dispatcher
+ */
+extern void dispatch_stop(struct dispatch *d);
+
+/**
+ * dispatch_destroy - free the partitions of a stopped dispatcher
+ * @d: the dispatcher
+ */
+extern void dispatch_destroy(struct dispatch *d);
+
+/**
+ * dispatch_skew - returns how uneven the partitions are loaded
+ * @d: the dispatcher
+ *
+ * The most records routed to one worker in percent of the mean, 100 means
+ * a perfectly even spread.
+ */
+extern unsigned int dispatch_skew(const struct dispatch *d);
+
+/**
+ * dispatch_worker_stats - returns the statistics of a worker
+ * @d: the dispatcher
+ * @worker: index of the worker
+ *
+ * Only stable after dispatch_stop().
+ */
+static inline const struct dispatch_stats *
+dispatch_worker_stats(const struct dispatch *d, unsigned int worker)
+{
+	return &d->worker[worker].stats;
+}
+
+#endif
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include "kfifo.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * kfifo_in_spinlocked/kfifo_out_spinlocked在不同锁下的争用测试
+ *
+ * 多个生产者和消费者共用一个kfifo，每次放入或取出BENCH_BATCH个元素，跑固定的时间后统计：
+ * 总吞吐量，以及每个线程完成的元素数最少和最多的比值（越接近1越公平）
+ *
+ * 用法：./fifo_lock_bench [每种锁的运行毫秒数] [生产者个数] [消费者个数]
+ */
+
+#define BENCH_BATCH 8
+#define BENCH_MAX_THREADS 64
+
+struct bench_thread
+{
+    pthread_t tid;
+    int cpu;
+    unsigned long long elems;
+} __attribute__((aligned(64)));
+
+static DECLARE_KFIFO(bench_fifo, int, 1024);
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+static volatile int bench_stop;
+static int bench_ms = 500;
+static int nr_producers = 2;
+static int nr_consumers = 2;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 线程按顺序绑定到各个cpu上，cpu不够就轮着来 */
+static void bench_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void bench_run(const char *name, void *(*producer)(void *), void *(*consumer)(void *))
+{
+    unsigned long long start, ns, total = 0, min = ~0ULL, max = 0;
+    int nr = nr_producers + nr_consumers;
+    int i;
+
+    INIT_KFIFO(bench_fifo);
+    bench_stop = 0;
+    memset(bench_threads, 0, sizeof(bench_threads));
+
+    start = now_ns();
+    for (i = 0; i < nr; i++)
+    {
+        bench_threads[i].cpu = i;
+        pthread_create(&bench_threads[i].tid, NULL, i < nr_producers ? producer : consumer, &bench_threads[i]);
+    }
+
+    usleep(bench_ms * 1000);
+    bench_stop = 1;
+    for (i = 0; i < nr; i++)
+        pthread_join(bench_threads[i].tid, NULL);
+    ns = now_ns() - start;
+
+    /* 吞吐量按消费者取出的元素数算 */
+    for (i = 0; i < nr; i++)
+    {
+        if (i >= nr_producers)
+            total += bench_threads[i].elems;
+        if (bench_threads[i].elems < min)
+            min = bench_threads[i].elems;
+        if (bench_threads[i].elems > max)
+            max = bench_threads[i].elems;
+    }
+
+    printf("%-8s %8.2f Melem/s, per thread min %llu max %llu, fairness %.3f\r\n",
+           name, (double)total * 1000 / ns, min, max, max ? (double)min / max : 0);
+}
+
+/* 每种锁生成一对生产者、消费者线程函数，spin_lock会根据锁的类型选择实现 */
+#define DEFINE_LOCK_BENCH(name, type)                                                 \
+    static type name##_l;                                                             \
+                                                                                      \
+    static void *name##_producer(void *arg)                                           \
+    {                                                                                 \
+        struct bench_thread *t = arg;                                                 \
+        int buf[BENCH_BATCH] = {0};                                                   \
+                                                                                      \
+        bench_pin(t->cpu);                                                            \
+        while (!bench_stop)                                                           \
+            t->elems += kfifo_in_spinlocked(&bench_fifo, buf, BENCH_BATCH, &name##_l); \
+        return NULL;                                                                  \
+    }                                                                                 \
+                                                                                      \
+    static void *name##_consumer(void *arg)                                           \
+    {                                                                                 \
+        struct bench_thread *t = arg;                                                 \
+        int buf[BENCH_BATCH];                                                         \
+                                                                                      \
+        bench_pin(t->cpu);                                                            \
+        while (!bench_stop)                                                           \
+            t->elems += kfifo_out_spinlocked(&bench_fifo, buf, BENCH_BATCH, &name##_l); \
+        return NULL;                                                                  \
+    }                                                                                 \
+                                                                                      \
+    static void bench_##name(void)                                                    \
+    {                                                                                 \
+        spin_lock_init(&name##_l);                                                    \
+        bench_run(#name, name##_producer, name##_consumer);                           \
+    }
+
+DEFINE_LOCK_BENCH(pthread, pthread_spinlock_t)
+DEFINE_LOCK_BENCH(ticket, struct ticket_spinlock)
+DEFINE_LOCK_BENCH(mcs, struct mcs_lock)
+DEFINE_LOCK_BENCH(clh, struct clh_lock)
+DEFINE_LOCK_BENCH(queued, struct qspinlock)
+DEFINE_LOCK_BENCH(futex, struct futex_mutex)
+
+int main(int argc, char const *argv[])
+{
+    if (argc > 1)
+        bench_ms = atoi(argv[1]);
+    if (argc > 2)
+        nr_producers = atoi(argv[2]);
+    if (argc > 3)
+        nr_consumers = atoi(argv[3]);
+    if (bench_ms <= 0 || nr_producers <= 0 || nr_consumers <= 0 ||
+        nr_producers + nr_consumers > BENCH_MAX_THREADS)
+    {
+        printf("usage: %s [ms] [producers] [consumers]\r\n", argv[0]);
+        exit(1);
+    }
+
+    printf("%d producers, %d consumers, %d elements per call, %d ms per lock\r\n",
+           nr_producers, nr_consumers, BENCH_BATCH, bench_ms);
+    bench_pthread();
+    bench_ticket();
+    bench_mcs();
+    bench_clh();
+    bench_queued();
+    bench_futex();
+    exit(0);
+}
@@ -1,6 +1,13 @@
+#include "dispatch.h"
 #include "kfifo.h"
+#include "kfifo64.h"
+#include "kfifo_cols.h"
+#include "kfifo_trace.h"
+#include "pipeline.h"
+#include "rpc.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/wait.h>
 
 /* 用户空间编译，魔改GFP_KERNEL */
 #define GFP_KERNEL (0)
@@ -153,6 +160,20 @@ void test_nonrec(void)
         printf("%d ", b[i]);
     printf(" line %d\r\n", __LINE__);
 
+    /* kfifo_peek_at返回指向第i个元素的指针，不拷贝也不读出，超出队列长度返回NULL */
+    unsigned char *p = kfifo_peek_at(&fifo1, 1);
+    if (p)
+        printf("element 1: %d line %d\r\n", *p, __LINE__);
+
+    /* kfifo_peek_range返回从第start个元素开始的最多n个元素所在的位置，越过队列末尾时分成first和second两段 */
+    struct kfifo_span span;
+    ret = kfifo_peek_range(&fifo1, 1, 2, &span);
+    for (int i = 0; i < span.first_len; i++)
+        printf("%d ", ((unsigned char *)span.first)[i]);
+    for (int i = 0; i < span.second_len; i++)
+        printf("%d ", ((unsigned char *)span.second)[i]);
+    printf("%d elements line %d\r\n", ret, __LINE__);
+
     /* kfifo_skip跳过下一次要读出的元素 */
     kfifo_skip(&fifo1);
 
@@ -320,6 +341,25 @@ void test_rec(void)
     ret = kfifo_get(&fifo1, b);
     printf("%d elements: %c line %d\r\n", ret, b[0], __LINE__);
 
+    /* 记录型kfifo的kfifo_len返回的是字节数，kfifo_rec_count返回记录条数，没有索引时要遍历所有记录头 */
+    printf("record count: %d\r\n", kfifo_rec_count(&fifo1));
+
+    /* kfifo_rec_index_alloc给记录型kfifo挂上一个索引环，记下每条记录的位置，之后的写入、读出、跳过都会维护它 */
+    ret = kfifo_rec_index_alloc(&fifo1, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    printf("record count: %d\r\n", kfifo_rec_count(&fifo1));
+
+    /* kfifo_rec_peek_at不拷贝也不读出，直接返回第k条记录的长度，span指向记录内容 */
+    struct kfifo_span span;
+    ret = kfifo_rec_peek_at(&fifo1, 2, &span);
+    printf("%d elements: %.*s%.*s line %d\r\n", ret, span.first_len, (char *)span.first,
+           span.second_len, (char *)span.second, __LINE__);
+
+    /* kfifo_rec_skip_n一次跳过n条记录，返回实际跳过的记录数 */
+    ret = kfifo_rec_skip_n(&fifo1, 2);
+    printf("skipped %d records, record count: %d\r\n", ret, kfifo_rec_count(&fifo1));
+
     /* kfifo_out读出一条记录，读出的元素个数为min(指定的最大元素数, 下一条记录包含的元素数)，返回值是读出元素个数，空队列返回0 */
     while (!kfifo_is_empty(&fifo1))
     {
@@ -353,15 +393,579 @@ void test_rec(void)
      * 5.
      * 释放
      */
-    /* 释放所有动态分配的空间 */
+    /* 释放所有动态分配的空间，索引环也一起释放 */
+    kfifo_free(&fifo1);
+}
+
+/**
+ * 这个函数演示了带校验和的记录型kfifo
+ */
+void test_rec_csum(void)
+{
+    /*
+     * recsize加上KFIFO_REC_CSUM后，每条记录的长度字段后面多了4个字节的CRC32C校验和
+     * 写入时边拷贝边计算，读出时边拷贝边校验，校验失败的记录被丢弃
+     */
+    struct kfifo_rec_csum_ptr_2 fifo1;
+    int ret = kfifo_alloc(&fifo1, 256, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    printf("record header size: %zu\r\n", kfifo_recsize(&fifo1));
+
+    kfifo_in(&fifo1, "hello", 5);
+    kfifo_in(&fifo1, "broken", 6);
+    kfifo_in(&fifo1, "kfifo", 5);
+
+    /* 模拟共享内存里的数据被改坏：第二条记录的内容在第一条记录（6字节头+5字节内容）和它自己的6字节头之后 */
+    unsigned char *data = fifo1.kfifo.data;
+    data[(fifo1.kfifo.out + 6 + 5 + 6) & fifo1.kfifo.mask] ^= 0x20;
+
+    char c[16];
+    while (!kfifo_is_empty(&fifo1))
+    {
+        ret = kfifo_out(&fifo1, c, sizeof(c));
+        c[ret] = '\0';
+        printf("%d elements: %s line %d\r\n", ret, c, __LINE__);
+    }
+
+    /* 长度字段被改坏时剩下的数据都不可信，整个fifo被清空，挂着的索引也要一起清空，不能只弹出一条 */
+    ret = kfifo_rec_index_alloc(&fifo1, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    kfifo_in(&fifo1, "hello", 5);
+    kfifo_in(&fifo1, "broken", 6);
+    kfifo_in(&fifo1, "kfifo", 5);
+    data[fifo1.kfifo.out & fifo1.kfifo.mask] ^= 0xf0;
+    ret = kfifo_out(&fifo1, c, sizeof(c));
+    printf("%d elements, empty %d, record count %u, expect 0 1 0 line %d\r\n", ret, kfifo_is_empty(&fifo1),
+           kfifo_rec_count(&fifo1), __LINE__);
+    kfifo_rec_index_free(&fifo1);
     kfifo_free(&fifo1);
 }
 
+struct my_sample
+{
+    double value;
+    long long timestamp;
+    int id;
+};
+
+/**
+ * 这个函数演示了对齐的记录型kfifo
+ */
+void test_rec_aligned(void)
+{
+    /*
+     * recsize为8、16或64时，记录头是一个4字节的长度，补齐到recsize字节，
+     * 每条记录的内容都从缓冲区里recsize对齐的位置开始，也不会绕回缓冲区开头，
+     * 所以可以用kfifo_peek_record()直接拿到结构体指针，不用再拷贝一次
+     * 放不下的记录前面会补一条填充记录，占满缓冲区剩下的部分
+     */
+    struct kfifo_rec_aligned_ptr_16 fifo1;
+    int ret = kfifo_alloc(&fifo1, 128, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    printf("record header size: %zu\r\n", kfifo_recsize(&fifo1));
+
+    /* 每条记录占16+32字节，128字节的缓冲区放不下3条，写满了就丢掉最老的记录 */
+    struct my_sample s;
+    for (int i = 0; i < 6; i++)
+    {
+        s.value = i * 1.5;
+        s.timestamp = 1000 + i;
+        s.id = i;
+        while (!kfifo_in(&fifo1, &s, sizeof(s)))
+            kfifo_skip(&fifo1);
+    }
+    printf("records: %u, in: %u, out: %u\r\n", kfifo_rec_count(&fifo1),
+           fifo1.kfifo.in, fifo1.kfifo.out);
+
+    /* 查询下一条记录的长度不会动out，前面有填充记录也一样 */
+    printf("next record size: %u, out: %u\r\n", kfifo_peek_len(&fifo1), fifo1.kfifo.out);
+
+    struct my_sample *p;
+    while ((p = kfifo_peek_record(&fifo1, struct my_sample)) != NULL)
+    {
+        printf("offset %3ld: %d %lld %.1f line %d\r\n",
+               (long)((unsigned char *)p - (unsigned char *)fifo1.kfifo.data),
+               p->id, p->timestamp, p->value, __LINE__);
+        kfifo_skip(&fifo1);
+    }
+    kfifo_free(&fifo1);
+
+    /* kfifo_init的缓冲区要对齐到recsize，不然返回-EINVAL */
+    static unsigned char buf[128 + 16] __attribute__((aligned(16)));
+    ret = kfifo_init(&fifo1, buf + 4, 128);
+    printf("kfifo_init on buf + 4: %s, line %d\r\n", strerror(-ret), __LINE__);
+
+    /* 缓冲区至少要放下一个记录头和一块内容，也就是两个recsize */
+    struct kfifo_rec_aligned_ptr_64 fifo2;
+    ret = kfifo_alloc(&fifo2, 32, GFP_KERNEL);
+    printf("kfifo_alloc of 32 bytes with recsize 64: %s, line %d\r\n", strerror(-ret), __LINE__);
+}
+
+/**
+ * 这个函数演示了不取出数据的快照遍历
+ */
+void test_snapshot(void)
+{
+    /*
+     * 监控线程想看看kfifo里排着什么，又不想拿读写用的锁、也不想影响读的一方
+     * kfifo_snapshot()无锁地读出一对一致的in和out，kfifo_snapshot_next()逐条拷出两者之间的元素或记录
+     * 拷的过程中读的一方越过了这条记录的话，写的一方可能已经覆盖了它，这时返回-ESTALE，从还在队列里的最老记录接着遍历
+     */
+    struct kfifo_rec_ptr_1 fifo1;
+    int ret = kfifo_alloc(&fifo1, 32, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    kfifo_in(&fifo1, "alpha", 5);
+    kfifo_in(&fifo1, "beta", 4);
+    kfifo_in(&fifo1, "gamma", 5);
+    kfifo_in(&fifo1, "delta", 5);
+
+    struct kfifo_snapshot snap;
+    printf("snapshot bytes: %u\r\n", kfifo_snapshot(&fifo1, &snap));
+
+    char c[16];
+    unsigned int copied;
+    ret = kfifo_snapshot_next(&fifo1, &snap, c, sizeof(c), &copied);
+    c[copied] = '\0';
+    printf("%d: %s line %d\r\n", ret, c, __LINE__);
+
+    /* 遍历到一半，读的一方取走了三条记录，写的一方又写了新的 */
+    for (int i = 0; i < 3; i++)
+        kfifo_skip(&fifo1);
+    kfifo_in(&fifo1, "epsilon", 7);
+    kfifo_in(&fifo1, "zeta", 4);
+
+    while ((ret = kfifo_snapshot_next(&fifo1, &snap, c, sizeof(c), &copied)) != 0)
+    {
+        c[copied] = '\0';
+        printf("%d: %s line %d\r\n", ret, c, __LINE__);
+    }
+    printf("records still queued: %u\r\n", kfifo_rec_count(&fifo1));
+    kfifo_free(&fifo1);
+}
+
+/**
+ * 这个函数演示了写入方的攒批发布
+ */
+void test_stage(void)
+{
+    /*
+     * kfifo_stage_in()把数据直接写进kfifo的缓冲区，但只移动stage自己的in，读的一方看不到
+     * 攒够max_len字节、max_records条，或者最老的数据等了budget_ns纳秒，才一次性更新kfifo的in
+     * kfifo_flush()立即发布，写的一方空闲下来时要调用kfifo_stage_poll()检查时间
+     */
+    struct kfifo_rec_ptr_1 fifo1;
+    struct kfifo_stage stage;
+    int ret = kfifo_alloc(&fifo1, 64, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    /* 攒够16字节或者3条记录就发布，最多等1ms */
+    ret = kfifo_stage_init(&fifo1, &stage, 16, 3, 1000000);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+
+    const char *msgs[] = {"a", "bb", "ccc", "dd", "e"};
+    for (int i = 0; i < 5; i++)
+    {
+        kfifo_stage_in(&fifo1, &stage, msgs[i], strlen(msgs[i]));
+        printf("staged %s, visible records: %u\r\n", msgs[i], kfifo_rec_count(&fifo1));
+    }
+    printf("flushed bytes: %u\r\n", kfifo_flush(&fifo1, &stage));
+
+    char c[16];
+    while (!kfifo_is_empty(&fifo1))
+    {
+        ret = kfifo_out(&fifo1, c, sizeof(c));
+        c[ret] = '\0';
+        printf("%d elements: %s line %d\r\n", ret, c, __LINE__);
+    }
+    kfifo_free(&fifo1);
+}
+
+/**
+ * 这个函数演示了64位下标的kfifo
+ */
+void test_kfifo64(void)
+{
+    /*
+     * struct __kfifo的in、out和mask都是unsigned int，元素个数最多2^31个，字节队列也不能超过4GB
+     * kfifo64的用法和kfifo完全一样，只是宏和类型都多了个64，in、out和mask是64位，长度参数也是64位
+     * 内存占用大一点，所以默认还是用kfifo
+     */
+    DECLARE_KFIFO64_PTR(fifo1, int);
+    /* 这里只分配128个元素，真正用的时候可以超过2^32个 */
+    int ret = kfifo64_alloc(&fifo1, 128, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+
+    /* 把in和out挪到2^32附近，看看下标越过32位以后的情况 */
+    fifo1.kfifo.in = fifo1.kfifo.out = 0xfffffff0ULL;
+    int b[40];
+    for (int i = 0; i < 40; i++)
+        b[i] = i;
+    printf("input counts: %llu\r\n", kfifo64_in(&fifo1, b, 40));
+    printf("in: %#llx, out: %#llx, used element count: %llu\r\n",
+           fifo1.kfifo.in, fifo1.kfifo.out, kfifo64_len(&fifo1));
+    ret = kfifo64_out(&fifo1, b, 40);
+    for (int i = 0; i < ret; i++)
+        printf("%d ", b[i]);
+    printf(" line %d\r\n", __LINE__);
+    kfifo64_free(&fifo1);
+
+    /* 超过2^63的大小没法向上取整到2的幂，直接返回-EINVAL */
+    ret = kfifo64_alloc(&fifo1, (1ULL << 63) + 1, GFP_KERNEL);
+    printf("alloc 2^63 + 1: %s, line %d\r\n", strerror(-ret), __LINE__);
+
+    /* 记录型也一样 */
+    struct kfifo64_rec_ptr_2 fifo2;
+    ret = kfifo64_alloc(&fifo2, 256, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    kfifo64_in(&fifo2, "hello", 5);
+    kfifo64_in(&fifo2, "kfifo64", 7);
+    printf("next record size: %llu bytes\r\n", kfifo64_peek_len(&fifo2));
+    char c[16];
+    while (!kfifo64_is_empty(&fifo2))
+    {
+        ret = kfifo64_out(&fifo2, c, sizeof(c));
+        c[ret] = '\0';
+        printf("%d elements: %s line %d\r\n", ret, c, __LINE__);
+    }
+    kfifo64_free(&fifo2);
+}
+
+/* 列式kfifo的字段列表 */
+#define MY_ELEMENT_COLS(X) \
+    X(int, a)              \
+    X(char *, b)           \
+    X(long long, c)
+
+/**
+ * 这个函数演示了列式kfifo
+ */
+void test_kfifo_cols(void)
+{
+    /*
+     * 列式kfifo从一个字段列表声明，每个字段有自己的环形缓冲区，所有字段共用一对in和out
+     * 取出时可以直接拿到每一列的连续数组，不用先把结构体数组转成数组结构体再做向量化的计算
+     */
+    DECLARE_KFIFO_COLS(fifo, MY_ELEMENT_COLS);
+    INIT_KFIFO_COLS(fifo, MY_ELEMENT_COLS);
+    int ret = kfifo_cols_alloc(&fifo, 64, GFP_KERNEL);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    printf("size %u, columns %u\r\n", kfifo_cols_size(&fifo), kfifo_cols_ncols(&fifo));
+
+    /* 把in和out挪到快要回绕的地方，看看回绕以后的两段 */
+    fifo.kfifo.in = fifo.kfifo.out = 40;
+
+    /* 放入结构体数组，字段会被分散到各自的列里，数组的类型必须是kfifo_cols_row_t，别的结构体编译不过 */
+    kfifo_cols_row_t(&fifo) rows[32];
+    for (int i = 0; i < 32; i++)
+    {
+        rows[i].a = i;
+        rows[i].b = "row";
+        rows[i].c = i * 1000LL;
+    }
+    printf("input rows: %u\r\n", kfifo_cols_in_rows(&fifo, rows, 32));
+
+    /* 也可以按列放入，每个字段给一个数组 */
+    int a[8] = {100, 101, 102, 103, 104, 105, 106, 107};
+    char *b[8] = {"col", "col", "col", "col", "col", "col", "col", "col"};
+    long long c[8] = {0};
+    kfifo_cols_ptrs_t(&fifo) cols = {.a = a, .b = b, .c = c};
+    printf("input columns: %u\r\n", kfifo_cols_in(&fifo, &cols, 8));
+    printf("used element count: %u\r\n", kfifo_cols_len(&fifo));
+
+    /*
+     * 批量取出：kfifo_cols_peek_span把队列里的数据直接映射出来，first是到缓冲区末尾的一段，second是回绕后的一段
+     * 每一列都在同一个位置回绕，所以对first和second各跑一遍循环就行，处理完再用kfifo_cols_skip丢掉
+     */
+    kfifo_cols_span_t(&fifo) span;
+    unsigned int n = kfifo_cols_peek_span(&fifo, 36, &span);
+    long long sum_a = 0, sum_c = 0;
+    for (unsigned int i = 0; i < span.first_len; i++)
+    {
+        sum_a += span.first.a[i];
+        sum_c += span.first.c[i];
+    }
+    for (unsigned int i = 0; i < span.second_len; i++)
+    {
+        sum_a += span.second.a[i];
+        sum_c += span.second.c[i];
+    }
+    printf("mapped %u (%u + %u), sum of a %lld, sum of c %lld line %d\r\n",
+           n, span.first_len, span.second_len, sum_a, sum_c, __LINE__);
+    kfifo_cols_skip(&fifo, n);
+
+    /* 剩下的元素按行取出 */
+    ret = kfifo_cols_out_rows(&fifo, rows, 32);
+    for (int i = 0; i < ret; i++)
+        printf("{%d, %s, %lld} ", rows[i].a, rows[i].b, rows[i].c);
+    printf(" line %d\r\n", __LINE__);
+
+    kfifo_cols_free(&fifo);
+}
+
+/*
+ * 流水线的三个阶段：source产生1~PIPE_COUNT，square求平方，sink求和
+ */
+#define PIPE_COUNT 100000
+
+static int pipe_source(void *priv, const void *in, unsigned int n,
+                       void *out, unsigned int out_max)
+{
+    int *next = priv;
+    int *o = out;
+    unsigned int i;
+
+    if (*next > PIPE_COUNT)
+        return PIPELINE_EOF;
+    for (i = 0; i < out_max && *next <= PIPE_COUNT; i++)
+        o[i] = (*next)++;
+    return i;
+}
+
+static int pipe_square(void *priv, const void *in, unsigned int n,
+                       void *out, unsigned int out_max)
+{
+    const int *v = in;
+    long long *o = out;
+
+    for (unsigned int i = 0; i < n; i++)
+        o[i] = (long long)v[i] * v[i];
+    return n;
+}
+
+static int pipe_sink(void *priv, const void *in, unsigned int n,
+                     void *out, unsigned int out_max)
+{
+    long long *sum = priv;
+    const long long *v = in;
+
+    for (unsigned int i = 0; i < n; i++)
+        *sum += v[i];
+    return 0;
+}
+
+/**
+ * 这个函数演示了基于kfifo的流水线
+ */
+void test_pipeline(void)
+{
+    /*
+     * 每个阶段一个线程，相邻阶段之间用单生产者单消费者的kfifo连接，不需要加锁
+     * 阶段函数每次处理一批元素，下游kfifo剩余空间不够一批时上游阻塞，形成背压
+     */
+    struct pipeline pl;
+    int next = 1;
+    long long sum = 0;
+    int ret = pipeline_init(&pl, 1024, 64);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+
+    /* 第一个阶段是source，最后一个是sink，esize是该阶段输出元素的字节数，最后一个参数是绑定的cpu */
+    pipeline_add_stage(&pl, "source", pipe_source, &next, sizeof(int), 0);
+    pipeline_add_stage(&pl, "square", pipe_square, NULL, sizeof(long long), 1);
+    pipeline_add_stage(&pl, "sink", pipe_sink, &sum, 0, 2);
+
+    ret = pipeline_start(&pl);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+
+    /* source返回PIPELINE_EOF后，下游把kfifo中剩下的数据处理完再依次退出，也可以用pipeline_stop提前结束source */
+    pipeline_join(&pl);
+    printf("sum: %lld line %d\r\n", sum, __LINE__);
+
+    /* 每个阶段的统计：吞吐量、背压等待次数、输入队列深度 */
+    for (unsigned int i = 0; i < pl.nr_stages; i++)
+    {
+        const struct pipeline_stats *st = pipeline_stage_stats(&pl, i);
+        printf("%-8s in %llu out %llu batches %llu stalls %llu starves %llu avg depth %llu max depth %u, %.2f Melem/s\r\n",
+               pl.stage[i].name, st->in, st->out, st->batches, st->stalls, st->starves,
+               st->batches ? st->depth_sum / st->batches : 0, st->depth_max,
+               st->ns ? (double)(st->in + st->out) * 1000 / st->ns : 0);
+    }
+
+    pipeline_destroy(&pl);
+}
+
+#define DISPATCH_SESSIONS 64
+
+struct session_msg
+{
+    unsigned int session;
+    unsigned int seq;
+};
+
+/* 每个会话只会被一个worker处理，所以这里不用加锁 */
+static int dispatch_handle(void *priv, unsigned int worker, const void *rec, unsigned int len)
+{
+    unsigned int *next_seq = priv;
+    const struct session_msg *msg = rec;
+
+    if (len != sizeof(*msg) || msg->seq != next_seq[msg->session])
+    {
+        printf("out of order: session %u seq %u\r\n", msg->session, msg->seq);
+        return -1;
+    }
+    next_seq[msg->session]++;
+    return 0;
+}
+
+/**
+ * 这个函数演示了按key分区的分发器
+ */
+void test_dispatch(void)
+{
+    /*
+     * 每个worker一个线程，各自读一个单生产者单消费者的记录型kfifo
+     * dispatch_submit()按key的哈希把记录交给固定的worker，同一个key的记录按提交的顺序处理
+     * 每个分区的记录先攒一批再发布（见kfifo_stage_in），统计里可以看到分区的负载是否均匀
+     */
+    struct dispatch d;
+    unsigned int next_seq[DISPATCH_SESSIONS] = {0};
+    int ret = dispatch_init(&d, 4, 4096, sizeof(struct session_msg), dispatch_handle, next_seq);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+    ret = dispatch_start(&d);
+    if (ret)
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+
+    struct session_msg msg;
+    unsigned int seq[DISPATCH_SESSIONS] = {0};
+    for (int i = 0; i < 100000; i++)
+    {
+        msg.session = (i * 7) % DISPATCH_SESSIONS;
+        msg.seq = seq[msg.session]++;
+        dispatch_submit(&d, &msg.session, sizeof(msg.session), &msg, sizeof(msg));
+    }
+    /* 把攒着的记录发布出去，等worker处理完 */
+    dispatch_stop(&d);
+
+    for (unsigned int i = 0; i < d.nr_workers; i++)
+    {
+        const struct dispatch_stats *st = dispatch_worker_stats(&d, i);
+        printf("worker %u records %llu done %llu batches %llu stalls %llu max depth %u\r\n",
+               i, st->records, st->done, st->flushes, st->stalls, st->depth_max);
+    }
+    printf("skew: %u%%\r\n", dispatch_skew(&d));
+    dispatch_destroy(&d);
+}
+
+static int rpc_upper(void *priv, const void *req, unsigned int len, void *resp, unsigned int resp_max)
+{
+    const char *in = req;
+    char *out = resp;
+
+    for (unsigned int i = 0; i < len; i++)
+        out[i] = (in[i] >= 'a' && in[i] <= 'z') ? in[i] - 'a' + 'A' : in[i];
+    return len;
+}
+
+/**
+ * 这个函数演示了共享内存上的rpc
+ */
+void test_rpc(void)
+{
+    /*
+     * 共享内存里放两个记录型kfifo，一个放请求，一个放应答，每条记录的开头是请求的id
+     * 等待的一方先轮询一会儿，再睡在futex上，发送的一方只有在对方睡着的时候才调用futex唤醒
+     * name为NULL时是匿名共享内存，fork出来的子进程调用rpc_set_role换到另一边；不相关的进程用名字rpc_open
+     */
+    struct rpc_chan ch;
+    int ret = rpc_create(&ch, NULL, 4096, RPC_CLIENT);
+    if (ret)
+    {
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+        return;
+    }
+
+    /* 子进程会继承stdio里还没输出的内容 */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        printf("%s, %d\r\n", strerror(errno), __LINE__);
+        rpc_close(&ch);
+        return;
+    }
+    if (!pid)
+    {
+        rpc_set_role(&ch, RPC_SERVER);
+        ret = rpc_serve(&ch, rpc_upper, NULL);
+        rpc_close(&ch);
+        exit(ret ? 1 : 0);
+    }
+
+    const char *reqs[] = {"hello", "shared", "memory"};
+    char c[16];
+    for (int i = 0; i < 3; i++)
+    {
+        ret = rpc_call(&ch, reqs[i], strlen(reqs[i]), c, sizeof(c) - 1);
+        c[ret > 0 ? ret : 0] = '\0';
+        printf("%d elements: %s line %d\r\n", ret, c, __LINE__);
+    }
+    /* 让服务端的rpc_serve返回 */
+    rpc_shutdown(&ch);
+    waitpid(pid, NULL, 0);
+    rpc_close(&ch);
+}
+
+/**
+ * 这个函数演示了kfifo读写的抓包
+ */
+void test_trace(void)
+{
+    /*
+     * kfifo_trace_start()以后，每次kfifo_in、kfifo_out（包括记录型）都会记下时间、线程id、kfifo、请求和实际读写的个数
+     * 每个线程先攒在自己的缓冲区里，攒满了再写文件，没开抓包的时候只多一次分支判断
+     * 抓到的文件可以用kfifo_replay按原来的时间和大小回放，比较不同的kfifo大小和锁
+     */
+    const char *path = "/tmp/fifo_test.trace";
+    int ret = kfifo_trace_start(path);
+    if (ret)
+    {
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+        return;
+    }
+
+    /* 用流水线产生一些多线程的流量 */
+    test_pipeline();
+
+    long n = kfifo_trace_stop();
+    printf("captured %ld events into %s\r\n", n, path);
+    printf("replay with: ./kfifo_replay %s\r\n", path);
+}
+
 int main(int argc, char const *argv[])
 {
     printf("====nonrec kfifo====\r\n");
     test_nonrec();
     printf("\r\n\r\n\r\n=====rec kfifo======\r\n");
     test_rec();
+    printf("\r\n\r\n\r\n=====rec kfifo with checksum======\r\n");
+    test_rec_csum();
+    printf("\r\n\r\n\r\n=====aligned rec kfifo======\r\n");
+    test_rec_aligned();
+    printf("\r\n\r\n\r\n=====kfifo snapshot======\r\n");
+    test_snapshot();
+    printf("\r\n\r\n\r\n=====kfifo stage======\r\n");
+    test_stage();
+    printf("\r\n\r\n\r\n=====kfifo64======\r\n");
+    test_kfifo64();
+    printf("\r\n\r\n\r\n=====kfifo cols======\r\n");
+    test_kfifo_cols();
+    printf("\r\n\r\n\r\n=====pipeline======\r\n");
+    test_pipeline();
+    printf("\r\n\r\n\r\n=====dispatch======\r\n");
+    test_dispatch();
+    printf("\r\n\r\n\r\n=====rpc======\r\n");
+    test_rpc();
+    printf("\r\n\r\n\r\n=====trace======\r\n");
+    test_trace();
     exit(0);
 }
@@ -7,24 +7,37 @@
 
 #include "kfifo.h"
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "const.h"
+#include "crc32c.h"
+#include "kfifo_trace.h"
 #include "log2.h"
 #include "minmax.h"
+#include "rwonce.h"
 
 #define DIV_ROUND_UP __KERNEL_DIV_ROUND_UP
 
+/*
+ * The lockless single reader/single writer paths publish the indices with
+ * release stores: the writer moves fifo->in after copying the data in, the
+ * reader moves fifo->out after copying the data out. The other side reads
+ * the index with an acquire load before touching the data, so no copy
+ * needs a barrier of its own.
+ */
+
 /*
  * internal helper to calculate the unused elements in a fifo
  */
 static inline unsigned int kfifo_unused(struct __kfifo *fifo)
 {
-	return (fifo->mask + 1) - (fifo->in - fifo->out);
+	return (fifo->mask + 1) - (fifo->in - smp_load_acquire(&fifo->out));
 }
 
 int __kfifo_alloc(struct __kfifo *fifo, unsigned int size,
-		size_t esize, gfp_t gfp_mask)
+		size_t esize, size_t recsize, gfp_t gfp_mask)
 {
 	/*
 	 * round up to the next power of 2, since our 'let the indices
@@ -35,14 +48,22 @@ int __kfifo_alloc(struct __kfifo *fifo, unsigned int size,
 	fifo->in = 0;
 	fifo->out = 0;
 	fifo->esize = esize;
+	fifo->index = NULL;
 
-	if (size < 2) {
+	/* an aligned record needs a header slot and a payload slot */
+	if (size < 2 || (__kfifo_rec_aligned(recsize) && size < 2 * recsize)) {
 		fifo->data = NULL;
 		fifo->mask = 0;
 		return -EINVAL;
 	}
 
-	fifo->data = kmalloc_array(esize, size, gfp_mask);
+	/* the payloads of aligned records are only as aligned as the buffer */
+	if (__kfifo_rec_aligned(recsize)) {
+		if (posix_memalign(&fifo->data, recsize, esize * size))
+			fifo->data = NULL;
+	} else {
+		fifo->data = kmalloc_array(esize, size, gfp_mask);
+	}
 
 	if (!fifo->data) {
 		fifo->mask = 0;
@@ -55,6 +76,7 @@ int __kfifo_alloc(struct __kfifo *fifo, unsigned int size,
 
 void __kfifo_free(struct __kfifo *fifo)
 {
+	__kfifo_rec_index_free(fifo);
 	kfree(fifo->data);
 	fifo->in = 0;
 	fifo->out = 0;
@@ -65,7 +87,7 @@ void __kfifo_free(struct __kfifo *fifo)
 
 
 int __kfifo_init(struct __kfifo *fifo, void *buffer,
-		unsigned int size, size_t esize)
+		unsigned int size, size_t esize, size_t recsize)
 {
 	size /= esize;
 
@@ -76,8 +98,11 @@ int __kfifo_init(struct __kfifo *fifo, void *buffer,
 	fifo->out = 0;
 	fifo->esize = esize;
 	fifo->data = buffer;
+	fifo->index = NULL;
 
-	if (size < 2) {
+	if (size < 2 || (__kfifo_rec_aligned(recsize) &&
+			 (size < 2 * recsize ||
+			  ((uintptr_t)buffer & (recsize - 1))))) {
 		fifo->mask = 0;
 		return -EINVAL;
 	}
@@ -103,16 +128,12 @@ static void kfifo_copy_in(struct __kfifo *fifo, const void *src,
 
 	memcpy(fifo->data + off, src, l);
 	memcpy(fifo->data, src + l, len - l);
-	/*
-	 * make sure that the data in the fifo is up to date before
-	 * incrementing the fifo->in index counter
-	 */
-	barrier();
 }
 
 unsigned int __kfifo_in(struct __kfifo *fifo,
 		const void *buf, unsigned int len)
 {
+	unsigned int req = len;
 	unsigned int l;
 
 	l = kfifo_unused(fifo);
@@ -120,7 +141,8 @@ unsigned int __kfifo_in(struct __kfifo *fifo,
 		len = l;
 
 	kfifo_copy_in(fifo, buf, len, fifo->in);
-	fifo->in += len;
+	smp_store_release(&fifo->in, fifo->in + len);
+	kfifo_trace(fifo, KFIFO_TRACE_IN, req, len, 0);
 	return len;
 }
 
@@ -141,11 +163,6 @@ static void kfifo_copy_out(struct __kfifo *fifo, void *dst,
 
 	memcpy(dst, fifo->data + off, l);
 	memcpy(dst + l, fifo->data, len - l);
-	/*
-	 * make sure that the data is copied before
-	 * incrementing the fifo->out index counter
-	 */
-	smp_wmb();
 }
 
 unsigned int __kfifo_out_peek(struct __kfifo *fifo,
@@ -153,7 +170,7 @@ unsigned int __kfifo_out_peek(struct __kfifo *fifo,
 {
 	unsigned int l;
 
-	l = fifo->in - fifo->out;
+	l = smp_load_acquire(&fifo->in) - fifo->out;
 	if (len > l)
 		len = l;
 
@@ -164,11 +181,46 @@ unsigned int __kfifo_out_peek(struct __kfifo *fifo,
 unsigned int __kfifo_out(struct __kfifo *fifo,
 		void *buf, unsigned int len)
 {
+	unsigned int req = len;
+
 	len = __kfifo_out_peek(fifo, buf, len);
-	fifo->out += len;
+	smp_store_release(&fifo->out, fifo->out + len);
+	kfifo_trace(fifo, KFIFO_TRACE_OUT, req, len, 0);
 	return len;
 }
 
+/*
+ * internal helper to point a span at n elements starting at index off
+ */
+static void kfifo_span(struct __kfifo *fifo, unsigned int off,
+		unsigned int n, struct kfifo_span *span)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int l;
+
+	off &= fifo->mask;
+	l = min(n, size - off);
+
+	span->first = fifo->data + off * fifo->esize;
+	span->first_len = l;
+	span->second = fifo->data;
+	span->second_len = n - l;
+}
+
+unsigned int __kfifo_peek_range(struct __kfifo *fifo, unsigned int start,
+		unsigned int n, struct kfifo_span *span)
+{
+	unsigned int len = smp_load_acquire(&fifo->in) - fifo->out;
+
+	if (start > len)
+		start = len;
+	if (n > len - start)
+		n = len - start;
+
+	kfifo_span(fifo, fifo->out + start, n, span);
+	return n;
+}
+
 static unsigned long kfifo_copy_from_user(struct __kfifo *fifo,
 	const void *from, unsigned int len, unsigned int off,
 	unsigned int *copied)
@@ -194,11 +246,6 @@ static unsigned long kfifo_copy_from_user(struct __kfifo *fifo,
 		if (unlikely(ret))
 			ret = DIV_ROUND_UP(ret, esize);
 	}
-	/*
-	 * make sure that the data in the fifo is up to date before
-	 * incrementing the fifo->in index counter
-	 */
-	smp_wmb();
 	*copied = len - ret * esize;
 	/* return the number of elements which are not copied */
 	return ret;
@@ -225,7 +272,7 @@ int __kfifo_from_user(struct __kfifo *fifo, const void *from,
 		err = -EFAULT;
 	} else
 		err = 0;
-	fifo->in += len;
+	smp_store_release(&fifo->in, fifo->in + len);
 	return err;
 }
 
@@ -253,11 +300,6 @@ static unsigned long kfifo_copy_to_user(struct __kfifo *fifo, void *to,
 		if (unlikely(ret))
 			ret = DIV_ROUND_UP(ret, esize);
 	}
-	/*
-	 * make sure that the data is copied before
-	 * incrementing the fifo->out index counter
-	 */
-	smp_wmb();
 	*copied = len - ret * esize;
 	/* return the number of elements which are not copied */
 	return ret;
@@ -274,7 +316,7 @@ int __kfifo_to_user(struct __kfifo *fifo, void *to,
 	if (esize != 1)
 		len /= esize;
 
-	l = fifo->in - fifo->out;
+	l = smp_load_acquire(&fifo->in) - fifo->out;
 	if (len > l)
 		len = l;
 	ret = kfifo_copy_to_user(fifo, to, len, fifo->out, copied);
@@ -283,14 +325,18 @@ int __kfifo_to_user(struct __kfifo *fifo, void *to,
 		err = -EFAULT;
 	} else
 		err = 0;
-	fifo->out += len;
+	smp_store_release(&fifo->out, fifo->out + len);
 	return err;
 }
 
 unsigned int __kfifo_max_r(unsigned int len, size_t recsize)
 {
-	unsigned int max = (1 << (recsize << 3)) - 1;
+	unsigned int max;
 
+	if (__kfifo_rec_aligned(recsize))
+		max = KFIFO_REC_PAD - 1;
+	else
+		max = (1 << (__kfifo_rec_lenbytes(recsize) << 3)) - 1;
 	if (len > max)
 		return max;
 	return len;
@@ -299,23 +345,127 @@ unsigned int __kfifo_max_r(unsigned int len, size_t recsize)
 #define	__KFIFO_PEEK(data, out, mask) \
 	((data)[(out) & (mask)])
 /*
- * __kfifo_peek_n internal helper function for determinate the length of
- * the next record in the fifo
+ * __kfifo_peek_n_at internal helper function for determinate the length of
+ * the record stored at index off
  */
-static unsigned int __kfifo_peek_n(struct __kfifo *fifo, size_t recsize)
+static unsigned int __kfifo_peek_n_at(struct __kfifo *fifo, unsigned int off,
+		size_t recsize)
 {
 	unsigned int l;
 	unsigned int mask = fifo->mask;
 	unsigned char *data = fifo->data;
 
-	l = __KFIFO_PEEK(data, fifo->out, mask);
+	/* the header of an aligned record never wraps around */
+	if (__kfifo_rec_aligned(recsize))
+		return *(unsigned int *)(data + (off & mask));
+
+	l = __KFIFO_PEEK(data, off, mask);
 
-	if (--recsize)
-		l |= __KFIFO_PEEK(data, fifo->out + 1, mask) << 8;
+	if (__kfifo_rec_lenbytes(recsize) > 1)
+		l |= __KFIFO_PEEK(data, off + 1, mask) << 8;
 
 	return l;
 }
 
+/*
+ * kfifo_rec_step internal helper to calculate the space taken by a record
+ * of n bytes, header included
+ */
+static inline unsigned int kfifo_rec_step(unsigned int n, size_t recsize)
+{
+	if (__kfifo_rec_aligned(recsize))
+		return recsize + ((n + recsize - 1) & ~(recsize - 1));
+	return n + recsize;
+}
+
+/*
+ * kfifo_rec_skip_pad internal helper to step over the padding record which
+ * an aligned record fifo puts in front of a record that would wrap around.
+ * A padding record is always followed by a real one.
+ */
+static unsigned int kfifo_rec_skip_pad(struct __kfifo *fifo, unsigned int off,
+		unsigned int in, size_t recsize)
+{
+	if (__kfifo_rec_aligned(recsize) && off != in &&
+	    __kfifo_peek_n_at(fifo, off, recsize) == KFIFO_REC_PAD)
+		off += fifo->mask + 1 - (off & fifo->mask);
+	return off;
+}
+
+/*
+ * kfifo_rec_next internal helper to find the record following the one
+ * stored at index off
+ */
+static unsigned int kfifo_rec_next(struct __kfifo *fifo, unsigned int off,
+		unsigned int in, size_t recsize)
+{
+	off += kfifo_rec_step(__kfifo_peek_n_at(fifo, off, recsize), recsize);
+	return kfifo_rec_skip_pad(fifo, off, in, recsize);
+}
+
+/*
+ * kfifo_rec_head internal helper to find the next record in the fifo, past
+ * a leading padding record. fifo->out is left alone, only taking a record
+ * out moves it.
+ */
+static unsigned int kfifo_rec_head(struct __kfifo *fifo, size_t recsize)
+{
+	return kfifo_rec_skip_pad(fifo, fifo->out, smp_load_acquire(&fifo->in),
+				  recsize);
+}
+
+/*
+ * __kfifo_peek_n internal helper function for determinate the length of
+ * the next record in the fifo
+ */
+static unsigned int __kfifo_peek_n(struct __kfifo *fifo, size_t recsize)
+{
+	return __kfifo_peek_n_at(fifo, kfifo_rec_head(fifo, recsize), recsize);
+}
+
+/*
+ * kfifo_index_push internal helper to record the position off of a new
+ * record, must be called before the fifo->in index counter is incremented
+ */
+static inline void kfifo_index_push(struct __kfifo *fifo, unsigned int off)
+{
+	struct __kfifo_rec_index *index = fifo->index;
+
+	if (!index)
+		return;
+
+	index->off[index->in & index->mask] = off;
+	smp_store_release(&index->in, index->in + 1);
+}
+
+/*
+ * kfifo_index_pop internal helper to drop the oldest indexed records
+ */
+static inline void kfifo_index_pop(struct __kfifo *fifo, unsigned int n)
+{
+	if (fifo->index)
+		fifo->index->out += n;
+}
+
+/*
+ * kfifo_index_pop_to internal helper to drop the indexed records that
+ * start before out, the new fifo->out. A corrupted length drops the rest
+ * of the fifo at once, however many records that were.
+ */
+static inline void kfifo_index_pop_to(struct __kfifo *fifo, unsigned int out)
+{
+	struct __kfifo_rec_index *index = fifo->index;
+	unsigned int in;
+
+	if (!index)
+		return;
+
+	in = smp_load_acquire(&index->in);
+	while (index->out != in &&
+	       (int)(index->off[index->out & index->mask] - out) < 0)
+		index->out++;
+}
+
 #define	__KFIFO_POKE(data, in, mask, val) \
 	( \
 	(data)[(in) & (mask)] = (unsigned char)(val) \
@@ -323,17 +473,169 @@ static unsigned int __kfifo_peek_n(struct __kfifo *fifo, size_t recsize)
 
 /*
  * __kfifo_poke_n internal helper function for storing the length of
- * the record into the fifo
+ * the record at index off into the fifo
+ */
+static void __kfifo_poke_n(struct __kfifo *fifo, unsigned int off,
+		unsigned int n, size_t recsize)
+{
+	unsigned int mask = fifo->mask;
+	unsigned char *data = fifo->data;
+
+	if (__kfifo_rec_aligned(recsize)) {
+		*(unsigned int *)(data + (off & mask)) = n;
+		return;
+	}
+
+	__KFIFO_POKE(data, off, mask, n);
+
+	if (__kfifo_rec_lenbytes(recsize) > 1)
+		__KFIFO_POKE(data, off + 1, mask, n >> 8);
+}
+
+/*
+ * kfifo_rec_reserve internal helper to check for room for a record of len
+ * bytes written at index in. If an aligned record would wrap around, the
+ * rest of the buffer is filled with a padding record. Returns false if the
+ * record doesn't fit, otherwise *off is set to the index of the new record.
  */
-static void __kfifo_poke_n(struct __kfifo *fifo, unsigned int n, size_t recsize)
+static bool kfifo_rec_reserve(struct __kfifo *fifo, unsigned int in,
+		unsigned int len, size_t recsize, unsigned int *off)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int step = kfifo_rec_step(len, recsize);
+	unsigned int pad = 0;
+
+	*off = in;
+	if (__kfifo_rec_aligned(recsize) && (*off & fifo->mask) + step > size)
+		pad = size - (*off & fifo->mask);
+
+	if (step > size || pad + step > size - (in - smp_load_acquire(&fifo->out)))
+		return false;
+
+	/* not visible to the reader until fifo->in moves past the record */
+	if (pad) {
+		__kfifo_poke_n(fifo, *off, KFIFO_REC_PAD, recsize);
+		*off += pad;
+	}
+	return true;
+}
+
+/*
+ * The checksum of a record covers its length field and its payload, it is
+ * stored little endian right behind the length field.
+ */
+static u32 kfifo_csum_seed(unsigned int n, size_t recsize)
+{
+	unsigned char len[2] = { n, n >> 8 };
+
+	return crc32c(~0, len, __kfifo_rec_lenbytes(recsize));
+}
+
+static void __kfifo_poke_csum(struct __kfifo *fifo, unsigned int off,
+		u32 csum, size_t recsize)
 {
 	unsigned int mask = fifo->mask;
 	unsigned char *data = fifo->data;
+	int i;
+
+	off += __kfifo_rec_lenbytes(recsize);
+	for (i = 0; i < 4; i++)
+		__KFIFO_POKE(data, off + i, mask, csum >> (i * 8));
+}
+
+static u32 __kfifo_peek_csum(struct __kfifo *fifo, size_t recsize)
+{
+	unsigned int mask = fifo->mask;
+	unsigned char *data = fifo->data;
+	unsigned int off = fifo->out + __kfifo_rec_lenbytes(recsize);
+	u32 csum = 0;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		csum |= (u32)__KFIFO_PEEK(data, off + i, mask) << (i * 8);
+	return csum;
+}
+
+/*
+ * kfifo_copy_in_csum - kfifo_copy_in() which returns the crc32c of the
+ * copied data, computed in the same pass
+ */
+static u32 kfifo_copy_in_csum(struct __kfifo *fifo, const void *src,
+		unsigned int len, unsigned int off, u32 crc)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int esize = fifo->esize;
+	unsigned int l;
 
-	__KFIFO_POKE(data, fifo->in, mask, n);
+	off &= fifo->mask;
+	if (esize != 1) {
+		off *= esize;
+		size *= esize;
+		len *= esize;
+	}
+	l = min(len, size - off);
 
-	if (recsize > 1)
-		__KFIFO_POKE(data, fifo->in + 1, mask, n >> 8);
+	crc = crc32c_copy(crc, fifo->data + off, src, l);
+	crc = crc32c_copy(crc, fifo->data, src + l, len - l);
+	return crc;
+}
+
+/*
+ * kfifo_copy_out_csum - kfifo_copy_out() which returns the crc32c of the
+ * copied data, computed in the same pass
+ */
+static u32 kfifo_copy_out_csum(struct __kfifo *fifo, void *dst,
+		unsigned int len, unsigned int off, u32 crc)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int esize = fifo->esize;
+	unsigned int l;
+
+	off &= fifo->mask;
+	if (esize != 1) {
+		off *= esize;
+		size *= esize;
+		len *= esize;
+	}
+	l = min(len, size - off);
+
+	crc = crc32c_copy(crc, dst, fifo->data + off, l);
+	crc = crc32c_copy(crc, dst + l, fifo->data, len - l);
+	return crc;
+}
+
+/*
+ * kfifo_csum_at - crc32c of len elements in place, starting at index off
+ */
+static u32 kfifo_csum_at(struct __kfifo *fifo, unsigned int off,
+		unsigned int len, u32 crc)
+{
+	struct kfifo_span span;
+
+	kfifo_span(fifo, off, len, &span);
+	crc = crc32c(crc, span.first, span.first_len * fifo->esize);
+	return crc32c(crc, span.second, span.second_len * fifo->esize);
+}
+
+/*
+ * kfifo_rec_check - verify the length and the checksum of the next record
+ * in place, the first done bytes of its payload are already covered by crc
+ *
+ * If the length field is corrupted the start of the following records is
+ * lost too, so *n is set to skip everything that is in the fifo.
+ */
+static bool kfifo_rec_check(struct __kfifo *fifo, size_t recsize,
+		unsigned int *n, unsigned int done, u32 crc)
+{
+	unsigned int used = fifo->in - fifo->out;
+
+	if (*n + recsize > used) {
+		*n = used - recsize;
+		return false;
+	}
+
+	crc = kfifo_csum_at(fifo, fifo->out + recsize + done, *n - done, crc);
+	return ~crc == __kfifo_peek_csum(fifo, recsize);
 }
 
 unsigned int __kfifo_len_r(struct __kfifo *fifo, size_t recsize)
@@ -341,83 +643,159 @@ unsigned int __kfifo_len_r(struct __kfifo *fifo, size_t recsize)
 	return __kfifo_peek_n(fifo, recsize);
 }
 
+/*
+ * kfifo_in_r_at internal helper to store a record made of hdr_len bytes
+ * of hdr followed by len bytes of buf at index *in, which is advanced past
+ * it. Returns false if the record doesn't fit.
+ */
+static bool kfifo_in_r_at(struct __kfifo *fifo, const void *hdr,
+		unsigned int hdr_len, const void *buf, unsigned int len,
+		size_t recsize, unsigned int *in)
+{
+	unsigned int n = hdr_len + len;
+	unsigned int off;
+
+	if (!kfifo_rec_reserve(fifo, *in, n, recsize, &off))
+		return false;
+
+	__kfifo_poke_n(fifo, off, n, recsize);
+
+	if (__kfifo_rec_csum(recsize)) {
+		u32 crc = kfifo_csum_seed(n, recsize);
+
+		/* plain records have no header, don't copy from a NULL */
+		if (hdr_len)
+			crc = kfifo_copy_in_csum(fifo, hdr, hdr_len,
+						 off + recsize, crc);
+		crc = kfifo_copy_in_csum(fifo, buf, len,
+					 off + recsize + hdr_len, crc);
+		__kfifo_poke_csum(fifo, off, ~crc, recsize);
+	} else {
+		if (hdr_len)
+			kfifo_copy_in(fifo, hdr, hdr_len, off + recsize);
+		kfifo_copy_in(fifo, buf, len, off + recsize + hdr_len);
+	}
+	kfifo_index_push(fifo, off);
+	*in = off + kfifo_rec_step(n, recsize);
+	return true;
+}
+
 unsigned int __kfifo_in_r(struct __kfifo *fifo, const void *buf,
 		unsigned int len, size_t recsize)
 {
-	if (len + recsize > kfifo_unused(fifo))
-		return 0;
+	return __kfifo_in_hdr_r(fifo, NULL, 0, buf, len, recsize);
+}
 
-	__kfifo_poke_n(fifo, len, recsize);
+unsigned int __kfifo_in_hdr_r(struct __kfifo *fifo, const void *hdr,
+		unsigned int hdr_len, const void *buf, unsigned int len,
+		size_t recsize)
+{
+	unsigned int in = fifo->in;
+
+	len += hdr_len;
+	if (!kfifo_in_r_at(fifo, hdr, hdr_len, buf, len - hdr_len, recsize,
+			   &in)) {
+		kfifo_trace(fifo, KFIFO_TRACE_IN, len, 0, recsize);
+		return 0;
+	}
 
-	kfifo_copy_in(fifo, buf, len, fifo->in + recsize);
-	fifo->in += len + recsize;
+	smp_store_release(&fifo->in, in);
+	kfifo_trace(fifo, KFIFO_TRACE_IN, len, len, recsize);
 	return len;
 }
 
 static unsigned int kfifo_out_copy_r(struct __kfifo *fifo,
-	void *buf, unsigned int len, size_t recsize, unsigned int *n)
+	void *buf, unsigned int len, size_t recsize, unsigned int *n,
+	unsigned int *off)
 {
-	*n = __kfifo_peek_n(fifo, recsize);
+	*off = kfifo_rec_head(fifo, recsize);
+	*n = __kfifo_peek_n_at(fifo, *off, recsize);
 
 	if (len > *n)
 		len = *n;
 
-	kfifo_copy_out(fifo, buf, len, fifo->out + recsize);
+	if (__kfifo_rec_csum(recsize)) {
+		u32 crc = kfifo_csum_seed(*n, recsize);
+
+		if (*n + recsize > fifo->in - fifo->out)
+			len = 0;
+		crc = kfifo_copy_out_csum(fifo, buf, len, *off + recsize,
+					  crc);
+		/* a corrupted record is dropped as if it was empty */
+		if (!kfifo_rec_check(fifo, recsize, n, len, crc))
+			return 0;
+		return len;
+	}
+
+	kfifo_copy_out(fifo, buf, len, *off + recsize);
 	return len;
 }
 
 unsigned int __kfifo_out_peek_r(struct __kfifo *fifo, void *buf,
 		unsigned int len, size_t recsize)
 {
-	unsigned int n;
+	unsigned int n, off;
 
-	if (fifo->in == fifo->out)
+	if (smp_load_acquire(&fifo->in) == fifo->out)
 		return 0;
 
-	return kfifo_out_copy_r(fifo, buf, len, recsize, &n);
+	return kfifo_out_copy_r(fifo, buf, len, recsize, &n, &off);
 }
 
 unsigned int __kfifo_out_r(struct __kfifo *fifo, void *buf,
 		unsigned int len, size_t recsize)
 {
-	unsigned int n;
+	unsigned int req = len;
+	unsigned int n, off;
 
-	if (fifo->in == fifo->out)
+	if (smp_load_acquire(&fifo->in) == fifo->out) {
+		kfifo_trace(fifo, KFIFO_TRACE_OUT, req, 0, recsize);
 		return 0;
+	}
 
-	len = kfifo_out_copy_r(fifo, buf, len, recsize, &n);
-	fifo->out += n + recsize;
+	len = kfifo_out_copy_r(fifo, buf, len, recsize, &n, &off);
+	off += kfifo_rec_step(n, recsize);
+	kfifo_index_pop_to(fifo, off);
+	smp_store_release(&fifo->out, off);
+	kfifo_trace(fifo, KFIFO_TRACE_OUT, req, len, recsize);
 	return len;
 }
 
 void __kfifo_skip_r(struct __kfifo *fifo, size_t recsize)
 {
-	unsigned int n;
+	unsigned int n, off;
 
-	n = __kfifo_peek_n(fifo, recsize);
-	fifo->out += n + recsize;
+	off = kfifo_rec_head(fifo, recsize);
+	n = __kfifo_peek_n_at(fifo, off, recsize);
+	kfifo_index_pop(fifo, 1);
+	smp_store_release(&fifo->out, off + kfifo_rec_step(n, recsize));
 }
 
 int __kfifo_from_user_r(struct __kfifo *fifo, const void *from,
 	unsigned long len, unsigned int *copied, size_t recsize)
 {
 	unsigned long ret;
+	unsigned int off;
 
 	len = __kfifo_max_r(len, recsize);
 
-	if (len + recsize > kfifo_unused(fifo)) {
+	if (!kfifo_rec_reserve(fifo, fifo->in, len, recsize, &off)) {
 		*copied = 0;
 		return 0;
 	}
 
-	__kfifo_poke_n(fifo, len, recsize);
+	__kfifo_poke_n(fifo, off, len, recsize);
 
-	ret = kfifo_copy_from_user(fifo, from, len, fifo->in + recsize, copied);
+	ret = kfifo_copy_from_user(fifo, from, len, off + recsize, copied);
 	if (unlikely(ret)) {
 		*copied = 0;
 		return -EFAULT;
 	}
-	fifo->in += len + recsize;
+	if (__kfifo_rec_csum(recsize))
+		__kfifo_poke_csum(fifo, off, ~kfifo_csum_at(fifo, off + recsize,
+			len, kfifo_csum_seed(len, recsize)), recsize);
+	kfifo_index_push(fifo, off);
+	smp_store_release(&fifo->in, off + kfifo_rec_step(len, recsize));
 	return 0;
 }
 
@@ -425,26 +803,329 @@ int __kfifo_to_user_r(struct __kfifo *fifo, void *to,
 	unsigned long len, unsigned int *copied, size_t recsize)
 {
 	unsigned long ret;
-	unsigned int n;
+	unsigned int n, off;
 
-	if (fifo->in == fifo->out) {
+	if (smp_load_acquire(&fifo->in) == fifo->out) {
 		*copied = 0;
 		return 0;
 	}
 
-	n = __kfifo_peek_n(fifo, recsize);
+	off = kfifo_rec_head(fifo, recsize);
+	n = __kfifo_peek_n_at(fifo, off, recsize);
 	if (len > n)
 		len = n;
 
-	ret = kfifo_copy_to_user(fifo, to, len, fifo->out + recsize, copied);
+	if (__kfifo_rec_csum(recsize) &&
+	    !kfifo_rec_check(fifo, recsize, &n, 0,
+			     kfifo_csum_seed(n, recsize))) {
+		off += kfifo_rec_step(n, recsize);
+		kfifo_index_pop_to(fifo, off);
+		smp_store_release(&fifo->out, off);
+		*copied = 0;
+		return -EBADMSG;
+	}
+
+	ret = kfifo_copy_to_user(fifo, to, len, off + recsize, copied);
 	if (unlikely(ret)) {
 		*copied = 0;
 		return -EFAULT;
 	}
-	fifo->out += n + recsize;
+	kfifo_index_pop(fifo, 1);
+	smp_store_release(&fifo->out, off + kfifo_rec_step(n, recsize));
+	return 0;
+}
+
+int __kfifo_rec_index_alloc(struct __kfifo *fifo, size_t recsize,
+		gfp_t gfp_mask)
+{
+	struct __kfifo_rec_index *index;
+	unsigned int size, off;
+
+	if (!fifo->mask)
+		return -EINVAL;
+
+	/* enough slots for a fifo full of empty records */
+	size = (fifo->mask + 1) / recsize;
+	if (!size)
+		return -EINVAL;
+	size = roundup_pow_of_two(size);
+
+	__kfifo_rec_index_free(fifo);
+	index = kmalloc_array(1, sizeof(*index) + size * sizeof(index->off[0]),
+			      gfp_mask);
+	if (!index)
+		return -ENOMEM;
+
+	index->in = 0;
+	index->out = 0;
+	index->mask = size - 1;
+
+	for (off = kfifo_rec_skip_pad(fifo, fifo->out, fifo->in, recsize);
+	     off != fifo->in; off = kfifo_rec_next(fifo, off, fifo->in, recsize))
+		index->off[index->in++ & index->mask] = off;
+
+	fifo->index = index;
 	return 0;
 }
 
+void __kfifo_rec_index_free(struct __kfifo *fifo)
+{
+	kfree(fifo->index);
+	fifo->index = NULL;
+}
 
+unsigned int __kfifo_rec_count(struct __kfifo *fifo, size_t recsize)
+{
+	unsigned int off, in;
+	unsigned int n = 0;
+
+	/* pairs with the release in kfifo_index_push() */
+	if (fifo->index)
+		return smp_load_acquire(&fifo->index->in) - fifo->index->out;
 
+	in = smp_load_acquire(&fifo->in);
+
+	for (off = kfifo_rec_skip_pad(fifo, fifo->out, in, recsize);
+	     off != in; off = kfifo_rec_next(fifo, off, in, recsize))
+		n++;
+	return n;
+}
+
+/*
+ * kfifo_rec_off internal helper to find the k-th queued record, returns
+ * false if fewer records are queued
+ */
+static bool kfifo_rec_off(struct __kfifo *fifo, unsigned int k,
+		size_t recsize, unsigned int *off)
+{
+	struct __kfifo_rec_index *index = fifo->index;
+	unsigned int in;
+
+	if (index) {
+		if (k >= smp_load_acquire(&index->in) - index->out)
+			return false;
+		*off = index->off[(index->out + k) & index->mask];
+		return true;
+	}
+
+	in = smp_load_acquire(&fifo->in);
+	for (*off = kfifo_rec_skip_pad(fifo, fifo->out, in, recsize);
+	     *off != in; k--) {
+		if (!k)
+			return true;
+		*off = kfifo_rec_next(fifo, *off, in, recsize);
+	}
+	return false;
+}
 
+unsigned int __kfifo_rec_peek_at(struct __kfifo *fifo, unsigned int k,
+		struct kfifo_span *span, size_t recsize)
+{
+	unsigned int off, n;
+
+	if (!kfifo_rec_off(fifo, k, recsize, &off)) {
+		kfifo_span(fifo, fifo->out, 0, span);
+		return 0;
+	}
+
+	n = __kfifo_peek_n_at(fifo, off, recsize);
+	kfifo_span(fifo, off + recsize, n, span);
+	return n;
+}
+
+unsigned int __kfifo_skip_n_r(struct __kfifo *fifo, unsigned int n,
+		size_t recsize)
+{
+	struct __kfifo_rec_index *index = fifo->index;
+	unsigned int i, count, last;
+
+	if (!index) {
+		for (i = 0; i < n && smp_load_acquire(&fifo->in) != fifo->out; i++)
+			__kfifo_skip_r(fifo, recsize);
+		return i;
+	}
+
+	count = smp_load_acquire(&index->in) - index->out;
+	if (!n || !count)
+		return 0;
+	if (n > count)
+		n = count;
+
+	/* the end of the last skipped record is the start of the next one */
+	last = index->off[(index->out + n - 1) & index->mask];
+	last += kfifo_rec_step(__kfifo_peek_n_at(fifo, last, recsize), recsize);
+
+	index->out += n;
+	smp_store_release(&fifo->out, last);
+	return n;
+}
+
+void *__kfifo_peek_record(struct __kfifo *fifo, unsigned int *n,
+		size_t recsize)
+{
+	unsigned int off;
+
+	if (smp_load_acquire(&fifo->in) == fifo->out)
+		return NULL;
+
+	off = kfifo_rec_head(fifo, recsize);
+	*n = __kfifo_peek_n_at(fifo, off, recsize);
+	return fifo->data + ((off + recsize) & fifo->mask);
+}
+
+unsigned int __kfifo_snapshot(struct __kfifo *fifo,
+		struct kfifo_snapshot *snap)
+{
+	unsigned int in, out;
+
+	/*
+	 * in only grows, so with out unchanged across the read of in the pair
+	 * describes a state the fifo really was in
+	 */
+	do {
+		out = READ_ONCE(fifo->out);
+		smp_rmb();
+		in = READ_ONCE(fifo->in);
+		smp_rmb();
+	} while (out != READ_ONCE(fifo->out));
+
+	snap->in = in;
+	snap->out = out;
+	snap->pos = out;
+	return in - out;
+}
+
+int __kfifo_snapshot_next(struct __kfifo *fifo,
+		struct kfifo_snapshot *snap, void *buf, unsigned int len,
+		unsigned int *copied, size_t recsize)
+{
+	unsigned int pos = snap->pos;
+	unsigned int next, out;
+	bool valid = true;
+
+	*copied = 0;
+	if (pos == snap->in)
+		return 0;
+
+	if (!recsize) {
+		len = min(len, snap->in - pos);
+		kfifo_copy_out(fifo, buf, len, pos);
+		next = pos + len;
+	} else {
+		unsigned int n, avail;
+
+		/* the header may be garbage already, check it before use */
+		pos = kfifo_rec_skip_pad(fifo, pos, snap->in, recsize);
+		n = __kfifo_peek_n_at(fifo, pos, recsize);
+		avail = snap->in - pos;
+		if ((int)avail < (int)recsize || n > avail - recsize ||
+		    kfifo_rec_step(n, recsize) > avail) {
+			valid = false;
+			len = 0;
+			next = snap->in;
+		} else {
+			len = min(len, n);
+			kfifo_copy_out(fifo, buf, len, pos + recsize);
+			next = pos + kfifo_rec_step(n, recsize);
+		}
+	}
+
+	/*
+	 * the writer reuses the space of an entry only after the reader moved
+	 * past its start, if that didn't happen the copy is intact
+	 */
+	smp_rmb();
+	out = READ_ONCE(fifo->out);
+	if ((int)(out - snap->pos) > 0) {
+		snap->pos = (int)(out - snap->in) < 0 ? out : snap->in;
+		return -ESTALE;
+	}
+	/* out didn't move, so a bad header can't be a race */
+	if (!valid) {
+		snap->pos = snap->in;
+		return -EBADMSG;
+	}
+
+	snap->pos = next;
+	*copied = len;
+	return 1;
+}
+
+static unsigned long long kfifo_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int __kfifo_stage_init(struct __kfifo *fifo, struct kfifo_stage *stage,
+		unsigned int max_len, unsigned int max_records,
+		unsigned long long budget_ns)
+{
+	memset(stage, 0, sizeof(*stage));
+
+	/* the record index would show records before they are published */
+	if (fifo->index || !max_len || max_len > fifo->mask + 1)
+		return -EINVAL;
+
+	stage->in = fifo->in;
+	stage->max_len = max_len;
+	stage->max_records = max_records;
+	stage->budget_ns = budget_ns;
+	return 0;
+}
+
+unsigned int __kfifo_flush(struct __kfifo *fifo, struct kfifo_stage *stage)
+{
+	unsigned int len = stage->in - fifo->in;
+
+	stage->records = 0;
+	if (!len)
+		return 0;
+	/* the staged data is up to date before fifo->in moves past it */
+	smp_store_release(&fifo->in, stage->in);
+	return len;
+}
+
+unsigned int __kfifo_stage_in(struct __kfifo *fifo,
+		struct kfifo_stage *stage, const void *buf, unsigned int len,
+		size_t recsize)
+{
+	unsigned int in = stage->in;
+	bool full;
+
+	if (recsize) {
+		full = !kfifo_in_r_at(fifo, NULL, 0, buf, len, recsize,
+				      &stage->in);
+		if (full)
+			len = 0;
+	} else {
+		unsigned int l = (fifo->mask + 1) - (in - smp_load_acquire(&fifo->out));
+
+		full = len >= l;
+		len = min(len, l);
+		kfifo_copy_in(fifo, buf, len, in);
+		stage->in += len;
+	}
+
+	if (stage->in != in && !stage->records++ && stage->budget_ns)
+		stage->deadline = kfifo_now_ns() + stage->budget_ns;
+
+	/* a full fifo publishes at once to let the reader make room */
+	if (full || stage->in - fifo->in >= stage->max_len ||
+	    (stage->max_records && stage->records >= stage->max_records) ||
+	    (stage->budget_ns && kfifo_now_ns() >= stage->deadline))
+		__kfifo_flush(fifo, stage);
+	return len;
+}
+
+bool __kfifo_stage_poll(struct __kfifo *fifo, struct kfifo_stage *stage)
+{
+	if (!stage->records || !stage->budget_ns ||
+	    kfifo_now_ns() < stage->deadline)
+		return false;
+
+	__kfifo_flush(fifo, stage);
+	return true;
+}
@@ -16,29 +16,14 @@
 
 # define likely(x)	__builtin_expect(!!(x), 1)
 # define unlikely(x)	__builtin_expect(!!(x), 0)
-/* Optimization barrier */
-#ifndef barrier
-/* The "volatile" is due to gcc bugs */
-# define barrier() __asm__ __volatile__("": : :"memory")
-#endif
-#ifndef mb
-#define mb()	barrier()
-#endif
-#ifndef wmb
-#define wmb()	mb()
-#endif
-#ifndef __smp_wmb
-#define __smp_wmb()	wmb()
-#endif
-#ifndef smp_wmb
-#define smp_wmb()	__smp_wmb()
-#endif
+/* smp_wmb(), smp_load_acquire() and friends, shared with synchronization/locking */
+#include "barrier.h"
 
-/* 为了在用户空间编译，内核spinlock改成了pthread的spinlock */
-#define spin_lock_irqsave(lock, flags)  do {pthread_spin_lock((lock)); (void)flags;} while (0)
-#define spin_unlock_irqrestore(lock, flags)  do {pthread_spin_unlock((lock)); (void)flags;} while (0)
-#define spin_lock(lock)  do {pthread_spin_lock((lock));} while (0)
-#define spin_unlock(lock)  do {pthread_spin_unlock((lock));} while (0)
+/*
+ * 为了在用户空间编译，内核spinlock换成了synchronization/locking里的实现，
+ * spin_lock按锁的类型选择pthread、ticket、mcs、q自旋锁或者futex锁
+ */
+#include "spinlock.h"
 
 typedef unsigned int gfp_t;
 /* Are two types/vars the same type (ignoring qualifiers)? */
@@ -143,12 +128,63 @@ static inline void kfree(const void *objp)
  */
 
 
+/*
+ * optional side ring of a record fifo, it keeps the in index of every
+ * queued record, see kfifo_rec_index_alloc()
+ */
+struct __kfifo_rec_index {
+	unsigned int	in;
+	unsigned int	out;
+	unsigned int	mask;
+	unsigned int	off[];
+};
+
 struct __kfifo {
 	unsigned int	in;
 	unsigned int	out;
 	unsigned int	mask;
 	unsigned int	esize;
 	void		*data;
+	/*
+	 * only used by record fifos, but the record functions get nothing
+	 * but the struct __kfifo, like in the kernel. The lockless paths
+	 * never touch it.
+	 */
+	struct __kfifo_rec_index *index;
+};
+
+/*
+ * a consistent view of the in and out indices of a live fifo, walked by
+ * kfifo_snapshot_next() without consuming anything
+ */
+struct kfifo_snapshot {
+	unsigned int	in;
+	unsigned int	out;
+	unsigned int	pos;
+};
+
+/*
+ * producer side staging of a fifo: data written through the stage lands in
+ * the fifo buffer at a private in index and is published in batches, see
+ * kfifo_stage_init()
+ */
+struct kfifo_stage {
+	unsigned int	in;
+	unsigned int	records;
+	unsigned int	max_len;
+	unsigned int	max_records;
+	unsigned long long	budget_ns;
+	unsigned long long	deadline;
+};
+
+/*
+ * a window into the fifo buffer, split in two parts when it wraps around
+ */
+struct kfifo_span {
+	void		*first;
+	unsigned int	first_len;
+	void		*second;
+	unsigned int	second_len;
 };
 
 #define __STRUCT_KFIFO_COMMON(datatype, recsize, ptrtype) \
@@ -196,6 +232,51 @@ struct kfifo __STRUCT_KFIFO_PTR(unsigned char, 0, void);
 struct kfifo_rec_ptr_1 __STRUCT_KFIFO_PTR(unsigned char, 1, void);
 struct kfifo_rec_ptr_2 __STRUCT_KFIFO_PTR(unsigned char, 2, void);
 
+/*
+ * Added to the recsize of a record fifo, a crc32c of the length field and
+ * the payload follows the length field of every record. It is computed
+ * while the record is copied in and verified while it is copied out, a
+ * record failing the check is dropped.
+ */
+#define KFIFO_REC_CSUM	4
+
+#define __kfifo_rec_csum(recsize)	((recsize) & KFIFO_REC_CSUM)
+#define __kfifo_rec_lenbytes(recsize)	((recsize) & ~KFIFO_REC_CSUM)
+
+#define STRUCT_KFIFO_REC_1_CSUM(size) \
+	struct __STRUCT_KFIFO(unsigned char, size, 1 + KFIFO_REC_CSUM, void)
+
+#define STRUCT_KFIFO_REC_2_CSUM(size) \
+	struct __STRUCT_KFIFO(unsigned char, size, 2 + KFIFO_REC_CSUM, void)
+
+struct kfifo_rec_csum_ptr_1 __STRUCT_KFIFO_PTR(unsigned char, 1 + KFIFO_REC_CSUM, void);
+struct kfifo_rec_csum_ptr_2 __STRUCT_KFIFO_PTR(unsigned char, 2 + KFIFO_REC_CSUM, void);
+
+/*
+ * A recsize of KFIFO_REC_ALIGN_MIN or more (a power of 2) selects aligned
+ * records: the header is a 4 byte length padded to recsize bytes and every
+ * payload starts on a recsize boundary of the buffer and never wraps
+ * around, so it can be accessed in place with kfifo_peek_record(). A record
+ * which would wrap is preceded by a padding record filling up the buffer.
+ */
+#define KFIFO_REC_ALIGN_MIN	8
+#define KFIFO_REC_PAD		(~0U)
+
+#define __kfifo_rec_aligned(recsize)	((recsize) >= KFIFO_REC_ALIGN_MIN)
+
+#define STRUCT_KFIFO_REC_ALIGNED(size, align) \
+struct { \
+	__STRUCT_KFIFO_COMMON(unsigned char, align, void); \
+	unsigned char	buf[((size < 2) || (size & (size - 1)) || \
+			     (align < KFIFO_REC_ALIGN_MIN) || \
+			     (align & (align - 1))) ? -1 : size] \
+			__attribute__((aligned(align))); \
+}
+
+struct kfifo_rec_aligned_ptr_8 __STRUCT_KFIFO_PTR(unsigned char, 8, void);
+struct kfifo_rec_aligned_ptr_16 __STRUCT_KFIFO_PTR(unsigned char, 16, void);
+struct kfifo_rec_aligned_ptr_64 __STRUCT_KFIFO_PTR(unsigned char, 64, void);
+
 /*
  * helper macro to distinguish between real in place fifo where the fifo
  * array is a part of the structure and the fifo type where the array is
@@ -232,6 +313,7 @@ struct kfifo_rec_ptr_2 __STRUCT_KFIFO_PTR(unsigned char, 2, void);
 	__kfifo->mask = __is_kfifo_ptr(__tmp) ? 0 : ARRAY_SIZE(__tmp->buf) - 1;\
 	__kfifo->esize = sizeof(*__tmp->buf); \
 	__kfifo->data = __is_kfifo_ptr(__tmp) ?  NULL : __tmp->buf; \
+	__kfifo->index = NULL; \
 })
 
 /**
@@ -289,8 +371,11 @@ __kfifo_int_must_check_helper(int val)
 #define kfifo_esize(fifo)	((fifo)->kfifo.esize)
 
 /**
- * kfifo_recsize - returns the size of the record length field
+ * kfifo_recsize - returns the size of the record header
  * @fifo: address of the fifo to be used
+ *
+ * The header is the record length field, followed by a 4 byte checksum for
+ * the *_CSUM record types. For aligned record types it is the alignment.
  */
 #define kfifo_recsize(fifo)	(sizeof(*(fifo)->rectype))
 
@@ -312,6 +397,8 @@ __kfifo_int_must_check_helper(int val)
 (void)({ \
 	typeof((fifo) + 1) __tmp = (fifo); \
 	__tmp->kfifo.in = __tmp->kfifo.out = 0; \
+	if (__tmp->kfifo.index) \
+		__tmp->kfifo.index->in = __tmp->kfifo.index->out = 0; \
 })
 
 /**
@@ -325,6 +412,8 @@ __kfifo_int_must_check_helper(int val)
 #define kfifo_reset_out(fifo)	\
 (void)({ \
 	typeof((fifo) + 1) __tmp = (fifo); \
+	if (__tmp->kfifo.index) \
+		__tmp->kfifo.index->out = __tmp->kfifo.index->in; \
 	__tmp->kfifo.out = __tmp->kfifo.in; \
 })
 
@@ -455,7 +544,8 @@ __kfifo_int_must_check_helper( \
 	typeof((fifo) + 1) __tmp = (fifo); \
 	struct __kfifo *__kfifo = &__tmp->kfifo; \
 	__is_kfifo_ptr(__tmp) ? \
-	__kfifo_alloc(__kfifo, size, sizeof(*__tmp->type), gfp_mask) : \
+	__kfifo_alloc(__kfifo, size, sizeof(*__tmp->type), \
+		      sizeof(*__tmp->rectype), gfp_mask) : \
 	-EINVAL; \
 }) \
 )
@@ -478,7 +568,8 @@ __kfifo_int_must_check_helper( \
  * @buffer: the preallocated buffer to be used
  * @size: the size of the internal buffer, this have to be a power of 2
  *
- * This macro initializes a fifo using a preallocated buffer.
+ * This macro initializes a fifo using a preallocated buffer. For an
+ * aligned record fifo the buffer must be aligned to kfifo_recsize().
  *
  * The number of elements will be rounded-up to a power of 2.
  * Return 0 if no error, otherwise an error code.
@@ -488,7 +579,8 @@ __kfifo_int_must_check_helper( \
 	typeof((fifo) + 1) __tmp = (fifo); \
 	struct __kfifo *__kfifo = &__tmp->kfifo; \
 	__is_kfifo_ptr(__tmp) ? \
-	__kfifo_init(__kfifo, buffer, size, sizeof(*__tmp->type)) : \
+	__kfifo_init(__kfifo, buffer, size, sizeof(*__tmp->type), \
+		     sizeof(*__tmp->rectype)) : \
 	-EINVAL; \
 })
 
@@ -515,15 +607,15 @@ __kfifo_int_must_check_helper( \
 		__ret = __kfifo_in_r(__kfifo, &__val, sizeof(__val), \
 			__recsize); \
 	else { \
-		__ret = !kfifo_is_full(__tmp); \
+		__ret = __kfifo->in - smp_load_acquire(&__kfifo->out) <= \
+			__kfifo->mask; \
 		if (__ret) { \
 			(__is_kfifo_ptr(__tmp) ? \
 			((typeof(__tmp->type))__kfifo->data) : \
 			(__tmp->buf) \
 			)[__kfifo->in & __tmp->kfifo.mask] = \
 				*(typeof(__tmp->type))&__val; \
-			smp_wmb(); \
-			__kfifo->in++; \
+			smp_store_release(&__kfifo->in, __kfifo->in + 1); \
 		} \
 	} \
 	__ret; \
@@ -553,15 +645,14 @@ __kfifo_uint_must_check_helper( \
 		__ret = __kfifo_out_r(__kfifo, __val, sizeof(*__val), \
 			__recsize); \
 	else { \
-		__ret = !kfifo_is_empty(__tmp); \
+		__ret = smp_load_acquire(&__kfifo->in) != __kfifo->out; \
 		if (__ret) { \
 			*(typeof(__tmp->type))__val = \
 				(__is_kfifo_ptr(__tmp) ? \
 				((typeof(__tmp->type))__kfifo->data) : \
 				(__tmp->buf) \
 				)[__kfifo->out & __tmp->kfifo.mask]; \
-			smp_wmb(); \
-			__kfifo->out++; \
+			smp_store_release(&__kfifo->out, __kfifo->out + 1); \
 		} \
 	} \
 	__ret; \
@@ -592,14 +683,13 @@ __kfifo_uint_must_check_helper( \
 		__ret = __kfifo_out_peek_r(__kfifo, __val, sizeof(*__val), \
 			__recsize); \
 	else { \
-		__ret = !kfifo_is_empty(__tmp); \
+		__ret = smp_load_acquire(&__kfifo->in) != __kfifo->out; \
 		if (__ret) { \
 			*(typeof(__tmp->type))__val = \
 				(__is_kfifo_ptr(__tmp) ? \
 				((typeof(__tmp->type))__kfifo->data) : \
 				(__tmp->buf) \
 				)[__kfifo->out & __tmp->kfifo.mask]; \
-			smp_wmb(); \
 		} \
 	} \
 	__ret; \
@@ -630,6 +720,29 @@ __kfifo_uint_must_check_helper( \
 	__kfifo_in(__kfifo, __buf, __n); \
 })
 
+/**
+ * kfifo_in_hdr - put a record made of a header and a payload into the fifo
+ * @fifo: address of the fifo to be used, with a record type
+ * @hdr: the bytes the record starts with
+ * @hdr_len: number of bytes of @hdr
+ * @buf: the payload following the header
+ * @n: number of bytes of @buf
+ *
+ * This macro stores one record like kfifo_in() of a buffer holding @hdr
+ * followed by @buf, without copying them together first. It returns the
+ * length of the record, 0 if it doesn't fit.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define	kfifo_in_hdr(fifo, hdr, hdr_len, buf, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	(void)BUILD_BUG_ON_ZERO(!sizeof(*__tmp->rectype)); \
+	__kfifo_in_hdr_r(&__tmp->kfifo, hdr, hdr_len, buf, n, \
+			 sizeof(*__tmp->rectype)); \
+})
+
 /**
  * kfifo_in_spinlocked - put data into the fifo using a spinlock for locking
  * @fifo: address of the fifo to be used
@@ -830,13 +943,184 @@ __kfifo_uint_must_check_helper( \
 }) \
 )
 
+/**
+ * kfifo_peek_at - returns a pointer to an element without removing it
+ * @fifo: address of the fifo to be used
+ * @i: index of the element, 0 is the next one kfifo_get() would return
+ *
+ * This macro returns a pointer into the fifo buffer to the @i-th queued
+ * element, or NULL if fewer than @i + 1 elements are queued. Nothing is
+ * copied, the pointer stays valid until the element is removed.
+ * Only for fifos without records.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define	kfifo_peek_at(fifo, i) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	unsigned int __i = (i); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	(void)BUILD_BUG_ON_ZERO(sizeof(*__tmp->rectype)); \
+	(__i < smp_load_acquire(&__kfifo->in) - __kfifo->out) ? \
+	&((typeof(__tmp->type))__kfifo->data)[(__kfifo->out + __i) & \
+		__kfifo->mask] : \
+	NULL; \
+})
+
+/**
+ * kfifo_peek_range - get a window of queued elements without copying
+ * @fifo: address of the fifo to be used
+ * @start: index of the first element of the window, 0 is the next one
+ * @n: max. number of elements in the window
+ * @span: pointer to a struct kfifo_span filled with the window
+ *
+ * This macro points @span into the fifo buffer at the elements
+ * [@start, @start + @n) counted from the out index and returns the number
+ * of elements covered, which is less than @n if not enough are queued.
+ * A window that wraps around the end of the buffer is returned in two
+ * parts, span->first and span->second. Only for fifos without records.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define	kfifo_peek_range(fifo, start, n, span) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	(void)BUILD_BUG_ON_ZERO(sizeof(*__tmp->rectype)); \
+	__kfifo_peek_range(__kfifo, start, n, span); \
+}) \
+)
+
+/**
+ * kfifo_rec_index_alloc - attach a record index to a record fifo
+ * @fifo: address of the fifo to be used
+ * @gfp_mask: get_free_pages mask, passed to kmalloc()
+ *
+ * The index is a side ring holding the position of every queued record.
+ * It is maintained by all record in/out/skip operations and makes
+ * kfifo_rec_count(), kfifo_rec_peek_at() and kfifo_rec_skip_n() O(1)
+ * instead of walking the record headers. Records already in the fifo are
+ * indexed. The index is released by kfifo_free() or
+ * kfifo_rec_index_free().
+ * Return 0 if no error, otherwise an error code.
+ *
+ * Note: must not run concurrently with a reader or a writer.
+ */
+#define kfifo_rec_index_alloc(fifo, gfp_mask) \
+__kfifo_int_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	(__recsize) ? \
+	__kfifo_rec_index_alloc(__kfifo, __recsize, gfp_mask) : \
+	-EINVAL; \
+}) \
+)
+
+/**
+ * kfifo_rec_index_free - detach and free the record index
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_rec_index_free(fifo) \
+	__kfifo_rec_index_free(&(fifo)->kfifo)
+
+/**
+ * kfifo_rec_count - returns the number of records in the fifo
+ * @fifo: address of the fifo to be used
+ *
+ * kfifo_len() counts bytes in a record fifo, this counts records. Without
+ * a record index the headers of all queued records are walked.
+ */
+#define kfifo_rec_count(fifo) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	(__recsize) ? \
+	__kfifo_rec_count(__kfifo, __recsize) : \
+	kfifo_len(__tmp); \
+}) \
+)
+
+/**
+ * kfifo_rec_peek_at - get the k-th record without removing it
+ * @fifo: address of the fifo to be used
+ * @k: index of the record, 0 is the next one kfifo_out() would return
+ * @span: pointer to a struct kfifo_span filled with the record payload
+ *
+ * This macro points @span into the fifo buffer at the payload of the
+ * @k-th queued record and returns its length in bytes. If fewer than
+ * @k + 1 records are queued, the span is empty and 0 is returned.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define kfifo_rec_peek_at(fifo, k, span) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	(void)BUILD_BUG_ON_ZERO(!sizeof(*__tmp->rectype)); \
+	__kfifo_rec_peek_at(__kfifo, k, span, __recsize); \
+}) \
+)
+
+/**
+ * kfifo_peek_record - get the next record in place without removing it
+ * @fifo: address of the fifo to be used, with an aligned record type
+ * @type: type of the payload
+ *
+ * This macro returns a pointer of type @type * to the payload of the next
+ * record inside the fifo buffer, NULL if the fifo is empty or the record is
+ * shorter than @type. The payload is aligned to kfifo_recsize() as long as
+ * the fifo buffer is, which kfifo_alloc() and the in place fifos make sure
+ * of and kfifo_init() checks. Release the record with kfifo_skip() when done with it.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define kfifo_peek_record(fifo, type) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	unsigned int __n = 0; \
+	type *__rec; \
+	(void)BUILD_BUG_ON_ZERO(!__kfifo_rec_aligned(sizeof(*__tmp->rectype)) || \
+		sizeof(*__tmp->rectype) < __alignof__(type)); \
+	__rec = __kfifo_peek_record(&__tmp->kfifo, &__n, __recsize); \
+	(__rec && __n >= sizeof(type)) ? __rec : NULL; \
+})
+
+/**
+ * kfifo_rec_skip_n - skip the next n records
+ * @fifo: address of the fifo to be used
+ * @n: number of records to skip
+ *
+ * Return the number of skipped records, less than @n if the fifo ran
+ * empty. With a record index this is a single step.
+ */
+#define kfifo_rec_skip_n(fifo, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	(void)BUILD_BUG_ON_ZERO(!sizeof(*__tmp->rectype)); \
+	__kfifo_skip_n_r(__kfifo, n, __recsize); \
+})
+
 extern int __kfifo_alloc(struct __kfifo *fifo, unsigned int size,
-	size_t esize, gfp_t gfp_mask);
+	size_t esize, size_t recsize, gfp_t gfp_mask);
 
 extern void __kfifo_free(struct __kfifo *fifo);
 
 extern int __kfifo_init(struct __kfifo *fifo, void *buffer,
-	unsigned int size, size_t esize);
+	unsigned int size, size_t esize, size_t recsize);
 
 extern unsigned int __kfifo_in(struct __kfifo *fifo,
 	const void *buf, unsigned int len);
@@ -852,10 +1136,139 @@ extern int __kfifo_to_user(struct __kfifo *fifo,
 
 extern unsigned int __kfifo_out_peek(struct __kfifo *fifo,
 	void *buf, unsigned int len);
+/**
+ * kfifo_snapshot - take a snapshot of the fifo indices for inspection
+ * @fifo: address of the fifo to be used
+ * @snap: pointer to a struct kfifo_snapshot
+ *
+ * This macro reads the in and out indices of a fifo which may be in use by
+ * a reader and a writer at the same time and prepares @snap for walking the
+ * data between them with kfifo_snapshot_next(). Returns the number of
+ * elements, or bytes for a record fifo, covered by the snapshot.
+ *
+ * No lock is taken and nothing is written to the fifo, so a monitoring
+ * thread never stalls the reader or the writer.
+ */
+#define kfifo_snapshot(fifo, snap) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__kfifo_snapshot(&__tmp->kfifo, snap); \
+})
+
+/**
+ * kfifo_snapshot_next - copy the next entry of a snapshot
+ * @fifo: address of the fifo to be used
+ * @snap: the snapshot returned by kfifo_snapshot()
+ * @buf: pointer to the storage buffer
+ * @len: max. number of elements, or bytes of a record, to copy
+ * @copied: pointer to output variable to store the number of copied
+ *  elements, or bytes of the record
+ *
+ * This macro copies up to @len elements, or the next record, out of the
+ * snapshot without removing them from the fifo. Returns 1 if something was
+ * copied and 0 at the end of the snapshot.
+ *
+ * If the reader consumed the data while it was copied, the writer may have
+ * overwritten it already, so nothing is copied and -ESTALE is returned. The
+ * walk then continues at the oldest entry still queued. A record header
+ * which doesn't fit into the snapshot ends the walk with -EBADMSG.
+ */
+#define kfifo_snapshot_next(fifo, snap, buf, len, copied) \
+__kfifo_int_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	__kfifo_snapshot_next(&__tmp->kfifo, snap, buf, len, copied, \
+			      __recsize); \
+}) \
+)
+/**
+ * kfifo_stage_init - set up producer side staging of a fifo
+ * @fifo: address of the fifo to be used
+ * @stage: pointer to a struct kfifo_stage owned by the writer
+ * @max_len: publish once this many elements, or bytes of a record fifo
+ *  including the record headers, are staged
+ * @max_records: publish once this many writes are staged, 0 for no limit
+ * @budget_ns: publish once the oldest staged write is this old, 0 for none
+ *
+ * Every kfifo_in() publishes its data by moving the in index, which makes
+ * the reader run and pulls the cache line holding it over to the writer
+ * again. Writes through kfifo_stage_in() go into the fifo buffer as well
+ * but only advance a private index of @stage, the reader sees them when
+ * one of the limits is reached or on kfifo_flush(), like Nagle's algorithm
+ * does for a socket.
+ *
+ * Don't mix kfifo_stage_in() with other writes without a kfifo_flush() in
+ * between, and don't use a record index together with staging.
+ * Return 0 if no error, otherwise -EINVAL.
+ */
+#define kfifo_stage_init(fifo, stage, max_len, max_records, budget_ns) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__kfifo_stage_init(&__tmp->kfifo, stage, max_len, max_records, \
+			   budget_ns); \
+})
+
+/**
+ * kfifo_stage_in - put data into the fifo without publishing it
+ * @fifo: address of the fifo to be used
+ * @stage: the stage set up by kfifo_stage_init()
+ * @buf: the data to be added
+ * @n: number of elements to be added
+ *
+ * This macro works like kfifo_in(), but the data stays invisible to the
+ * reader until a limit of @stage is reached. If the fifo has no room left
+ * the staged data is published to let the reader drain it.
+ *
+ * The time budget is only checked when something is written, a writer
+ * which may go idle must call kfifo_stage_poll() from time to time.
+ */
+#define kfifo_stage_in(fifo, stage, buf, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr_const) __buf = (buf); \
+	unsigned long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo *__kfifo = &__tmp->kfifo; \
+	__kfifo_stage_in(__kfifo, stage, __buf, __n, __recsize); \
+})
+
+/**
+ * kfifo_flush - publish all staged data
+ * @fifo: address of the fifo to be used
+ * @stage: the stage set up by kfifo_stage_init()
+ *
+ * Returns the number of elements, or bytes for a record fifo, published.
+ */
+#define kfifo_flush(fifo, stage) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__kfifo_flush(&__tmp->kfifo, stage); \
+})
+
+/**
+ * kfifo_stage_poll - publish the staged data if its time budget ran out
+ * @fifo: address of the fifo to be used
+ * @stage: the stage set up by kfifo_stage_init()
+ *
+ * Returns true if the staged data was published.
+ */
+#define kfifo_stage_poll(fifo, stage) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__kfifo_stage_poll(&__tmp->kfifo, stage); \
+})
+
+extern unsigned int __kfifo_peek_range(struct __kfifo *fifo,
+	unsigned int start, unsigned int n, struct kfifo_span *span);
 
 extern unsigned int __kfifo_in_r(struct __kfifo *fifo,
 	const void *buf, unsigned int len, size_t recsize);
 
+extern unsigned int __kfifo_in_hdr_r(struct __kfifo *fifo,
+	const void *hdr, unsigned int hdr_len, const void *buf,
+	unsigned int len, size_t recsize);
+
 extern unsigned int __kfifo_out_r(struct __kfifo *fifo,
 	void *buf, unsigned int len, size_t recsize);
 
@@ -875,4 +1288,41 @@ extern unsigned int __kfifo_out_peek_r(struct __kfifo *fifo,
 
 extern unsigned int __kfifo_max_r(unsigned int len, size_t recsize);
 
+extern int __kfifo_rec_index_alloc(struct __kfifo *fifo, size_t recsize,
+	gfp_t gfp_mask);
+
+extern void __kfifo_rec_index_free(struct __kfifo *fifo);
+
+extern unsigned int __kfifo_rec_count(struct __kfifo *fifo, size_t recsize);
+
+extern unsigned int __kfifo_rec_peek_at(struct __kfifo *fifo, unsigned int k,
+	struct kfifo_span *span, size_t recsize);
+
+extern unsigned int __kfifo_skip_n_r(struct __kfifo *fifo, unsigned int n,
+	size_t recsize);
+
+extern void *__kfifo_peek_record(struct __kfifo *fifo, unsigned int *n,
+	size_t recsize);
+
+extern int __kfifo_stage_init(struct __kfifo *fifo, struct kfifo_stage *stage,
+	unsigned int max_len, unsigned int max_records,
+	unsigned long long budget_ns);
+
+extern unsigned int __kfifo_stage_in(struct __kfifo *fifo,
+	struct kfifo_stage *stage, const void *buf, unsigned int len,
+	size_t recsize);
+
+extern unsigned int __kfifo_flush(struct __kfifo *fifo,
+	struct kfifo_stage *stage);
+
+extern bool __kfifo_stage_poll(struct __kfifo *fifo,
+	struct kfifo_stage *stage);
+
+extern unsigned int __kfifo_snapshot(struct __kfifo *fifo,
+	struct kfifo_snapshot *snap);
+
+extern int __kfifo_snapshot_next(struct __kfifo *fifo,
+	struct kfifo_snapshot *snap, void *buf, unsigned int len,
+	unsigned int *copied, size_t recsize);
+
 #endif
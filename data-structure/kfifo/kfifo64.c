@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * A generic FIFO with 64 bit indices, see kfifo.c for the original
+ */
+
+#include "kfifo64.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log2.h"
+#include "minmax.h"
+
+/*
+ * The indices are published like in kfifo.c: the writer moves fifo->in
+ * with a release store after copying the data in, the reader moves
+ * fifo->out with a release store after copying the data out, and each side
+ * reads the other's index with an acquire load before touching the data.
+ */
+
+/*
+ * internal helper to calculate the unused elements in a fifo
+ */
+static inline unsigned long long kfifo64_unused(struct __kfifo64 *fifo)
+{
+	return (fifo->mask + 1) - (fifo->in - smp_load_acquire(&fifo->out));
+}
+
+static inline unsigned long long kfifo64_roundup(unsigned long long n)
+{
+	return n <= 1 ? n : 1ULL << fls64(n - 1);
+}
+
+int __kfifo64_alloc(struct __kfifo64 *fifo, unsigned long long size,
+		size_t esize, gfp_t gfp_mask)
+{
+	fifo->in = 0;
+	fifo->out = 0;
+	fifo->esize = esize;
+
+	/*
+	 * round up to the next power of 2, since our 'let the indices
+	 * wrap' technique works only in this case. Above 2^63 there is no
+	 * next power of 2 in 64 bits.
+	 */
+	if (size > 1ULL << 63) {
+		fifo->data = NULL;
+		fifo->mask = 0;
+		return -EINVAL;
+	}
+	size = kfifo64_roundup(size);
+
+	if (size < 2 || size > SIZE_MAX / esize) {
+		fifo->data = NULL;
+		fifo->mask = 0;
+		return -EINVAL;
+	}
+
+	fifo->data = kmalloc_array(esize, size, gfp_mask);
+
+	if (!fifo->data) {
+		fifo->mask = 0;
+		return -ENOMEM;
+	}
+	fifo->mask = size - 1;
+
+	return 0;
+}
+
+void __kfifo64_free(struct __kfifo64 *fifo)
+{
+	kfree(fifo->data);
+	fifo->in = 0;
+	fifo->out = 0;
+	fifo->esize = 0;
+	fifo->data = NULL;
+	fifo->mask = 0;
+}
+
+int __kfifo64_init(struct __kfifo64 *fifo, void *buffer,
+		unsigned long long size, size_t esize)
+{
+	size /= esize;
+
+	if (size && (size & (size - 1)))
+		size = 1ULL << (fls64(size) - 1);
+
+	fifo->in = 0;
+	fifo->out = 0;
+	fifo->esize = esize;
+	fifo->data = buffer;
+
+	if (size < 2) {
+		fifo->mask = 0;
+		return -EINVAL;
+	}
+	fifo->mask = size - 1;
+
+	return 0;
+}
+
+static void kfifo64_copy_in(struct __kfifo64 *fifo, const void *src,
+		unsigned long long len, unsigned long long off)
+{
+	unsigned long long size = fifo->mask + 1;
+	unsigned int esize = fifo->esize;
+	unsigned long long l;
+
+	off &= fifo->mask;
+	if (esize != 1) {
+		off *= esize;
+		size *= esize;
+		len *= esize;
+	}
+	l = min(len, size - off);
+
+	memcpy(fifo->data + off, src, l);
+	memcpy(fifo->data, src + l, len - l);
+}
+
+unsigned long long __kfifo64_in(struct __kfifo64 *fifo,
+		const void *buf, unsigned long long len)
+{
+	unsigned long long l;
+
+	l = kfifo64_unused(fifo);
+	if (len > l)
+		len = l;
+
+	kfifo64_copy_in(fifo, buf, len, fifo->in);
+	smp_store_release(&fifo->in, fifo->in + len);
+	return len;
+}
+
+static void kfifo64_copy_out(struct __kfifo64 *fifo, void *dst,
+		unsigned long long len, unsigned long long off)
+{
+	unsigned long long size = fifo->mask + 1;
+	unsigned int esize = fifo->esize;
+	unsigned long long l;
+
+	off &= fifo->mask;
+	if (esize != 1) {
+		off *= esize;
+		size *= esize;
+		len *= esize;
+	}
+	l = min(len, size - off);
+
+	memcpy(dst, fifo->data + off, l);
+	memcpy(dst + l, fifo->data, len - l);
+}
+
+unsigned long long __kfifo64_out_peek(struct __kfifo64 *fifo,
+		void *buf, unsigned long long len)
+{
+	unsigned long long l;
+
+	l = smp_load_acquire(&fifo->in) - fifo->out;
+	if (len > l)
+		len = l;
+
+	kfifo64_copy_out(fifo, buf, len, fifo->out);
+	return len;
+}
+
+unsigned long long __kfifo64_out(struct __kfifo64 *fifo,
+		void *buf, unsigned long long len)
+{
+	len = __kfifo64_out_peek(fifo, buf, len);
+	smp_store_release(&fifo->out, fifo->out + len);
+	return len;
+}
+
+unsigned long long __kfifo64_max_r(unsigned long long len, size_t recsize)
+{
+	unsigned long long max = (1ULL << (recsize << 3)) - 1;
+
+	if (len > max)
+		return max;
+	return len;
+}
+
+#define	__KFIFO_PEEK(data, out, mask) \
+	((data)[(out) & (mask)])
+/*
+ * __kfifo64_peek_n internal helper function for determinate the length of
+ * the next record in the fifo
+ */
+static unsigned int __kfifo64_peek_n(struct __kfifo64 *fifo, size_t recsize)
+{
+	unsigned int l;
+	unsigned long long mask = fifo->mask;
+	unsigned char *data = fifo->data;
+
+	l = __KFIFO_PEEK(data, fifo->out, mask);
+
+	if (--recsize)
+		l |= __KFIFO_PEEK(data, fifo->out + 1, mask) << 8;
+
+	return l;
+}
+
+#define	__KFIFO_POKE(data, in, mask, val) \
+	( \
+	(data)[(in) & (mask)] = (unsigned char)(val) \
+	)
+
+/*
+ * __kfifo64_poke_n internal helper function for storing the length of
+ * the record into the fifo
+ */
+static void __kfifo64_poke_n(struct __kfifo64 *fifo, unsigned int n,
+		size_t recsize)
+{
+	unsigned long long mask = fifo->mask;
+	unsigned char *data = fifo->data;
+
+	__KFIFO_POKE(data, fifo->in, mask, n);
+
+	if (recsize > 1)
+		__KFIFO_POKE(data, fifo->in + 1, mask, n >> 8);
+}
+
+unsigned long long __kfifo64_len_r(struct __kfifo64 *fifo, size_t recsize)
+{
+	return __kfifo64_peek_n(fifo, recsize);
+}
+
+unsigned long long __kfifo64_in_r(struct __kfifo64 *fifo, const void *buf,
+		unsigned long long len, size_t recsize)
+{
+	if (len > __kfifo64_max_r(len, recsize) ||
+	    len + recsize > kfifo64_unused(fifo))
+		return 0;
+
+	__kfifo64_poke_n(fifo, len, recsize);
+
+	kfifo64_copy_in(fifo, buf, len, fifo->in + recsize);
+	smp_store_release(&fifo->in, fifo->in + len + recsize);
+	return len;
+}
+
+static unsigned long long kfifo64_out_copy_r(struct __kfifo64 *fifo,
+	void *buf, unsigned long long len, size_t recsize, unsigned int *n)
+{
+	*n = __kfifo64_peek_n(fifo, recsize);
+
+	if (len > *n)
+		len = *n;
+
+	kfifo64_copy_out(fifo, buf, len, fifo->out + recsize);
+	return len;
+}
+
+unsigned long long __kfifo64_out_peek_r(struct __kfifo64 *fifo, void *buf,
+		unsigned long long len, size_t recsize)
+{
+	unsigned int n;
+
+	if (smp_load_acquire(&fifo->in) == fifo->out)
+		return 0;
+
+	return kfifo64_out_copy_r(fifo, buf, len, recsize, &n);
+}
+
+unsigned long long __kfifo64_out_r(struct __kfifo64 *fifo, void *buf,
+		unsigned long long len, size_t recsize)
+{
+	unsigned int n;
+
+	if (smp_load_acquire(&fifo->in) == fifo->out)
+		return 0;
+
+	len = kfifo64_out_copy_r(fifo, buf, len, recsize, &n);
+	smp_store_release(&fifo->out, fifo->out + n + recsize);
+	return len;
+}
+
+void __kfifo64_skip_r(struct __kfifo64 *fifo, size_t recsize)
+{
+	unsigned int n;
+
+	n = __kfifo64_peek_n(fifo, recsize);
+	smp_store_release(&fifo->out, fifo->out + n + recsize);
+}
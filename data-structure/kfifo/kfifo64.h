@@ -0,0 +1,507 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * A generic FIFO with 64 bit indices
+ *
+ * Same as kfifo.h, but in, out and mask are 64 bit wide and all sizes and
+ * lengths are passed as unsigned long long, so a fifo can hold more than
+ * 2^31 elements and a byte fifo can grow beyond 4GB. struct kfifo stays
+ * the compact default, use this one only for really large buffers.
+ *
+ * The kfifo_from_user()/kfifo_to_user() helpers have no 64 bit variant.
+ */
+
+#ifndef _LINUX_KFIFO64_H
+#define _LINUX_KFIFO64_H
+
+#include "kfifo.h"
+
+struct __kfifo64 {
+	unsigned long long	in;
+	unsigned long long	out;
+	unsigned long long	mask;
+	unsigned int		esize;
+	void			*data;
+};
+
+#define __STRUCT_KFIFO64_COMMON(datatype, recsize, ptrtype) \
+	union { \
+		struct __kfifo64	kfifo; \
+		datatype	*type; \
+		const datatype	*const_type; \
+		char		(*rectype)[recsize]; \
+		ptrtype		*ptr; \
+		ptrtype const	*ptr_const; \
+	}
+
+#define __STRUCT_KFIFO64(type, size, recsize, ptrtype) \
+{ \
+	__STRUCT_KFIFO64_COMMON(type, recsize, ptrtype); \
+	type		buf[((size < 2) || (size & (size - 1))) ? -1 : size]; \
+}
+
+#define STRUCT_KFIFO64(type, size) \
+	struct __STRUCT_KFIFO64(type, size, 0, type)
+
+#define __STRUCT_KFIFO64_PTR(type, recsize, ptrtype) \
+{ \
+	__STRUCT_KFIFO64_COMMON(type, recsize, ptrtype); \
+	type		buf[0]; \
+}
+
+#define STRUCT_KFIFO64_PTR(type) \
+	struct __STRUCT_KFIFO64_PTR(type, 0, type)
+
+/*
+ * define compatibility "struct kfifo64" for dynamic allocated fifos
+ */
+struct kfifo64 __STRUCT_KFIFO64_PTR(unsigned char, 0, void);
+
+#define STRUCT_KFIFO64_REC_1(size) \
+	struct __STRUCT_KFIFO64(unsigned char, size, 1, void)
+
+#define STRUCT_KFIFO64_REC_2(size) \
+	struct __STRUCT_KFIFO64(unsigned char, size, 2, void)
+
+/*
+ * define kfifo64_rec types
+ */
+struct kfifo64_rec_ptr_1 __STRUCT_KFIFO64_PTR(unsigned char, 1, void);
+struct kfifo64_rec_ptr_2 __STRUCT_KFIFO64_PTR(unsigned char, 2, void);
+
+#define	__is_kfifo64_ptr(fifo) \
+	(sizeof(*fifo) == sizeof(STRUCT_KFIFO64_PTR(typeof(*(fifo)->type))))
+
+/**
+ * DECLARE_KFIFO64_PTR - macro to declare a wide fifo pointer object
+ * @fifo: name of the declared fifo
+ * @type: type of the fifo elements
+ */
+#define DECLARE_KFIFO64_PTR(fifo, type)	STRUCT_KFIFO64_PTR(type) fifo
+
+/**
+ * DECLARE_KFIFO64 - macro to declare a wide fifo object
+ * @fifo: name of the declared fifo
+ * @type: type of the fifo elements
+ * @size: the number of elements in the fifo, this must be a power of 2
+ */
+#define DECLARE_KFIFO64(fifo, type, size)	STRUCT_KFIFO64(type, size) fifo
+
+/**
+ * INIT_KFIFO64 - Initialize a fifo declared by DECLARE_KFIFO64
+ * @fifo: name of the declared fifo datatype
+ */
+#define INIT_KFIFO64(fifo) \
+(void)({ \
+	typeof(&(fifo)) __tmp = &(fifo); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	__kfifo->in = 0; \
+	__kfifo->out = 0; \
+	__kfifo->mask = __is_kfifo64_ptr(__tmp) ? 0 : ARRAY_SIZE(__tmp->buf) - 1;\
+	__kfifo->esize = sizeof(*__tmp->buf); \
+	__kfifo->data = __is_kfifo64_ptr(__tmp) ?  NULL : __tmp->buf; \
+})
+
+/**
+ * DEFINE_KFIFO64 - macro to define and initialize a wide fifo
+ * @fifo: name of the declared fifo datatype
+ * @type: type of the fifo elements
+ * @size: the number of elements in the fifo, this must be a power of 2
+ */
+#define DEFINE_KFIFO64(fifo, type, size) \
+	DECLARE_KFIFO64(fifo, type, size) = \
+	(typeof(fifo)) { \
+		{ \
+			{ \
+			.in	= 0, \
+			.out	= 0, \
+			.mask	= __is_kfifo64_ptr(&(fifo)) ? \
+				  0 : \
+				  ARRAY_SIZE((fifo).buf) - 1, \
+			.esize	= sizeof(*(fifo).buf), \
+			.data	= __is_kfifo64_ptr(&(fifo)) ? \
+				NULL : \
+				(fifo).buf, \
+			} \
+		} \
+	}
+
+static inline unsigned long long __must_check
+__kfifo64_ull_must_check_helper(unsigned long long val)
+{
+	return val;
+}
+
+#define kfifo64_initialized(fifo)	((fifo)->kfifo.mask)
+
+#define kfifo64_esize(fifo)	((fifo)->kfifo.esize)
+
+#define kfifo64_recsize(fifo)	(sizeof(*(fifo)->rectype))
+
+/**
+ * kfifo64_size - returns the size of the fifo in elements
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo64_size(fifo)	((fifo)->kfifo.mask + 1)
+
+#define kfifo64_reset(fifo) \
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__tmp->kfifo.in = __tmp->kfifo.out = 0; \
+})
+
+#define kfifo64_reset_out(fifo)	\
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__tmp->kfifo.out = __tmp->kfifo.in; \
+})
+
+/**
+ * kfifo64_len - returns the number of used elements in the fifo
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo64_len(fifo) \
+({ \
+	typeof((fifo) + 1) __tmpl = (fifo); \
+	__tmpl->kfifo.in - __tmpl->kfifo.out; \
+})
+
+#define	kfifo64_is_empty(fifo) \
+({ \
+	typeof((fifo) + 1) __tmpq = (fifo); \
+	__tmpq->kfifo.in == __tmpq->kfifo.out; \
+})
+
+#define kfifo64_is_empty_spinlocked(fifo, lock) \
+({ \
+	unsigned long __flags; \
+	bool __ret; \
+	spin_lock_irqsave(lock, __flags); \
+	__ret = kfifo64_is_empty(fifo); \
+	spin_unlock_irqrestore(lock, __flags); \
+	__ret; \
+})
+
+#define kfifo64_is_empty_spinlocked_noirqsave(fifo, lock) \
+({ \
+	bool __ret; \
+	spin_lock(lock); \
+	__ret = kfifo64_is_empty(fifo); \
+	spin_unlock(lock); \
+	__ret; \
+})
+
+#define	kfifo64_is_full(fifo) \
+({ \
+	typeof((fifo) + 1) __tmpq = (fifo); \
+	kfifo64_len(__tmpq) > __tmpq->kfifo.mask; \
+})
+
+/**
+ * kfifo64_avail - returns the number of unused elements in the fifo
+ * @fifo: address of the fifo to be used
+ */
+#define	kfifo64_avail(fifo) \
+__kfifo64_ull_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmpq = (fifo); \
+	const size_t __recsize = sizeof(*__tmpq->rectype); \
+	unsigned long long __avail = kfifo64_size(__tmpq) - kfifo64_len(__tmpq); \
+	(__recsize) ? ((__avail <= __recsize) ? 0 : \
+	__kfifo64_max_r(__avail - __recsize, __recsize)) : \
+	__avail; \
+}) \
+)
+
+#define	kfifo64_skip(fifo) \
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	if (__recsize) \
+		__kfifo64_skip_r(__kfifo, __recsize); \
+	else \
+		__kfifo->out++; \
+})
+
+/**
+ * kfifo64_peek_len - gets the size of the next fifo record
+ * @fifo: address of the fifo to be used
+ *
+ * This function returns the size of the next fifo record in number of bytes.
+ */
+#define kfifo64_peek_len(fifo) \
+__kfifo64_ull_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	(!__recsize) ? kfifo64_len(__tmp) * sizeof(*__tmp->type) : \
+	__kfifo64_len_r(__kfifo, __recsize); \
+}) \
+)
+
+/**
+ * kfifo64_alloc - dynamically allocates a new wide fifo buffer
+ * @fifo: pointer to the fifo
+ * @size: the number of elements in the fifo, this must be a power of 2
+ * @gfp_mask: get_free_pages mask, passed to kmalloc()
+ *
+ * The number of elements will be rounded-up to a power of 2.
+ * Return 0 if no error, otherwise an error code.
+ */
+#define kfifo64_alloc(fifo, size, gfp_mask) \
+__kfifo_int_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	__is_kfifo64_ptr(__tmp) ? \
+	__kfifo64_alloc(__kfifo, size, sizeof(*__tmp->type), gfp_mask) : \
+	-EINVAL; \
+}) \
+)
+
+#define kfifo64_free(fifo) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	if (__is_kfifo64_ptr(__tmp)) \
+		__kfifo64_free(__kfifo); \
+})
+
+/**
+ * kfifo64_init - initialize a wide fifo using a preallocated buffer
+ * @fifo: the fifo to assign the buffer
+ * @buffer: the preallocated buffer to be used
+ * @size: the size of the internal buffer in bytes
+ *
+ * The number of elements will be rounded-down to a power of 2.
+ * Return 0 if no error, otherwise an error code.
+ */
+#define kfifo64_init(fifo, buffer, size) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	__is_kfifo64_ptr(__tmp) ? \
+	__kfifo64_init(__kfifo, buffer, size, sizeof(*__tmp->type)) : \
+	-EINVAL; \
+})
+
+#define	kfifo64_put(fifo, val) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(*__tmp->const_type) __val = (val); \
+	unsigned int __ret; \
+	size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	if (__recsize) \
+		__ret = __kfifo64_in_r(__kfifo, &__val, sizeof(__val), \
+			__recsize); \
+	else { \
+		__ret = __kfifo->in - smp_load_acquire(&__kfifo->out) <= \
+			__kfifo->mask; \
+		if (__ret) { \
+			(__is_kfifo64_ptr(__tmp) ? \
+			((typeof(__tmp->type))__kfifo->data) : \
+			(__tmp->buf) \
+			)[__kfifo->in & __tmp->kfifo.mask] = \
+				*(typeof(__tmp->type))&__val; \
+			smp_store_release(&__kfifo->in, __kfifo->in + 1); \
+		} \
+	} \
+	__ret; \
+})
+
+#define	kfifo64_get(fifo, val) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr) __val = (val); \
+	unsigned int __ret; \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	if (__recsize) \
+		__ret = __kfifo64_out_r(__kfifo, __val, sizeof(*__val), \
+			__recsize); \
+	else { \
+		__ret = smp_load_acquire(&__kfifo->in) != __kfifo->out; \
+		if (__ret) { \
+			*(typeof(__tmp->type))__val = \
+				(__is_kfifo64_ptr(__tmp) ? \
+				((typeof(__tmp->type))__kfifo->data) : \
+				(__tmp->buf) \
+				)[__kfifo->out & __tmp->kfifo.mask]; \
+			smp_store_release(&__kfifo->out, __kfifo->out + 1); \
+		} \
+	} \
+	__ret; \
+}) \
+)
+
+#define	kfifo64_peek(fifo, val) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr) __val = (val); \
+	unsigned int __ret; \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	if (__recsize) \
+		__ret = __kfifo64_out_peek_r(__kfifo, __val, sizeof(*__val), \
+			__recsize); \
+	else { \
+		__ret = smp_load_acquire(&__kfifo->in) != __kfifo->out; \
+		if (__ret) { \
+			*(typeof(__tmp->type))__val = \
+				(__is_kfifo64_ptr(__tmp) ? \
+				((typeof(__tmp->type))__kfifo->data) : \
+				(__tmp->buf) \
+				)[__kfifo->out & __tmp->kfifo.mask]; \
+		} \
+	} \
+	__ret; \
+}) \
+)
+
+/**
+ * kfifo64_in - put data into the fifo
+ * @fifo: address of the fifo to be used
+ * @buf: the data to be added
+ * @n: number of elements to be added
+ *
+ * This macro copies the given buffer into the fifo and returns the
+ * number of copied elements.
+ */
+#define	kfifo64_in(fifo, buf, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr_const) __buf = (buf); \
+	unsigned long long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	(__recsize) ?\
+	__kfifo64_in_r(__kfifo, __buf, __n, __recsize) : \
+	__kfifo64_in(__kfifo, __buf, __n); \
+})
+
+#define	kfifo64_in_spinlocked(fifo, buf, n, lock) \
+({ \
+	unsigned long __flags; \
+	unsigned long long __ret; \
+	spin_lock_irqsave(lock, __flags); \
+	__ret = kfifo64_in(fifo, buf, n); \
+	spin_unlock_irqrestore(lock, __flags); \
+	__ret; \
+})
+
+#define kfifo64_in_spinlocked_noirqsave(fifo, buf, n, lock) \
+({ \
+	unsigned long long __ret; \
+	spin_lock(lock); \
+	__ret = kfifo64_in(fifo, buf, n); \
+	spin_unlock(lock); \
+	__ret; \
+})
+
+/**
+ * kfifo64_out - get data from the fifo
+ * @fifo: address of the fifo to be used
+ * @buf: pointer to the storage buffer
+ * @n: max. number of elements to get
+ *
+ * This macro get some data from the fifo and return the numbers of elements
+ * copied.
+ */
+#define	kfifo64_out(fifo, buf, n) \
+__kfifo64_ull_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr) __buf = (buf); \
+	unsigned long long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	(__recsize) ?\
+	__kfifo64_out_r(__kfifo, __buf, __n, __recsize) : \
+	__kfifo64_out(__kfifo, __buf, __n); \
+}) \
+)
+
+#define	kfifo64_out_spinlocked(fifo, buf, n, lock) \
+__kfifo64_ull_must_check_helper( \
+({ \
+	unsigned long __flags; \
+	unsigned long long __ret; \
+	spin_lock_irqsave(lock, __flags); \
+	__ret = kfifo64_out(fifo, buf, n); \
+	spin_unlock_irqrestore(lock, __flags); \
+	__ret; \
+}) \
+)
+
+#define kfifo64_out_spinlocked_noirqsave(fifo, buf, n, lock) \
+__kfifo64_ull_must_check_helper( \
+({ \
+	unsigned long long __ret; \
+	spin_lock(lock); \
+	__ret = kfifo64_out(fifo, buf, n); \
+	spin_unlock(lock); \
+	__ret; \
+}) \
+)
+
+/**
+ * kfifo64_out_peek - gets some data from the fifo
+ * @fifo: address of the fifo to be used
+ * @buf: pointer to the storage buffer
+ * @n: max. number of elements to get
+ *
+ * The data is not removed from the fifo.
+ */
+#define	kfifo64_out_peek(fifo, buf, n) \
+__kfifo64_ull_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr) __buf = (buf); \
+	unsigned long long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __kfifo64 *__kfifo = &__tmp->kfifo; \
+	(__recsize) ? \
+	__kfifo64_out_peek_r(__kfifo, __buf, __n, __recsize) : \
+	__kfifo64_out_peek(__kfifo, __buf, __n); \
+}) \
+)
+
+extern int __kfifo64_alloc(struct __kfifo64 *fifo, unsigned long long size,
+	size_t esize, gfp_t gfp_mask);
+
+extern void __kfifo64_free(struct __kfifo64 *fifo);
+
+extern int __kfifo64_init(struct __kfifo64 *fifo, void *buffer,
+	unsigned long long size, size_t esize);
+
+extern unsigned long long __kfifo64_in(struct __kfifo64 *fifo,
+	const void *buf, unsigned long long len);
+
+extern unsigned long long __kfifo64_out(struct __kfifo64 *fifo,
+	void *buf, unsigned long long len);
+
+extern unsigned long long __kfifo64_out_peek(struct __kfifo64 *fifo,
+	void *buf, unsigned long long len);
+
+extern unsigned long long __kfifo64_in_r(struct __kfifo64 *fifo,
+	const void *buf, unsigned long long len, size_t recsize);
+
+extern unsigned long long __kfifo64_out_r(struct __kfifo64 *fifo,
+	void *buf, unsigned long long len, size_t recsize);
+
+extern unsigned long long __kfifo64_len_r(struct __kfifo64 *fifo,
+	size_t recsize);
+
+extern void __kfifo64_skip_r(struct __kfifo64 *fifo, size_t recsize);
+
+extern unsigned long long __kfifo64_out_peek_r(struct __kfifo64 *fifo,
+	void *buf, unsigned long long len, size_t recsize);
+
+extern unsigned long long __kfifo64_max_r(unsigned long long len,
+	size_t recsize);
+
+#endif
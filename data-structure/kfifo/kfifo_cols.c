@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * A columnar (struct of arrays) FIFO, see kfifo_cols.h
+ */
+
+#include "kfifo_cols.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log2.h"
+#include "minmax.h"
+
+/*
+ * internal helper to calculate the unused elements in a fifo
+ */
+static inline unsigned int kfifo_cols_unused(struct __kfifo_cols *fifo)
+{
+	return (fifo->mask + 1) - (fifo->in - smp_load_acquire(&fifo->out));
+}
+
+/*
+ * internal helper to calculate the used elements in a fifo, the columns
+ * are read only after the in index telling they are there
+ */
+static inline unsigned int kfifo_cols_used(struct __kfifo_cols *fifo)
+{
+	return smp_load_acquire(&fifo->in) - fifo->out;
+}
+
+void __kfifo_cols_init(struct __kfifo_cols *fifo, const unsigned int *esize,
+		const unsigned int *offset, unsigned int ncols)
+{
+	unsigned int i;
+
+	memset(fifo, 0, sizeof(*fifo));
+	fifo->ncols = ncols;
+	for (i = 0; i < ncols; i++) {
+		fifo->esize[i] = esize[i];
+		fifo->offset[i] = offset[i];
+	}
+}
+
+int __kfifo_cols_alloc(struct __kfifo_cols *fifo, unsigned int size,
+		gfp_t gfp_mask)
+{
+	unsigned int i;
+
+	(void)gfp_mask;
+
+	/*
+	 * round up to the next power of 2, since our 'let the indices
+	 * wrap' technique works only in this case.
+	 */
+	size = roundup_pow_of_two(size);
+
+	fifo->in = 0;
+	fifo->out = 0;
+	fifo->mask = 0;
+	memset(fifo->data, 0, sizeof(fifo->data));
+
+	if (size < 2 || !fifo->ncols)
+		return -EINVAL;
+
+	for (i = 0; i < fifo->ncols; i++) {
+		size_t bytes = (size_t)fifo->esize[i] * size;
+
+		/* aligned_alloc wants a multiple of the alignment */
+		bytes = (bytes + KFIFO_COLS_ALIGN - 1) & ~(KFIFO_COLS_ALIGN - 1);
+		fifo->data[i] = aligned_alloc(KFIFO_COLS_ALIGN, bytes);
+		if (!fifo->data[i]) {
+			__kfifo_cols_free(fifo);
+			return -ENOMEM;
+		}
+	}
+	fifo->mask = size - 1;
+
+	return 0;
+}
+
+void __kfifo_cols_free(struct __kfifo_cols *fifo)
+{
+	unsigned int i;
+
+	for (i = 0; i < fifo->ncols; i++) {
+		free(fifo->data[i]);
+		fifo->data[i] = NULL;
+	}
+	fifo->in = 0;
+	fifo->out = 0;
+	fifo->mask = 0;
+}
+
+static void kfifo_cols_copy_in(struct __kfifo_cols *fifo, unsigned int col,
+		const void *src, unsigned int len, unsigned int off)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int esize = fifo->esize[col];
+	unsigned int l;
+
+	off &= fifo->mask;
+	l = min(len, size - off);
+
+	memcpy(fifo->data[col] + off * esize, src, l * esize);
+	memcpy(fifo->data[col], src + l * esize, (len - l) * esize);
+}
+
+static void kfifo_cols_copy_out(struct __kfifo_cols *fifo, unsigned int col,
+		void *dst, unsigned int len, unsigned int off)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int esize = fifo->esize[col];
+	unsigned int l;
+
+	off &= fifo->mask;
+	l = min(len, size - off);
+
+	memcpy(dst, fifo->data[col] + off * esize, l * esize);
+	memcpy(dst + l * esize, fifo->data[col], (len - l) * esize);
+}
+
+/*
+ * Copy one field of @len rows between a row array and a column, starting
+ * at ring position @off. With a constant size memcpy() turns into a plain
+ * load and store, so the common field sizes get their own loop.
+ */
+#define KFIFO_COLS_STRIDED(dst, dst_step, src, src_step, len, esize) \
+do { \
+	unsigned int __i; \
+	for (__i = 0; __i < (len); __i++) \
+		memcpy((dst) + __i * (dst_step), (src) + __i * (src_step), \
+		       esize); \
+} while (0)
+
+static void kfifo_cols_scatter(void *dst, const void *src, size_t rowsize,
+		unsigned int len, unsigned int esize)
+{
+	switch (esize) {
+	case 1:
+		KFIFO_COLS_STRIDED(dst, 1, src, rowsize, len, 1);
+		break;
+	case 2:
+		KFIFO_COLS_STRIDED(dst, 2, src, rowsize, len, 2);
+		break;
+	case 4:
+		KFIFO_COLS_STRIDED(dst, 4, src, rowsize, len, 4);
+		break;
+	case 8:
+		KFIFO_COLS_STRIDED(dst, 8, src, rowsize, len, 8);
+		break;
+	default:
+		KFIFO_COLS_STRIDED(dst, esize, src, rowsize, len, esize);
+		break;
+	}
+}
+
+static void kfifo_cols_gather(void *dst, size_t rowsize, const void *src,
+		unsigned int len, unsigned int esize)
+{
+	switch (esize) {
+	case 1:
+		KFIFO_COLS_STRIDED(dst, rowsize, src, 1, len, 1);
+		break;
+	case 2:
+		KFIFO_COLS_STRIDED(dst, rowsize, src, 2, len, 2);
+		break;
+	case 4:
+		KFIFO_COLS_STRIDED(dst, rowsize, src, 4, len, 4);
+		break;
+	case 8:
+		KFIFO_COLS_STRIDED(dst, rowsize, src, 8, len, 8);
+		break;
+	default:
+		KFIFO_COLS_STRIDED(dst, rowsize, src, esize, len, esize);
+		break;
+	}
+}
+
+unsigned int __kfifo_cols_in(struct __kfifo_cols *fifo,
+		void *const *cols, unsigned int len)
+{
+	unsigned int i;
+
+	len = min(len, kfifo_cols_unused(fifo));
+
+	for (i = 0; i < fifo->ncols; i++)
+		kfifo_cols_copy_in(fifo, i, cols[i], len, fifo->in);
+	/* all columns are up to date before the reader sees the new in */
+	smp_store_release(&fifo->in, fifo->in + len);
+	return len;
+}
+
+unsigned int __kfifo_cols_in_rows(struct __kfifo_cols *fifo,
+		const void *rows, unsigned int len, size_t rowsize)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int off = fifo->in & fifo->mask;
+	unsigned int i, l;
+
+	len = min(len, kfifo_cols_unused(fifo));
+	l = min(len, size - off);
+
+	for (i = 0; i < fifo->ncols; i++) {
+		unsigned int esize = fifo->esize[i];
+		const void *src = rows + fifo->offset[i];
+
+		kfifo_cols_scatter(fifo->data[i] + off * esize, src, rowsize,
+				   l, esize);
+		kfifo_cols_scatter(fifo->data[i], src + l * rowsize, rowsize,
+				   len - l, esize);
+	}
+	smp_store_release(&fifo->in, fifo->in + len);
+	return len;
+}
+
+unsigned int __kfifo_cols_out(struct __kfifo_cols *fifo,
+		void *const *cols, unsigned int len)
+{
+	unsigned int i;
+
+	len = min(len, kfifo_cols_used(fifo));
+
+	for (i = 0; i < fifo->ncols; i++)
+		kfifo_cols_copy_out(fifo, i, cols[i], len, fifo->out);
+	/* the columns are read before the writer may overwrite them */
+	smp_store_release(&fifo->out, fifo->out + len);
+	return len;
+}
+
+unsigned int __kfifo_cols_out_rows(struct __kfifo_cols *fifo,
+		void *rows, unsigned int len, size_t rowsize)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int off = fifo->out & fifo->mask;
+	unsigned int i, l;
+
+	len = min(len, kfifo_cols_used(fifo));
+	l = min(len, size - off);
+
+	for (i = 0; i < fifo->ncols; i++) {
+		unsigned int esize = fifo->esize[i];
+		void *dst = rows + fifo->offset[i];
+
+		kfifo_cols_gather(dst, rowsize, fifo->data[i] + off * esize,
+				  l, esize);
+		kfifo_cols_gather(dst + l * rowsize, rowsize, fifo->data[i],
+				  len - l, esize);
+	}
+	smp_store_release(&fifo->out, fifo->out + len);
+	return len;
+}
+
+unsigned int __kfifo_cols_peek_span(struct __kfifo_cols *fifo,
+		unsigned int len, void **first, unsigned int *first_len,
+		void **second, unsigned int *second_len)
+{
+	unsigned int size = fifo->mask + 1;
+	unsigned int off = fifo->out & fifo->mask;
+	unsigned int i, l;
+
+	len = min(len, kfifo_cols_used(fifo));
+	l = min(len, size - off);
+
+	for (i = 0; i < fifo->ncols; i++) {
+		first[i] = fifo->data[i] + off * fifo->esize[i];
+		second[i] = fifo->data[i];
+	}
+	*first_len = l;
+	*second_len = len - l;
+	return len;
+}
@@ -0,0 +1,381 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * A columnar (struct of arrays) FIFO built the kfifo way
+ *
+ * The elements are small fixed structs, but every field lives in its own
+ * power of 2 ring and all rings share one in/out pair. A consumer gets the
+ * queued data as one plain array per field and can run vectorized loops on
+ * it without transposing an array of structs first.
+ *
+ * The fields are given as an X-macro list:
+ *
+ *	#define MY_COLS(X) \
+ *		X(int, a) \
+ *		X(long long, c)
+ *
+ *	DECLARE_KFIFO_COLS(fifo, MY_COLS);
+ *	INIT_KFIFO_COLS(fifo, MY_COLS);
+ *	kfifo_cols_alloc(&fifo, 1024, GFP_KERNEL);
+ *
+ * Like kfifo, one reader and one writer need no extra locking.
+ */
+
+#ifndef _LINUX_KFIFO_COLS_H
+#define _LINUX_KFIFO_COLS_H
+
+#include <stddef.h>
+#include "kfifo.h"
+
+/* max. number of fields of a columnar fifo */
+#define KFIFO_COLS_MAX	16
+
+/* every column starts on its own cache line */
+#define KFIFO_COLS_ALIGN	64
+
+struct __kfifo_cols {
+	unsigned int	in;
+	unsigned int	out;
+	unsigned int	mask;
+	unsigned int	ncols;
+	unsigned int	esize[KFIFO_COLS_MAX];	/* size of the field */
+	unsigned int	offset[KFIFO_COLS_MAX];	/* offset of the field in a row */
+	void		*data[KFIFO_COLS_MAX];
+};
+
+#define __KFIFO_COLS_FIELD(type, name)	type name;
+#define __KFIFO_COLS_PTR(type, name)	type *name;
+#define __KFIFO_COLS_ESIZE(type, name)	sizeof(type),
+#define __KFIFO_COLS_OFFSET(type, name)	offsetof(__kfifo_cols_row_t, name),
+
+/*
+ * The typed views of a columnar fifo. colstype is a struct with one pointer
+ * per field in declaration order, the generic code fills it as an array of
+ * void pointers.
+ */
+#define __STRUCT_KFIFO_COLS(COLS) \
+{ \
+	struct __kfifo_cols	kfifo; \
+	struct { COLS(__KFIFO_COLS_FIELD) } *rectype; \
+	struct { COLS(__KFIFO_COLS_PTR) } *colstype; \
+	struct { \
+		struct { COLS(__KFIFO_COLS_PTR) } first; \
+		struct { COLS(__KFIFO_COLS_PTR) } second; \
+		unsigned int first_len; \
+		unsigned int second_len; \
+	} *spantype; \
+}
+
+#define STRUCT_KFIFO_COLS(COLS) \
+	struct __STRUCT_KFIFO_COLS(COLS)
+
+/**
+ * kfifo_cols_row_t - the row struct of a columnar fifo
+ * @fifo: address of the fifo
+ *
+ * The only row type kfifo_cols_in_rows() and kfifo_cols_out_rows() take.
+ * A struct declared elsewhere from the same list is a different type, so
+ * typedef this one to name it.
+ */
+#define kfifo_cols_row_t(fifo)	typeof(*(fifo)->rectype)
+
+/**
+ * kfifo_cols_ptrs_t - struct with one pointer per field of a columnar fifo
+ * @fifo: address of the fifo
+ */
+#define kfifo_cols_ptrs_t(fifo)	typeof(*(fifo)->colstype)
+
+/**
+ * kfifo_cols_span_t - result type of kfifo_cols_peek_span()
+ * @fifo: address of the fifo
+ */
+#define kfifo_cols_span_t(fifo)	typeof(*(fifo)->spantype)
+
+/**
+ * DECLARE_KFIFO_COLS - macro to declare a columnar fifo object
+ * @fifo: name of the declared fifo
+ * @COLS: X-macro list of the fields, X(type, name) for each one
+ */
+#define DECLARE_KFIFO_COLS(fifo, COLS)	STRUCT_KFIFO_COLS(COLS) fifo
+
+/**
+ * INIT_KFIFO_COLS - Initialize a fifo declared by DECLARE_KFIFO_COLS
+ * @fifo: name of the declared fifo
+ * @COLS: the same list passed to DECLARE_KFIFO_COLS
+ *
+ * This records the size and the row offset of every field, the buffers are
+ * allocated by kfifo_cols_alloc().
+ */
+#define INIT_KFIFO_COLS(fifo, COLS) \
+do { \
+	typedef kfifo_cols_row_t(&(fifo)) __kfifo_cols_row_t; \
+	static const unsigned int __esize[] = { COLS(__KFIFO_COLS_ESIZE) }; \
+	static const unsigned int __offset[] = { COLS(__KFIFO_COLS_OFFSET) }; \
+	__kfifo_cols_init(&(fifo).kfifo, __esize, __offset, \
+		ARRAY_SIZE(__esize) + \
+		BUILD_BUG_ON_ZERO(ARRAY_SIZE(__esize) > KFIFO_COLS_MAX)); \
+} while (0)
+
+/**
+ * kfifo_cols_alloc - dynamically allocates the column rings
+ * @fifo: pointer to the fifo
+ * @size: number of elements in the fifo, this must be a power of 2
+ * @gfp_mask: get_free_pages mask, passed to kmalloc()
+ *
+ * Every column gets its own buffer aligned to KFIFO_COLS_ALIGN.
+ * The size will be rounded-up to a power of 2.
+ * Return 0 if no error, otherwise an error code.
+ */
+#define kfifo_cols_alloc(fifo, size, gfp_mask) \
+__kfifo_int_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__kfifo_cols_alloc(&__tmp->kfifo, size, gfp_mask); \
+}) \
+)
+
+/**
+ * kfifo_cols_free - frees the column rings
+ * @fifo: the fifo to be freed
+ */
+#define kfifo_cols_free(fifo) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__kfifo_cols_free(&__tmp->kfifo); \
+})
+
+/**
+ * kfifo_cols_size - returns the size of the fifo in elements
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_cols_size(fifo)	((fifo)->kfifo.mask + 1)
+
+/**
+ * kfifo_cols_ncols - returns the number of columns
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_cols_ncols(fifo)	((fifo)->kfifo.ncols)
+
+/**
+ * kfifo_cols_reset - removes the entire fifo content
+ * @fifo: address of the fifo to be used
+ *
+ * Note: same restrictions as kfifo_reset().
+ */
+#define kfifo_cols_reset(fifo) \
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__tmp->kfifo.in = __tmp->kfifo.out = 0; \
+})
+
+/**
+ * kfifo_cols_len - returns the number of used elements in the fifo
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_cols_len(fifo) \
+({ \
+	typeof((fifo) + 1) __tmpl = (fifo); \
+	__tmpl->kfifo.in - __tmpl->kfifo.out; \
+})
+
+/**
+ * kfifo_cols_is_empty - returns true if the fifo is empty
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_cols_is_empty(fifo) \
+({ \
+	typeof((fifo) + 1) __tmpq = (fifo); \
+	__tmpq->kfifo.in == __tmpq->kfifo.out; \
+})
+
+/**
+ * kfifo_cols_is_full - returns true if the fifo is full
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_cols_is_full(fifo) \
+({ \
+	typeof((fifo) + 1) __tmpq = (fifo); \
+	kfifo_cols_len(__tmpq) > __tmpq->kfifo.mask; \
+})
+
+/**
+ * kfifo_cols_avail - returns the number of unused elements in the fifo
+ * @fifo: address of the fifo to be used
+ */
+#define kfifo_cols_avail(fifo) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmpq = (fifo); \
+	(__tmpq->kfifo.mask + 1) - kfifo_cols_len(__tmpq); \
+}) \
+)
+
+/**
+ * kfifo_cols_in - put columns of data into the fifo
+ * @fifo: address of the fifo to be used
+ * @cols: kfifo_cols_ptrs_t pointer, one source array per field
+ * @n: number of elements to be added
+ *
+ * This macro copies @n elements of every source array into its column and
+ * returns the number of copied elements.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define kfifo_cols_in(fifo, cols, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	const kfifo_cols_ptrs_t(__tmp) *__cols = (cols); \
+	__kfifo_cols_in(&__tmp->kfifo, (void *const *)__cols, (n)); \
+})
+
+/*
+ * __kfifo_cols_row_check - 0, or a build error if rows don't have the row
+ * type of the fifo. The field offsets of the fifo are applied to the rows,
+ * a struct of the same size but another layout would be scrambled.
+ */
+#define __kfifo_cols_row_check(fifo, rows) \
+	BUILD_BUG_ON_ZERO(!__builtin_types_compatible_p(typeof(*(rows)), \
+		kfifo_cols_row_t(fifo)))
+
+/**
+ * kfifo_cols_in_rows - scatter an array of rows into the fifo
+ * @fifo: address of the fifo to be used
+ * @rows: the rows to be added, of type kfifo_cols_row_t(@fifo)
+ * @n: number of rows to be added
+ *
+ * This macro copies every field of the given rows into its column and
+ * returns the number of copied rows.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define kfifo_cols_in_rows(fifo, rows, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof((rows) + 1) __rows = (rows); \
+	__kfifo_cols_in_rows(&__tmp->kfifo, __rows, (n), \
+		sizeof(*__rows) + __kfifo_cols_row_check(__tmp, __rows)); \
+})
+
+/**
+ * kfifo_cols_put - put a single row into the fifo
+ * @fifo: address of the fifo to be used
+ * @row: the row to be added
+ *
+ * This macro copies the given row into the fifo.
+ * It returns 0 if the fifo was full. Otherwise it returns the number
+ * processed elements.
+ */
+#define kfifo_cols_put(fifo, row) \
+({ \
+	typeof((fifo) + 1) __tmpp = (fifo); \
+	kfifo_cols_row_t(__tmpp) __row = (row); \
+	kfifo_cols_in_rows(__tmpp, &__row, 1); \
+})
+
+/**
+ * kfifo_cols_out - get columns of data from the fifo
+ * @fifo: address of the fifo to be used
+ * @cols: kfifo_cols_ptrs_t pointer, one destination array per field
+ * @n: max. number of elements to get
+ *
+ * This macro gets up to @n elements of every column and returns the number
+ * of elements copied.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define kfifo_cols_out(fifo, cols, n) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	kfifo_cols_ptrs_t(__tmp) *__cols = (cols); \
+	__kfifo_cols_out(&__tmp->kfifo, (void *const *)__cols, (n)); \
+}) \
+)
+
+/**
+ * kfifo_cols_out_rows - gather rows from the fifo
+ * @fifo: address of the fifo to be used
+ * @rows: where to store the rows, of type kfifo_cols_row_t(@fifo)
+ * @n: max. number of rows to get
+ *
+ * This macro gets up to @n rows and returns the number of rows copied.
+ *
+ * Note that with only one concurrent reader and one concurrent
+ * writer, you don't need extra locking to use these macro.
+ */
+#define kfifo_cols_out_rows(fifo, rows, n) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof((rows) + 1) __rows = (rows); \
+	__kfifo_cols_out_rows(&__tmp->kfifo, __rows, (n), \
+		sizeof(*__rows) + __kfifo_cols_row_check(__tmp, __rows)); \
+}) \
+)
+
+/**
+ * kfifo_cols_peek_span - map the next elements of every column in place
+ * @fifo: address of the fifo to be used
+ * @n: max. number of elements to map
+ * @span: kfifo_cols_span_t pointer to store the mapping
+ *
+ * This is the batch dequeue of a columnar fifo: span->first holds one
+ * pointer per field to the next span->first_len queued elements,
+ * span->second the span->second_len elements continuing at the start of
+ * the rings. Every column splits at the same place, so a consumer runs its
+ * loop once over first and once over second, and then drops the elements
+ * with kfifo_cols_skip().
+ *
+ * It returns the number of mapped elements. The data stays valid until
+ * the elements are skipped.
+ */
+#define kfifo_cols_peek_span(fifo, n, span) \
+__kfifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	kfifo_cols_span_t(__tmp) *__span = (span); \
+	__kfifo_cols_peek_span(&__tmp->kfifo, (n), \
+		(void **)&__span->first, &__span->first_len, \
+		(void **)&__span->second, &__span->second_len); \
+}) \
+)
+
+/**
+ * kfifo_cols_skip - skip elements of the fifo
+ * @fifo: address of the fifo to be used
+ * @n: number of elements to skip, at most kfifo_cols_len()
+ */
+#define kfifo_cols_skip(fifo, n) \
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	smp_store_release(&__tmp->kfifo.out, __tmp->kfifo.out + (n)); \
+})
+
+extern void __kfifo_cols_init(struct __kfifo_cols *fifo,
+	const unsigned int *esize, const unsigned int *offset,
+	unsigned int ncols);
+
+extern int __kfifo_cols_alloc(struct __kfifo_cols *fifo, unsigned int size,
+	gfp_t gfp_mask);
+
+extern void __kfifo_cols_free(struct __kfifo_cols *fifo);
+
+extern unsigned int __kfifo_cols_in(struct __kfifo_cols *fifo,
+	void *const *cols, unsigned int len);
+
+extern unsigned int __kfifo_cols_in_rows(struct __kfifo_cols *fifo,
+	const void *rows, unsigned int len, size_t rowsize);
+
+extern unsigned int __kfifo_cols_out(struct __kfifo_cols *fifo,
+	void *const *cols, unsigned int len);
+
+extern unsigned int __kfifo_cols_out_rows(struct __kfifo_cols *fifo,
+	void *rows, unsigned int len, size_t rowsize);
+
+extern unsigned int __kfifo_cols_peek_span(struct __kfifo_cols *fifo,
+	unsigned int len, void **first, unsigned int *first_len,
+	void **second, unsigned int *second_len);
+
+#endif
@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include "kfifo.h"
+#include "kfifo_trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 回放kfifo_trace_start()抓下来的kfifo读写记录
+ *
+ * 先输出抓包的概况：线程数、kfifo个数、每次读写的元素个数分布、没读写完整的次数
+ * 然后按原来的线程、原来的时间间隔和原来的读写大小，驱动不同的队列实现，比较每次调用的耗时，
+ * 以及原来一次读写完的调用回放时要等待的次数，用真实的流量评估kfifo的大小和锁的选择
+ *
+ * 用法：./kfifo_replay 抓包文件 [队列实现] [kfifo大小] [速度]
+ * 队列实现是下面replay_queues里的名字，默认全部跑一遍；kfifo大小为0表示用抓包时的大小；
+ * 速度为1按原来的时间回放，2是两倍速，0是不等待尽快回放
+ */
+
+#define REPLAY_MAX_THREADS 64
+#define REPLAY_MAX_FIFOS 16
+/* 原来读写成功的调用，回放时最多等这么久 */
+#define REPLAY_MAX_WAIT 100000000ULL
+
+/*
+ * 队列实现的接口，要比较别的队列实现，加一组这样的函数就可以
+ * n和返回值的单位和kfifo_in/kfifo_out一样：非记录型是元素个数，记录型是字节数
+ */
+struct replay_ops
+{
+    const char *name;
+    void *(*create)(unsigned int size, unsigned int esize, size_t recsize);
+    unsigned int (*in)(void *q, const void *buf, unsigned int n, size_t recsize);
+    unsigned int (*out)(void *q, void *buf, unsigned int n, size_t recsize);
+    void (*destroy)(void *q);
+};
+
+struct replay_fifo
+{
+    uint32_t id;
+    unsigned int size;
+    unsigned int esize;
+    size_t recsize;
+    void *q;
+};
+
+struct replay_thread
+{
+    pthread_t thread;
+    uint32_t tid;
+    unsigned int nr;
+    struct kfifo_trace_rec **ev;
+    unsigned long long *lat;
+    unsigned long long calls;
+    unsigned long long waits;
+    unsigned long long wait_ns;
+    unsigned long long lost;
+    unsigned long long elems;
+} __attribute__((aligned(64)));
+
+static struct kfifo_trace_rec *recs;
+static size_t nr_recs;
+static struct replay_fifo fifos[REPLAY_MAX_FIFOS];
+static unsigned int nr_fifos;
+static struct replay_thread threads[REPLAY_MAX_THREADS];
+static unsigned int nr_threads;
+static const struct replay_ops *ops;
+static unsigned int fifo_size;
+static double speed = 1;
+static unsigned long long replay_start;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 每种锁一个kfifo_in_spinlocked/kfifo_out_spinlocked的实现，spin_lock会根据锁的类型选择实现 */
+#define DEFINE_REPLAY_QUEUE(name, type)                                                           \
+    struct replay_##name##_queue                                                                  \
+    {                                                                                             \
+        struct __kfifo fifo;                                                                      \
+        type lock;                                                                                \
+    };                                                                                            \
+                                                                                                  \
+    static void *replay_##name##_create(unsigned int size, unsigned int esize, size_t recsize)    \
+    {                                                                                             \
+        struct replay_##name##_queue *q = calloc(1, sizeof(*q));                                  \
+                                                                                                  \
+        if (!q || __kfifo_alloc(&q->fifo, size, esize, recsize, 0))                               \
+        {                                                                                         \
+            free(q);                                                                              \
+            return NULL;                                                                          \
+        }                                                                                         \
+        spin_lock_init(&q->lock);                                                                 \
+        return q;                                                                                 \
+    }                                                                                             \
+                                                                                                  \
+    static unsigned int replay_##name##_in(void *arg, const void *buf, unsigned int n, size_t recsize) \
+    {                                                                                             \
+        struct replay_##name##_queue *q = arg;                                                    \
+        unsigned int ret;                                                                         \
+                                                                                                  \
+        spin_lock(&q->lock);                                                                      \
+        ret = recsize ? __kfifo_in_r(&q->fifo, buf, n, recsize) : __kfifo_in(&q->fifo, buf, n);   \
+        spin_unlock(&q->lock);                                                                    \
+        return ret;                                                                               \
+    }                                                                                             \
+                                                                                                  \
+    static unsigned int replay_##name##_out(void *arg, void *buf, unsigned int n, size_t recsize) \
+    {                                                                                             \
+        struct replay_##name##_queue *q = arg;                                                    \
+        unsigned int ret;                                                                         \
+                                                                                                  \
+        spin_lock(&q->lock);                                                                      \
+        ret = recsize ? __kfifo_out_r(&q->fifo, buf, n, recsize) : __kfifo_out(&q->fifo, buf, n); \
+        spin_unlock(&q->lock);                                                                    \
+        return ret;                                                                               \
+    }                                                                                             \
+                                                                                                  \
+    static void replay_##name##_destroy(void *arg)                                                \
+    {                                                                                             \
+        struct replay_##name##_queue *q = arg;                                                    \
+                                                                                                  \
+        __kfifo_free(&q->fifo);                                                                   \
+        free(q);                                                                                  \
+    }
+
+DEFINE_REPLAY_QUEUE(pthread, pthread_spinlock_t)
+DEFINE_REPLAY_QUEUE(ticket, struct ticket_spinlock)
+DEFINE_REPLAY_QUEUE(mcs, struct mcs_lock)
+DEFINE_REPLAY_QUEUE(clh, struct clh_lock)
+DEFINE_REPLAY_QUEUE(queued, struct qspinlock)
+DEFINE_REPLAY_QUEUE(futex, struct futex_mutex)
+
+#define REPLAY_QUEUE(name) {#name, replay_##name##_create, replay_##name##_in, replay_##name##_out, replay_##name##_destroy}
+
+static const struct replay_ops replay_queues[] = {
+    REPLAY_QUEUE(pthread),
+    REPLAY_QUEUE(ticket),
+    REPLAY_QUEUE(mcs),
+    REPLAY_QUEUE(clh),
+    REPLAY_QUEUE(queued),
+    REPLAY_QUEUE(futex),
+};
+
+static int load(const char *path)
+{
+    struct kfifo_trace_header hdr;
+    FILE *f = fopen(path, "rb");
+    long len;
+
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != KFIFO_TRACE_MAGIC ||
+        hdr.version != KFIFO_TRACE_VERSION || hdr.rec_size != sizeof(*recs))
+    {
+        printf("%s: not a kfifo trace\r\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f) - sizeof(hdr);
+    fseek(f, sizeof(hdr), SEEK_SET);
+    nr_recs = len / sizeof(*recs);
+    recs = malloc(nr_recs * sizeof(*recs) + 1);
+    nr_recs = fread(recs, sizeof(*recs), nr_recs, f);
+    fclose(f);
+    return 0;
+}
+
+static struct replay_fifo *find_fifo(const struct kfifo_trace_rec *r)
+{
+    for (unsigned int i = 0; i < nr_fifos; i++)
+        if (fifos[i].id == r->fifo)
+            return &fifos[i];
+    if (nr_fifos == REPLAY_MAX_FIFOS)
+        return NULL;
+    fifos[nr_fifos].id = r->fifo;
+    fifos[nr_fifos].size = r->size;
+    fifos[nr_fifos].esize = r->esize;
+    fifos[nr_fifos].recsize = r->recsize;
+    return &fifos[nr_fifos++];
+}
+
+static struct replay_thread *find_thread(const struct kfifo_trace_rec *r)
+{
+    for (unsigned int i = 0; i < nr_threads; i++)
+        if (threads[i].tid == r->tid)
+            return &threads[i];
+    if (nr_threads == REPLAY_MAX_THREADS)
+        return NULL;
+    threads[nr_threads].tid = r->tid;
+    return &threads[nr_threads++];
+}
+
+/* 按线程把事件分组，同时输出抓包的概况 */
+static int prepare(void)
+{
+    unsigned long long elems[2] = {0}, calls[2] = {0}, shorts[2] = {0};
+    unsigned long long hist[33] = {0};
+    size_t i;
+
+    for (i = 0; i < nr_recs; i++)
+    {
+        struct replay_fifo *f = find_fifo(&recs[i]);
+        struct replay_thread *t = find_thread(&recs[i]);
+        int op = recs[i].op == KFIFO_TRACE_OUT;
+
+        if (!f || !t)
+        {
+            printf("more than %d threads or %d fifos\r\n", REPLAY_MAX_THREADS, REPLAY_MAX_FIFOS);
+            return -1;
+        }
+        t->nr++;
+        calls[op]++;
+        elems[op] += recs[i].done;
+        if (recs[i].done < recs[i].req)
+            shorts[op]++;
+        hist[recs[i].req ? 32 - __builtin_clz(recs[i].req) : 0]++;
+    }
+
+    for (i = 0; i < nr_threads; i++)
+    {
+        threads[i].ev = malloc(threads[i].nr * sizeof(threads[i].ev[0]));
+        threads[i].lat = malloc(threads[i].nr * sizeof(threads[i].lat[0]));
+        threads[i].nr = 0;
+    }
+    for (i = 0; i < nr_recs; i++)
+    {
+        struct replay_thread *t = find_thread(&recs[i]);
+
+        t->ev[t->nr++] = &recs[i];
+    }
+
+    printf("%zu events in %.3f ms, %u threads, %u fifos\r\n", nr_recs,
+           nr_recs ? recs[nr_recs - 1].ns / 1e6 : 0, nr_threads, nr_fifos);
+    for (i = 0; i < nr_fifos; i++)
+        printf("fifo %08x: size %u, element size %u\r\n", fifos[i].id, fifos[i].size, fifos[i].esize);
+    printf("in:  %llu calls, %llu elements, %llu short\r\n", calls[0], elems[0], shorts[0]);
+    printf("out: %llu calls, %llu elements, %llu short\r\n", calls[1], elems[1], shorts[1]);
+    printf("elements per call:");
+    for (i = 0; i < 33; i++)
+        if (hist[i])
+            printf(" <%llu: %llu", 1ULL << i, hist[i]);
+    printf("\r\n");
+    return 0;
+}
+
+/* 等到这个事件在回放中的时间，远的睡眠，近的自旋 */
+static void wait_until(unsigned long long ns)
+{
+    unsigned long long deadline, now;
+
+    if (speed <= 0)
+        return;
+    deadline = replay_start + (unsigned long long)(ns / speed);
+    while ((now = now_ns()) < deadline)
+    {
+        if (deadline - now > 100000)
+        {
+            struct timespec ts = {0, deadline - now - 50000};
+
+            nanosleep(&ts, NULL);
+        }
+        else
+        {
+            cpu_relax();
+        }
+    }
+}
+
+/*
+ * 回放一个线程的事件。原来读写成功了的调用，回放时队列暂时空了或者满了就等一会儿再试，
+ * 凑够原来读写的个数，这样下游的读才会跟着上游的写走，而不是按时间读了个空
+ */
+static void *replay_thread(void *arg)
+{
+    struct replay_thread *t = arg;
+    size_t max = 0;
+    void *buf = NULL;
+
+    for (unsigned int i = 0; i < t->nr; i++)
+    {
+        const struct kfifo_trace_rec *r = t->ev[i];
+        size_t len = (size_t)r->req * (r->recsize ? 1 : r->esize);
+        struct replay_fifo *f = find_fifo(r);
+        unsigned long long start, t0;
+        unsigned int done, got = 0, tries = 0;
+
+        if (len > max)
+        {
+            free(buf);
+            max = len;
+            buf = calloc(1, max);
+        }
+
+        wait_until(r->ns);
+        start = now_ns();
+        for (;;)
+        {
+            /* 一条记录读写一次，非记录型接着上次的位置 */
+            unsigned int n = r->recsize ? r->req : r->req - got;
+            void *p = buf + (r->recsize ? 0 : got * r->esize);
+
+            t0 = now_ns();
+            if (r->op == KFIFO_TRACE_IN)
+                done = ops->in(f->q, p, n, r->recsize);
+            else
+                done = ops->out(f->q, p, n, r->recsize);
+            /* 只统计第一次调用的耗时 */
+            if (!tries++)
+                t->lat[i] = now_ns() - t0;
+            got += done;
+
+            if (got >= r->done || (r->recsize && done))
+                break;
+            if (now_ns() - start > REPLAY_MAX_WAIT)
+            {
+                t->lost++;
+                break;
+            }
+            sched_yield();
+        }
+
+        t->calls += tries;
+        t->elems += got;
+        if (tries > 1)
+        {
+            t->waits++;
+            t->wait_ns += now_ns() - start;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void replay(const struct replay_ops *o)
+{
+    unsigned long long ns, calls = 0, waits = 0, wait_ns = 0, lost = 0, elems = 0;
+    unsigned long long *lat = malloc(nr_recs * sizeof(*lat) + 1);
+    size_t n = 0;
+    unsigned int i;
+
+    ops = o;
+    for (i = 0; i < nr_fifos; i++)
+    {
+        fifos[i].q = o->create(fifo_size ? fifo_size : fifos[i].size, fifos[i].esize, fifos[i].recsize);
+        if (!fifos[i].q)
+        {
+            printf("%s: can't create a queue of %u\r\n", o->name, fifo_size ? fifo_size : fifos[i].size);
+            exit(1);
+        }
+    }
+
+    replay_start = now_ns();
+    for (i = 0; i < nr_threads; i++)
+    {
+        threads[i].calls = threads[i].waits = threads[i].wait_ns = 0;
+        threads[i].lost = threads[i].elems = 0;
+        pthread_create(&threads[i].thread, NULL, replay_thread, &threads[i]);
+    }
+    for (i = 0; i < nr_threads; i++)
+        pthread_join(threads[i].thread, NULL);
+    ns = now_ns() - replay_start;
+
+    for (i = 0; i < nr_threads; i++)
+    {
+        calls += threads[i].calls;
+        waits += threads[i].waits;
+        wait_ns += threads[i].wait_ns;
+        lost += threads[i].lost;
+        elems += threads[i].elems;
+        memcpy(lat + n, threads[i].lat, threads[i].nr * sizeof(*lat));
+        n += threads[i].nr;
+    }
+    qsort(lat, n, sizeof(*lat), cmp_ull);
+
+    printf("%-8s %8.3f ms, %llu calls, %llu elements, call ns p50 %llu p99 %llu max %llu\r\n",
+           o->name, ns / 1e6, calls, elems,
+           n ? lat[n / 2] : 0, n ? lat[n * 99 / 100] : 0, n ? lat[n - 1] : 0);
+    printf("%-8s waited %llu (avg %llu us), lost %llu\r\n",
+           "", waits, waits ? wait_ns / waits / 1000 : 0, lost);
+
+    for (i = 0; i < nr_fifos; i++)
+        o->destroy(fifos[i].q);
+    free(lat);
+}
+
+int main(int argc, char const *argv[])
+{
+    const char *name = NULL;
+
+    if (argc < 2)
+    {
+        printf("usage: %s trace [queue] [fifo size] [speed]\r\n", argv[0]);
+        exit(1);
+    }
+    if (argc > 2 && strcmp(argv[2], "all"))
+        name = argv[2];
+    if (argc > 3)
+        fifo_size = atoi(argv[3]);
+    if (argc > 4)
+        speed = atof(argv[4]);
+
+    if (load(argv[1]) || prepare())
+        exit(1);
+
+    for (unsigned int i = 0; i < ARRAY_SIZE(replay_queues); i++)
+        if (!name || !strcmp(name, replay_queues[i].name))
+            replay(&replay_queues[i]);
+    exit(0);
+}
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Capture of the kfifo traffic of a program, see kfifo_trace.h
+ */
+
+#define _GNU_SOURCE
+#include "kfifo.h"
+#include "kfifo_trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* events of one thread, kept on a list so kfifo_trace_stop() finds them */
+struct kfifo_trace_buf {
+	struct kfifo_trace_buf	*next;
+	unsigned int		n;
+	struct kfifo_trace_rec	rec[KFIFO_TRACE_BATCH];
+};
+
+bool kfifo_trace_enabled;
+
+static pthread_mutex_t kfifo_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *kfifo_trace_file;
+static struct kfifo_trace_buf *kfifo_trace_bufs;
+/* the buffers of the last capture, freed by the next kfifo_trace_start() */
+static struct kfifo_trace_buf *kfifo_trace_retired;
+static unsigned long long kfifo_trace_t0;
+static long kfifo_trace_count;
+static int kfifo_trace_err;
+static unsigned int kfifo_trace_gen;
+
+static __thread struct kfifo_trace_buf *kfifo_trace_tbuf;
+static __thread unsigned int kfifo_trace_tgen;
+
+static unsigned long long kfifo_trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* called with kfifo_trace_lock held */
+static void kfifo_trace_write(struct kfifo_trace_buf *buf)
+{
+	if (!buf->n)
+		return;
+	if (kfifo_trace_file && !kfifo_trace_err &&
+	    fwrite(buf->rec, sizeof(buf->rec[0]), buf->n,
+		   kfifo_trace_file) != buf->n)
+		kfifo_trace_err = -EIO;
+	kfifo_trace_count += buf->n;
+	buf->n = 0;
+}
+
+static struct kfifo_trace_buf *kfifo_trace_get_buf(void)
+{
+	struct kfifo_trace_buf *buf = kfifo_trace_tbuf;
+
+	/* a buffer of an earlier capture was retired by kfifo_trace_stop() */
+	if (buf && kfifo_trace_tgen == __atomic_load_n(&kfifo_trace_gen,
+						       __ATOMIC_RELAXED))
+		return buf;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+	pthread_mutex_lock(&kfifo_trace_lock);
+	buf->next = kfifo_trace_bufs;
+	kfifo_trace_bufs = buf;
+	kfifo_trace_tgen = kfifo_trace_gen;
+	pthread_mutex_unlock(&kfifo_trace_lock);
+	kfifo_trace_tbuf = buf;
+	return buf;
+}
+
+void __kfifo_trace(struct __kfifo *fifo, enum kfifo_trace_op op,
+		unsigned int req, unsigned int done, size_t recsize)
+{
+	struct kfifo_trace_buf *buf = kfifo_trace_get_buf();
+	struct kfifo_trace_rec *rec;
+	uintptr_t addr = (uintptr_t)fifo;
+
+	if (!buf)
+		return;
+
+	rec = &buf->rec[buf->n];
+	rec->ns = kfifo_trace_now_ns() - kfifo_trace_t0;
+	rec->tid = gettid();
+	rec->fifo = (uint32_t)(addr ^ (addr >> 32));
+	rec->size = fifo->mask + 1;
+	rec->req = req;
+	rec->done = done;
+	rec->esize = fifo->esize;
+	rec->op = op;
+	rec->recsize = recsize;
+
+	if (++buf->n == KFIFO_TRACE_BATCH) {
+		pthread_mutex_lock(&kfifo_trace_lock);
+		kfifo_trace_write(buf);
+		pthread_mutex_unlock(&kfifo_trace_lock);
+	}
+}
+
+int kfifo_trace_start(const char *path)
+{
+	struct kfifo_trace_header hdr = {
+		.magic = KFIFO_TRACE_MAGIC,
+		.version = KFIFO_TRACE_VERSION,
+		.rec_size = sizeof(struct kfifo_trace_rec),
+	};
+	struct kfifo_trace_buf *buf, *next;
+	FILE *f;
+
+#ifndef CONFIG_KFIFO_TRACE
+	/* kfifo.c was built without the hooks, there is nothing to capture */
+	return -EOPNOTSUPP;
+#endif
+	if (kfifo_trace_enabled)
+		return -EBUSY;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return -errno;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		fclose(f);
+		return -EIO;
+	}
+
+	pthread_mutex_lock(&kfifo_trace_lock);
+	for (buf = kfifo_trace_retired; buf; buf = next) {
+		next = buf->next;
+		free(buf);
+	}
+	kfifo_trace_retired = NULL;
+	kfifo_trace_file = f;
+	kfifo_trace_count = 0;
+	kfifo_trace_err = 0;
+	__atomic_store_n(&kfifo_trace_gen, kfifo_trace_gen + 1,
+			 __ATOMIC_RELAXED);
+	kfifo_trace_t0 = kfifo_trace_now_ns();
+	pthread_mutex_unlock(&kfifo_trace_lock);
+	__atomic_store_n(&kfifo_trace_enabled, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+long kfifo_trace_stop(void)
+{
+	struct kfifo_trace_buf *buf;
+	long ret;
+
+	if (!kfifo_trace_enabled)
+		return -EINVAL;
+	__atomic_store_n(&kfifo_trace_enabled, false, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&kfifo_trace_lock);
+	for (buf = kfifo_trace_bufs; buf; buf = buf->next)
+		kfifo_trace_write(buf);
+	/*
+	 * a call that saw the capture enabled may still be writing into its
+	 * buffer, so it is only freed by the next kfifo_trace_start()
+	 */
+	kfifo_trace_retired = kfifo_trace_bufs;
+	kfifo_trace_bufs = NULL;
+	/* the thread local pointers are stale now */
+	__atomic_store_n(&kfifo_trace_gen, kfifo_trace_gen + 1,
+			 __ATOMIC_RELAXED);
+	if (fclose(kfifo_trace_file) && !kfifo_trace_err)
+		kfifo_trace_err = -EIO;
+	kfifo_trace_file = NULL;
+	ret = kfifo_trace_err ? kfifo_trace_err : kfifo_trace_count;
+	pthread_mutex_unlock(&kfifo_trace_lock);
+	return ret;
+}
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Capture of the kfifo traffic of a program into a binary file, which
+ * kfifo_replay plays back against a kfifo or another queue
+ *
+ * The hooks in kfifo.c are only compiled in with CONFIG_KFIFO_TRACE, a
+ * program built without it needs nothing from kfifo_trace.c.
+ */
+
+#ifndef _LINUX_KFIFO_TRACE_H
+#define _LINUX_KFIFO_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define KFIFO_TRACE_MAGIC	0x5254464b	/* "KFTR" */
+#define KFIFO_TRACE_VERSION	1
+
+/* events buffered per thread before they are written out */
+#define KFIFO_TRACE_BATCH	256
+
+enum kfifo_trace_op {
+	KFIFO_TRACE_IN,
+	KFIFO_TRACE_OUT,
+};
+
+struct kfifo_trace_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	rec_size;	/* sizeof(struct kfifo_trace_rec) */
+	uint32_t	reserved;
+};
+
+/* one kfifo_in() or kfifo_out() call, the file is a header and an array */
+struct kfifo_trace_rec {
+	uint64_t	ns;		/* since kfifo_trace_start() */
+	uint32_t	tid;		/* thread id of the caller */
+	uint32_t	fifo;		/* tells the fifos of a program apart */
+	uint32_t	size;		/* of the fifo in elements */
+	uint32_t	req;		/* elements asked for, bytes for records */
+	uint32_t	done;		/* elements moved, bytes for records */
+	uint16_t	esize;
+	uint8_t		op;		/* enum kfifo_trace_op */
+	uint8_t		recsize;
+};
+
+extern bool kfifo_trace_enabled;
+
+struct __kfifo;
+
+extern void __kfifo_trace(struct __kfifo *fifo, enum kfifo_trace_op op,
+	unsigned int req, unsigned int done, size_t recsize);
+
+/*
+ * kfifo_trace internal helper called by kfifo.c, a disabled capture costs
+ * one predictable branch
+ */
+static inline void kfifo_trace(struct __kfifo *fifo, enum kfifo_trace_op op,
+		unsigned int req, unsigned int done, size_t recsize)
+{
+#ifdef CONFIG_KFIFO_TRACE
+	if (__builtin_expect(kfifo_trace_enabled, 0))
+		__kfifo_trace(fifo, op, req, done, recsize);
+#endif
+}
+
+/**
+ * kfifo_trace_start - start capturing kfifo traffic
+ * @path: file the events are written to, it is truncated
+ *
+ * From now on every kfifo_in(), kfifo_out() and their record variants are
+ * logged with their time, thread, fifo and sizes. kfifo_put() and
+ * kfifo_get() are inline and not captured.
+ * Return 0 if no error, -EOPNOTSUPP without CONFIG_KFIFO_TRACE, otherwise
+ * an error code.
+ */
+extern int kfifo_trace_start(const char *path);
+
+/**
+ * kfifo_trace_stop - stop capturing and write out all buffered events
+ *
+ * Call it when the traced fifos are quiet, events of calls running while
+ * it runs may be lost. The buffers of the threads are kept until the next
+ * kfifo_trace_start(), a call running late may still write to them.
+ * Return the number of events captured, otherwise an error code.
+ */
+extern long kfifo_trace_stop(void);
+
+#endif
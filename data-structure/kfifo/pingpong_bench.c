@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include "kfifo.h"
+#include "rwonce.h"
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 两个线程之间的乒乓延迟测试
+ *
+ * ping线程通过一个kfifo把令牌发给pong线程，pong线程通过另一个kfifo原样发回，ping线程测每一轮的往返时间，
+ * 最后输出p50、p99、p99.9和最大值。吞吐量测试看不到尾延迟，这个测试看的就是尾延迟
+ *
+ * 依次测这几种方式：
+ *   kfifo   无锁的kfifo，等待方自旋
+ *   pthread、ticket、mcs、clh、queued、futex_mutex
+ *           用kfifo_in_spinlocked/kfifo_out_spinlocked读写，每个kfifo一把锁，等待方自旋
+ *   futex   无锁的kfifo，等待方不自旋，直接在futex上睡眠，由发送方唤醒
+ *
+ * 用法：./pingpong_bench [轮数] [位置] 或者 ./pingpong_bench [轮数] [ping cpu] [pong cpu]
+ * 位置是下面几种之一，按/sys/devices/system/cpu里的拓扑从cpu0开始找第二个cpu：
+ *   core    同一个cpu，两个线程只能轮流运行
+ *   smt     同一个物理核的另一个超线程
+ *   socket  同一个socket的另一个物理核
+ *   cross   另一个socket
+ */
+
+struct pingpong_chan
+{
+    DECLARE_KFIFO(fifo, int, 16);
+    uint32_t seq;     /* futex方式下等待方睡在这里 */
+    uint32_t waiters; /* 睡眠的等待方个数，没有就不用唤醒 */
+} __attribute__((aligned(64)));
+
+struct pingpong_ops
+{
+    const char *name;
+    void (*init)(void);
+    void (*send)(struct pingpong_chan *c, int v);
+    int (*recv)(struct pingpong_chan *c);
+};
+
+/* ping到pong，pong到ping */
+static struct pingpong_chan chans[2];
+static int nr_rounds = 100000;
+static int ping_cpu = 0;
+static int pong_cpu = 1;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_pin(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* 读/sys/devices/system/cpu/cpuN/topology下的一个数，读不到返回-1 */
+static int cpu_topology(int cpu, const char *name)
+{
+    char path[128];
+    FILE *f;
+    int val = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (fscanf(f, "%d", &val) != 1)
+        val = -1;
+    fclose(f);
+    return val;
+}
+
+/* 按位置找一个和cpu搭配的cpu，找不到返回-1 */
+static int pick_cpu(int cpu, const char *where)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int core = cpu_topology(cpu, "core_id");
+    int pkg = cpu_topology(cpu, "physical_package_id");
+
+    if (!strcmp(where, "core"))
+        return cpu;
+
+    for (int i = 0; i < nr_cpus; i++)
+    {
+        int c = cpu_topology(i, "core_id");
+        int p = cpu_topology(i, "physical_package_id");
+
+        if (i == cpu || c < 0 || p < 0)
+            continue;
+        if (!strcmp(where, "smt") && p == pkg && c == core)
+            return i;
+        if (!strcmp(where, "socket") && p == pkg && c != core)
+            return i;
+        if (!strcmp(where, "cross") && p != pkg)
+            return i;
+    }
+    return -1;
+}
+
+static void *pong(void *arg)
+{
+    const struct pingpong_ops *o = arg;
+    int v;
+
+    bench_pin(pong_cpu);
+    do
+    {
+        v = o->recv(&chans[0]);
+        o->send(&chans[1], v);
+    } while (v >= 0);
+    return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench_run(const struct pingpong_ops *o, unsigned long long *lat)
+{
+    unsigned long long start, ns;
+    pthread_t tid;
+    int i;
+
+    memset(chans, 0, sizeof(chans));
+    INIT_KFIFO(chans[0].fifo);
+    INIT_KFIFO(chans[1].fifo);
+    if (o->init)
+        o->init();
+
+    pthread_create(&tid, NULL, pong, (void *)o);
+
+    /* 先热身，让两个线程都跑起来 */
+    for (i = 0; i < nr_rounds / 10; i++)
+    {
+        o->send(&chans[0], i);
+        o->recv(&chans[1]);
+    }
+
+    start = now_ns();
+    for (i = 0; i < nr_rounds; i++)
+    {
+        unsigned long long t = now_ns();
+
+        o->send(&chans[0], i);
+        o->recv(&chans[1]);
+        lat[i] = now_ns() - t;
+    }
+    ns = now_ns() - start;
+
+    /* 负数让pong线程退出 */
+    o->send(&chans[0], -1);
+    o->recv(&chans[1]);
+    pthread_join(tid, NULL);
+
+    qsort(lat, nr_rounds, sizeof(*lat), cmp_ull);
+    printf("%-12s avg %6llu p50 %6llu p99 %6llu p99.9 %7llu max %8llu\r\n",
+           o->name, ns / nr_rounds, lat[nr_rounds / 2], lat[nr_rounds * 99 / 100],
+           lat[nr_rounds * 999 / 1000], lat[nr_rounds - 1]);
+}
+
+static void pingpong_kfifo_send(struct pingpong_chan *c, int v)
+{
+    kfifo_in(&c->fifo, &v, 1);
+}
+
+static int pingpong_kfifo_recv(struct pingpong_chan *c)
+{
+    unsigned int spins = 0;
+    int v;
+
+    while (!kfifo_out(&c->fifo, &v, 1))
+        spin_relax(&spins);
+    return v;
+}
+
+/* 每种锁生成一组读写函数，spin_lock会根据锁的类型选择实现 */
+#define DEFINE_PINGPONG_LOCK(name, type)                                                \
+    static type pingpong_##name##_l[2];                                                 \
+                                                                                        \
+    static void pingpong_##name##_init(void)                                            \
+    {                                                                                   \
+        spin_lock_init(&pingpong_##name##_l[0]);                                        \
+        spin_lock_init(&pingpong_##name##_l[1]);                                        \
+    }                                                                                   \
+                                                                                        \
+    static void pingpong_##name##_send(struct pingpong_chan *c, int v)                  \
+    {                                                                                   \
+        kfifo_in_spinlocked(&c->fifo, &v, 1, &pingpong_##name##_l[c - chans]);          \
+    }                                                                                   \
+                                                                                        \
+    static int pingpong_##name##_recv(struct pingpong_chan *c)                          \
+    {                                                                                   \
+        unsigned int spins = 0;                                                         \
+        int v;                                                                          \
+                                                                                        \
+        while (!kfifo_out_spinlocked(&c->fifo, &v, 1, &pingpong_##name##_l[c - chans])) \
+            spin_relax(&spins);                                                         \
+        return v;                                                                       \
+    }
+
+DEFINE_PINGPONG_LOCK(pthread, pthread_spinlock_t)
+DEFINE_PINGPONG_LOCK(ticket, struct ticket_spinlock)
+DEFINE_PINGPONG_LOCK(mcs, struct mcs_lock)
+DEFINE_PINGPONG_LOCK(clh, struct clh_lock)
+DEFINE_PINGPONG_LOCK(queued, struct qspinlock)
+DEFINE_PINGPONG_LOCK(futex_mutex, struct futex_mutex)
+
+/*
+ * 写入后如果对方在睡眠就唤醒它。写入和读waiters之间要有full barrier，
+ * 和pingpong_futex_recv里加waiters再检查kfifo配对，保证不会两边都没看到对方
+ */
+static void pingpong_futex_send(struct pingpong_chan *c, int v)
+{
+    kfifo_in(&c->fifo, &v, 1);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (READ_ONCE(c->waiters))
+    {
+        __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+        futex(&c->seq, FUTEX_WAKE, 1);
+    }
+}
+
+static int pingpong_futex_recv(struct pingpong_chan *c)
+{
+    uint32_t seq;
+    int v;
+
+    for (;;)
+    {
+        if (kfifo_out(&c->fifo, &v, 1))
+            return v;
+
+        seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        __atomic_fetch_add(&c->waiters, 1, __ATOMIC_SEQ_CST);
+        if (kfifo_out(&c->fifo, &v, 1))
+        {
+            __atomic_fetch_sub(&c->waiters, 1, __ATOMIC_RELAXED);
+            return v;
+        }
+        futex(&c->seq, FUTEX_WAIT, seq);
+        __atomic_fetch_sub(&c->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static const struct pingpong_ops pingpong_ops[] = {
+    {"kfifo", NULL, pingpong_kfifo_send, pingpong_kfifo_recv},
+    {"pthread", pingpong_pthread_init, pingpong_pthread_send, pingpong_pthread_recv},
+    {"ticket", pingpong_ticket_init, pingpong_ticket_send, pingpong_ticket_recv},
+    {"mcs", pingpong_mcs_init, pingpong_mcs_send, pingpong_mcs_recv},
+    {"clh", pingpong_clh_init, pingpong_clh_send, pingpong_clh_recv},
+    {"queued", pingpong_queued_init, pingpong_queued_send, pingpong_queued_recv},
+    {"futex_mutex", pingpong_futex_mutex_init, pingpong_futex_mutex_send, pingpong_futex_mutex_recv},
+    {"futex", NULL, pingpong_futex_send, pingpong_futex_recv},
+};
+
+int main(int argc, char const *argv[])
+{
+    unsigned long long *lat;
+
+    if (argc > 1)
+        nr_rounds = atoi(argv[1]);
+    if (argc == 3)
+    {
+        pong_cpu = pick_cpu(ping_cpu, argv[2]);
+        if (pong_cpu < 0)
+        {
+            printf("no cpu for \"%s\" next to cpu %d\r\n", argv[2], ping_cpu);
+            exit(1);
+        }
+    }
+    else if (argc > 3)
+    {
+        ping_cpu = atoi(argv[2]);
+        pong_cpu = atoi(argv[3]);
+    }
+    else
+    {
+        /* 默认找另一个物理核，只有一个cpu就只能在同一个cpu上 */
+        pong_cpu = pick_cpu(ping_cpu, "socket");
+        if (pong_cpu < 0)
+            pong_cpu = pick_cpu(ping_cpu, "smt");
+        if (pong_cpu < 0)
+            pong_cpu = ping_cpu;
+    }
+    if (nr_rounds <= 0)
+    {
+        printf("usage: %s [rounds] [core|smt|socket|cross]\r\n", argv[0]);
+        printf("       %s [rounds] [ping cpu] [pong cpu]\r\n", argv[0]);
+        exit(1);
+    }
+
+    bench_pin(ping_cpu);
+    lat = malloc(nr_rounds * sizeof(*lat));
+    printf("%d rounds, ping cpu %d, pong cpu %d, round trip ns:\r\n", nr_rounds, ping_cpu, pong_cpu);
+    for (unsigned int i = 0; i < ARRAY_SIZE(pingpong_ops); i++)
+        bench_run(&pingpong_ops[i], lat);
+
+    free(lat);
+    exit(0);
+}
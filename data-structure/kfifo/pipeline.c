@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * A multi-stage streaming pipeline built on kfifo
+ */
+
+#define _GNU_SOURCE
+#include "pipeline.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "minmax.h"
+#include "rwonce.h"
+
+/* spins before a waiting stage gives its cpu away */
+#define PIPELINE_SPINS	128
+
+static unsigned long long pipeline_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int pipeline_edge_len(struct pipeline_edge *e)
+{
+	return READ_ONCE(e->fifo.in) - READ_ONCE(e->fifo.out);
+}
+
+static inline unsigned int pipeline_edge_unused(struct pipeline_edge *e)
+{
+	return e->fifo.mask + 1 - pipeline_edge_len(e);
+}
+
+static inline void pipeline_relax(unsigned int *spins)
+{
+	if (++*spins < PIPELINE_SPINS) {
+		cpu_relax();
+	} else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+int pipeline_init(struct pipeline *pl, unsigned int fifo_size,
+		unsigned int batch)
+{
+	memset(pl, 0, sizeof(*pl));
+
+	if (!batch || batch > fifo_size)
+		return -EINVAL;
+
+	pl->fifo_size = fifo_size;
+	pl->batch = batch;
+	return 0;
+}
+
+int pipeline_add_stage(struct pipeline *pl, const char *name,
+		pipeline_fn_t fn, void *priv, size_t esize, int cpu)
+{
+	struct pipeline_stage *st;
+
+	if (pl->nr_stages == PIPELINE_MAX_STAGES)
+		return -ENOSPC;
+
+	st = &pl->stage[pl->nr_stages];
+	st->name = name;
+	st->fn = fn;
+	st->priv = priv;
+	st->esize = esize;
+	st->cpu = cpu;
+	st->pl = pl;
+	return pl->nr_stages++;
+}
+
+static void pipeline_pin(struct pipeline_stage *st)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+
+	if (st->cpu < 0 || nr_cpus <= 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(st->cpu % nr_cpus, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * pipeline_pull - wait for input and take one batch of it
+ *
+ * Return the number of elements taken, 0 when upstream reached the end of
+ * the stream and the edge is drained.
+ */
+static unsigned int pipeline_pull(struct pipeline_stage *st)
+{
+	struct pipeline_edge *e = st->in;
+	unsigned int spins = 0;
+	unsigned int n;
+
+	n = pipeline_edge_len(e);
+	if (!n) {
+		st->stats.starves++;
+		while (!(n = pipeline_edge_len(e))) {
+			/* eof is set after the last in index, check again */
+			if (smp_load_acquire(&e->eof)) {
+				n = pipeline_edge_len(e);
+				if (!n)
+					return 0;
+				break;
+			}
+			pipeline_relax(&spins);
+		}
+	}
+
+	st->stats.depth_sum += n;
+	if (n > st->stats.depth_max)
+		st->stats.depth_max = n;
+
+	n = min(n, st->pl->batch);
+	return __kfifo_out(&e->fifo, st->in_buf, n);
+}
+
+/*
+ * pipeline_reserve - wait until the output edge takes a whole batch
+ *
+ * This is where the backpressure comes from: a stage never calls its
+ * function without room for the result, so a full edge stalls it and in
+ * turn lets its own input edge fill up. Return false when downstream is
+ * gone and nothing would ever be read again.
+ */
+static bool pipeline_reserve(struct pipeline_stage *st)
+{
+	struct pipeline_edge *e = st->out;
+	unsigned int spins = 0;
+
+	if (pipeline_edge_unused(e) >= st->pl->batch)
+		return true;
+
+	st->stats.stalls++;
+	while (pipeline_edge_unused(e) < st->pl->batch) {
+		if (READ_ONCE(e->closed))
+			return false;
+		pipeline_relax(&spins);
+	}
+	return true;
+}
+
+static void *pipeline_stage_thread(void *arg)
+{
+	struct pipeline_stage *st = arg;
+	struct pipeline *pl = st->pl;
+	unsigned long long start;
+	unsigned int n;
+	int ret;
+
+	pipeline_pin(st);
+	start = pipeline_now_ns();
+
+	for (;;) {
+		n = 0;
+		if (st->in) {
+			n = pipeline_pull(st);
+			if (!n)
+				break;
+		} else if (READ_ONCE(pl->stop)) {
+			break;
+		}
+
+		if (st->out && !pipeline_reserve(st))
+			break;
+
+		ret = st->fn(st->priv, st->in_buf, n, st->out_buf,
+			     st->out ? pl->batch : 0);
+		st->stats.batches++;
+		st->stats.in += n;
+		if (ret < 0)
+			break;
+
+		if (st->out && ret) {
+			__kfifo_in(&st->out->fifo, st->out_buf, ret);
+			st->stats.out += ret;
+		}
+	}
+
+	/* let upstream stop instead of stalling on an edge nobody reads */
+	if (st->in)
+		WRITE_ONCE(st->in->closed, 1);
+	/* pairs with the acquire in pipeline_pull(), after the last in index */
+	if (st->out)
+		smp_store_release(&st->out->eof, 1);
+
+	st->stats.ns = pipeline_now_ns() - start;
+	return NULL;
+}
+
+void pipeline_destroy(struct pipeline *pl)
+{
+	unsigned int i;
+
+	for (i = 0; i < pl->nr_stages; i++) {
+		struct pipeline_stage *st = &pl->stage[i];
+
+		free(st->in_buf);
+		free(st->out_buf);
+		st->in_buf = st->out_buf = NULL;
+		if (st->out)
+			__kfifo_free(&st->out->fifo);
+		st->in = st->out = NULL;
+	}
+}
+
+int pipeline_start(struct pipeline *pl)
+{
+	unsigned int i;
+	int ret;
+
+	if (pl->nr_stages < 2)
+		return -EINVAL;
+
+	for (i = 0; i < pl->nr_stages; i++) {
+		struct pipeline_stage *st = &pl->stage[i];
+
+		memset(&st->stats, 0, sizeof(st->stats));
+		if (i)
+			st->in = &pl->edge[i - 1];
+		if (i == pl->nr_stages - 1)
+			continue;
+
+		if (!st->esize) {
+			ret = -EINVAL;
+			goto err;
+		}
+		st->out = &pl->edge[i];
+		memset(st->out, 0, sizeof(*st->out));
+		ret = __kfifo_alloc(&st->out->fifo, pl->fifo_size, st->esize, 0, 0);
+		if (ret)
+			goto err;
+		st->out_buf = malloc(pl->batch * st->esize);
+		if (!st->out_buf) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	for (i = 1; i < pl->nr_stages; i++) {
+		struct pipeline_stage *st = &pl->stage[i];
+
+		st->in_buf = malloc(pl->batch * pl->stage[i - 1].esize);
+		if (!st->in_buf) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	pl->stop = 0;
+	for (i = 0; i < pl->nr_stages; i++) {
+		ret = -pthread_create(&pl->stage[i].thread, NULL,
+				      pipeline_stage_thread, &pl->stage[i]);
+		if (ret)
+			goto err_threads;
+	}
+	return 0;
+
+err_threads:
+	/* the started stages drain whatever the source already emitted */
+	pipeline_stop(pl);
+	if (i)
+		WRITE_ONCE(pl->edge[i - 1].closed, 1);
+	while (i--)
+		pthread_join(pl->stage[i].thread, NULL);
+err:
+	pipeline_destroy(pl);
+	return ret;
+}
+
+void pipeline_stop(struct pipeline *pl)
+{
+	WRITE_ONCE(pl->stop, 1);
+}
+
+void pipeline_join(struct pipeline *pl)
+{
+	unsigned int i;
+
+	for (i = 0; i < pl->nr_stages; i++)
+		pthread_join(pl->stage[i].thread, NULL);
+}
@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * A multi-stage streaming pipeline built on kfifo
+ *
+ * Every stage runs in its own thread and is connected to the next one by a
+ * single producer/single consumer kfifo, so the edges need no locking.
+ */
+
+#ifndef _LINUX_KFIFO_PIPELINE_H
+#define _LINUX_KFIFO_PIPELINE_H
+
+#include "kfifo.h"
+
+#define PIPELINE_MAX_STAGES	16
+
+/* returned by a stage function to end the stream */
+#define PIPELINE_EOF		(-1)
+
+/**
+ * pipeline_fn_t - body of a pipeline stage
+ * @priv: private data passed to pipeline_add_stage()
+ * @in: batch of input elements, NULL for the source stage
+ * @n: number of elements in @in
+ * @out: room for @out_max output elements, NULL for the sink stage
+ * @out_max: capacity of @out in elements
+ *
+ * Return the number of elements written to @out, or PIPELINE_EOF to end
+ * the stream. The source returns PIPELINE_EOF when it has nothing more to
+ * produce, any other stage may return it to abort the pipeline.
+ */
+typedef int (*pipeline_fn_t)(void *priv, const void *in, unsigned int n,
+			     void *out, unsigned int out_max);
+
+struct pipeline_stats {
+	unsigned long long	in;		/* elements consumed */
+	unsigned long long	out;		/* elements produced */
+	unsigned long long	batches;	/* calls of the stage function */
+	unsigned long long	stalls;		/* waits on a full output edge */
+	unsigned long long	starves;	/* waits on an empty input edge */
+	unsigned long long	depth_sum;	/* input depth summed per batch */
+	unsigned int		depth_max;	/* deepest input queue seen */
+	unsigned long long	ns;		/* lifetime of the stage thread */
+};
+
+struct pipeline_edge {
+	struct __kfifo		fifo;
+	int			eof;		/* producer will not write again */
+	int			closed;		/* consumer will not read again */
+};
+
+struct pipeline_stage {
+	const char		*name;
+	pipeline_fn_t		fn;
+	void			*priv;
+	size_t			esize;		/* element size of the output edge */
+	int			cpu;		/* -1 to leave the thread unpinned */
+	struct pipeline_edge	*in;		/* NULL for the source */
+	struct pipeline_edge	*out;		/* NULL for the sink */
+	void			*in_buf;
+	void			*out_buf;
+	pthread_t		thread;
+	struct pipeline		*pl;
+	struct pipeline_stats	stats;
+};
+
+struct pipeline {
+	struct pipeline_stage	stage[PIPELINE_MAX_STAGES];
+	struct pipeline_edge	edge[PIPELINE_MAX_STAGES - 1];
+	unsigned int		nr_stages;
+	unsigned int		fifo_size;	/* elements per edge */
+	unsigned int		batch;		/* elements moved per stage call */
+	int			stop;
+};
+
+/**
+ * pipeline_init - initialize an empty pipeline
+ * @pl: the pipeline
+ * @fifo_size: number of elements of every edge, rounded up to a power of 2
+ * @batch: max. number of elements handed to a stage function at once
+ *
+ * A stage is only called when its output edge has room for a whole batch,
+ * so a slow stage fills its input edge and stalls everything upstream.
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int pipeline_init(struct pipeline *pl, unsigned int fifo_size,
+	unsigned int batch);
+
+/**
+ * pipeline_add_stage - append a stage to the pipeline
+ * @pl: the pipeline
+ * @name: name used in the statistics
+ * @fn: stage function
+ * @priv: private data of @fn
+ * @esize: size of the elements this stage emits, 0 for the sink
+ * @cpu: cpu the stage is pinned to, -1 for no pinning
+ *
+ * The first stage added is the source, the last one is the sink.
+ * Return the index of the stage, otherwise an error code.
+ */
+extern int pipeline_add_stage(struct pipeline *pl, const char *name,
+	pipeline_fn_t fn, void *priv, size_t esize, int cpu);
+
+/**
+ * pipeline_start - allocate the edges and start all stage threads
+ * @pl: the pipeline
+ *
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int pipeline_start(struct pipeline *pl);
+
+/**
+ * pipeline_stop - ask the source to stop producing
+ * @pl: the pipeline
+ *
+ * Data already in the edges is still processed by the downstream stages,
+ * use pipeline_join() to wait for the drain.
+ */
+extern void pipeline_stop(struct pipeline *pl);
+
+/**
+ * pipeline_join - wait until every stage has finished
+ * @pl: the pipeline
+ *
+ * A stage finishes when its input edge is drained and closed by upstream,
+ * so this returns after the source ended and all data reached the sink.
+ */
+extern void pipeline_join(struct pipeline *pl);
+
+/**
+ * pipeline_destroy - free the edges of a joined pipeline
+ * @pl: the pipeline
+ */
+extern void pipeline_destroy(struct pipeline *pl);
+
+/**
+ * pipeline_stage_stats - returns the statistics of a stage
+ * @pl: the pipeline
+ * @idx: index returned by pipeline_add_stage()
+ *
+ * Only stable after pipeline_join().
+ */
+static inline const struct pipeline_stats *
+pipeline_stage_stats(const struct pipeline *pl, unsigned int idx)
+{
+	return &pl->stage[idx].stats;
+}
+
+#endif
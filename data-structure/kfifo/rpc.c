@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * A request/response channel between processes, see rpc.h
+ */
+
+#include "rpc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log2.h"
+#include "minmax.h"
+#include "rwonce.h"
+
+#define RPC_MAGIC	0x6b667263	/* "crfk" */
+
+struct rpc_hdr {
+	u32	id;
+};
+
+static size_t rpc_region_len(unsigned int ring_size)
+{
+	size_t hdr = (sizeof(struct rpc_shm) + 63) & ~(size_t)63;
+
+	return hdr + 2 * (size_t)ring_size;
+}
+
+static void rpc_ring_init(struct rpc_ring *ring, unsigned int size,
+		unsigned int offset)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->size = size;
+	ring->offset = offset;
+}
+
+/*
+ * rpc_view internal helper to point a private kfifo at a ring of the
+ * mapping of this process
+ */
+static void rpc_view(struct rpc_chan *ch, struct __kfifo *view,
+		struct rpc_ring *ring)
+{
+	memset(view, 0, sizeof(*view));
+	view->mask = ring->size - 1;
+	view->esize = 1;
+	view->data = (unsigned char *)ch->shm + ring->offset;
+}
+
+void rpc_set_role(struct rpc_chan *ch, enum rpc_role role)
+{
+	int tx = role == RPC_CLIENT ? RPC_REQ : RPC_RESP;
+
+	ch->tx_ring = &ch->shm->ring[tx];
+	ch->rx_ring = &ch->shm->ring[!tx];
+	rpc_view(ch, &ch->tx, ch->tx_ring);
+	rpc_view(ch, &ch->rx, ch->rx_ring);
+}
+
+static int rpc_attach(struct rpc_chan *ch, struct rpc_shm *shm, size_t len,
+		enum rpc_role role)
+{
+	unsigned int size = shm->ring[RPC_REQ].size;
+
+	ch->shm = shm;
+	ch->len = len;
+	ch->next_id = 0;
+	ch->max_msg = min(size / 4 - sizeof(struct rpc_hdr) - RPC_RECSIZE,
+			  (1U << (RPC_RECSIZE * 8)) - 1 - sizeof(struct rpc_hdr));
+	rpc_set_role(ch, role);
+	return 0;
+}
+
+int rpc_create(struct rpc_chan *ch, const char *name,
+		unsigned int ring_size, enum rpc_role role)
+{
+	struct rpc_shm *shm;
+	size_t len;
+	int fd = -1;
+
+	memset(ch, 0, sizeof(*ch));
+	ring_size = roundup_pow_of_two(ring_size);
+	if (ring_size < 64 || ring_size > INT_MAX / 2)
+		return -EINVAL;
+	len = rpc_region_len(ring_size);
+
+	if (name) {
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0)
+			return -errno;
+		if (ftruncate(fd, len)) {
+			int ret = -errno;
+
+			close(fd);
+			shm_unlink(name);
+			return ret;
+		}
+		shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	} else {
+		shm = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	}
+	if (shm == MAP_FAILED) {
+		int ret = -errno;
+
+		if (name)
+			shm_unlink(name);
+		return ret;
+	}
+
+	shm->shutdown = 0;
+	shm->len = len;
+	rpc_ring_init(&shm->ring[RPC_REQ], ring_size, len - 2 * ring_size);
+	rpc_ring_init(&shm->ring[RPC_RESP], ring_size, len - ring_size);
+	/* rpc_open() only trusts a region with the magic set */
+	smp_wmb();
+	WRITE_ONCE(shm->magic, RPC_MAGIC);
+
+	return rpc_attach(ch, shm, len, role);
+}
+
+int rpc_open(struct rpc_chan *ch, const char *name, enum rpc_role role)
+{
+	struct rpc_shm *shm;
+	struct stat st;
+	int fd;
+
+	memset(ch, 0, sizeof(*ch));
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -errno;
+	}
+	if ((size_t)st.st_size < sizeof(*shm)) {
+		close(fd);
+		return -EAGAIN;
+	}
+	shm = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return -errno;
+
+	if (READ_ONCE(shm->magic) != RPC_MAGIC || shm->len != st.st_size) {
+		munmap(shm, st.st_size);
+		return -EAGAIN;
+	}
+	smp_rmb();
+	return rpc_attach(ch, shm, st.st_size, role);
+}
+
+void rpc_close(struct rpc_chan *ch)
+{
+	if (ch->shm)
+		munmap(ch->shm, ch->len);
+	ch->shm = NULL;
+}
+
+int rpc_unlink(const char *name)
+{
+	return shm_unlink(name) ? -errno : 0;
+}
+
+/*
+ * rpc_wake internal helper to wake the peer waiting on seq, the futex call
+ * is only made if it announced itself in waiters
+ */
+static void rpc_wake(u32 *seq, u32 *waiters)
+{
+	/* the index update must be visible before waiters is read */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (READ_ONCE(*waiters)) {
+		__atomic_fetch_add(seq, 1, __ATOMIC_RELEASE);
+		futex(seq, FUTEX_WAKE, INT_MAX);
+	}
+}
+
+void rpc_shutdown(struct rpc_chan *ch)
+{
+	struct rpc_shm *shm = ch->shm;
+	int i;
+
+	WRITE_ONCE(shm->shutdown, 1);
+	for (i = 0; i < 2; i++) {
+		__atomic_fetch_add(&shm->ring[i].data_seq, 1, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&shm->ring[i].space_seq, 1, __ATOMIC_SEQ_CST);
+		futex(&shm->ring[i].data_seq, FUTEX_WAKE, INT_MAX);
+		futex(&shm->ring[i].space_seq, FUTEX_WAKE, INT_MAX);
+	}
+}
+
+/*
+ * rpc_ready internal helper to check a ring for data if need is 0,
+ * otherwise for need bytes of room
+ */
+static inline bool rpc_ready(struct rpc_ring *ring, unsigned int need)
+{
+	unsigned int used = READ_ONCE(ring->in) - READ_ONCE(ring->out);
+
+	return need ? ring->size - used >= need : used != 0;
+}
+
+/*
+ * rpc_wait internal helper to wait until rpc_ready() holds: poll the ring
+ * for a while, then announce a sleeper and sleep on the futex word seq
+ * until the peer bumps it
+ */
+static int rpc_wait(struct rpc_chan *ch, struct rpc_ring *ring,
+		unsigned int need, u32 *seq, u32 *waiters)
+{
+	unsigned int spins = 0, i;
+	u32 val;
+
+	for (i = 0; i < RPC_SPINS; i++) {
+		if (rpc_ready(ring, need))
+			return 0;
+		if (READ_ONCE(ch->shm->shutdown))
+			return -EPIPE;
+		spin_relax(&spins);
+	}
+
+	for (;;) {
+		val = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		__atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+		/* either the peer sees the waiter or we see its update */
+		if (rpc_ready(ring, need) || READ_ONCE(ch->shm->shutdown)) {
+			__atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		futex(seq, FUTEX_WAIT, val);
+		__atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+		if (rpc_ready(ring, need))
+			return 0;
+	}
+	return READ_ONCE(ch->shm->shutdown) && !rpc_ready(ring, need) ?
+		-EPIPE : 0;
+}
+
+int rpc_send(struct rpc_chan *ch, u32 id, const void *buf, unsigned int len)
+{
+	struct rpc_ring *ring = ch->tx_ring;
+	struct __kfifo *view = &ch->tx;
+	struct rpc_hdr hdr = { .id = id };
+	unsigned int n = sizeof(hdr) + len;
+	int ret;
+
+	if (len > ch->max_msg)
+		return -EMSGSIZE;
+	if (READ_ONCE(ch->shm->shutdown))
+		return -EPIPE;
+
+	ret = rpc_wait(ch, ring, n + RPC_RECSIZE, &ring->space_seq,
+		       &ring->space_waiters);
+	if (ret)
+		return ret;
+
+	view->in = ring->in;
+	/* the peer is done reading what we are about to overwrite */
+	view->out = smp_load_acquire(&ring->out);
+	/* header and payload go straight into the ring as one record */
+	__kfifo_in_hdr_r(view, &hdr, sizeof(hdr), buf, len, RPC_RECSIZE);
+	/* the record is complete before the peer can see the new in */
+	smp_store_release(&ring->in, view->in);
+	rpc_wake(&ring->data_seq, &ring->data_waiters);
+	return 0;
+}
+
+/*
+ * rpc_copy_span internal helper to copy len bytes from off into a record
+ * which may wrap around the end of the ring
+ */
+static void rpc_copy_span(void *dst, const struct kfifo_span *span,
+		unsigned int off, unsigned int len)
+{
+	unsigned int l = 0;
+
+	if (off < span->first_len) {
+		l = min(len, span->first_len - off);
+		memcpy(dst, span->first + off, l);
+		off = 0;
+	} else {
+		off -= span->first_len;
+	}
+	memcpy(dst + l, span->second + off, len - l);
+}
+
+int rpc_recv(struct rpc_chan *ch, u32 *id, void *buf, unsigned int len)
+{
+	struct rpc_ring *ring = ch->rx_ring;
+	struct __kfifo *view = &ch->rx;
+	struct kfifo_span span;
+	struct rpc_hdr hdr;
+	unsigned int n;
+	int ret;
+
+	ret = rpc_wait(ch, ring, 0, &ring->data_seq, &ring->data_waiters);
+	if (ret)
+		return ret;
+
+	/* don't read the record before the in index telling it is there */
+	view->in = smp_load_acquire(&ring->in);
+	view->out = ring->out;
+	n = __kfifo_rec_peek_at(view, 0, &span, RPC_RECSIZE);
+	if (n < sizeof(hdr)) {
+		__kfifo_skip_r(view, RPC_RECSIZE);
+		smp_store_release(&ring->out, view->out);
+		return -EBADMSG;
+	}
+
+	rpc_copy_span(&hdr, &span, 0, sizeof(hdr));
+	n = min(len, n - (unsigned int)sizeof(hdr));
+	rpc_copy_span(buf, &span, sizeof(hdr), n);
+	*id = hdr.id;
+
+	__kfifo_skip_r(view, RPC_RECSIZE);
+	/* the record is copied before the peer may overwrite it */
+	smp_store_release(&ring->out, view->out);
+	rpc_wake(&ring->space_seq, &ring->space_waiters);
+	return n;
+}
+
+int rpc_call(struct rpc_chan *ch, const void *req, unsigned int len,
+		void *resp, unsigned int resp_max)
+{
+	u32 id = ch->next_id++;
+	u32 resp_id;
+	int ret;
+
+	ret = rpc_send(ch, id, req, len);
+	if (ret)
+		return ret;
+
+	ret = rpc_recv(ch, &resp_id, resp, resp_max);
+	if (ret >= 0 && resp_id != id)
+		return -EPROTO;
+	return ret;
+}
+
+int rpc_serve(struct rpc_chan *ch, rpc_handler_t fn, void *priv)
+{
+	void *req, *resp;
+	int ret;
+	u32 id;
+
+	req = malloc(ch->max_msg);
+	resp = malloc(ch->max_msg);
+	if (!req || !resp) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (;;) {
+		ret = rpc_recv(ch, &id, req, ch->max_msg);
+		if (ret == -EBADMSG)
+			continue;
+		if (ret < 0)
+			break;
+		ret = fn(priv, req, ret, resp, ch->max_msg);
+		if (ret < 0)
+			goto out;
+		ret = rpc_send(ch, id, resp, ret);
+		if (ret)
+			break;
+	}
+	/* a shut down channel is the normal end of a server */
+	if (ret == -EPIPE)
+		ret = 0;
+out:
+	free(req);
+	free(resp);
+	return ret;
+}
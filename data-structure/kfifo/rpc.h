@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * A request/response channel between processes built on two record kfifos
+ * in shared memory
+ *
+ * The shared region holds the in and out indices of both rings and their
+ * buffers. struct __kfifo keeps a pointer to its buffer, which is only
+ * valid in one process, so every process works on a private view of each
+ * ring and copies the indices from and to the shared region around the
+ * usual __kfifo_*_r calls.
+ */
+
+#ifndef _LINUX_KFIFO_RPC_H
+#define _LINUX_KFIFO_RPC_H
+
+#include "kfifo.h"
+#include "crc32c.h"
+
+/* length field of the records in the rings */
+#define RPC_RECSIZE	2
+
+/* polls of a ring before a waiter goes to sleep on its futex */
+#define RPC_SPINS	1024
+
+enum rpc_role {
+	RPC_CLIENT,
+	RPC_SERVER,
+};
+
+enum {
+	RPC_REQ,
+	RPC_RESP,
+};
+
+/*
+ * one direction of the channel, the fields written by the writer and by
+ * the reader live on different cache lines
+ */
+struct rpc_ring {
+	unsigned int	in __attribute__((aligned(64)));
+	u32		data_seq;	/* bumped by the writer to wake the reader */
+	u32		space_waiters;	/* writers sleeping on a full ring */
+	unsigned int	out __attribute__((aligned(64)));
+	u32		space_seq;	/* bumped by the reader to wake the writer */
+	u32		data_waiters;	/* readers sleeping on an empty ring */
+	unsigned int	size __attribute__((aligned(64)));
+	unsigned int	offset;		/* of the buffer in the shared region */
+};
+
+struct rpc_shm {
+	u32		magic;
+	u32		shutdown;
+	u32		len;		/* of the whole region */
+	struct rpc_ring	ring[2];
+};
+
+/* the process local side of a channel */
+struct rpc_chan {
+	struct rpc_shm	*shm;
+	size_t		len;
+	struct rpc_ring	*tx_ring;
+	struct rpc_ring	*rx_ring;
+	struct __kfifo	tx;		/* private views of the rings */
+	struct __kfifo	rx;
+	u32		next_id;
+	unsigned int	max_msg;	/* longest payload */
+};
+
+/**
+ * rpc_handler_t - request handler of a server
+ * @priv: private data passed to rpc_serve()
+ * @req: the request payload
+ * @len: length of @req in bytes
+ * @resp: room for the response payload
+ * @resp_max: capacity of @resp in bytes
+ *
+ * Return the length of the response, a negative value stops the server.
+ */
+typedef int (*rpc_handler_t)(void *priv, const void *req, unsigned int len,
+			     void *resp, unsigned int resp_max);
+
+/**
+ * rpc_create - create a channel and attach to it
+ * @ch: the channel
+ * @name: name of the POSIX shared memory object, NULL for an anonymous
+ *  mapping which is inherited by fork()
+ * @ring_size: bytes of every ring, rounded up to a power of 2
+ * @role: the side of the channel taken by the caller
+ *
+ * Payloads may be up to a quarter of @ring_size long.
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int rpc_create(struct rpc_chan *ch, const char *name,
+	unsigned int ring_size, enum rpc_role role);
+
+/**
+ * rpc_open - attach to a channel created by another process
+ * @ch: the channel
+ * @name: name passed to rpc_create()
+ * @role: the side of the channel taken by the caller
+ *
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int rpc_open(struct rpc_chan *ch, const char *name,
+	enum rpc_role role);
+
+/**
+ * rpc_set_role - switch to the other side of a channel
+ * @ch: the channel
+ * @role: the new side
+ *
+ * The child of fork() gets a copy of its parent's channel and calls this
+ * to become its peer.
+ */
+extern void rpc_set_role(struct rpc_chan *ch, enum rpc_role role);
+
+/**
+ * rpc_close - detach from a channel
+ * @ch: the channel
+ */
+extern void rpc_close(struct rpc_chan *ch);
+
+/**
+ * rpc_unlink - remove the name of a channel
+ * @name: name passed to rpc_create()
+ */
+extern int rpc_unlink(const char *name);
+
+/**
+ * rpc_shutdown - make every current and future wait on the channel fail
+ * @ch: the channel
+ */
+extern void rpc_shutdown(struct rpc_chan *ch);
+
+/**
+ * rpc_send - queue a message for the peer
+ * @ch: the channel
+ * @id: correlation id, copied into the response by the server
+ * @buf: the payload
+ * @len: length of @buf in bytes
+ *
+ * Waits while the ring is full. The peer is only woken with a futex call
+ * if it went to sleep.
+ * Return 0 if no error, -EMSGSIZE or -EPIPE after rpc_shutdown().
+ */
+extern int rpc_send(struct rpc_chan *ch, u32 id, const void *buf,
+	unsigned int len);
+
+/**
+ * rpc_recv - take the next message from the peer
+ * @ch: the channel
+ * @id: pointer to output variable to store the correlation id
+ * @buf: room for the payload
+ * @len: capacity of @buf, a longer payload is truncated
+ *
+ * Spins for a while and then sleeps until a message arrives.
+ * Return the length of the payload copied, -EPIPE after rpc_shutdown().
+ */
+extern int rpc_recv(struct rpc_chan *ch, u32 *id, void *buf,
+	unsigned int len);
+
+/**
+ * rpc_call - send a request and wait for its response
+ * @ch: the channel, on the client side
+ * @req: the request payload
+ * @len: length of @req in bytes
+ * @resp: room for the response payload
+ * @resp_max: capacity of @resp in bytes
+ *
+ * Return the length of the response, otherwise an error code. -EPROTO
+ * means the response didn't carry the id of the request, which happens if
+ * rpc_call() is mixed with pipelined rpc_send()s.
+ */
+extern int rpc_call(struct rpc_chan *ch, const void *req, unsigned int len,
+	void *resp, unsigned int resp_max);
+
+/**
+ * rpc_serve - answer requests until the channel is shut down
+ * @ch: the channel, on the server side
+ * @fn: request handler
+ * @priv: private data of @fn
+ *
+ * Return 0 after rpc_shutdown(), otherwise the error of @fn.
+ */
+extern int rpc_serve(struct rpc_chan *ch, rpc_handler_t fn, void *priv);
+
+#endif
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include "rpc.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 共享内存rpc的往返延迟测试
+ *
+ * fork出一个服务端进程，客户端和服务端通过一块匿名共享内存里的两个记录型kfifo通信，
+ * 服务端把请求原样发回，客户端测每次rpc_call的往返时间，最后输出p50、p99、p99.9和最大值
+ *
+ * 用法：./rpc_bench [调用次数] [负载字节数] [客户端cpu] [服务端cpu]
+ * cpu为-1表示不绑定，同一个cpu上两端只能靠futex唤醒对方，延迟会大很多
+ */
+
+static int nr_calls = 100000;
+static int payload = 64;
+static int client_cpu = 0;
+static int server_cpu = 1;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (cpu < 0 || nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static int echo(void *priv, const void *req, unsigned int len, void *resp, unsigned int resp_max)
+{
+    memcpy(resp, req, len);
+    return len;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char const *argv[])
+{
+    struct rpc_chan ch;
+    pid_t pid;
+    int ret;
+
+    if (argc > 1)
+        nr_calls = atoi(argv[1]);
+    if (argc > 2)
+        payload = atoi(argv[2]);
+    if (argc > 3)
+        client_cpu = atoi(argv[3]);
+    if (argc > 4)
+        server_cpu = atoi(argv[4]);
+    if (nr_calls <= 0 || payload < 0)
+    {
+        printf("usage: %s [calls] [payload bytes] [client cpu] [server cpu]\r\n", argv[0]);
+        exit(1);
+    }
+
+    ret = rpc_create(&ch, NULL, 64 * 1024, RPC_CLIENT);
+    if (ret)
+    {
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+        exit(1);
+    }
+    if ((unsigned int)payload > ch.max_msg)
+    {
+        printf("payload is limited to %u bytes\r\n", ch.max_msg);
+        exit(1);
+    }
+
+    /* 子进程会继承stdio里还没输出的内容 */
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (!pid)
+    {
+        /* 子进程继承了同一块共享内存，换到服务端那一边 */
+        rpc_set_role(&ch, RPC_SERVER);
+        bench_pin(server_cpu);
+        ret = rpc_serve(&ch, echo, NULL);
+        rpc_close(&ch);
+        exit(ret ? 1 : 0);
+    }
+
+    bench_pin(client_cpu);
+    unsigned long long *lat = malloc(nr_calls * sizeof(*lat));
+    char *req = malloc(payload + 1);
+    char *resp = malloc(payload + 1);
+    memset(req, 'x', payload);
+
+    /* 先热身，让两端都进入稳定状态 */
+    int done = 0, failed = 0;
+    for (int i = 0; i < nr_calls / 10 && !failed; i++)
+    {
+        ret = rpc_call(&ch, req, payload, resp, payload);
+        if (ret != payload)
+        {
+            printf("warmup call %d: %d\r\n", i, ret);
+            failed = 1;
+        }
+    }
+
+    unsigned long long start = now_ns();
+    for (; done < nr_calls && !failed; done++)
+    {
+        unsigned long long t = now_ns();
+
+        ret = rpc_call(&ch, req, payload, resp, payload);
+        if (ret != payload)
+        {
+            printf("call %d: %d\r\n", done, ret);
+            failed = 1;
+            break;
+        }
+        lat[done] = now_ns() - t;
+    }
+    unsigned long long ns = now_ns() - start;
+
+    rpc_shutdown(&ch);
+    waitpid(pid, NULL, 0);
+
+    /* 出错时只统计出错前完成的调用 */
+    printf("%d of %d calls, %d bytes, client cpu %d, server cpu %d\r\n", done, nr_calls, payload, client_cpu,
+           server_cpu);
+    if (done)
+    {
+        qsort(lat, done, sizeof(*lat), cmp_ull);
+        printf("round trip ns: avg %llu p50 %llu p99 %llu p99.9 %llu max %llu\r\n",
+               ns / done, lat[done / 2], lat[done * 99 / 100],
+               lat[done * 999 / 1000], lat[done - 1]);
+    }
+
+    free(lat);
+    free(req);
+    free(resp);
+    rpc_close(&ch);
+    exit(failed);
+}
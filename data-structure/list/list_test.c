@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include <list.h>
+#include <rculist.h>
 
 #define PRINT_FROM_NODE(node)                        \
     do                                               \
@@ -16,8 +17,7 @@
 /*
  * 内核里的list数据结构为双向循环列表
  * 反常识的是，它不是把数据结构塞入链表，而是把链表塞入数据结构
- * rcu功能依赖linux内核，移植到用户空间是个大工程，所以这里没有保留rcu，不要用链表的rcu功能
- * 如果要在用户空间用rcu，看这个https://liburcu.org/
+ * 链表的rcu功能在rculist.h里，rcu本身在synchronization/locking/rcupdate.h
  */
 
 /* 要用内核中的list数据结构，自定义的节点必须包含list_head成员，如下 */
@@ -29,6 +29,22 @@ struct my_node
     struct list_head head;
 };
 
+/* 用rcu链表的节点，删掉的节点要等宽限期过了才能回收，回收时用到rcu_head */
+struct rcu_node
+{
+    const char *data;
+    struct list_head head;
+    struct hlist_node hnode;
+    struct rcu_head rcu;
+};
+
+/* call_rcu的回调，宽限期过后在rcu的后台线程里执行 */
+static void rcu_node_reclaim(struct rcu_head *rcu)
+{
+    struct rcu_node *n = container_of(rcu, struct rcu_node, rcu);
+    printf("reclaim %s\t%d\r\n", n->data, __LINE__);
+}
+
 int main(void)
 {
     /*
@@ -280,5 +296,63 @@ int main(void)
     PRINT_FROM_NODE(node2);
     PRINT_FROM_NODE(node1);
 
+    /*
+     * 9.
+     * rcu链表
+     * 读者在rcu_read_lock和rcu_read_unlock之间用带rcu字样的宏遍历，不加锁，可以和写者同时进行；
+     * 写者之间要自己加锁互斥，删掉的节点可能还有读者在用，要等一个宽限期后才能回收
+     */
+    LIST_HEAD(rcu_list);
+    struct rcu_node rnode[3] = {{.data = "rnode0"}, {.data = "rnode1"}, {.data = "rnode2"}};
+    struct rcu_node *rn;
+    for (int i = 0; i < 3; i++)
+        list_add_tail_rcu(&rnode[i].head, &rcu_list);
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(rn, &rcu_list, head)
+    {
+        printf(" > %s", rn->data);
+    }
+    rcu_read_unlock();
+    printf("\t%d\r\n", __LINE__);
+
+    /* 删除rnode1，synchronize_rcu返回后已经没有读者能看到它，可以回收了 */
+    list_del_rcu(&rnode[1].head);
+    synchronize_rcu();
+
+    /* 用新节点替换rnode2，读者看到的要么是旧的要么是新的；旧节点交给call_rcu在宽限期后回收，写者不用等 */
+    struct rcu_node *new_rn = malloc(sizeof(*new_rn));
+    new_rn->data = "rnode3";
+    list_replace_rcu(&rnode[2].head, &new_rn->head);
+    call_rcu(&rnode[2].rcu, rcu_node_reclaim);
+    /* 等前面所有call_rcu的回调执行完 */
+    rcu_barrier();
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(rn, &rcu_list, head)
+    {
+        printf(" > %s", rn->data);
+    }
+    rcu_read_unlock();
+    printf("\t%d\r\n", __LINE__);
+
+    /* hlist也一样，常用在读多写少的哈希表里 */
+    HLIST_HEAD(rcu_hash);
+    hlist_add_head_rcu(&rnode[0].hnode, &rcu_hash);
+    hlist_add_behind_rcu(&new_rn->hnode, &rnode[0].hnode);
+    hlist_del_rcu(&rnode[0].hnode);
+    rcu_read_lock();
+    hlist_for_each_entry_rcu(rn, &rcu_hash, hnode)
+    {
+        printf(" > %s", rn->data);
+    }
+    rcu_read_unlock();
+    printf("\t%d\r\n", __LINE__);
+
+    list_del_rcu(&new_rn->head);
+    hlist_del_rcu(&new_rn->hnode);
+    synchronize_rcu();
+    free(new_rn);
+
     exit(0);
 }
\ No newline at end of file
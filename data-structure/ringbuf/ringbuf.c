@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * A multi producer/single consumer ring buffer for variable length records,
+ * see ringbuf.h
+ */
+
+#include "ringbuf.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline struct ringbuf_hdr *ringbuf_hdr_at(struct ringbuf *rb,
+		unsigned long pos)
+{
+	return rb->data + (pos & rb->mask);
+}
+
+/* bytes a record takes in the buffer, headers keep 8 byte alignment */
+static inline unsigned int ringbuf_rec_size(unsigned int len)
+{
+	return RINGBUF_HDR_SZ + ((len + 7) & ~7U);
+}
+
+int ringbuf_init(struct ringbuf *rb, unsigned int size)
+{
+	memset(rb, 0, sizeof(*rb));
+
+	if (size < RINGBUF_MIN_SIZE || (size & (size - 1)))
+		return -EINVAL;
+
+	/* free space must read as 0, see struct ringbuf_hdr */
+	rb->data = aligned_alloc(64, size);
+	if (!rb->data)
+		return -ENOMEM;
+	memset(rb->data, 0, size);
+	rb->mask = size - 1;
+	return 0;
+}
+
+void ringbuf_free(struct ringbuf *rb)
+{
+	free(rb->data);
+	rb->data = NULL;
+	rb->mask = 0;
+}
+
+void *ringbuf_reserve(struct ringbuf *rb, unsigned int len)
+{
+	unsigned int size = ringbuf_size(rb);
+	unsigned int rec = ringbuf_rec_size(len);
+	unsigned long pos, cons, need, off;
+	struct ringbuf_hdr *hdr;
+
+	if (len > ringbuf_max_record(rb))
+		return NULL;
+
+	pos = __atomic_load_n(&rb->producer_pos, __ATOMIC_RELAXED);
+	do {
+		/* pairs with the release in ringbuf_consume(), the space is zeroed */
+		cons = __atomic_load_n(&rb->consumer_pos, __ATOMIC_ACQUIRE);
+		off = pos & rb->mask;
+		need = rec;
+		if (off + rec > size)
+			need += size - off;
+		if (pos + need - cons > size)
+			return NULL;
+	} while (!__atomic_compare_exchange_n(&rb->producer_pos, &pos,
+			pos + need, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	/*
+	 * [pos, pos + need) is ours now. Nobody else writes its headers and
+	 * the consumer waits until their flags become non zero.
+	 */
+	if (need != rec) {
+		hdr = ringbuf_hdr_at(rb, pos);
+		hdr->len = size - off - RINGBUF_HDR_SZ;
+		__atomic_store_n(&hdr->flags, RINGBUF_PAD_BIT, __ATOMIC_RELEASE);
+		pos += size - off;
+	}
+
+	hdr = ringbuf_hdr_at(rb, pos);
+	hdr->len = len;
+	return hdr + 1;
+}
+
+void ringbuf_commit(struct ringbuf *rb, void *rec)
+{
+	struct ringbuf_hdr *hdr = (struct ringbuf_hdr *)rec - 1;
+
+	/* the record must be visible before the consumer sees the flag */
+	__atomic_store_n(&hdr->flags, RINGBUF_COMMIT_BIT, __ATOMIC_RELEASE);
+}
+
+void ringbuf_discard(struct ringbuf *rb, void *rec)
+{
+	struct ringbuf_hdr *hdr = (struct ringbuf_hdr *)rec - 1;
+
+	__atomic_store_n(&hdr->flags, RINGBUF_DISCARD_BIT, __ATOMIC_RELEASE);
+}
+
+int ringbuf_output(struct ringbuf *rb, const void *buf, unsigned int len)
+{
+	void *rec;
+
+	if (len > ringbuf_max_record(rb))
+		return -EMSGSIZE;
+
+	rec = ringbuf_reserve(rb, len);
+	if (!rec)
+		return -ENOSPC;
+	memcpy(rec, buf, len);
+	ringbuf_commit(rb, rec);
+	return 0;
+}
+
+/*
+ * ringbuf_next internal helper to find the committed record at *pos,
+ * padding and discarded records are zeroed and skipped on the way
+ */
+static struct ringbuf_hdr *ringbuf_next(struct ringbuf *rb, unsigned long *pos)
+{
+	struct ringbuf_hdr *hdr;
+	unsigned int rec;
+	uint32_t flags;
+
+	for (;;) {
+		hdr = ringbuf_hdr_at(rb, *pos);
+		flags = __atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE);
+		if (!flags)
+			return NULL;
+		if (flags & RINGBUF_COMMIT_BIT)
+			return hdr;
+
+		/* nothing but the header of the padding was written */
+		rec = ringbuf_rec_size(hdr->len);
+		memset(hdr, 0, flags & RINGBUF_PAD_BIT ? RINGBUF_HDR_SZ : rec);
+		*pos += rec;
+	}
+}
+
+/* ringbuf_release internal helper to zero a record read by the consumer */
+static inline void ringbuf_release(struct ringbuf_hdr *hdr, unsigned long *pos)
+{
+	unsigned int rec = ringbuf_rec_size(hdr->len);
+
+	memset(hdr, 0, rec);
+	*pos += rec;
+}
+
+void *ringbuf_peek(struct ringbuf *rb, unsigned int *len)
+{
+	unsigned long pos = rb->consumer_pos;
+	struct ringbuf_hdr *hdr = ringbuf_next(rb, &pos);
+
+	/* give back what was skipped */
+	if (pos != rb->consumer_pos)
+		__atomic_store_n(&rb->consumer_pos, pos, __ATOMIC_RELEASE);
+	if (!hdr)
+		return NULL;
+	*len = hdr->len;
+	return hdr + 1;
+}
+
+void ringbuf_consume(struct ringbuf *rb)
+{
+	unsigned long pos = rb->consumer_pos;
+
+	ringbuf_release(ringbuf_hdr_at(rb, pos), &pos);
+	/* pairs with the acquire in ringbuf_reserve() */
+	__atomic_store_n(&rb->consumer_pos, pos, __ATOMIC_RELEASE);
+}
+
+int ringbuf_read(struct ringbuf *rb, void *buf, unsigned int len)
+{
+	unsigned int n;
+	void *rec;
+
+	rec = ringbuf_peek(rb, &n);
+	if (!rec)
+		return 0;
+	if (n > len)
+		return -EMSGSIZE;
+	memcpy(buf, rec, n);
+	ringbuf_consume(rb);
+	return n;
+}
+
+long ringbuf_drain(struct ringbuf *rb, ringbuf_drain_fn_t fn, void *priv)
+{
+	unsigned long pos = rb->consumer_pos;
+	struct ringbuf_hdr *hdr;
+	long count = 0;
+	int ret = 0;
+
+	while ((hdr = ringbuf_next(rb, &pos))) {
+		ret = fn(priv, hdr + 1, hdr->len);
+		if (ret < 0)
+			break;
+		ringbuf_release(hdr, &pos);
+		count++;
+	}
+
+	if (pos != rb->consumer_pos)
+		__atomic_store_n(&rb->consumer_pos, pos, __ATOMIC_RELEASE);
+	return ret < 0 ? ret : count;
+}
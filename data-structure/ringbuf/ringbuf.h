@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * A multi producer/single consumer ring buffer for variable length records,
+ * modelled on the bpf ringbuf of kernel/bpf/ringbuf.c
+ *
+ * Producers reserve space with one compare-and-swap on the producer
+ * position, fill their records in parallel and commit them in any order.
+ * The consumer reads the committed records in reservation order and stops
+ * at the first one still being written.
+ */
+
+#ifndef _LINUX_RINGBUF_H
+#define _LINUX_RINGBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* the state of a record lives in its header */
+#define RINGBUF_COMMIT_BIT	(1U << 0)
+#define RINGBUF_DISCARD_BIT	(1U << 1)
+/* fills the end of the buffer when a record does not fit before it */
+#define RINGBUF_PAD_BIT		(1U << 2)
+
+/* smallest buffer ringbuf_init() accepts */
+#define RINGBUF_MIN_SIZE	64
+
+/*
+ * 8 byte header in front of every record. flags is 0 while the record is
+ * reserved but not committed, the consumer zeroes what it has read so the
+ * free space always reads as 0.
+ */
+struct ringbuf_hdr {
+	uint32_t	len;
+	uint32_t	flags;
+};
+
+#define RINGBUF_HDR_SZ		sizeof(struct ringbuf_hdr)
+
+struct ringbuf {
+	/* written by the consumer only */
+	unsigned long	consumer_pos __attribute__((aligned(64)));
+	/* advanced by the producers */
+	unsigned long	producer_pos __attribute__((aligned(64)));
+	unsigned long	mask __attribute__((aligned(64)));
+	void		*data;
+};
+
+/**
+ * ringbuf_drain_fn_t - record handler of ringbuf_drain()
+ * @priv: private data passed to ringbuf_drain()
+ * @rec: the record, valid until the handler returns
+ * @len: length of @rec in bytes
+ *
+ * Return 0 to go on, a negative value stops ringbuf_drain().
+ */
+typedef int (*ringbuf_drain_fn_t)(void *priv, void *rec, unsigned int len);
+
+/**
+ * ringbuf_init - allocate a ring buffer
+ * @rb: the ring buffer
+ * @size: size of the data area in bytes, a power of 2
+ *
+ * Return 0 if no error, otherwise an error code.
+ */
+extern int ringbuf_init(struct ringbuf *rb, unsigned int size);
+
+/**
+ * ringbuf_free - free a ring buffer
+ * @rb: the ring buffer
+ */
+extern void ringbuf_free(struct ringbuf *rb);
+
+/**
+ * ringbuf_size - returns the size of the data area in bytes
+ * @rb: the ring buffer
+ */
+static inline unsigned int ringbuf_size(struct ringbuf *rb)
+{
+	return rb->mask + 1;
+}
+
+/**
+ * ringbuf_max_record - returns the longest record that can be reserved
+ * @rb: the ring buffer
+ *
+ * Records never wrap, so one that does not fit before the end of the buffer
+ * is placed at its start and the rest is padded. Limiting records to half
+ * of the buffer makes sure every one of them fits in an empty buffer.
+ */
+static inline unsigned int ringbuf_max_record(struct ringbuf *rb)
+{
+	return ringbuf_size(rb) / 2 - RINGBUF_HDR_SZ;
+}
+
+/**
+ * ringbuf_len - returns the number of bytes reserved and not consumed
+ * @rb: the ring buffer
+ *
+ * Headers and padding are counted. The value is only a snapshot while
+ * producers are running.
+ */
+static inline unsigned long ringbuf_len(struct ringbuf *rb)
+{
+	return __atomic_load_n(&rb->producer_pos, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&rb->consumer_pos, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * ringbuf_reserve - reserve room for a record
+ * @rb: the ring buffer
+ * @len: length of the record in bytes
+ *
+ * Safe to call from any number of threads. The returned memory is 8 byte
+ * aligned and belongs to the caller until it passes it to ringbuf_commit()
+ * or ringbuf_discard(). The consumer will not get past an uncommitted
+ * record, so commit soon.
+ * Return the record, or NULL if the buffer is full or @len is larger than
+ * ringbuf_max_record().
+ */
+extern void *ringbuf_reserve(struct ringbuf *rb, unsigned int len);
+
+/**
+ * ringbuf_commit - hand a reserved record to the consumer
+ * @rb: the ring buffer
+ * @rec: record returned by ringbuf_reserve()
+ */
+extern void ringbuf_commit(struct ringbuf *rb, void *rec);
+
+/**
+ * ringbuf_discard - drop a reserved record
+ * @rb: the ring buffer
+ * @rec: record returned by ringbuf_reserve()
+ *
+ * The consumer skips the record, its space is freed in order.
+ */
+extern void ringbuf_discard(struct ringbuf *rb, void *rec);
+
+/**
+ * ringbuf_output - copy a record into the ring buffer
+ * @rb: the ring buffer
+ * @buf: the data
+ * @len: length of @buf in bytes
+ *
+ * ringbuf_reserve(), memcpy() and ringbuf_commit() in one go.
+ * Return 0 if no error, -EMSGSIZE if @len is larger than
+ * ringbuf_max_record(), -ENOSPC if the buffer is full.
+ */
+extern int ringbuf_output(struct ringbuf *rb, const void *buf,
+		unsigned int len);
+
+/**
+ * ringbuf_peek - get the next committed record without removing it
+ * @rb: the ring buffer
+ * @len: set to the length of the record
+ *
+ * Only one thread may consume. Discarded records are skipped.
+ * Return the record, or NULL if the buffer is empty or the next record is
+ * not committed yet. The record stays valid until ringbuf_consume().
+ */
+extern void *ringbuf_peek(struct ringbuf *rb, unsigned int *len);
+
+/**
+ * ringbuf_consume - remove the record returned by ringbuf_peek()
+ * @rb: the ring buffer
+ */
+extern void ringbuf_consume(struct ringbuf *rb);
+
+/**
+ * ringbuf_read - copy out and remove the next committed record
+ * @rb: the ring buffer
+ * @buf: where to store the record
+ * @len: size of @buf in bytes
+ *
+ * Return the length of the record, 0 if there is none, -EMSGSIZE if it is
+ * longer than @len, it stays in the buffer then.
+ */
+extern int ringbuf_read(struct ringbuf *rb, void *buf, unsigned int len);
+
+/**
+ * ringbuf_drain - pass all committed records to a handler
+ * @rb: the ring buffer
+ * @fn: the handler, called with each record in reservation order
+ * @priv: private data of @fn
+ *
+ * The space of the records is given back to the producers once at the end,
+ * which saves a store to a shared cache line per record. The record @fn
+ * fails on stays in the buffer.
+ * Return the number of records handled, or the negative value of @fn.
+ */
+extern long ringbuf_drain(struct ringbuf *rb, ringbuf_drain_fn_t fn,
+		void *priv);
+
+#endif
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "kfifo.h"
+#include "ringbuf.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 多个生产者写不定长记录的吞吐量测试
+ *
+ * 多个生产者写，一个消费者读，跑固定的时间后统计消费者读到的记录数和字节数，以及生产者遇到缓冲区满的次数
+ *   ringbuf  生产者用cas预留空间，拷贝的时候不持有任何锁
+ *   其它     记录型kfifo，生产者用kfifo_in_spinlocked写，整个拷贝都在锁里，消费者只有一个，读不用加锁
+ *
+ * 用法：./ringbuf_bench [每种实现的运行毫秒数] [生产者个数] [最长记录字节数]
+ */
+
+#define BENCH_SIZE (1 << 16)
+#define BENCH_MAX_THREADS 64
+
+struct bench_thread
+{
+    pthread_t tid;
+    int cpu;
+    unsigned long long records;
+    unsigned long long bytes;
+    unsigned long long fulls;
+} __attribute__((aligned(64)));
+
+static struct ringbuf bench_rb;
+static STRUCT_KFIFO_REC_2(BENCH_SIZE) bench_fifo;
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+static volatile int bench_stop;
+static int bench_ms = 500;
+static int nr_producers = 3;
+static unsigned int max_len = 256;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 线程按顺序绑定到各个cpu上，cpu不够就轮着来 */
+static void bench_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* 记录的长度在16到max_len之间变化，和日志差不多 */
+static inline unsigned int bench_len(unsigned long long i)
+{
+    return 16 + (i * 37) % (max_len - 15);
+}
+
+static void bench_run(const char *name, void *(*producer)(void *), void *(*consumer)(void *))
+{
+    unsigned long long start, ns, fulls = 0;
+    struct bench_thread *c = &bench_threads[nr_producers];
+    int i;
+
+    bench_stop = 0;
+    memset(bench_threads, 0, sizeof(bench_threads));
+
+    start = now_ns();
+    for (i = 0; i <= nr_producers; i++)
+    {
+        bench_threads[i].cpu = i;
+        pthread_create(&bench_threads[i].tid, NULL, i < nr_producers ? producer : consumer, &bench_threads[i]);
+    }
+
+    usleep(bench_ms * 1000);
+    bench_stop = 1;
+    for (i = 0; i <= nr_producers; i++)
+        pthread_join(bench_threads[i].tid, NULL);
+    ns = now_ns() - start;
+
+    for (i = 0; i < nr_producers; i++)
+        fulls += bench_threads[i].fulls;
+
+    /* 吞吐量按消费者读到的记录算 */
+    printf("%-8s %8.2f Mrec/s %8.1f MB/s, producers found it full %llu times\r\n",
+           name, (double)c->records * 1000 / ns, (double)c->bytes * 1000 / ns, fulls);
+}
+
+static void *ringbuf_producer(void *arg)
+{
+    struct bench_thread *t = arg;
+    char buf[max_len];
+    void *rec;
+
+    memset(buf, 'x', max_len);
+    bench_pin(t->cpu);
+    while (!bench_stop)
+    {
+        unsigned int len = bench_len(t->records);
+
+        rec = ringbuf_reserve(&bench_rb, len);
+        if (!rec)
+        {
+            t->fulls++;
+            sched_yield();
+            continue;
+        }
+        memcpy(rec, buf, len);
+        ringbuf_commit(&bench_rb, rec);
+        t->records++;
+    }
+    return NULL;
+}
+
+static int ringbuf_count(void *priv, void *rec, unsigned int len)
+{
+    struct bench_thread *t = priv;
+
+    t->records++;
+    t->bytes += len;
+    return 0;
+}
+
+static void *ringbuf_consumer(void *arg)
+{
+    struct bench_thread *t = arg;
+
+    bench_pin(t->cpu);
+    while (!bench_stop)
+        if (!ringbuf_drain(&bench_rb, ringbuf_count, t))
+            sched_yield();
+    return NULL;
+}
+
+static void bench_ringbuf(void)
+{
+    ringbuf_init(&bench_rb, BENCH_SIZE);
+    bench_run("ringbuf", ringbuf_producer, ringbuf_consumer);
+    ringbuf_free(&bench_rb);
+}
+
+static void *kfifo_consumer(void *arg)
+{
+    struct bench_thread *t = arg;
+    char buf[max_len];
+    unsigned int len;
+
+    bench_pin(t->cpu);
+    while (!bench_stop)
+    {
+        len = kfifo_out(&bench_fifo, buf, max_len);
+        if (!len)
+        {
+            sched_yield();
+            continue;
+        }
+        t->records++;
+        t->bytes += len;
+    }
+    return NULL;
+}
+
+/* 每种锁生成一个生产者线程函数，spin_lock会根据锁的类型选择实现 */
+#define DEFINE_KFIFO_BENCH(name, type)                                                \
+    static type name##_l;                                                             \
+                                                                                      \
+    static void *name##_producer(void *arg)                                           \
+    {                                                                                 \
+        struct bench_thread *t = arg;                                                 \
+        char buf[max_len];                                                            \
+                                                                                      \
+        memset(buf, 'x', max_len);                                                    \
+        bench_pin(t->cpu);                                                            \
+        while (!bench_stop)                                                           \
+        {                                                                             \
+            if (!kfifo_in_spinlocked(&bench_fifo, buf, bench_len(t->records), &name##_l)) \
+            {                                                                         \
+                t->fulls++;                                                           \
+                sched_yield();                                                        \
+                continue;                                                             \
+            }                                                                         \
+            t->records++;                                                             \
+        }                                                                             \
+        return NULL;                                                                  \
+    }                                                                                 \
+                                                                                      \
+    static void bench_##name(void)                                                    \
+    {                                                                                 \
+        INIT_KFIFO(bench_fifo);                                                       \
+        spin_lock_init(&name##_l);                                                    \
+        bench_run(#name, name##_producer, kfifo_consumer);                            \
+    }
+
+DEFINE_KFIFO_BENCH(pthread, pthread_spinlock_t)
+DEFINE_KFIFO_BENCH(ticket, struct ticket_spinlock)
+DEFINE_KFIFO_BENCH(mcs, struct mcs_lock)
+DEFINE_KFIFO_BENCH(clh, struct clh_lock)
+DEFINE_KFIFO_BENCH(queued, struct qspinlock)
+DEFINE_KFIFO_BENCH(futex, struct futex_mutex)
+
+int main(int argc, char const *argv[])
+{
+    if (argc > 1)
+        bench_ms = atoi(argv[1]);
+    if (argc > 2)
+        nr_producers = atoi(argv[2]);
+    if (argc > 3)
+        max_len = atoi(argv[3]);
+    if (bench_ms <= 0 || nr_producers <= 0 || nr_producers >= BENCH_MAX_THREADS ||
+        max_len < 16 || max_len > 4096)
+    {
+        printf("usage: %s [ms] [producers] [max record bytes, 16-4096]\r\n", argv[0]);
+        exit(1);
+    }
+
+    printf("%d producers, 1 consumer, records of 16-%u bytes, %d ms each\r\n",
+           nr_producers, max_len, bench_ms);
+    bench_ringbuf();
+    bench_pthread();
+    bench_ticket();
+    bench_mcs();
+    bench_clh();
+    bench_queued();
+    bench_futex();
+    exit(0);
+}
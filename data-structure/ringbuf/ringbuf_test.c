@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuf.h"
+
+/*
+ * 多生产者单消费者的不定长记录环形缓冲区，仿照内核kernel/bpf/ringbuf.c
+ * 生产者先用一次cas预留空间，各自往里写，写完提交，提交的顺序随意
+ * 消费者按预留的顺序读，遇到还没提交的记录就停下
+ */
+
+#define NR_PRODUCERS 4
+#define NR_RECORDS 100000
+
+/* 多线程测试里的记录，payload的内容由线程号和序号决定，用来检查数据有没有被踩 */
+struct my_log
+{
+    int thread;
+    int seq;
+    char payload[];
+};
+
+static struct ringbuf rb;
+
+static void fill(struct my_log *log, int thread, int seq, unsigned int len)
+{
+    log->thread = thread;
+    log->seq = seq;
+    for (unsigned int i = 0; i < len - sizeof(*log); i++)
+        log->payload[i] = (char)(thread + seq + i);
+}
+
+static int check(const struct my_log *log, unsigned int len)
+{
+    for (unsigned int i = 0; i < len - sizeof(*log); i++)
+        if (log->payload[i] != (char)(log->thread + log->seq + i))
+            return -1;
+    return 0;
+}
+
+static void *producer(void *arg)
+{
+    int thread = (long)arg;
+
+    for (int seq = 0; seq < NR_RECORDS; seq++)
+    {
+        /* 长度在8到135字节之间变化 */
+        unsigned int len = sizeof(struct my_log) + (seq * 7 + thread) % 128;
+        struct my_log *log;
+
+        /* 满了就等消费者 */
+        while (!(log = ringbuf_reserve(&rb, len)))
+            sched_yield();
+        fill(log, thread, seq, len);
+        ringbuf_commit(&rb, log);
+    }
+    return NULL;
+}
+
+struct my_check
+{
+    int next[NR_PRODUCERS];
+    long errors;
+};
+
+static int check_one(void *priv, void *rec, unsigned int len)
+{
+    struct my_check *c = priv;
+    struct my_log *log = rec;
+
+    /* 同一个线程的记录要按顺序出来，内容不能错 */
+    if (log->seq != c->next[log->thread]++ || check(log, len))
+        c->errors++;
+    return 0;
+}
+
+static void test_mpsc(void)
+{
+    pthread_t threads[NR_PRODUCERS];
+    struct my_check c = {0};
+    long total = 0;
+
+    ringbuf_init(&rb, 4096);
+    for (long i = 0; i < NR_PRODUCERS; i++)
+        pthread_create(&threads[i], NULL, producer, (void *)i);
+
+    /* 消费者一次把提交了的记录都读出来，读完才把空间还给生产者 */
+    while (total < (long)NR_PRODUCERS * NR_RECORDS)
+    {
+        long n = ringbuf_drain(&rb, check_one, &c);
+
+        if (!n)
+            sched_yield();
+        total += n;
+    }
+
+    for (int i = 0; i < NR_PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+    printf("%d producers, %ld records, %ld errors, %lu bytes left\r\n",
+           NR_PRODUCERS, total, c.errors, ringbuf_len(&rb));
+    ringbuf_free(&rb);
+}
+
+static int print_one(void *priv, void *rec, unsigned int len)
+{
+    printf("%.*s ", len, (char *)rec);
+    return 0;
+}
+
+int main(void)
+{
+    char buf[64];
+    unsigned int len;
+    char *a, *b, *c;
+    int ret;
+
+    printf("=====basic======\r\n");
+    /* 大小必须是2的幂，最小64字节 */
+    ret = ringbuf_init(&rb, 256);
+    if (ret)
+    {
+        printf("%s, %d\r\n", strerror(-ret), __LINE__);
+        exit(1);
+    }
+    printf("size %u, max record %u\r\n", ringbuf_size(&rb), ringbuf_max_record(&rb));
+
+    /* 预留三条记录，后预留的先提交，消费者还是按预留的顺序读 */
+    a = ringbuf_reserve(&rb, 5);
+    b = ringbuf_reserve(&rb, 3);
+    c = ringbuf_reserve(&rb, 7);
+    memcpy(c, "charlie", 7);
+    ringbuf_commit(&rb, c);
+    memcpy(b, "bob", 3);
+    ringbuf_commit(&rb, b);
+    /* a还没提交，消费者读不到任何东西 */
+    printf("a not committed, peek %p, len %lu\r\n", ringbuf_peek(&rb, &len), ringbuf_len(&rb));
+
+    /* 丢弃a，消费者会跳过它 */
+    ringbuf_discard(&rb, a);
+    a = ringbuf_peek(&rb, &len);
+    printf("peek %.*s\r\n", len, a);
+    ringbuf_consume(&rb);
+    ret = ringbuf_read(&rb, buf, sizeof(buf));
+    printf("read %.*s\r\n", ret, buf);
+
+    /* 超过max record的记录放不进去 */
+    printf("output 200 bytes: %d\r\n", ringbuf_output(&rb, buf, 200));
+
+    printf("=====wrap======\r\n");
+    /* 记录不会跨过缓冲区的末尾，放不下就从头开始放，末尾补一条填充记录 */
+    for (int i = 0; i < 20; i++)
+    {
+        int n = snprintf(buf, sizeof(buf), "record%d", i);
+
+        ret = ringbuf_output(&rb, buf, n);
+        if (ret == -ENOSPC)
+        {
+            /* 满了就先读出来 */
+            ringbuf_drain(&rb, print_one, NULL);
+            ret = ringbuf_output(&rb, buf, n);
+        }
+    }
+    ringbuf_drain(&rb, print_one, NULL);
+    printf("\r\nlen %lu\r\n", ringbuf_len(&rb));
+    ringbuf_free(&rb);
+
+    printf("=====mpsc======\r\n");
+    test_mpsc();
+    exit(0);
+}
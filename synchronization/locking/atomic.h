@@ -0,0 +1,336 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Atomic integers, following include/linux/atomic/atomic-instrumented.h
+ * and include/linux/atomic/atomic-arch-fallback.h
+ *
+ * See synchronization/1-原子操作.md. atomic_t wraps an int, atomic64_t a
+ * long long and atomic_long_t a long, and all three have the same
+ * operations as in the kernel:
+ *
+ *   read set read_acquire set_release
+ *   add sub inc dec and or xor andnot                no ordering
+ *   {add,sub,inc,dec}_return{,_relaxed,_acquire,_release}
+ *   fetch_{add,sub,inc,dec,and,or,xor,andnot}{,_relaxed,_acquire,_release}
+ *   xchg cmpxchg try_cmpxchg{,_relaxed,_acquire,_release}
+ *   sub_and_test dec_and_test inc_and_test add_negative
+ *   fetch_add_unless add_unless inc_not_zero inc_unless_negative
+ *   dec_unless_positive dec_if_positive             fully ordered
+ *
+ * The operations that return a value and have no suffix are fully
+ * ordered, as if smp_mb() came before and after them. A failed cmpxchg or
+ * try_cmpxchg orders nothing beyond its _acquire load.
+ *
+ * Everything is built on the gcc __atomic builtins, which pick the single
+ * instruction the kernel's arch code uses: lock add/inc/and/or/xor when the
+ * result is unused, lock xadd for add_return and fetch_add, lock cmpxchg
+ * for cmpxchg, and a flag test after lock sub/add for dec_and_test and
+ * add_negative; ldadd, ldclr, ldset, ldeor, swp and cas on arm64 with LSE.
+ * Only fetch_{and,or,xor,andnot} on x86 need a cmpxchg loop, as in the
+ * kernel. A locked instruction on x86 and an LSE instruction with both
+ * acquire and release semantics on arm64 are full barriers; elsewhere the
+ * fully ordered operations are the relaxed ones between
+ * smp_mb__before_atomic() and smp_mb__after_atomic().
+ *
+ * Arithmetic wraps on overflow like in the kernel.
+ */
+#ifndef _LOCKING_ATOMIC_H
+#define _LOCKING_ATOMIC_H
+
+#include <stdbool.h>
+#include "barrier.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+typedef struct {
+	long long counter;
+} atomic64_t;
+
+typedef struct {
+	long counter;
+} atomic_long_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define ATOMIC64_INIT(i)	{ (i) }
+#define ATOMIC_LONG_INIT(i)	{ (i) }
+
+#if defined(__x86_64__) || defined(__i386__) ||				\
+	(defined(__aarch64__) && defined(__ARM_FEATURE_ATOMICS))
+#define ATOMIC_FULL_ORDER		__ATOMIC_SEQ_CST
+#define ATOMIC_PRE_FULL_FENCE()	do { } while (0)
+#define ATOMIC_POST_FULL_FENCE()	do { } while (0)
+#else
+#define ATOMIC_FULL_ORDER		__ATOMIC_RELAXED
+#define ATOMIC_PRE_FULL_FENCE()	smp_mb__before_atomic()
+#define ATOMIC_POST_FULL_FENCE()	smp_mb__after_atomic()
+#endif
+
+#define ATOMIC_NO_FENCE()		do { } while (0)
+
+/*
+ * gen(suffix, order, order of a failed cmpxchg, fence before, fence after,
+ * ...) once for each ordering variant of an operation
+ */
+#define ATOMIC_VARIANTS(gen, ...)					\
+	gen(_relaxed, __ATOMIC_RELAXED, __ATOMIC_RELAXED,		\
+	    ATOMIC_NO_FENCE, ATOMIC_NO_FENCE, __VA_ARGS__)		\
+	gen(_acquire, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE,		\
+	    ATOMIC_NO_FENCE, ATOMIC_NO_FENCE, __VA_ARGS__)		\
+	gen(_release, __ATOMIC_RELEASE, __ATOMIC_RELAXED,		\
+	    ATOMIC_NO_FENCE, ATOMIC_NO_FENCE, __VA_ARGS__)		\
+	gen(, ATOMIC_FULL_ORDER, ATOMIC_FULL_ORDER,			\
+	    ATOMIC_PRE_FULL_FENCE, ATOMIC_POST_FULL_FENCE, __VA_ARGS__)
+
+/* add, sub, and, or, xor, andnot without a result, no ordering */
+#define ATOMIC_OP(pfx, T, op, fetch_op, arg)				\
+static inline void pfx##_##op(T i, pfx##_t *v)				\
+{									\
+	fetch_op(&v->counter, arg, __ATOMIC_RELAXED);			\
+}
+
+#define ATOMIC_OP_RETURN(sfx, order, fail, pre, post, pfx, T, op, op_fetch) \
+static inline T pfx##_##op##_return##sfx(T i, pfx##_t *v)		\
+{									\
+	T ret;								\
+									\
+	pre();								\
+	ret = op_fetch(&v->counter, i, order);				\
+	post();								\
+	return ret;							\
+}
+
+#define ATOMIC_FETCH_OP(sfx, order, fail, pre, post, pfx, T, op, fetch_op, arg) \
+static inline T pfx##_fetch_##op##sfx(T i, pfx##_t *v)			\
+{									\
+	T ret;								\
+									\
+	pre();								\
+	ret = fetch_op(&v->counter, arg, order);			\
+	post();								\
+	return ret;							\
+}
+
+/* inc and dec in terms of add and sub */
+#define ATOMIC_INC_DEC(sfx, order, fail, pre, post, pfx, T)		\
+static inline T pfx##_inc_return##sfx(pfx##_t *v)			\
+{									\
+	return pfx##_add_return##sfx(1, v);				\
+}									\
+									\
+static inline T pfx##_dec_return##sfx(pfx##_t *v)			\
+{									\
+	return pfx##_sub_return##sfx(1, v);				\
+}									\
+									\
+static inline T pfx##_fetch_inc##sfx(pfx##_t *v)			\
+{									\
+	return pfx##_fetch_add##sfx(1, v);				\
+}									\
+									\
+static inline T pfx##_fetch_dec##sfx(pfx##_t *v)			\
+{									\
+	return pfx##_fetch_sub##sfx(1, v);				\
+}
+
+#define ATOMIC_XCHG(sfx, order, fail, pre, post, pfx, T)		\
+static inline T pfx##_xchg##sfx(pfx##_t *v, T n)			\
+{									\
+	T ret;								\
+									\
+	pre();								\
+	ret = __atomic_exchange_n(&v->counter, n, order);		\
+	post();								\
+	return ret;							\
+}									\
+									\
+static inline T pfx##_cmpxchg##sfx(pfx##_t *v, T old, T n)		\
+{									\
+	pre();								\
+	__atomic_compare_exchange_n(&v->counter, &old, n, false,	\
+				    order, fail);			\
+	post();								\
+	return old;							\
+}									\
+									\
+static inline bool pfx##_try_cmpxchg##sfx(pfx##_t *v, T *old, T n)	\
+{									\
+	bool ret;							\
+									\
+	pre();								\
+	ret = __atomic_compare_exchange_n(&v->counter, old, n, false,	\
+					  order, fail);			\
+	post();								\
+	return ret;							\
+}
+
+/* UT is the unsigned type of T, the additions must wrap */
+#define ATOMIC_OPS(pfx, T, UT)						\
+static inline T pfx##_read(const pfx##_t *v)				\
+{									\
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);		\
+}									\
+									\
+static inline T pfx##_read_acquire(const pfx##_t *v)			\
+{									\
+	return __atomic_load_n(&v->counter, __ATOMIC_ACQUIRE);		\
+}									\
+									\
+static inline void pfx##_set(pfx##_t *v, T i)				\
+{									\
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);		\
+}									\
+									\
+static inline void pfx##_set_release(pfx##_t *v, T i)			\
+{									\
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELEASE);		\
+}									\
+									\
+ATOMIC_OP(pfx, T, add, __atomic_fetch_add, i)				\
+ATOMIC_OP(pfx, T, sub, __atomic_fetch_sub, i)				\
+ATOMIC_OP(pfx, T, and, __atomic_fetch_and, i)				\
+ATOMIC_OP(pfx, T, or, __atomic_fetch_or, i)				\
+ATOMIC_OP(pfx, T, xor, __atomic_fetch_xor, i)				\
+ATOMIC_OP(pfx, T, andnot, __atomic_fetch_and, ~i)			\
+									\
+static inline void pfx##_inc(pfx##_t *v)				\
+{									\
+	pfx##_add(1, v);						\
+}									\
+									\
+static inline void pfx##_dec(pfx##_t *v)				\
+{									\
+	pfx##_sub(1, v);						\
+}									\
+									\
+ATOMIC_VARIANTS(ATOMIC_OP_RETURN, pfx, T, add, __atomic_add_fetch)	\
+ATOMIC_VARIANTS(ATOMIC_OP_RETURN, pfx, T, sub, __atomic_sub_fetch)	\
+ATOMIC_VARIANTS(ATOMIC_FETCH_OP, pfx, T, add, __atomic_fetch_add, i)	\
+ATOMIC_VARIANTS(ATOMIC_FETCH_OP, pfx, T, sub, __atomic_fetch_sub, i)	\
+ATOMIC_VARIANTS(ATOMIC_FETCH_OP, pfx, T, and, __atomic_fetch_and, i)	\
+ATOMIC_VARIANTS(ATOMIC_FETCH_OP, pfx, T, or, __atomic_fetch_or, i)	\
+ATOMIC_VARIANTS(ATOMIC_FETCH_OP, pfx, T, xor, __atomic_fetch_xor, i)	\
+ATOMIC_VARIANTS(ATOMIC_FETCH_OP, pfx, T, andnot, __atomic_fetch_and, ~i) \
+ATOMIC_VARIANTS(ATOMIC_INC_DEC, pfx, T)					\
+ATOMIC_VARIANTS(ATOMIC_XCHG, pfx, T)					\
+									\
+static inline bool pfx##_sub_and_test(T i, pfx##_t *v)			\
+{									\
+	return pfx##_sub_return(i, v) == 0;				\
+}									\
+									\
+static inline bool pfx##_dec_and_test(pfx##_t *v)			\
+{									\
+	return pfx##_dec_return(v) == 0;				\
+}									\
+									\
+static inline bool pfx##_inc_and_test(pfx##_t *v)			\
+{									\
+	return pfx##_inc_return(v) == 0;				\
+}									\
+									\
+static inline bool pfx##_add_negative(T i, pfx##_t *v)			\
+{									\
+	return pfx##_add_return(i, v) < 0;				\
+}									\
+									\
+/* add @a unless the value is @u, return the old value */		\
+static inline T pfx##_fetch_add_unless(pfx##_t *v, T a, T u)		\
+{									\
+	T c = pfx##_read(v);						\
+									\
+	do {								\
+		if (c == u)						\
+			break;						\
+	} while (!pfx##_try_cmpxchg(v, &c, (T)((UT)c + (UT)a)));	\
+									\
+	return c;							\
+}									\
+									\
+static inline bool pfx##_add_unless(pfx##_t *v, T a, T u)		\
+{									\
+	return pfx##_fetch_add_unless(v, a, u) != u;			\
+}									\
+									\
+/* take a reference unless the last one is gone already */		\
+static inline bool pfx##_inc_not_zero(pfx##_t *v)			\
+{									\
+	return pfx##_add_unless(v, 1, 0);				\
+}									\
+									\
+static inline bool pfx##_inc_unless_negative(pfx##_t *v)		\
+{									\
+	T c = pfx##_read(v);						\
+									\
+	do {								\
+		if (c < 0)						\
+			return false;					\
+	} while (!pfx##_try_cmpxchg(v, &c, (T)((UT)c + 1)));		\
+									\
+	return true;							\
+}									\
+									\
+static inline bool pfx##_dec_unless_positive(pfx##_t *v)		\
+{									\
+	T c = pfx##_read(v);						\
+									\
+	do {								\
+		if (c > 0)						\
+			return false;					\
+	} while (!pfx##_try_cmpxchg(v, &c, (T)((UT)c - 1)));		\
+									\
+	return true;							\
+}									\
+									\
+/* decrement if the result stays >= 0, return the result either way */	\
+static inline T pfx##_dec_if_positive(pfx##_t *v)			\
+{									\
+	T dec, c = pfx##_read(v);					\
+									\
+	do {								\
+		dec = (T)((UT)c - 1);					\
+		if (dec < 0)						\
+			break;						\
+	} while (!pfx##_try_cmpxchg(v, &c, dec));			\
+									\
+	return dec;							\
+}
+
+/*
+ * <stdatomic.h> defines five of these names as generic macros, which would
+ * expand the definitions below into garbage. If it came first the kernel
+ * operations take the names over; the C11 ones are still there as
+ * atomic_fetch_{add,sub,and,or,xor}_explicit(). Don't include it after
+ * this header, its macros would break every call of those five.
+ */
+#undef atomic_fetch_add
+#undef atomic_fetch_sub
+#undef atomic_fetch_and
+#undef atomic_fetch_or
+#undef atomic_fetch_xor
+
+ATOMIC_OPS(atomic, int, unsigned int)
+ATOMIC_OPS(atomic64, long long, unsigned long long)
+ATOMIC_OPS(atomic_long, long, unsigned long)
+
+#undef ATOMIC_OPS
+#undef ATOMIC_XCHG
+#undef ATOMIC_INC_DEC
+#undef ATOMIC_FETCH_OP
+#undef ATOMIC_OP_RETURN
+#undef ATOMIC_OP
+#undef ATOMIC_VARIANTS
+#undef ATOMIC_NO_FENCE
+#undef ATOMIC_POST_FULL_FENCE
+#undef ATOMIC_PRE_FULL_FENCE
+#undef ATOMIC_FULL_ORDER
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOCKING_ATOMIC_H */
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Memory barriers, modelled on arch/x86/include/asm/barrier.h,
+ * arch/arm64/include/asm/barrier.h and include/asm-generic/barrier.h
+ *
+ * See synchronization/3-内存屏障.md for what each barrier orders. Every
+ * barrier is also a compiler barrier.
+ *
+ *   barrier()               compiler barrier only
+ *   mb() rmb() wmb()        order accesses to memory shared with devices,
+ *                           including non-temporal stores
+ *   smp_mb()                orders all earlier accesses against all later ones
+ *   smp_rmb()               orders earlier loads against later loads
+ *   smp_wmb()               orders earlier stores against later stores
+ *   smp_load_acquire(p)     load *p, later accesses stay after it
+ *   smp_store_release(p, v) store v to *p, earlier accesses stay before it
+ *   smp_mb__before_atomic()
+ *   smp_mb__after_atomic()  upgrade a relaxed atomic read-modify-write
+ *                           to a full barrier
+ *
+ * An acquire/release pair is cheaper than smp_wmb() on one side plus
+ * smp_rmb() on the other, prefer it for publishing data to another thread.
+ *
+ * x86 is TSO: only a store followed by a load can be reordered, so
+ * smp_rmb(), smp_wmb(), acquire and release only have to stop the compiler,
+ * and smp_mb() is a locked add to the stack, cheaper than mfence. Locked
+ * instructions are full barriers already, smp_mb__{before,after}_atomic()
+ * are compiler barriers.
+ *
+ * arm64 uses dmb ish for smp_mb(), the load and store only forms for
+ * smp_rmb() and smp_wmb(), and ldar/stlr for acquire and release. Its
+ * relaxed atomics order nothing, smp_mb__{before,after}_atomic() are full
+ * barriers.
+ */
+#ifndef _LOCKING_BARRIER_H
+#define _LOCKING_BARRIER_H
+
+#ifndef barrier
+/* The "volatile" is due to gcc bugs */
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define mb()	__asm__ __volatile__("mfence" : : : "memory")
+#define rmb()	__asm__ __volatile__("lfence" : : : "memory")
+#define wmb()	__asm__ __volatile__("sfence" : : : "memory")
+
+#ifdef __x86_64__
+#define __smp_mb()	__asm__ __volatile__("lock; addl $0,-4(%%rsp)" : : : "memory", "cc")
+#else
+#define __smp_mb()	__asm__ __volatile__("lock; addl $0,-4(%%esp)" : : : "memory", "cc")
+#endif
+#define __smp_rmb()	barrier()
+#define __smp_wmb()	barrier()
+
+#define __smp_mb__before_atomic()	barrier()
+#define __smp_mb__after_atomic()	barrier()
+
+#elif defined(__aarch64__)
+
+#define mb()	__asm__ __volatile__("dsb sy" : : : "memory")
+#define rmb()	__asm__ __volatile__("dsb ld" : : : "memory")
+#define wmb()	__asm__ __volatile__("dsb st" : : : "memory")
+
+#define __smp_mb()	__asm__ __volatile__("dmb ish" : : : "memory")
+#define __smp_rmb()	__asm__ __volatile__("dmb ishld" : : : "memory")
+#define __smp_wmb()	__asm__ __volatile__("dmb ishst" : : : "memory")
+
+#elif defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7
+
+#define mb()	__asm__ __volatile__("dsb" : : : "memory")
+#define rmb()	mb()
+#define wmb()	__asm__ __volatile__("dsb st" : : : "memory")
+
+#define __smp_mb()	__asm__ __volatile__("dmb ish" : : : "memory")
+#define __smp_rmb()	__smp_mb()
+#define __smp_wmb()	__asm__ __volatile__("dmb ishst" : : : "memory")
+
+#else
+
+/* let the compiler pick the instructions */
+#define mb()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define rmb()	mb()
+#define wmb()	mb()
+
+#define __smp_mb()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __smp_rmb()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define __smp_wmb()	__atomic_thread_fence(__ATOMIC_RELEASE)
+
+#endif
+
+#ifndef __smp_mb__before_atomic
+#define __smp_mb__before_atomic()	__smp_mb()
+#endif
+#ifndef __smp_mb__after_atomic
+#define __smp_mb__after_atomic()	__smp_mb()
+#endif
+
+#define smp_mb()	__smp_mb()
+#define smp_rmb()	__smp_rmb()
+#define smp_wmb()	__smp_wmb()
+
+#define smp_mb__before_atomic()	__smp_mb__before_atomic()
+#define smp_mb__after_atomic()	__smp_mb__after_atomic()
+
+/*
+ * The compiler emits the cheapest instruction for these on every
+ * architecture: a plain mov on x86, ldar/stlr on arm64, a plain access
+ * plus dmb on 32 bit arm. *p must be a scalar or a pointer.
+ */
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+
+#define smp_store_release(p, v)						\
+do {									\
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);			\
+} while (0)
+
+#endif /* _LOCKING_BARRIER_H */
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Big reader lock, the slow paths and the registry of reader slots
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "brlock.h"
+#include "processor.h"
+
+__thread struct brlock_reader *brlock_self;
+
+/*
+ * The slots of every thread that ever took a read lock, writers scan
+ * brlock_readers[0, brlock_nr_readers). An exiting thread gives its index
+ * back but the memory stays in the table for the next thread, so a writer
+ * never looks at freed memory.
+ */
+static struct brlock_reader *brlock_readers[BRLOCK_MAX_READERS];
+static unsigned int brlock_nr_readers;
+
+static pthread_mutex_t brlock_free_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int brlock_free[BRLOCK_MAX_READERS];
+static unsigned int brlock_nr_free;
+static pthread_key_t brlock_key;
+static pthread_once_t brlock_once = PTHREAD_ONCE_INIT;
+
+static unsigned long long brlock_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * brlock_reader_put - give the slots of an exiting thread back. It holds
+ * no read lock, so all of its slots are empty.
+ */
+static void brlock_reader_put(void *arg)
+{
+	unsigned int idx = (uintptr_t)arg - 1;
+
+	pthread_mutex_lock(&brlock_free_lock);
+	brlock_free[brlock_nr_free++] = idx;
+	pthread_mutex_unlock(&brlock_free_lock);
+}
+
+static void brlock_key_init(void)
+{
+	pthread_key_create(&brlock_key, brlock_reader_put);
+}
+
+/**
+ * brlock_reader_get - register the slots of the calling thread
+ *
+ * Return: the slots, NULL if BRLOCK_MAX_READERS threads have them already
+ */
+struct brlock_reader *brlock_reader_get(void)
+{
+	unsigned int idx = BRLOCK_MAX_READERS;
+	struct brlock_reader *r;
+
+	pthread_once(&brlock_once, brlock_key_init);
+	pthread_mutex_lock(&brlock_free_lock);
+	if (brlock_nr_free) {
+		idx = brlock_free[--brlock_nr_free];
+	} else if (brlock_nr_readers < BRLOCK_MAX_READERS) {
+		r = (struct brlock_reader *)aligned_alloc(64, sizeof(*r));
+		if (r) {
+			idx = brlock_nr_readers;
+			*r = (struct brlock_reader){ { NULL } };
+			__atomic_store_n(&brlock_readers[idx], r, __ATOMIC_RELAXED);
+			/* a writer that sees the new count sees the slots */
+			__atomic_store_n(&brlock_nr_readers, idx + 1,
+					 __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&brlock_free_lock);
+	if (idx >= BRLOCK_MAX_READERS)
+		return NULL;
+
+	pthread_setspecific(brlock_key, (void *)(uintptr_t)(idx + 1));
+	brlock_self = brlock_readers[idx];
+	return brlock_self;
+}
+
+/**
+ * brlock_read_lock_slowpath - take the read side of the qrwlock
+ * @lock: Pointer to brlock structure
+ *
+ * Turns the bias back on once the penalty of the last revocation is over.
+ */
+void brlock_read_lock_slowpath(struct brlock *lock)
+{
+	queued_read_lock(&lock->rwlock);
+
+	if (!__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED) &&
+	    brlock_now() >= __atomic_load_n(&lock->inhibit_until, __ATOMIC_RELAXED))
+		__atomic_store_n(&lock->rbias, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * brlock_write_lock - acquire the write side of a big reader lock
+ * @lock: Pointer to brlock structure
+ */
+void brlock_write_lock(struct brlock *lock)
+{
+	unsigned long long start, now;
+	unsigned int i, nr;
+	int j;
+
+	queued_write_lock(&lock->rwlock);
+	if (!__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED))
+		return;
+
+	/* revoke the bias and wait for the fast path readers to leave */
+	start = brlock_now();
+	__atomic_store_n(&lock->rbias, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	nr = __atomic_load_n(&brlock_nr_readers, __ATOMIC_ACQUIRE);
+	for (i = 0; i < nr; i++) {
+		struct brlock_reader *r = brlock_readers[i];
+
+		for (j = 0; j < BRLOCK_NR_SLOTS; j++) {
+			unsigned int spins = 0;
+
+			while (__atomic_load_n(&r->slots[j], __ATOMIC_ACQUIRE) == lock)
+				spin_relax(&spins);
+		}
+	}
+
+	now = brlock_now();
+	__atomic_store_n(&lock->inhibit_until,
+			 now + (now - start) * BRLOCK_INHIBIT_MULT,
+			 __ATOMIC_RELAXED);
+}
@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Big reader lock, a qrwlock with a reader bias in the style of BRAVO
+ * (Dice and Kogan, "BRAVO: Biased Locking for Reader-Writer Locks")
+ *
+ * Every read_lock of a qrwlock adds to the reader count, so the cache line
+ * of the lock moves to each cpu that takes it and read throughput stops
+ * growing with the number of cpus. While the lock is reader biased a
+ * reader instead publishes the lock in one of the slots of its own
+ * thread, a cache line nobody else writes, the way the kernel's
+ * percpu_rw_semaphore counts readers per cpu. A writer revokes the bias
+ * and waits until no slot of any thread names the lock any more, then
+ * works on the underlying qrwlock as usual. Revocation costs the writer a
+ * scan of all threads, so the bias stays off for BRLOCK_INHIBIT_MULT times
+ * as long as the last revocation took, bounding the slowdown of writers.
+ *
+ * Threads get their slots on the first read lock and give them back when
+ * they exit. A thread holding BRLOCK_NR_SLOTS read locks on the fast path,
+ * or started after BRLOCK_MAX_READERS threads are alive, just takes the
+ * read side of the qrwlock.
+ */
+#ifndef _LOCKING_BRLOCK_H
+#define _LOCKING_BRLOCK_H
+
+#include <stddef.h>
+#include "qrwlock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* read locks a thread can hold on the fast path at the same time */
+#define BRLOCK_NR_SLOTS		4
+#define BRLOCK_MAX_READERS	4096
+#define BRLOCK_INHIBIT_MULT	9
+
+struct brlock;
+
+/* the slots of one thread, only that thread writes them */
+struct brlock_reader {
+	struct brlock *slots[BRLOCK_NR_SLOTS];
+} __attribute__((aligned(64)));
+
+struct brlock {
+	int rbias;				/* readers may use their slots */
+	unsigned long long inhibit_until;	/* no bias before, in ns */
+	struct qrwlock rwlock;
+};
+
+#define __BRLOCK_UNLOCKED { \
+	.rbias = 1, \
+	.inhibit_until = 0, \
+	.rwlock = __ARCH_RW_LOCK_UNLOCKED, \
+}
+
+#define DEFINE_BRLOCK(x)	struct brlock x = __BRLOCK_UNLOCKED
+
+extern __thread struct brlock_reader *brlock_self;
+
+extern struct brlock_reader *brlock_reader_get(void);
+extern void brlock_read_lock_slowpath(struct brlock *lock);
+extern void brlock_write_lock(struct brlock *lock);
+
+static inline void brlock_init(struct brlock *lock)
+{
+	__atomic_store_n(&lock->rbias, 1, __ATOMIC_RELAXED);
+	lock->inhibit_until = 0;
+	queued_rwlock_init(&lock->rwlock);
+}
+
+/**
+ * brlock_read_lock - acquire the read side of a big reader lock
+ * @lock: Pointer to brlock structure
+ */
+static inline void brlock_read_lock(struct brlock *lock)
+{
+	struct brlock_reader *r = brlock_self;
+	int i;
+
+	if (!__atomic_load_n(&lock->rbias, __ATOMIC_RELAXED))
+		goto slowpath;
+	if (!r && !(r = brlock_reader_get()))
+		goto slowpath;
+
+	for (i = 0; i < BRLOCK_NR_SLOTS; i++) {
+		if (r->slots[i])
+			continue;
+
+		__atomic_store_n(&r->slots[i], lock, __ATOMIC_RELAXED);
+		/*
+		 * The slot is visible before we look at rbias again, pairs
+		 * with the full barrier between clearing rbias and scanning
+		 * the slots in brlock_write_lock(): either the writer sees
+		 * our slot or we see the bias gone.
+		 */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&lock->rbias, __ATOMIC_ACQUIRE))
+			return;
+
+		__atomic_store_n(&r->slots[i], NULL, __ATOMIC_RELEASE);
+		break;
+	}
+
+slowpath:
+	brlock_read_lock_slowpath(lock);
+}
+
+/**
+ * brlock_read_unlock - release the read side of a big reader lock
+ * @lock: Pointer to brlock structure
+ */
+static inline void brlock_read_unlock(struct brlock *lock)
+{
+	struct brlock_reader *r = brlock_self;
+	int i;
+
+	/* only we write our slots, one naming the lock is a read lock we hold */
+	if (r) {
+		for (i = 0; i < BRLOCK_NR_SLOTS; i++) {
+			if (r->slots[i] == lock) {
+				/* pairs with the acquire in brlock_write_lock() */
+				__atomic_store_n(&r->slots[i], NULL,
+						 __ATOMIC_RELEASE);
+				return;
+			}
+		}
+	}
+
+	queued_read_unlock(&lock->rwlock);
+}
+
+/**
+ * brlock_write_unlock - release the write side of a big reader lock
+ * @lock: Pointer to brlock structure
+ */
+static inline void brlock_write_unlock(struct brlock *lock)
+{
+	queued_write_unlock(&lock->rwlock);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOCKING_BRLOCK_H */
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * CLH queue lock (Craig, Landin and Hagersten)
+ *
+ * Like the MCS lock every waiter spins on its own cache line, but it spins
+ * on the node of its predecessor instead of its own, so a waiter never
+ * needs to link itself into the queue and the owner never has to wait for
+ * its successor to show up: unlocking is a single store once somebody is
+ * queued.
+ *
+ * tail is NULL when the lock is free. A locker swaps its node into tail
+ * and waits for the previous node to be released. After that nobody else
+ * looks at the previous node, so the new owner takes it into its pool,
+ * while its own node now belongs to its successor. Nodes therefore move
+ * between threads, the per-thread pools are freed when the thread exits.
+ */
+#ifndef _LOCKING_CLH_SPINLOCK_H
+#define _LOCKING_CLH_SPINLOCK_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "processor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct clh_node {
+	int locked;			/* 1 until the owner of the node unlocks */
+	struct clh_node *next_free;	/* in the pool of a thread */
+} __attribute__((aligned(64)));
+
+struct clh_lock {
+	struct clh_node *tail;
+	struct clh_node *owner;		/* node of the lock holder */
+};
+
+#define __CLH_LOCK_UNLOCKED	{ NULL, NULL }
+
+static __thread struct clh_node *clh_pool __attribute__((unused));
+static pthread_key_t clh_pool_key __attribute__((unused));
+static pthread_once_t clh_pool_once __attribute__((unused)) = PTHREAD_ONCE_INIT;
+
+/* arg is the clh_pool of the exiting thread */
+static inline void clh_pool_free(void *arg)
+{
+	struct clh_node *node = *(struct clh_node **)arg, *next;
+
+	for (; node; node = next) {
+		next = node->next_free;
+		free(node);
+	}
+	*(struct clh_node **)arg = NULL;
+}
+
+static inline void clh_pool_init(void)
+{
+	pthread_key_create(&clh_pool_key, clh_pool_free);
+}
+
+static inline struct clh_node *clh_node_get(void)
+{
+	struct clh_node *node = clh_pool;
+
+	if (node) {
+		clh_pool = node->next_free;
+		return node;
+	}
+
+	node = (struct clh_node *)aligned_alloc(64, sizeof(*node));
+	if (!node)
+		abort();
+	/* free the pool of this thread when it exits */
+	pthread_once(&clh_pool_once, clh_pool_init);
+	pthread_setspecific(clh_pool_key, &clh_pool);
+	return node;
+}
+
+static inline void clh_node_put(struct clh_node *node)
+{
+	node->next_free = clh_pool;
+	clh_pool = node;
+}
+
+static inline void clh_lock_init(struct clh_lock *lock)
+{
+	lock->tail = NULL;
+	lock->owner = NULL;
+}
+
+static inline void clh_lock(struct clh_lock *lock)
+{
+	struct clh_node *node = clh_node_get();
+	struct clh_node *prev;
+	unsigned int spins = 0;
+
+	node->locked = 1;
+
+	/*
+	 * The release half publishes node->locked to our successor, the
+	 * acquire half pairs with the release of the previous tail.
+	 */
+	prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+	if (prev) {
+		/* pairs with the release in clh_unlock() */
+		while (__atomic_load_n(&prev->locked, __ATOMIC_ACQUIRE))
+			spin_relax(&spins);
+		/* nobody looks at prev any more, it is ours now */
+		clh_node_put(prev);
+	}
+	lock->owner = node;
+}
+
+static inline bool clh_trylock(struct clh_lock *lock)
+{
+	struct clh_node *node, *expected = NULL;
+
+	if (__atomic_load_n(&lock->tail, __ATOMIC_RELAXED))
+		return false;
+
+	node = clh_node_get();
+	node->locked = 1;
+	if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		clh_node_put(node);
+		return false;
+	}
+	lock->owner = node;
+	return true;
+}
+
+static inline void clh_unlock(struct clh_lock *lock)
+{
+	struct clh_node *node = lock->owner, *expected = node;
+
+	/* nobody queued behind us, the node stays ours */
+	if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		clh_node_put(node);
+		return;
+	}
+
+	/* hand the lock and the node over to the successor */
+	__atomic_store_n(&node->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline bool clh_is_locked(struct clh_lock *lock)
+{
+	return __atomic_load_n(&lock->tail, __ATOMIC_RELAXED) != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOCKING_CLH_SPINLOCK_H */
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Futex based mutex, "mutex2" from Ulrich Drepper's "Futexes Are Tricky"
+ *
+ * val is 0 when unlocked, 1 when locked and 2 when locked with possible
+ * waiters. Unlike the spinlocks a waiter sleeps in the kernel, so the
+ * owner can be preempted without every waiter burning its time slice.
+ */
+#ifndef _LOCKING_FUTEX_MUTEX_H
+#define _LOCKING_FUTEX_MUTEX_H
+
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "processor.h"
+
+/* trylock attempts before a locker goes to sleep */
+#define FUTEX_MUTEX_SPINS	100
+
+struct futex_mutex {
+	uint32_t val;
+};
+
+#define __FUTEX_MUTEX_UNLOCKED	{ 0 }
+
+static inline long futex(uint32_t *uaddr, int op, uint32_t val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static inline void futex_mutex_init(struct futex_mutex *m)
+{
+	__atomic_store_n(&m->val, 0, __ATOMIC_RELAXED);
+}
+
+static inline bool futex_mutex_trylock(struct futex_mutex *m)
+{
+	uint32_t c = 0;
+
+	return __atomic_compare_exchange_n(&m->val, &c, 1, false,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void futex_mutex_lock(struct futex_mutex *m)
+{
+	uint32_t c;
+	int i;
+
+	for (i = 0; i < FUTEX_MUTEX_SPINS; i++) {
+		if (futex_mutex_trylock(m))
+			return;
+		cpu_relax();
+	}
+
+	/* announce a waiter, and take the lock if it became free */
+	c = __atomic_exchange_n(&m->val, 2, __ATOMIC_ACQUIRE);
+	while (c != 0) {
+		futex(&m->val, FUTEX_WAIT_PRIVATE, 2);
+		c = __atomic_exchange_n(&m->val, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+static inline void futex_mutex_unlock(struct futex_mutex *m)
+{
+	/* 1 -> 0 needs no wakeup, 2 -> 1 means somebody may be sleeping */
+	if (__atomic_fetch_sub(&m->val, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n(&m->val, 0, __ATOMIC_RELEASE);
+		futex(&m->val, FUTEX_WAKE_PRIVATE, 1);
+	}
+}
+
+#endif /* _LOCKING_FUTEX_MUTEX_H */
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include "barrier.h"
+#include "processor.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * 内存模型的litmus测试，在本机上看barrier.h里的屏障是不是必要、是不是足够
+ *
+ * 两个线程绑定在两个cpu上，反复执行经典的几种形状，每次执行完记下两个线程读到的值，
+ * 统计出现了多少次重排后才会有的结果（弱结果）。加了足够的屏障后内存模型禁止这个结果，应该是0；
+ * 屏障不够时内存模型允许它，输出里标成allowed，出现多少次看cpu：
+ *
+ *   mp  消息传递，和kfifo的写者先写数据再更新in、读者先读in再读数据一样
+ *         T0: buf = 1; in = 1          T1: r0 = in; r1 = buf       弱结果r0 == 1 && r1 == 0
+ *   sb  存储缓冲，两个线程都先写后读，store buffer会让读跑到写前面
+ *         T0: x = 1; r0 = y            T1: y = 1; r1 = x           弱结果r0 == 0 && r1 == 0
+ *   lb  加载缓冲，两个线程都先读后写
+ *         T0: r0 = x; y = 1            T1: r1 = y; x = 1           弱结果r0 == 1 && r1 == 1
+ *
+ * 每种形状有不加屏障和加各种屏障的版本。不加屏障时出现了弱结果，说明这台机器上这个屏障是必要的；
+ * forbidden的版本还出现，说明屏障的实现有问题。sb只用acquire/release也不够，内存模型本来就允许。
+ * x86是TSO，只有sb不加smp_mb会出现，mp和lb在arm64上才看得到
+ *
+ * 每次执行前两个线程先在一个计数器上对齐，让两边的代码尽量同时跑，这样才容易撞上重排
+ *
+ * 用法：./litmus [每种测试的执行次数，单位百万] [cpu a] [cpu b]
+ */
+
+#define LITMUS_BATCH 4096
+
+/* 每个变量单独占一条cache line，和真实程序里的数据和下标一样 */
+struct litmus_var
+{
+    int val;
+} __attribute__((aligned(64)));
+
+struct litmus_instance
+{
+    struct litmus_var x;
+    struct litmus_var y;
+};
+
+struct litmus_thread
+{
+    pthread_t tid;
+    int cpu;
+    int r[LITMUS_BATCH];
+} __attribute__((aligned(64)));
+
+static struct litmus_instance litmus_vars[LITMUS_BATCH];
+static struct litmus_thread litmus_threads[2];
+static pthread_barrier_t litmus_start, litmus_end;
+static void (*litmus_body[2])(struct litmus_instance *v, int *r);
+static volatile int litmus_stop;
+/* 两个线程每次执行前都加一，加到2的倍数时一起开始 */
+static unsigned long litmus_arrive __attribute__((aligned(64)));
+static unsigned long litmus_runs = 1000000;
+
+/* 编译器不能拆开、合并或者去掉的访问，屏障只能由下面的测试自己加 */
+#define L(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define S(p, v) __atomic_store_n(&(p), v, __ATOMIC_RELAXED)
+
+/*
+ * 每个测试生成两个线程的代码和判断弱结果的函数，
+ * T0读到的值放在r0，T1读到的值放在r1，两个值一起存进r里
+ */
+#define DEFINE_LITMUS(test, t0, t1, weak)                                 \
+    static void test##_t0(struct litmus_instance *v, int *r)              \
+    {                                                                     \
+        int r0 = 0;                                                       \
+        t0;                                                               \
+        *r = r0;                                                          \
+    }                                                                     \
+                                                                          \
+    static void test##_t1(struct litmus_instance *v, int *r)              \
+    {                                                                     \
+        int r0 = 0, r1 = 0;                                               \
+        t1;                                                               \
+        *r = r0 << 1 | r1;                                                \
+    }                                                                     \
+                                                                          \
+    static int test##_weak(int r0, int r1)                                \
+    {                                                                     \
+        return weak;                                                      \
+    }
+
+/* mp的两个读都在T1里，r0是in，r1是buf；其它形状T1只读一个值，放在r1 */
+DEFINE_LITMUS(mp,
+              { S(v->x.val, 1); S(v->y.val, 1); },
+              { r0 = L(v->y.val); r1 = L(v->x.val); },
+              r0 == 1 && r1 == 0)
+DEFINE_LITMUS(mp_wmb,
+              { S(v->x.val, 1); smp_wmb(); S(v->y.val, 1); },
+              { r0 = L(v->y.val); r1 = L(v->x.val); },
+              r0 == 1 && r1 == 0)
+DEFINE_LITMUS(mp_wmb_rmb,
+              { S(v->x.val, 1); smp_wmb(); S(v->y.val, 1); },
+              { r0 = L(v->y.val); smp_rmb(); r1 = L(v->x.val); },
+              r0 == 1 && r1 == 0)
+DEFINE_LITMUS(mp_rel_acq,
+              { S(v->x.val, 1); smp_store_release(&v->y.val, 1); },
+              { r0 = smp_load_acquire(&v->y.val); r1 = L(v->x.val); },
+              r0 == 1 && r1 == 0)
+DEFINE_LITMUS(sb,
+              { S(v->x.val, 1); r0 = L(v->y.val); },
+              { S(v->y.val, 1); r1 = L(v->x.val); },
+              r0 == 0 && r1 == 0)
+DEFINE_LITMUS(sb_rel_acq,
+              { smp_store_release(&v->x.val, 1); r0 = smp_load_acquire(&v->y.val); },
+              { smp_store_release(&v->y.val, 1); r1 = smp_load_acquire(&v->x.val); },
+              r0 == 0 && r1 == 0)
+DEFINE_LITMUS(sb_mb,
+              { S(v->x.val, 1); smp_mb(); r0 = L(v->y.val); },
+              { S(v->y.val, 1); smp_mb(); r1 = L(v->x.val); },
+              r0 == 0 && r1 == 0)
+DEFINE_LITMUS(sb_xchg_mb,
+              { __atomic_exchange_n(&v->x.val, 1, __ATOMIC_RELAXED); smp_mb__after_atomic(); r0 = L(v->y.val); },
+              { __atomic_exchange_n(&v->y.val, 1, __ATOMIC_RELAXED); smp_mb__after_atomic(); r1 = L(v->x.val); },
+              r0 == 0 && r1 == 0)
+DEFINE_LITMUS(lb,
+              { r0 = L(v->x.val); S(v->y.val, 1); },
+              { r1 = L(v->y.val); S(v->x.val, 1); },
+              r0 == 1 && r1 == 1)
+DEFINE_LITMUS(lb_acq,
+              { r0 = smp_load_acquire(&v->x.val); S(v->y.val, 1); },
+              { r1 = smp_load_acquire(&v->y.val); S(v->x.val, 1); },
+              r0 == 1 && r1 == 1)
+DEFINE_LITMUS(lb_rel,
+              { r0 = L(v->x.val); smp_store_release(&v->y.val, 1); },
+              { r1 = L(v->y.val); smp_store_release(&v->x.val, 1); },
+              r0 == 1 && r1 == 1)
+
+struct litmus_test
+{
+    const char *name;
+    const char *desc;
+    void (*t0)(struct litmus_instance *v, int *r);
+    void (*t1)(struct litmus_instance *v, int *r);
+    int (*weak)(int r0, int r1);
+    int mp;      /* T1读两个值 */
+    int allowed; /* 内存模型允许弱结果 */
+};
+
+#define LITMUS(test, desc, mp, allowed) {#test, desc, test##_t0, test##_t1, test##_weak, mp, allowed}
+
+static const struct litmus_test litmus_tests[] = {
+    LITMUS(mp, "no barrier", 1, 1),
+    LITMUS(mp_wmb, "smp_wmb only", 1, 1),
+    LITMUS(mp_wmb_rmb, "smp_wmb + smp_rmb", 1, 0),
+    LITMUS(mp_rel_acq, "release + acquire, kfifo in", 1, 0),
+    LITMUS(sb, "no barrier", 0, 1),
+    LITMUS(sb_rel_acq, "release + acquire", 0, 1),
+    LITMUS(sb_mb, "smp_mb", 0, 0),
+    LITMUS(sb_xchg_mb, "xchg + smp_mb__after_atomic", 0, 0),
+    LITMUS(lb, "no barrier", 0, 1),
+    LITMUS(lb_acq, "acquire loads", 0, 0),
+    LITMUS(lb_rel, "release stores", 0, 0),
+};
+
+static void litmus_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *litmus_thread(void *arg)
+{
+    struct litmus_thread *t = arg;
+    int self = t - litmus_threads;
+
+    litmus_pin(t->cpu);
+    for (;;)
+    {
+        pthread_barrier_wait(&litmus_start);
+        if (litmus_stop)
+            break;
+
+        for (int i = 0; i < LITMUS_BATCH; i++)
+        {
+            unsigned long go = (__atomic_add_fetch(&litmus_arrive, 1, __ATOMIC_RELAXED) + 1) & ~1UL;
+            unsigned int spins = 0;
+
+            while (__atomic_load_n(&litmus_arrive, __ATOMIC_RELAXED) < go)
+                spin_relax(&spins);
+            litmus_body[self](&litmus_vars[i], &t->r[i]);
+        }
+        pthread_barrier_wait(&litmus_end);
+    }
+    return NULL;
+}
+
+static void litmus_run(const struct litmus_test *test)
+{
+    unsigned long outcomes[2][2] = {{0}};
+    unsigned long runs, weak = 0;
+
+    litmus_body[0] = test->t0;
+    litmus_body[1] = test->t1;
+    for (runs = 0; runs < litmus_runs; runs += LITMUS_BATCH)
+    {
+        memset(litmus_vars, 0, sizeof(litmus_vars));
+        pthread_barrier_wait(&litmus_start);
+        pthread_barrier_wait(&litmus_end);
+
+        for (int i = 0; i < LITMUS_BATCH; i++)
+        {
+            int r0, r1;
+
+            /* mp的两个值都在T1里 */
+            if (test->mp)
+            {
+                r0 = litmus_threads[1].r[i] >> 1;
+                r1 = litmus_threads[1].r[i] & 1;
+            }
+            else
+            {
+                r0 = litmus_threads[0].r[i];
+                r1 = litmus_threads[1].r[i] & 1;
+            }
+            outcomes[r0][r1]++;
+            weak += test->weak(r0, r1);
+        }
+    }
+
+    printf("%-12s %-30s %10lu runs, 00/01/10/11 %9lu %9lu %9lu %9lu, %-9s %lu\r\n", test->name,
+           test->desc, runs, outcomes[0][0], outcomes[0][1], outcomes[1][0], outcomes[1][1],
+           test->allowed ? "allowed" : "forbidden", weak);
+}
+
+int main(int argc, char const *argv[])
+{
+    int cpu_a = 0, cpu_b = 1;
+
+    if (argc > 1)
+        litmus_runs = atof(argv[1]) * 1000000;
+    if (argc > 2)
+        cpu_a = atoi(argv[2]);
+    if (argc > 3)
+        cpu_b = atoi(argv[3]);
+    if (!litmus_runs || cpu_a < 0 || cpu_b < 0)
+    {
+        printf("usage: %s [million runs] [cpu a] [cpu b]\r\n", argv[0]);
+        exit(1);
+    }
+
+    pthread_barrier_init(&litmus_start, NULL, 3);
+    pthread_barrier_init(&litmus_end, NULL, 3);
+    litmus_threads[0].cpu = cpu_a;
+    litmus_threads[1].cpu = cpu_b;
+    for (int i = 0; i < 2; i++)
+        pthread_create(&litmus_threads[i].tid, NULL, litmus_thread, &litmus_threads[i]);
+
+    printf("T0 on cpu %d, T1 on cpu %d, outcomes are r0r1\r\n", cpu_a, cpu_b);
+    for (unsigned int i = 0; i < sizeof(litmus_tests) / sizeof(litmus_tests[0]); i++)
+        litmus_run(&litmus_tests[i]);
+
+    litmus_stop = 1;
+    pthread_barrier_wait(&litmus_start);
+    for (int i = 0; i < 2; i++)
+        pthread_join(litmus_threads[i].tid, NULL);
+    exit(0);
+}
@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+#include "spinlock.h"
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 几种锁的扩展性测试
+ *
+ * 1. 每种锁占的字节数
+ * 2. 一把锁：线程数从1加到所有的硬件线程，每个线程反复加锁、改一条共享的cache line、解锁、在锁外做一点事，
+ *    输出每秒加锁的次数，看争用变大以后吞吐量怎么变
+ * 3. 很多把锁：每种锁各建nr_locks把，所有线程随机挑一把加锁解锁，几乎没有争用，
+ *    这时决定吞吐量的是cache miss，锁越小，同样的cache能装下的锁越多
+ * 4. 锁的交接：持锁的线程解锁前记下时间，下一个拿到锁的线程算出从解锁到自己拿到锁过了多久，
+ *    同时用perf计数器统计每次加锁的L1D read miss，近似每次加锁在cpu之间搬了几条cache line，
+ *    没有权限打开perf计数器时输出-
+ * 5. 公平性：和1一样反复加锁，统计各线程加锁次数的Jain公平指数（1表示完全平均，1/线程数表示一个线程独占），
+ *    以及解锁后又被同一个线程马上拿回去的比例，不公平的锁在争用时会让刚解锁的线程一直抢到锁，饿死别的线程
+ *
+ * 用法：./lock_bench [每项的运行毫秒数] [最多线程数] [锁的把数]
+ */
+
+#define BENCH_MAX_THREADS 256
+/* 锁外做的事，模拟真实程序里两次加锁之间的工作 */
+#define BENCH_THINK 50
+
+struct bench_thread
+{
+    pthread_t tid;
+    int cpu;
+    int perf_fd;
+    unsigned long long ops;
+    unsigned long long handoffs; /* 从别的线程手里拿到锁的次数 */
+    unsigned long long handoff_ns;
+    unsigned long long again;    /* 解锁后又是自己拿到锁的次数 */
+    long long misses;            /* -1表示没有perf计数器 */
+} __attribute__((aligned(64)));
+
+/* 锁保护的数据，一条cache line */
+struct bench_data
+{
+    unsigned long count;
+    unsigned long sum[5];
+    unsigned long long release_ns; /* 上一个持锁的线程解锁的时间 */
+    struct bench_thread *owner;    /* 上一个持锁的线程 */
+} __attribute__((aligned(64)));
+
+/* 一次bench_run的结果 */
+struct bench_result
+{
+    double mops;
+    double handoff_ns; /* 平均每次交接的纳秒数 */
+    double misses;     /* 平均每次加锁的L1D miss，<0表示没有 */
+    double fairness;   /* 各线程加锁次数的Jain公平指数 */
+    double again;      /* 同一个线程连续拿到锁的比例 */
+};
+
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+static struct bench_data bench_data;
+static volatile int bench_stop;
+static int bench_ms = 200;
+static int max_threads;
+static unsigned long nr_locks = 1 << 20;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 线程按顺序绑定到各个cpu上，cpu不够就轮着来 */
+static void bench_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* 统计本线程的L1D read miss */
+static void bench_thread_start(struct bench_thread *t)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HW_CACHE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+
+    bench_pin(t->cpu);
+    t->perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (t->perf_fd >= 0)
+        ioctl(t->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static void bench_thread_end(struct bench_thread *t)
+{
+    t->misses = -1;
+    if (t->perf_fd < 0)
+        return;
+    ioctl(t->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(t->perf_fd, &t->misses, sizeof(t->misses)) != sizeof(t->misses))
+        t->misses = -1;
+    close(t->perf_fd);
+}
+
+static inline void bench_think(void)
+{
+    for (volatile int i = 0; i < BENCH_THINK; i++)
+        ;
+}
+
+/* xorshift，每个线程自己的随机数 */
+static inline unsigned long bench_rand(unsigned long *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* 跑nr个线程 */
+static struct bench_result bench_run(void *(*fn)(void *), int nr)
+{
+    unsigned long long start, ns, total = 0, handoffs = 0, handoff_ns = 0, again = 0;
+    double squares = 0;
+    long long misses = 0;
+    struct bench_result r;
+    int i;
+
+    bench_stop = 0;
+    memset(bench_threads, 0, sizeof(bench_threads));
+    memset(&bench_data, 0, sizeof(bench_data));
+
+    start = now_ns();
+    for (i = 0; i < nr; i++)
+    {
+        bench_threads[i].cpu = i;
+        pthread_create(&bench_threads[i].tid, NULL, fn, &bench_threads[i]);
+    }
+
+    usleep(bench_ms * 1000);
+    bench_stop = 1;
+    for (i = 0; i < nr; i++)
+    {
+        pthread_join(bench_threads[i].tid, NULL);
+        total += bench_threads[i].ops;
+        handoffs += bench_threads[i].handoffs;
+        handoff_ns += bench_threads[i].handoff_ns;
+        again += bench_threads[i].again;
+        squares += (double)bench_threads[i].ops * bench_threads[i].ops;
+        if (misses >= 0)
+            misses = bench_threads[i].misses < 0 ? -1 : misses + bench_threads[i].misses;
+    }
+    ns = now_ns() - start;
+
+    r.mops = (double)total * 1000 / ns;
+    r.handoff_ns = handoffs ? (double)handoff_ns / handoffs : 0;
+    r.misses = misses < 0 || !total ? -1 : (double)misses / total;
+    /* (sum x)^2 / (n * sum x^2) */
+    r.fairness = squares ? (double)total * total / (nr * squares) : 0;
+    r.again = total ? (double)again / total : 0;
+    return r;
+}
+
+struct bench_lock
+{
+    const char *name;
+    size_t size;
+    void *(*one)(void *);
+    void *(*many)(void *);
+    void *(*handoff)(void *);
+    void *(*fair)(void *);
+};
+
+/* 每种锁生成一把争用的锁、一个锁数组和各项测试的线程函数，spin_lock会根据锁的类型选择实现 */
+#define DEFINE_LOCK_BENCH(lock, type)                                   \
+    static type bench_##lock##_l;                                       \
+    static type *bench_##lock##_locks;                                  \
+                                                                        \
+    static void *bench_##lock##_one(void *arg)                          \
+    {                                                                   \
+        struct bench_thread *t = arg;                                   \
+                                                                        \
+        bench_thread_start(t);                                          \
+        while (!bench_stop)                                             \
+        {                                                               \
+            spin_lock(&bench_##lock##_l);                               \
+            bench_data.count++;                                         \
+            bench_data.sum[bench_data.count % 5] += t->cpu;             \
+            spin_unlock(&bench_##lock##_l);                             \
+            t->ops++;                                                   \
+            bench_think();                                              \
+        }                                                               \
+        bench_thread_end(t);                                            \
+        return NULL;                                                    \
+    }                                                                   \
+                                                                        \
+    static void *bench_##lock##_many(void *arg)                         \
+    {                                                                   \
+        struct bench_thread *t = arg;                                   \
+        unsigned long x = 88172645463325252UL + t->cpu;                 \
+                                                                        \
+        bench_thread_start(t);                                          \
+        while (!bench_stop)                                             \
+        {                                                               \
+            type *l = &bench_##lock##_locks[bench_rand(&x) % nr_locks]; \
+                                                                        \
+            spin_lock(l);                                               \
+            spin_unlock(l);                                             \
+            t->ops++;                                                   \
+        }                                                               \
+        bench_thread_end(t);                                            \
+        return NULL;                                                    \
+    }                                                                   \
+                                                                        \
+    static void *bench_##lock##_handoff(void *arg)                      \
+    {                                                                   \
+        struct bench_thread *t = arg;                                   \
+                                                                        \
+        bench_thread_start(t);                                          \
+        while (!bench_stop)                                             \
+        {                                                               \
+            spin_lock(&bench_##lock##_l);                               \
+            if (bench_data.owner && bench_data.owner != t)              \
+            {                                                           \
+                t->handoffs++;                                          \
+                t->handoff_ns += now_ns() - bench_data.release_ns;      \
+            }                                                           \
+            bench_data.owner = t;                                       \
+            bench_data.count++;                                         \
+            bench_data.release_ns = now_ns();                           \
+            spin_unlock(&bench_##lock##_l);                             \
+            t->ops++;                                                   \
+        }                                                               \
+        bench_thread_end(t);                                            \
+        return NULL;                                                    \
+    }                                                                   \
+                                                                        \
+    static void *bench_##lock##_fair(void *arg)                         \
+    {                                                                   \
+        struct bench_thread *t = arg;                                   \
+                                                                        \
+        bench_thread_start(t);                                          \
+        while (!bench_stop)                                             \
+        {                                                               \
+            spin_lock(&bench_##lock##_l);                               \
+            if (bench_data.owner == t)                                  \
+                t->again++;                                             \
+            bench_data.owner = t;                                       \
+            bench_data.count++;                                         \
+            spin_unlock(&bench_##lock##_l);                             \
+            t->ops++;                                                   \
+            bench_think();                                              \
+        }                                                               \
+        bench_thread_end(t);                                            \
+        return NULL;                                                    \
+    }                                                                   \
+                                                                        \
+    static const struct bench_lock bench_##lock##_bench = {             \
+        .name = #lock,                                                  \
+        .size = sizeof(type),                                           \
+        .one = bench_##lock##_one,                                      \
+        .many = bench_##lock##_many,                                    \
+        .handoff = bench_##lock##_handoff,                              \
+        .fair = bench_##lock##_fair,                                    \
+    };                                                                  \
+                                                                        \
+    static void bench_##lock##_init(void)                               \
+    {                                                                   \
+        spin_lock_init(&bench_##lock##_l);                              \
+        bench_##lock##_locks = malloc(nr_locks * sizeof(type));         \
+        for (unsigned long i = 0; i < nr_locks; i++)                    \
+            spin_lock_init(&bench_##lock##_locks[i]);                   \
+    }                                                                   \
+                                                                        \
+    static void bench_##lock##_exit(void)                               \
+    {                                                                   \
+        free((void *)bench_##lock##_locks);                             \
+    }
+
+DEFINE_LOCK_BENCH(pthread, pthread_spinlock_t)
+DEFINE_LOCK_BENCH(ticket, struct ticket_spinlock)
+DEFINE_LOCK_BENCH(mcs, struct mcs_lock)
+DEFINE_LOCK_BENCH(clh, struct clh_lock)
+DEFINE_LOCK_BENCH(queued, struct qspinlock)
+DEFINE_LOCK_BENCH(futex, struct futex_mutex)
+
+static const struct bench_lock *bench_locks[] = {
+    &bench_pthread_bench,
+    &bench_ticket_bench,
+    &bench_mcs_bench,
+    &bench_clh_bench,
+    &bench_queued_bench,
+    &bench_futex_bench,
+};
+
+#define NR_BENCH_LOCKS (sizeof(bench_locks) / sizeof(bench_locks[0]))
+
+/* 线程数按1、2、4……翻倍，最后一定跑一次max_threads */
+static int next_threads(int nr)
+{
+    if (nr == max_threads)
+        return 0;
+    return nr * 2 < max_threads ? nr * 2 : max_threads;
+}
+
+enum bench_mode
+{
+    BENCH_ONE,
+    BENCH_MANY,
+    BENCH_HANDOFF,
+    BENCH_FAIR,
+};
+
+/* 每行是一个线程数，每列是一种锁 */
+static void bench_table(enum bench_mode mode)
+{
+    unsigned int i;
+    int nr;
+
+    printf("threads");
+    for (i = 0; i < NR_BENCH_LOCKS; i++)
+        printf(" %12s", bench_locks[i]->name);
+    printf("\r\n");
+    for (nr = 1; nr; nr = next_threads(nr))
+    {
+        printf("%7d", nr);
+        for (i = 0; i < NR_BENCH_LOCKS; i++)
+        {
+            const struct bench_lock *b = bench_locks[i];
+            struct bench_result r;
+
+            if (mode == BENCH_ONE)
+            {
+                r = bench_run(b->one, nr);
+                printf(" %12.2f", r.mops);
+            }
+            else if (mode == BENCH_MANY)
+            {
+                r = bench_run(b->many, nr);
+                printf(" %12.2f", r.mops);
+            }
+            else if (mode == BENCH_FAIR)
+            {
+                r = bench_run(b->fair, nr);
+                printf(" %5.3f/%5.1f%%", r.fairness, r.again * 100);
+            }
+            else
+            {
+                r = bench_run(b->handoff, nr);
+                if (r.misses < 0)
+                    printf(" %7.0f/   -", r.handoff_ns);
+                else
+                    printf(" %7.0f/%4.1f", r.handoff_ns, r.misses);
+            }
+            fflush(stdout);
+        }
+        printf("\r\n");
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    unsigned int i;
+
+    max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        bench_ms = atoi(argv[1]);
+    if (argc > 2)
+        max_threads = atoi(argv[2]);
+    if (argc > 3)
+        nr_locks = atol(argv[3]);
+    if (bench_ms <= 0 || max_threads <= 0 || max_threads > BENCH_MAX_THREADS || !nr_locks)
+    {
+        printf("usage: %s [ms] [max threads] [number of locks]\r\n", argv[0]);
+        exit(1);
+    }
+
+    bench_pthread_init();
+    bench_ticket_init();
+    bench_mcs_init();
+    bench_clh_init();
+    bench_queued_init();
+    bench_futex_init();
+
+    printf("=====size======\r\n");
+    for (i = 0; i < NR_BENCH_LOCKS; i++)
+        printf("%-8s %zu bytes, %lu locks take %.1f MB\r\n", bench_locks[i]->name,
+               bench_locks[i]->size, nr_locks, (double)bench_locks[i]->size * nr_locks / (1 << 20));
+
+    printf("=====one lock, Mops/s======\r\n");
+    bench_table(BENCH_ONE);
+    printf("=====%lu locks, random picks, Mops/s======\r\n", nr_locks);
+    bench_table(BENCH_MANY);
+    printf("=====handoff, ns from unlock to the next owner / L1D misses per lock======\r\n");
+    bench_table(BENCH_HANDOFF);
+    printf("=====fairness, Jain index of locks per thread / locks taken right after own unlock======\r\n");
+    bench_table(BENCH_FAIR);
+
+    bench_pthread_exit();
+    bench_ticket_exit();
+    bench_mcs_exit();
+    bench_clh_exit();
+    bench_queued_exit();
+    bench_futex_exit();
+    exit(0);
+}
@@ -0,0 +1,489 @@
+/* 先包含stdatomic.h，检查atomic.h和它的同名宏能共存 */
+#include <stdatomic.h>
+#include "atomic.h"
+#include "brlock.h"
+#include "qrwlock.h"
+#include "rcupdate.h"
+#include "seqlock.h"
+#include "spinlock.h"
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NR_THREADS 4
+#define LOOPS 100000
+
+/*
+ * spinlock.h根据锁的类型选择实现，同一套spin_lock/spin_unlock可以用在下面六种锁上：
+ * pthread_spinlock_t、struct ticket_spinlock、struct mcs_lock、struct clh_lock、struct qspinlock、struct futex_mutex
+ */
+
+/* 每种锁各开NR_THREADS个线程，在锁里对同一个计数器加LOOPS次，最后计数应该正好是NR_THREADS * LOOPS */
+#define DEFINE_LOCK_TEST(name, type)                               \
+    static type name##_l;                                       \
+    static unsigned long name##_count;                             \
+                                                                   \
+    static void *name##_thread(void *arg)                          \
+    {                                                              \
+        for (int i = 0; i < LOOPS; i++)                            \
+        {                                                          \
+            spin_lock(&name##_l);                                  \
+            name##_count++;                                        \
+            spin_unlock(&name##_l);                                \
+        }                                                          \
+        return NULL;                                               \
+    }                                                              \
+                                                                   \
+    void test_##name(void)                                         \
+    {                                                              \
+        pthread_t tid[NR_THREADS];                                 \
+                                                                   \
+        spin_lock_init(&name##_l);                                 \
+        for (int i = 0; i < NR_THREADS; i++)                       \
+            pthread_create(&tid[i], NULL, name##_thread, NULL);    \
+        for (int i = 0; i < NR_THREADS; i++)                       \
+            pthread_join(tid[i], NULL);                            \
+                                                                   \
+        printf("%-8s count %lu, expect %d, %s\r\n", #name,         \
+               name##_count, NR_THREADS * LOOPS,                   \
+               name##_count == NR_THREADS * LOOPS ? "ok" : "FAIL"); \
+    }
+
+DEFINE_LOCK_TEST(pthread, pthread_spinlock_t)
+DEFINE_LOCK_TEST(ticket, struct ticket_spinlock)
+DEFINE_LOCK_TEST(mcs, struct mcs_lock)
+DEFINE_LOCK_TEST(clh, struct clh_lock)
+DEFINE_LOCK_TEST(queued, struct qspinlock)
+DEFINE_LOCK_TEST(futex, struct futex_mutex)
+
+/**
+ * 这个函数演示了trylock和锁的嵌套
+ */
+void test_trylock(void)
+{
+    struct ticket_spinlock a = __TICKET_SPIN_LOCK_UNLOCKED;
+    struct mcs_lock b = __MCS_LOCK_UNLOCKED;
+    struct qspinlock c = __ARCH_SPIN_LOCK_UNLOCKED;
+
+    /* spin_trylock拿到锁返回true，锁已被持有返回false */
+    bool first = spin_trylock(&a);
+    bool again = spin_trylock(&a);
+    printf("ticket trylock %d, again %d\r\n", first, again);
+    spin_unlock(&a);
+
+    /* mcs和q自旋锁每个线程有4个队列节点，最多可以同时持有或等待4把锁 */
+    spin_lock(&b);
+    spin_lock(&c);
+    printf("mcs trylock %d, queued is locked %d\r\n", spin_trylock(&b), queued_spin_is_locked(&c));
+    spin_unlock(&c);
+    spin_unlock(&b);
+
+    /* DEFINE_SPINLOCK定义的是编译时选择的spinlock_t，默认是ticket锁，
+       用-DCONFIG_SPINLOCK_MCS/QUEUED/FUTEX换成别的锁。pthread的自旋锁没有可移植的静态初始化，
+       -DCONFIG_SPINLOCK_PTHREAD时要用spin_lock_init初始化 */
+    DEFINE_SPINLOCK(d);
+    unsigned long flags = 0;
+    spin_lock_irqsave(&d, flags);
+    printf("spinlock_t trylock while locked %d\r\n", spin_trylock(&d));
+    spin_unlock_irqrestore(&d, flags);
+}
+
+static struct qspinlock pending_l = __ARCH_SPIN_LOCK_UNLOCKED;
+
+static void *pending_thread(void *arg)
+{
+    spin_lock(&pending_l);
+    spin_unlock(&pending_l);
+    return NULL;
+}
+
+/**
+ * 这个函数演示了q自旋锁的pending位：锁被持有时第二个来抢锁的线程不排队，
+ * 而是设置pending位后直接自旋在锁上，第三个来的才用到队列节点
+ */
+void test_pending(void)
+{
+    pthread_t tid[2];
+
+    spin_lock(&pending_l);
+    printf("locked          val 0x%08x\r\n", pending_l.val);
+
+    pthread_create(&tid[0], NULL, pending_thread, NULL);
+    usleep(10000);
+    /* (tail, pending, locked) = (0, 1, 1) */
+    printf("one waiter      val 0x%08x, contended %d\r\n", pending_l.val, !!queued_spin_is_contended(&pending_l));
+
+    pthread_create(&tid[1], NULL, pending_thread, NULL);
+    usleep(10000);
+    /* 第三个线程排进了队列，tail是它的槽位号和节点下标 */
+    printf("two waiters     val 0x%08x, tail 0x%x\r\n", pending_l.val, pending_l.tail);
+
+    spin_unlock(&pending_l);
+    pthread_join(tid[0], NULL);
+    pthread_join(tid[1], NULL);
+    printf("unlocked        val 0x%08x\r\n", pending_l.val);
+}
+
+static struct ticket_spinlock fair_l = __TICKET_SPIN_LOCK_UNLOCKED;
+
+static void *fair_thread(void *arg)
+{
+    spin_lock(&fair_l);
+    spin_unlock(&fair_l);
+    return NULL;
+}
+
+/**
+ * 这个函数演示了ticket锁的排队：每来一个线程next加一，owner追上next时锁才空闲，
+ * 除了持锁者还有人在等就是contended
+ */
+void test_ticket_contended(void)
+{
+    pthread_t tid[2];
+
+    spin_lock(&fair_l);
+    printf("locked          next %u, owner %u, contended %d\r\n",
+           fair_l.tickets.next, fair_l.tickets.owner, ticket_spin_is_contended(&fair_l));
+
+    for (int i = 0; i < 2; i++)
+        pthread_create(&tid[i], NULL, fair_thread, NULL);
+    usleep(10000);
+    /* 两个等待者排在第1、2号，离锁越远的退避越久 */
+    printf("two waiters     next %u, owner %u, contended %d\r\n",
+           fair_l.tickets.next, fair_l.tickets.owner, ticket_spin_is_contended(&fair_l));
+
+    spin_unlock(&fair_l);
+    for (int i = 0; i < 2; i++)
+        pthread_join(tid[i], NULL);
+    printf("unlocked        next %u, owner %u, locked %d\r\n",
+           fair_l.tickets.next, fair_l.tickets.owner, ticket_spin_is_locked(&fair_l));
+}
+
+static DEFINE_SEQLOCK(seq_l);
+static unsigned long seq_a, seq_b;
+static volatile int seq_stop;
+
+/* 写者让a和b始终相等，读者读到不相等就是读到了写到一半的数据 */
+static void *seq_writer(void *arg)
+{
+    for (unsigned long i = 1; i <= LOOPS; i++)
+    {
+        write_seqlock(&seq_l);
+        __atomic_store_n(&seq_a, i, __ATOMIC_RELAXED);
+        __atomic_store_n(&seq_b, i, __ATOMIC_RELAXED);
+        write_sequnlock(&seq_l);
+    }
+    seq_stop = 1;
+    return NULL;
+}
+
+/**
+ * 这个函数演示了顺序锁：读者不加锁，读完用read_seqretry检查期间有没有写者，有就重读
+ */
+void test_seqlock(void)
+{
+    unsigned long a, b, reads = 0, retries = 0, torn = 0;
+    unsigned int seq;
+    pthread_t tid;
+
+    pthread_create(&tid, NULL, seq_writer, NULL);
+    while (!seq_stop)
+    {
+        for (;;)
+        {
+            seq = read_seqbegin(&seq_l);
+            a = __atomic_load_n(&seq_a, __ATOMIC_RELAXED);
+            b = __atomic_load_n(&seq_b, __ATOMIC_RELAXED);
+            if (!read_seqretry(&seq_l, seq))
+                break;
+            retries++;
+        }
+        torn += a != b;
+        reads++;
+    }
+    pthread_join(tid, NULL);
+    printf("seqlock  %lu reads, %lu retries, %lu torn, %s\r\n", reads, retries, torn, torn ? "FAIL" : "ok");
+}
+
+static struct qrwlock rw_l = __ARCH_RW_LOCK_UNLOCKED;
+static unsigned long rw_a, rw_b, rw_torn;
+
+/* 一半线程写，让a和b一起加一，另一半读，检查a和b相等 */
+static void *rw_thread(void *arg)
+{
+    long writer = (long)arg & 1;
+
+    for (int i = 0; i < LOOPS; i++)
+    {
+        if (writer)
+        {
+            queued_write_lock(&rw_l);
+            rw_a++;
+            rw_b++;
+            queued_write_unlock(&rw_l);
+        }
+        else
+        {
+            queued_read_lock(&rw_l);
+            if (rw_a != rw_b)
+                __atomic_fetch_add(&rw_torn, 1, __ATOMIC_RELAXED);
+            queued_read_unlock(&rw_l);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 这个函数演示了排队读写锁：读者之间不互斥，写者和所有人互斥
+ */
+void test_qrwlock(void)
+{
+    pthread_t tid[NR_THREADS];
+
+    queued_read_lock(&rw_l);
+    printf("read locked     cnts 0x%08x, read trylock %d, write trylock %d\r\n", rw_l.cnts,
+           queued_read_trylock(&rw_l), queued_write_trylock(&rw_l));
+    queued_read_unlock(&rw_l);
+    queued_read_unlock(&rw_l);
+
+    for (long i = 0; i < NR_THREADS; i++)
+        pthread_create(&tid[i], NULL, rw_thread, (void *)i);
+    for (int i = 0; i < NR_THREADS; i++)
+        pthread_join(tid[i], NULL);
+    printf("qrwlock  count %lu, expect %d, torn %lu, %s\r\n", rw_a, NR_THREADS / 2 * LOOPS, rw_torn,
+           rw_a == NR_THREADS / 2 * LOOPS && !rw_torn ? "ok" : "FAIL");
+}
+
+static DEFINE_BRLOCK(br_l);
+static unsigned long br_a, br_b, br_torn;
+
+/* 和rw_thread一样，四分之一的线程写 */
+static void *br_thread(void *arg)
+{
+    long writer = !((long)arg & 3);
+
+    for (int i = 0; i < LOOPS; i++)
+    {
+        if (writer)
+        {
+            brlock_write_lock(&br_l);
+            br_a++;
+            br_b++;
+            brlock_write_unlock(&br_l);
+        }
+        else
+        {
+            brlock_read_lock(&br_l);
+            if (br_a != br_b)
+                __atomic_fetch_add(&br_torn, 1, __ATOMIC_RELAXED);
+            brlock_read_unlock(&br_l);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 这个函数演示了大读者锁：有读者偏向时读者只在自己线程的槽位里记下锁，
+ * 写者收回偏向，等所有线程的槽位里都没有这把锁了才进去
+ */
+void test_brlock(void)
+{
+    pthread_t tid[NR_THREADS];
+
+    brlock_read_lock(&br_l);
+    printf("read locked     rbias %d, slot %p, qrwlock cnts 0x%08x\r\n", br_l.rbias,
+           (void *)brlock_self->slots[0], br_l.rwlock.cnts);
+    brlock_read_unlock(&br_l);
+
+    /* 写者收回了偏向，一段时间内读者都走qrwlock */
+    brlock_write_lock(&br_l);
+    brlock_write_unlock(&br_l);
+    brlock_read_lock(&br_l);
+    printf("after a writer  rbias %d, slot %p, qrwlock cnts 0x%08x\r\n", br_l.rbias,
+           (void *)brlock_self->slots[0], br_l.rwlock.cnts);
+    brlock_read_unlock(&br_l);
+
+    for (long i = 0; i < NR_THREADS; i++)
+        pthread_create(&tid[i], NULL, br_thread, (void *)i);
+    for (int i = 0; i < NR_THREADS; i++)
+        pthread_join(tid[i], NULL);
+    printf("brlock   count %lu, expect %d, torn %lu, %s\r\n", br_a, NR_THREADS / 4 * LOOPS, br_torn,
+           br_a == NR_THREADS / 4 * LOOPS && !br_torn ? "ok" : "FAIL");
+}
+
+static atomic_t at_a = ATOMIC_INIT(0);
+static atomic64_t at_b = ATOMIC64_INIT(0);
+static atomic_long_t at_c = ATOMIC_LONG_INIT(0);
+
+/* 不加锁，三种原子变量各用不同的操作累加 */
+static void *at_thread(void *arg)
+{
+    for (int i = 0; i < LOOPS; i++)
+    {
+        long c = atomic_long_read(&at_c);
+
+        atomic_inc(&at_a);
+        atomic64_fetch_add_relaxed(2, &at_b);
+        while (!atomic_long_try_cmpxchg(&at_c, &c, c + 3))
+            ;
+    }
+    return NULL;
+}
+
+/**
+ * 这个函数演示了原子操作：先检查条件操作的返回值和溢出回绕，
+ * 再让几个线程同时累加
+ */
+void test_atomic(void)
+{
+    pthread_t tid[NR_THREADS];
+    atomic_t v = ATOMIC_INIT(1);
+    int ok;
+
+    ok = atomic_dec_and_test(&v) && !atomic_inc_not_zero(&v) && atomic_dec_if_positive(&v) == -1 &&
+         atomic_read(&v) == 0 && atomic_inc_unless_negative(&v) && atomic_fetch_add_unless(&v, 5, 1) == 1 &&
+         atomic_cmpxchg(&v, 0, 7) == 1 && atomic_xchg(&v, 0xff) == 1 && atomic_fetch_andnot(0x0f, &v) == 0xff &&
+         atomic_read(&v) == 0xf0 && atomic_add_negative(-0xf1, &v);
+    atomic_set(&v, INT_MAX);
+    ok = ok && atomic_inc_return(&v) == INT_MIN;
+    {
+        _Atomic int c11 = 1;
+
+        ok = ok && atomic_fetch_add(2, &v) == INT_MIN && atomic_fetch_sub_explicit(&c11, 1, memory_order_relaxed) == 1;
+    }
+    printf("conditional ops %s\r\n", ok ? "ok" : "FAIL");
+
+    for (long i = 0; i < NR_THREADS; i++)
+        pthread_create(&tid[i], NULL, at_thread, (void *)i);
+    for (int i = 0; i < NR_THREADS; i++)
+        pthread_join(tid[i], NULL);
+    ok = atomic_read(&at_a) == NR_THREADS * LOOPS && atomic64_read(&at_b) == 2LL * NR_THREADS * LOOPS &&
+         atomic_long_read(&at_c) == 3L * NR_THREADS * LOOPS;
+    printf("atomic   %d %lld %ld, expect %d %d %d, %s\r\n", atomic_read(&at_a), atomic64_read(&at_b),
+           atomic_long_read(&at_c), NR_THREADS * LOOPS, 2 * NR_THREADS * LOOPS, 3 * NR_THREADS * LOOPS,
+           ok ? "ok" : "FAIL");
+}
+
+struct rcu_cfg
+{
+    unsigned long a, b;
+    struct rcu_head rcu;
+};
+
+/* 回收前把a清零，读者读到a和b不相等就是用到了已经回收的配置 */
+static void rcu_cfg_free(struct rcu_head *head)
+{
+    struct rcu_cfg *c = (struct rcu_cfg *)((char *)head - offsetof(struct rcu_cfg, rcu));
+
+    __atomic_store_n(&c->a, 0, __ATOMIC_RELAXED);
+    free(c);
+}
+
+/*
+ * 每种rcu开NR_THREADS - 1个读者和一个写者，写者换LOOPS / 100次配置，
+ * 一半用call_rcu回收旧的，一半用synchronize_rcu等读者走完再回收。
+ * 两种rcu都有quiescent_state，读者都在第一次read_lock时自动注册，读者的代码一样
+ */
+#define DEFINE_RCU_TEST(flavor)                                                   \
+    static struct rcu_cfg *flavor##_cfg;                                          \
+    static unsigned long flavor##_reads, flavor##_torn, flavor##_freed;           \
+    static volatile int flavor##_stop;                                            \
+                                                                                  \
+    static void flavor##_free(struct rcu_head *head)                              \
+    {                                                                             \
+        flavor##_freed++;                                                         \
+        rcu_cfg_free(head);                                                       \
+    }                                                                             \
+                                                                                  \
+    static void *flavor##_reader(void *arg)                                       \
+    {                                                                             \
+        unsigned long reads = 0, torn = 0;                                        \
+                                                                                  \
+        while (!flavor##_stop)                                                    \
+        {                                                                         \
+            struct rcu_cfg *c;                                                    \
+                                                                                  \
+            flavor##_read_lock();                                                 \
+            c = rcu_dereference(flavor##_cfg);                                    \
+            torn += !c->a || c->a != c->b;                                        \
+            flavor##_read_unlock();                                               \
+            reads++;                                                              \
+            flavor##_quiescent_state();                                           \
+        }                                                                         \
+        flavor##_unregister_thread();                                             \
+        __atomic_fetch_add(&flavor##_reads, reads, __ATOMIC_RELAXED);             \
+        __atomic_fetch_add(&flavor##_torn, torn, __ATOMIC_RELAXED);               \
+        return NULL;                                                              \
+    }                                                                             \
+                                                                                  \
+    void test_##flavor(void)                                                      \
+    {                                                                             \
+        pthread_t tid[NR_THREADS - 1];                                            \
+        struct rcu_cfg *c = malloc(sizeof(*c));                                   \
+                                                                                  \
+        c->a = c->b = 1;                                                          \
+        RCU_INIT_POINTER(flavor##_cfg, c);                                        \
+        for (int i = 0; i < NR_THREADS - 1; i++)                                  \
+            pthread_create(&tid[i], NULL, flavor##_reader, NULL);                 \
+                                                                                  \
+        for (unsigned long i = 2; i <= LOOPS / 100 + 1; i++)                      \
+        {                                                                         \
+            struct rcu_cfg *old = rcu_dereference_protected(flavor##_cfg, 1);     \
+                                                                                  \
+            c = malloc(sizeof(*c));                                               \
+            c->a = c->b = i;                                                      \
+            rcu_assign_pointer(flavor##_cfg, c);                                  \
+            if (i & 1)                                                            \
+            {                                                                     \
+                flavor##_call(&old->rcu, flavor##_free);                          \
+            }                                                                     \
+            else                                                                  \
+            {                                                                     \
+                flavor##_synchronize();                                           \
+                rcu_cfg_free(&old->rcu);                                          \
+            }                                                                     \
+        }                                                                         \
+        flavor##_barrier();                                                       \
+                                                                                  \
+        flavor##_stop = 1;                                                        \
+        for (int i = 0; i < NR_THREADS - 1; i++)                                  \
+            pthread_join(tid[i], NULL);                                           \
+        free(flavor##_cfg);                                                       \
+        printf("%-9s %lu reads, %lu torn, call_rcu freed %lu, expect %d, %s\r\n", \
+               #flavor, flavor##_reads, flavor##_torn, flavor##_freed, LOOPS / 200, \
+               !flavor##_torn && flavor##_freed == LOOPS / 200 ? "ok" : "FAIL");   \
+    }
+
+DEFINE_RCU_TEST(rcu_epoch)
+DEFINE_RCU_TEST(rcu_qsbr)
+
+int main(int argc, char const *argv[])
+{
+    printf("====locks====\r\n");
+    test_pthread();
+    test_ticket();
+    test_mcs();
+    test_clh();
+    test_queued();
+    test_futex();
+    printf("\r\n\r\n\r\n=====trylock======\r\n");
+    test_trylock();
+    printf("\r\n\r\n\r\n=====pending======\r\n");
+    test_pending();
+    printf("\r\n\r\n\r\n=====ticket======\r\n");
+    test_ticket_contended();
+    printf("\r\n\r\n\r\n=====seqlock======\r\n");
+    test_seqlock();
+    printf("\r\n\r\n\r\n=====qrwlock======\r\n");
+    test_qrwlock();
+    printf("\r\n\r\n\r\n=====brlock======\r\n");
+    test_brlock();
+    printf("\r\n\r\n\r\n=====atomic======\r\n");
+    test_atomic();
+    printf("\r\n\r\n\r\n=====rcu======\r\n");
+    test_rcu_epoch();
+    test_rcu_qsbr();
+    exit(0);
+}
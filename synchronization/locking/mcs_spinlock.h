@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * MCS lock defines, from kernel/locking/mcs_spinlock.h
+ *
+ * This file contains the main data structure and API definitions of MCS lock.
+ *
+ * The MCS lock (proposed by Mellor-Crummey and Scott) is a simple spin-lock
+ * with the desirable properties of being fair, and with each cpu trying
+ * to acquire the lock spinning on a local variable.
+ * It avoids expensive cache bounces that common test-and-set spin-lock
+ * implementations incur.
+ */
+#ifndef _LOCKING_MCS_SPINLOCK_H
+#define _LOCKING_MCS_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "processor.h"
+
+struct mcs_spinlock {
+	struct mcs_spinlock *next;
+	int locked; /* 1 if lock acquired */
+	int count;  /* nesting count, see qspinlock.c */
+};
+
+/*
+ * Note: the smp_load_acquire/smp_store_release pair is not
+ * sufficient to form a full memory barrier across
+ * cpus for many architectures (except x86) for mcs_unlock and mcs_lock.
+ * For applications that need a full barrier across multiple cpus
+ * with mcs_unlock and mcs_lock pair, smp_mb__after_unlock_lock() should be
+ * used after mcs_lock.
+ */
+
+/*
+ * Using smp_cond_load_acquire() provides the acquire semantics
+ * required so that subsequent operations happen after the
+ * lock is acquired.
+ */
+static inline void arch_mcs_spin_lock_contended(int *l)
+{
+	unsigned int spins = 0;
+
+	while (!__atomic_load_n(l, __ATOMIC_ACQUIRE))
+		spin_relax(&spins);
+}
+
+/*
+ * smp_store_release() provides a memory barrier to ensure all
+ * operations in the critical section has been completed before
+ * unlocking.
+ */
+static inline void arch_mcs_spin_unlock_contended(int *l)
+{
+	__atomic_store_n(l, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * In order to acquire the lock, the caller should declare a local node and
+ * pass a reference of the node to this function in addition to the lock.
+ * If the lock has already been acquired, then this will proceed to spin
+ * on this node->locked until the previous lock holder sets the node->locked
+ * in mcs_spin_unlock().
+ */
+static inline
+void mcs_spin_lock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *prev;
+
+	/* Init node */
+	node->locked = 0;
+	node->next   = NULL;
+
+	/*
+	 * We rely on the full barrier with global transitivity implied by the
+	 * below xchg() to order the initialization stores above against any
+	 * observation of @node. And to provide the ACQUIRE ordering associated
+	 * with a LOCK primitive.
+	 */
+	prev = __atomic_exchange_n(lock, node, __ATOMIC_ACQ_REL);
+	if (prev == NULL) {
+		/*
+		 * Lock acquired, don't need to set node->locked to 1. Threads
+		 * only spin on its own node->locked value for lock acquisition.
+		 * However, since this thread can immediately acquire the lock
+		 * and does not proceed to spin on its own node->locked, this
+		 * value won't be used. If a debug mode is needed to
+		 * audit lock status, then set node->locked value here.
+		 */
+		return;
+	}
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+	/* Wait until the lock holder passes the lock down. */
+	arch_mcs_spin_lock_contended(&node->locked);
+}
+
+/*
+ * Releases the lock. The caller should pass in the corresponding node that
+ * was used to acquire the lock.
+ */
+static inline
+void mcs_spin_unlock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+	if (!next) {
+		struct mcs_spinlock *expected = node;
+
+		/*
+		 * Release the lock by setting it to NULL
+		 */
+		if (__atomic_compare_exchange_n(lock, &expected, NULL, false,
+						__ATOMIC_RELEASE,
+						__ATOMIC_RELAXED))
+			return;
+		unsigned int spins = 0;
+
+		/* Wait until the next pointer is set */
+		while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+			spin_relax(&spins);
+	}
+
+	/* Pass lock to next waiter. */
+	arch_mcs_spin_unlock_contended(&next->locked);
+}
+
+/*
+ * struct mcs_lock - MCS lock usable like any other spinlock
+ *
+ * The kernel API above needs the caller to keep a node around from lock to
+ * unlock. This wrapper takes the node from a small per-thread pool instead
+ * and remembers it in the lock while it is held, so mcs_unlock() only
+ * needs the lock. Up to MCS_MAX_NODES locks may be held or waited for by
+ * one thread at the same time.
+ */
+#define MCS_MAX_NODES	4
+
+struct mcs_lock {
+	struct mcs_spinlock *tail;
+	struct mcs_spinlock *owner;
+};
+
+#define __MCS_LOCK_UNLOCKED	{ NULL, NULL }
+
+struct mcs_qnode {
+	struct mcs_spinlock mcs;
+	bool busy;
+} __attribute__((aligned(64)));
+
+static __thread struct mcs_qnode mcs_qnodes[MCS_MAX_NODES]
+	__attribute__((unused));
+
+static inline struct mcs_spinlock *mcs_node_get(void)
+{
+	int i;
+
+	for (i = 0; i < MCS_MAX_NODES; i++) {
+		if (!mcs_qnodes[i].busy) {
+			mcs_qnodes[i].busy = true;
+			return &mcs_qnodes[i].mcs;
+		}
+	}
+	/* nested deeper than MCS_MAX_NODES, a bug in the caller */
+	abort();
+}
+
+static inline void mcs_node_put(struct mcs_spinlock *node)
+{
+	((struct mcs_qnode *)node)->busy = false;
+}
+
+static inline void mcs_lock_init(struct mcs_lock *lock)
+{
+	lock->tail = NULL;
+	lock->owner = NULL;
+}
+
+static inline void mcs_lock(struct mcs_lock *lock)
+{
+	struct mcs_spinlock *node = mcs_node_get();
+
+	mcs_spin_lock(&lock->tail, node);
+	lock->owner = node;
+}
+
+static inline bool mcs_trylock(struct mcs_lock *lock)
+{
+	struct mcs_spinlock *node, *expected = NULL;
+
+	if (__atomic_load_n(&lock->tail, __ATOMIC_RELAXED))
+		return false;
+
+	node = mcs_node_get();
+	node->locked = 0;
+	node->next = NULL;
+	if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		mcs_node_put(node);
+		return false;
+	}
+	lock->owner = node;
+	return true;
+}
+
+static inline void mcs_unlock(struct mcs_lock *lock)
+{
+	struct mcs_spinlock *node = lock->owner;
+
+	mcs_spin_unlock(&lock->tail, node);
+	mcs_node_put(node);
+}
+
+#endif /* _LOCKING_MCS_SPINLOCK_H */
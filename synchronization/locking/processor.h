@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LOCKING_PROCESSOR_H
+#define _LOCKING_PROCESSOR_H
+
+#include <sched.h>
+
+/*
+ * cpu_relax - hint the cpu that we are busy waiting
+ *
+ * pause on x86 and yield on arm64 keep a spinning hyper thread from
+ * starving its sibling and save power while waiting for a cache line.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__asm__ __volatile__("pause" : : : "memory")
+#elif defined(__aarch64__) || defined(__arm__)
+#define cpu_relax()	__asm__ __volatile__("yield" : : : "memory")
+#else
+#define cpu_relax()	__asm__ __volatile__("" : : : "memory")
+#endif
+
+/*
+ * In user space the thread we wait for can be preempted, and with the fair
+ * locks that includes the next waiter in line. Spinning on for the rest of
+ * a time slice only delays it, so after SPIN_RELAX_LIMIT rounds a waiter
+ * gives its cpu away.
+ */
+#define SPIN_RELAX_LIMIT	128
+
+static inline void spin_relax(unsigned int *spins)
+{
+	if (++*spins < SPIN_RELAX_LIMIT) {
+		cpu_relax();
+	} else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+#endif /* _LOCKING_PROCESSOR_H */
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Queued read/write locks, from kernel/locking/qrwlock.c
+ *
+ * (C) Copyright 2013-2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Authors: Waiman Long <waiman.long@hp.com>
+ */
+
+#include "qrwlock.h"
+#include "processor.h"
+
+/*
+ * The kernel lets readers in interrupt context skip the queue and only
+ * wait for the writer inside, so an interrupted reader cannot deadlock on
+ * a writer queued behind it. Signal handlers must not take locks anyway,
+ * in user space every reader queues up.
+ */
+
+/* spin until VAL of the lock word satisfies cond, then return VAL */
+#define qrwlock_cond_read(lock, cond, order)				\
+({									\
+	unsigned int __spins = 0;					\
+	uint32_t VAL;							\
+									\
+	for (;;) {							\
+		VAL = __atomic_load_n(&(lock)->cnts, order);		\
+		if (cond)						\
+			break;						\
+		spin_relax(&__spins);					\
+	}								\
+	VAL;								\
+})
+
+/**
+ * queued_read_lock_slowpath - acquire read lock of a queued rwlock
+ * @lock: Pointer to queued rwlock structure
+ */
+void queued_read_lock_slowpath(struct qrwlock *lock)
+{
+	__atomic_fetch_sub(&lock->cnts, _QR_BIAS, __ATOMIC_RELAXED);
+
+	/*
+	 * Put the reader into the wait queue
+	 */
+	queued_spin_lock(&lock->wait_lock);
+	__atomic_fetch_add(&lock->cnts, _QR_BIAS, __ATOMIC_RELAXED);
+
+	/*
+	 * The ACQUIRE semantics of the following spinning code ensure
+	 * that accesses can't leak upwards out of our subsequent critical
+	 * section in the case that the lock is currently held for write.
+	 */
+	qrwlock_cond_read(lock, !(VAL & _QW_LOCKED), __ATOMIC_ACQUIRE);
+
+	/*
+	 * Signal the next one in queue to become queue head
+	 */
+	queued_spin_unlock(&lock->wait_lock);
+}
+
+/**
+ * queued_write_lock_slowpath - acquire write lock of a queued rwlock
+ * @lock : Pointer to queued rwlock structure
+ */
+void queued_write_lock_slowpath(struct qrwlock *lock)
+{
+	uint32_t cnts;
+
+	/* Put the writer into the wait queue */
+	queued_spin_lock(&lock->wait_lock);
+
+	/* Try to acquire the lock directly if no reader is present */
+	cnts = __atomic_load_n(&lock->cnts, __ATOMIC_RELAXED);
+	if (!cnts &&
+	    __atomic_compare_exchange_n(&lock->cnts, &cnts, _QW_LOCKED, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		goto unlock;
+
+	/* Set the waiting flag to notify readers that a writer is pending */
+	__atomic_fetch_or(&lock->cnts, _QW_WAITING, __ATOMIC_RELAXED);
+
+	/* When no more readers or writers, set the locked flag */
+	do {
+		cnts = qrwlock_cond_read(lock, VAL == _QW_WAITING,
+					 __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&lock->cnts, &cnts, _QW_LOCKED,
+					      false, __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+unlock:
+	queued_spin_unlock(&lock->wait_lock);
+}
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Queue read/write lock, from include/asm-generic/qrwlock.h and
+ * include/asm-generic/qrwlock_types.h
+ *
+ * The reader count and the writer byte share one word, so an uncontended
+ * read or write lock is a single atomic operation. Everybody who cannot get
+ * the lock right away queues up on wait_lock, a queued spinlock, and only
+ * the head of that queue competes for the lock word. A writer at the head
+ * sets _QW_WAITING, after which new readers queue up behind it instead of
+ * joining the readers inside, so a stream of readers cannot starve it.
+ */
+#ifndef _LOCKING_QRWLOCK_H
+#define _LOCKING_QRWLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "qspinlock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The queued read/write lock data structure
+ */
+typedef struct qrwlock {
+	union {
+		uint32_t cnts;
+		struct {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			uint8_t wlocked;	/* Locked for write? */
+			uint8_t __lstate[3];
+#else
+			uint8_t __lstate[3];
+			uint8_t wlocked;	/* Locked for write? */
+#endif
+		};
+	};
+	struct qspinlock wait_lock;
+} arch_rwlock_t;
+
+#define	__ARCH_RW_LOCK_UNLOCKED {		\
+	{ .cnts = 0 },				\
+	.wait_lock = __ARCH_SPIN_LOCK_UNLOCKED,	\
+}
+
+/*
+ * Writer states & reader shift and bias.
+ */
+#define	_QW_WAITING	0x100		/* A writer is waiting	   */
+#define	_QW_LOCKED	0x0ff		/* A writer holds the lock */
+#define	_QW_WMASK	0x1ff		/* Writer mask		   */
+#define	_QR_SHIFT	9		/* Reader count shift	   */
+#define _QR_BIAS	(1U << _QR_SHIFT)
+
+extern void queued_read_lock_slowpath(struct qrwlock *lock);
+extern void queued_write_lock_slowpath(struct qrwlock *lock);
+
+static inline void queued_rwlock_init(struct qrwlock *lock)
+{
+	__atomic_store_n(&lock->cnts, 0, __ATOMIC_RELAXED);
+	queued_spin_lock_init(&lock->wait_lock);
+}
+
+/**
+ * queued_read_trylock - try to acquire read lock of a queued rwlock
+ * @lock : Pointer to queued rwlock structure
+ * Return: 1 if lock acquired, 0 if failed
+ */
+static inline int queued_read_trylock(struct qrwlock *lock)
+{
+	uint32_t cnts;
+
+	cnts = __atomic_load_n(&lock->cnts, __ATOMIC_RELAXED);
+	if (!(cnts & _QW_WMASK)) {
+		cnts = __atomic_add_fetch(&lock->cnts, _QR_BIAS, __ATOMIC_ACQUIRE);
+		if (!(cnts & _QW_WMASK))
+			return 1;
+		__atomic_fetch_sub(&lock->cnts, _QR_BIAS, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/**
+ * queued_write_trylock - try to acquire write lock of a queued rwlock
+ * @lock : Pointer to queued rwlock structure
+ * Return: 1 if lock acquired, 0 if failed
+ */
+static inline int queued_write_trylock(struct qrwlock *lock)
+{
+	uint32_t cnts;
+
+	cnts = __atomic_load_n(&lock->cnts, __ATOMIC_RELAXED);
+	if (cnts)
+		return 0;
+
+	return __atomic_compare_exchange_n(&lock->cnts, &cnts, _QW_LOCKED,
+					   false, __ATOMIC_ACQUIRE,
+					   __ATOMIC_RELAXED);
+}
+
+/**
+ * queued_read_lock - acquire read lock of a queued rwlock
+ * @lock: Pointer to queued rwlock structure
+ */
+static inline void queued_read_lock(struct qrwlock *lock)
+{
+	uint32_t cnts;
+
+	cnts = __atomic_add_fetch(&lock->cnts, _QR_BIAS, __ATOMIC_ACQUIRE);
+	if (!(cnts & _QW_WMASK))
+		return;
+
+	/* The slowpath will decrement the reader count, if necessary. */
+	queued_read_lock_slowpath(lock);
+}
+
+/**
+ * queued_write_lock - acquire write lock of a queued rwlock
+ * @lock : Pointer to queued rwlock structure
+ */
+static inline void queued_write_lock(struct qrwlock *lock)
+{
+	uint32_t cnts = 0;
+
+	/* Optimize for the unfair lock case where the fair flag is 0. */
+	if (__atomic_compare_exchange_n(&lock->cnts, &cnts, _QW_LOCKED, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	queued_write_lock_slowpath(lock);
+}
+
+/**
+ * queued_read_unlock - release read lock of a queued rwlock
+ * @lock : Pointer to queued rwlock structure
+ */
+static inline void queued_read_unlock(struct qrwlock *lock)
+{
+	/*
+	 * Atomically decrement the reader count
+	 */
+	__atomic_fetch_sub(&lock->cnts, _QR_BIAS, __ATOMIC_RELEASE);
+}
+
+/**
+ * queued_write_unlock - release write lock of a queued rwlock
+ * @lock : Pointer to queued rwlock structure
+ */
+static inline void queued_write_unlock(struct qrwlock *lock)
+{
+	__atomic_store_n(&lock->wlocked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * queued_rwlock_is_contended - check if the lock is contended
+ * @lock : Pointer to queued rwlock structure
+ * Return: 1 if lock contended, 0 otherwise
+ */
+static inline int queued_rwlock_is_contended(struct qrwlock *lock)
+{
+	return queued_spin_is_locked(&lock->wait_lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOCKING_QRWLOCK_H */
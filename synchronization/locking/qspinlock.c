@@ -0,0 +1,438 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Queued spinlock, from kernel/locking/qspinlock.c
+ *
+ * (C) Copyright 2013-2015 Hewlett-Packard Development Company, L.P.
+ * (C) Copyright 2013-2014,2018 Red Hat, Inc.
+ * (C) Copyright 2015 Intel Corp.
+ * (C) Copyright 2015 Hewlett-Packard Enterprise Development LP
+ *
+ * Authors: Waiman Long <longman@redhat.com>
+ *          Peter Zijlstra <peterz@infradead.org>
+ */
+
+#include <pthread.h>
+#include "qspinlock.h"
+#include "mcs_spinlock.h"
+#include "processor.h"
+
+/*
+ * The basic principle of a queue-based spinlock can best be understood
+ * by studying a classic queue-based spinlock implementation called the
+ * MCS lock. The paper below provides a good description for this kind
+ * of lock.
+ *
+ * http://www.cise.ufl.edu/tr/DOC/REP-1992-71.pdf
+ *
+ * This queued spinlock implementation is based on the MCS lock, however to
+ * make it fit the 4 bytes we assume spinlock_t to be, and preserve its
+ * existing API, we must modify it somehow.
+ *
+ * In particular; where the traditional MCS lock consists of a tail pointer
+ * (8 bytes) and needs the next pointer (another 8 bytes) of its own node to
+ * unlock the next pending (next->locked), we compress both these: {tail,
+ * next->locked} into a single u32 value.
+ *
+ * The kernel encodes the tail as (cpu + 1, context index) and finds the
+ * node in the per-cpu qnodes[] array. In user space there is no cpu we
+ * could stay on, so every thread that ever queues up gets a slot number
+ * and registers its thread local qnodes[] in qnode_table[slot]. The tail
+ * is then (slot + 1, nesting index), which still fits 16 bits.
+ */
+
+/*
+ * The maximum number of nested lock acquisitions per thread, in the kernel
+ * these are the 4 contexts task, softirq, hardirq and nmi.
+ */
+#define MAX_NODES	4
+
+#define MAX_SLOTS	((1U << _Q_TAIL_CPU_BITS) - 1)
+
+/*
+ * On 64-bit architectures, the mcs_spinlock structure will be 16 bytes in
+ * size, pad it to a cache line so two spinning threads never share one.
+ */
+struct qnode {
+	struct mcs_spinlock mcs;
+} __attribute__((aligned(64)));
+
+/*
+ * The pending bit spinning loop count.
+ * This heuristic is used to limit the number of lockword accesses
+ * made by atomic_cond_read_relaxed when waiting for the lock to
+ * transition out of the "== _Q_PENDING_VAL" state. We don't spin
+ * indefinitely because there's no guarantee that we'll make forward
+ * progress.
+ */
+#define _Q_PENDING_LOOPS	1
+
+static __thread struct qnode qnodes[MAX_NODES];
+static __thread int qnode_slot = -1;
+
+static struct qnode *qnode_table[MAX_SLOTS];
+static unsigned int qnode_slots;
+
+/*
+ * Slots of exited threads, handed out again before new ones so programs
+ * that keep creating short lived threads don't run out of them.
+ */
+static pthread_mutex_t qnode_free_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int qnode_free[MAX_SLOTS];
+static unsigned int qnode_nr_free;
+static pthread_key_t qnode_key;
+static pthread_once_t qnode_once = PTHREAD_ONCE_INIT;
+
+/*
+ * qnode_slot_put - give the slot of an exiting thread back. It is not
+ * queued on any lock, so nobody looks its qnodes up any more.
+ */
+static void qnode_slot_put(void *arg)
+{
+	unsigned int slot = (uintptr_t)arg - 1;
+
+	__atomic_store_n(&qnode_table[slot], NULL, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&qnode_free_lock);
+	qnode_free[qnode_nr_free++] = slot;
+	pthread_mutex_unlock(&qnode_free_lock);
+}
+
+static void qnode_key_init(void)
+{
+	pthread_key_create(&qnode_key, qnode_slot_put);
+}
+
+/*
+ * qnode_slot_get - returns the slot of the calling thread, -1 if all
+ * slots are taken
+ */
+static int qnode_slot_get(void)
+{
+	unsigned int slot = MAX_SLOTS;
+
+	if (qnode_slot >= 0)
+		return qnode_slot;
+
+	pthread_once(&qnode_once, qnode_key_init);
+	pthread_mutex_lock(&qnode_free_lock);
+	if (qnode_nr_free)
+		slot = qnode_free[--qnode_nr_free];
+	else if (qnode_slots < MAX_SLOTS)
+		slot = qnode_slots++;
+	pthread_mutex_unlock(&qnode_free_lock);
+	if (slot >= MAX_SLOTS)
+		return -1;
+
+	__atomic_store_n(&qnode_table[slot], qnodes, __ATOMIC_RELEASE);
+	pthread_setspecific(qnode_key, (void *)(uintptr_t)(slot + 1));
+	qnode_slot = slot;
+	return slot;
+}
+
+/*
+ * We must be able to distinguish between no-tail and the tail at 0:0,
+ * therefore increment the slot number by one.
+ */
+static inline uint32_t encode_tail(int slot, int idx)
+{
+	uint32_t tail;
+
+	tail  = (slot + 1) << _Q_TAIL_CPU_OFFSET;
+	tail |= idx << _Q_TAIL_IDX_OFFSET; /* assume < 4 */
+
+	return tail;
+}
+
+static inline struct mcs_spinlock *decode_tail(uint32_t tail)
+{
+	int slot = (tail >> _Q_TAIL_CPU_OFFSET) - 1;
+	int idx = (tail &  _Q_TAIL_IDX_MASK) >> _Q_TAIL_IDX_OFFSET;
+
+	return &__atomic_load_n(&qnode_table[slot], __ATOMIC_ACQUIRE)[idx].mcs;
+}
+
+/**
+ * clear_pending - clear the pending bit.
+ * @lock: Pointer to queued spinlock structure
+ *
+ * *,1,* -> *,0,*
+ */
+static inline void clear_pending(struct qspinlock *lock)
+{
+	__atomic_store_n(&lock->pending, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * clear_pending_set_locked - take ownership and clear the pending bit.
+ * @lock: Pointer to queued spinlock structure
+ *
+ * *,1,0 -> *,0,1
+ *
+ * Lock stealing is not allowed if this function is used.
+ */
+static inline void clear_pending_set_locked(struct qspinlock *lock)
+{
+	__atomic_store_n(&lock->locked_pending, _Q_LOCKED_VAL,
+			 __ATOMIC_RELAXED);
+}
+
+/**
+ * queued_fetch_set_pending_acquire - fetch the whole lock value and set pending
+ * @lock : Pointer to queued spinlock structure
+ * Return: The previous lock value
+ *
+ * *,*,* -> *,1,*
+ */
+static inline uint32_t queued_fetch_set_pending_acquire(struct qspinlock *lock)
+{
+	return __atomic_fetch_or(&lock->val, _Q_PENDING_VAL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * set_locked - Set the lock bit and own the lock
+ * @lock: Pointer to queued spinlock structure
+ *
+ * *,*,0 -> *,0,1
+ */
+static inline void set_locked(struct qspinlock *lock)
+{
+	__atomic_store_n(&lock->locked, _Q_LOCKED_VAL, __ATOMIC_RELAXED);
+}
+
+/**
+ * xchg_tail - Put in the new queue tail code word & retrieve previous one
+ * @lock : Pointer to queued spinlock structure
+ * @tail : The new queue tail code word
+ * Return: The previous queue tail code word
+ *
+ * xchg(lock, tail), which heads an address dependency
+ *
+ * p,*,* -> n,*,* ; prev = xchg(lock, node)
+ */
+static inline uint32_t xchg_tail(struct qspinlock *lock, uint32_t tail)
+{
+	/*
+	 * We can use relaxed semantics since the caller ensures that the
+	 * MCS node is properly initialized before updating the tail. In user
+	 * space the release half of acq_rel is that guarantee.
+	 */
+	return (uint32_t)__atomic_exchange_n(&lock->tail,
+					     tail >> _Q_TAIL_OFFSET,
+					     __ATOMIC_ACQ_REL) << _Q_TAIL_OFFSET;
+}
+
+/**
+ * queued_spin_lock_slowpath - acquire the queued spinlock
+ * @lock: Pointer to queued spinlock structure
+ * @val: Current value of the queued spinlock 32-bit word
+ *
+ * (queue tail, pending bit, lock value)
+ *
+ *              fast     :    slow                                  :    unlock
+ *                       :                                          :
+ * uncontended  (0,0,0) -:--> (0,0,1) ------------------------------:--> (*,*,0)
+ *                       :       | ^--------.------.             /  :
+ *                       :       v           \      \            |  :
+ * pending               :    (0,1,1) +--> (0,1,0)   \           |  :
+ *                       :       | ^--'              |           |  :
+ *                       :       v                   |           |  :
+ * uncontended           :    (n,x,y) +--> (n,0,0) --'           |  :
+ *   queue               :       | ^--'                          |  :
+ *                       :       v                               |  :
+ * contended             :    (*,x,y) +--> (*,0,0) ---> (*,0,1) -'  :
+ *   queue               :         ^--'                             :
+ */
+void queued_spin_lock_slowpath(struct qspinlock *lock, uint32_t val)
+{
+	struct mcs_spinlock *prev, *next, *node;
+	unsigned int spins = 0;
+	uint32_t old, tail;
+	int slot, idx;
+
+	/*
+	 * Wait for in-progress pending->locked hand-overs with a bounded
+	 * number of spins so that we guarantee forward progress.
+	 *
+	 * 0,1,0 -> 0,0,1
+	 */
+	if (val == _Q_PENDING_VAL) {
+		int cnt = _Q_PENDING_LOOPS;
+
+		do {
+			cpu_relax();
+			val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+		} while (val == _Q_PENDING_VAL && cnt--);
+	}
+
+	/*
+	 * If we observe any contention; queue.
+	 */
+	if (val & ~_Q_LOCKED_MASK)
+		goto queue;
+
+	/*
+	 * trylock || pending
+	 *
+	 * 0,0,* -> 0,1,* -> 0,0,1 pending, trylock
+	 */
+	val = queued_fetch_set_pending_acquire(lock);
+
+	/*
+	 * If we observe contention, there is a concurrent locker.
+	 *
+	 * Undo and queue; our setting of PENDING might have made the
+	 * n,0,0 -> 0,0,0 transition fail and it will now be waiting
+	 * on @next to become !NULL.
+	 */
+	if (__builtin_expect(val & ~_Q_LOCKED_MASK, 0)) {
+
+		/* Undo PENDING if we set it. */
+		if (!(val & _Q_PENDING_MASK))
+			clear_pending(lock);
+
+		goto queue;
+	}
+
+	/*
+	 * We're pending, wait for the owner to go away.
+	 *
+	 * 0,1,1 -> *,1,0
+	 *
+	 * this wait loop must be a load-acquire such that we match the
+	 * store-release that clears the locked bit and create lock
+	 * sequentiality; this is because clear_pending_set_locked() is a
+	 * plain store.
+	 */
+	if (val & _Q_LOCKED_MASK) {
+		while (__atomic_load_n(&lock->locked, __ATOMIC_ACQUIRE))
+			spin_relax(&spins);
+	}
+
+	/*
+	 * take ownership and clear the pending bit.
+	 *
+	 * 0,1,0 -> 0,0,1
+	 */
+	clear_pending_set_locked(lock);
+	return;
+
+	/*
+	 * End of pending bit optimistic spinning and beginning of MCS
+	 * queuing.
+	 */
+queue:
+	slot = qnode_slot_get();
+	node = &qnodes[0].mcs;
+	idx = node->count++;
+
+	/*
+	 * 4 nodes are allocated based on the assumption that there will
+	 * not be nested lock acquisitions deeper than that. If that happens,
+	 * or the thread got no slot, we fall back to spinning on the lock
+	 * directly until it is available.
+	 */
+	if (slot < 0 || idx >= MAX_NODES) {
+		while (!queued_spin_trylock(lock))
+			spin_relax(&spins);
+		goto release;
+	}
+
+	tail = encode_tail(slot, idx);
+	node = &qnodes[idx].mcs;
+
+	node->locked = 0;
+	node->next = NULL;
+
+	/*
+	 * We touched a (possibly) cold cacheline in the per-thread queue node;
+	 * attempt the trylock once more in the hope someone let go while we
+	 * weren't watching.
+	 */
+	if (queued_spin_trylock(lock))
+		goto release;
+
+	/*
+	 * Publish the updated tail.
+	 * We have already touched the queueing cacheline; don't bother with
+	 * pending stuff.
+	 *
+	 * p,*,* -> n,*,*
+	 */
+	old = xchg_tail(lock, tail);
+	next = NULL;
+
+	/*
+	 * if there was a previous node; link it and wait until reaching the
+	 * head of the waitqueue.
+	 */
+	if (old & _Q_TAIL_MASK) {
+		prev = decode_tail(old);
+
+		/* Link @node into the waitqueue. */
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+		arch_mcs_spin_lock_contended(&node->locked);
+
+		/*
+		 * While waiting for the MCS lock, the next pointer may have
+		 * been set by another lock waiter. We optimistically load
+		 * the next pointer & prefetch the cacheline for writing
+		 * to reduce latency in the upcoming MCS unlock operation.
+		 */
+		next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+		if (next)
+			__builtin_prefetch(next, 1);
+	}
+
+	/*
+	 * we're at the head of the waitqueue, wait for the owner & pending to
+	 * go away.
+	 *
+	 * *,x,y -> *,0,0
+	 *
+	 * The load must be an acquire, it orders the critical section of
+	 * the previous owner before ours.
+	 */
+	while ((val = __atomic_load_n(&lock->val, __ATOMIC_ACQUIRE)) &
+	       _Q_LOCKED_PENDING_MASK)
+		spin_relax(&spins);
+
+	/*
+	 * claim the lock:
+	 *
+	 * n,0,0 -> 0,0,1 : lock, uncontended
+	 * *,*,0 -> *,*,1 : lock, contended
+	 *
+	 * If the queue head is the only one in the queue (lock value == tail)
+	 * and nobody is pending, clear the tail code and grab the lock.
+	 * Otherwise, we only need to grab the lock.
+	 */
+	if ((val & _Q_TAIL_MASK) == tail) {
+		if (__atomic_compare_exchange_n(&lock->val, &val, _Q_LOCKED_VAL,
+						false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			goto release; /* No contention */
+	}
+
+	/*
+	 * Either somebody is queued behind us or _Q_PENDING_VAL got set
+	 * which will then detect the remaining tail and queue behind us
+	 * ensuring we'll see a @next.
+	 */
+	set_locked(lock);
+
+	/*
+	 * contended path; wait for next if not observed yet, release.
+	 */
+	if (!next) {
+		while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+			spin_relax(&spins);
+	}
+
+	arch_mcs_spin_unlock_contended(&next->locked);
+
+release:
+	/*
+	 * release the node
+	 */
+	qnodes[0].mcs.count--;
+}
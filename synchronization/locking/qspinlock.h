@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Queued spinlock, from include/asm-generic/qspinlock.h and
+ * include/asm-generic/qspinlock_types.h
+ *
+ * The whole lock is 4 bytes. Waiters queue up in MCS nodes owned by each
+ * thread, the lock word only keeps the tail of that queue encoded as
+ * (thread slot + 1, nesting index), see qspinlock.c.
+ */
+#ifndef _LOCKING_QSPINLOCK_H
+#define _LOCKING_QSPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct qspinlock {
+	union {
+		uint32_t val;
+
+		/*
+		 * By using the whole 2nd least significant byte for the
+		 * pending bit, we can allow better optimization of the lock
+		 * acquisition for the pending bit holder.
+		 */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		struct {
+			uint8_t	locked;
+			uint8_t	pending;
+		};
+		struct {
+			uint16_t	locked_pending;
+			uint16_t	tail;
+		};
+#else
+		struct {
+			uint16_t	tail;
+			uint16_t	locked_pending;
+		};
+		struct {
+			uint8_t	reserved[2];
+			uint8_t	pending;
+			uint8_t	locked;
+		};
+#endif
+	};
+} arch_spinlock_t;
+
+/*
+ * Initializier
+ */
+#define	__ARCH_SPIN_LOCK_UNLOCKED	{ { .val = 0 } }
+
+/*
+ * Bitfields in the atomic value:
+ *
+ *  0- 7: locked byte
+ *     8: pending
+ *  9-15: not used
+ * 16-17: tail index
+ * 18-31: tail thread slot (+1)
+ */
+#define	_Q_SET_MASK(type)	(((1U << _Q_ ## type ## _BITS) - 1)\
+				      << _Q_ ## type ## _OFFSET)
+#define _Q_LOCKED_OFFSET	0
+#define _Q_LOCKED_BITS		8
+#define _Q_LOCKED_MASK		_Q_SET_MASK(LOCKED)
+
+#define _Q_PENDING_OFFSET	(_Q_LOCKED_OFFSET + _Q_LOCKED_BITS)
+#define _Q_PENDING_BITS		8
+#define _Q_PENDING_MASK		_Q_SET_MASK(PENDING)
+
+#define _Q_TAIL_IDX_OFFSET	(_Q_PENDING_OFFSET + _Q_PENDING_BITS)
+#define _Q_TAIL_IDX_BITS	2
+#define _Q_TAIL_IDX_MASK	_Q_SET_MASK(TAIL_IDX)
+
+#define _Q_TAIL_CPU_OFFSET	(_Q_TAIL_IDX_OFFSET + _Q_TAIL_IDX_BITS)
+#define _Q_TAIL_CPU_BITS	(32 - _Q_TAIL_CPU_OFFSET)
+#define _Q_TAIL_CPU_MASK	_Q_SET_MASK(TAIL_CPU)
+
+#define _Q_TAIL_OFFSET		_Q_TAIL_IDX_OFFSET
+#define _Q_TAIL_MASK		(_Q_TAIL_IDX_MASK | _Q_TAIL_CPU_MASK)
+
+#define _Q_LOCKED_VAL		(1U << _Q_LOCKED_OFFSET)
+#define _Q_PENDING_VAL		(1U << _Q_PENDING_OFFSET)
+
+#define _Q_LOCKED_PENDING_MASK	(_Q_LOCKED_MASK | _Q_PENDING_MASK)
+
+extern void queued_spin_lock_slowpath(struct qspinlock *lock, uint32_t val);
+
+static inline void queued_spin_lock_init(struct qspinlock *lock)
+{
+	__atomic_store_n(&lock->val, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * queued_spin_is_locked - is the spinlock locked?
+ * @lock: Pointer to queued spinlock structure
+ * Return: 1 if it is locked, 0 otherwise
+ */
+static inline int queued_spin_is_locked(struct qspinlock *lock)
+{
+	return __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+}
+
+/**
+ * queued_spin_is_contended - check if the lock is contended
+ * @lock : Pointer to queued spinlock structure
+ * Return: 1 if lock contended, 0 otherwise
+ */
+static inline int queued_spin_is_contended(struct qspinlock *lock)
+{
+	return __atomic_load_n(&lock->val, __ATOMIC_RELAXED) & ~_Q_LOCKED_MASK;
+}
+
+/**
+ * queued_spin_trylock - try to acquire the queued spinlock
+ * @lock : Pointer to queued spinlock structure
+ * Return: 1 if lock acquired, 0 if failed
+ */
+static inline int queued_spin_trylock(struct qspinlock *lock)
+{
+	uint32_t val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+
+	if (val)
+		return 0;
+
+	return __atomic_compare_exchange_n(&lock->val, &val, _Q_LOCKED_VAL,
+					   false, __ATOMIC_ACQUIRE,
+					   __ATOMIC_RELAXED);
+}
+
+/**
+ * queued_spin_lock - acquire a queued spinlock
+ * @lock: Pointer to queued spinlock structure
+ */
+static inline void queued_spin_lock(struct qspinlock *lock)
+{
+	uint32_t val = 0;
+
+	if (__builtin_expect(__atomic_compare_exchange_n(&lock->val, &val,
+				_Q_LOCKED_VAL, false, __ATOMIC_ACQUIRE,
+				__ATOMIC_RELAXED), 1))
+		return;
+
+	queued_spin_lock_slowpath(lock, val);
+}
+
+/**
+ * queued_spin_unlock - release a queued spinlock
+ * @lock : Pointer to queued spinlock structure
+ */
+static inline void queued_spin_unlock(struct qspinlock *lock)
+{
+	/*
+	 * unlock() needs release semantics:
+	 */
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOCKING_QSPINLOCK_H */
@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Read-copy update in user space, the registry of reader counters, grace
+ * periods and callbacks of both flavors
+ */
+
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "processor.h"
+#include "rcupdate.h"
+
+unsigned long rcu_epoch_gp_ctr __attribute__((aligned(64))) = 1;
+unsigned long rcu_qsbr_gp_ctr __attribute__((aligned(64))) = 1;
+int rcu_epoch_has_membarrier;
+
+__thread struct rcu_reader *rcu_epoch_self;
+__thread struct rcu_reader *rcu_qsbr_self;
+
+/* the part of a flavor the read side does not touch */
+struct rcu_flavor {
+	unsigned long *gp_ctr;
+	/* the writer side of the barriers around a grace period */
+	void (*smp_mb_master)(void);
+
+	/*
+	 * Every thread that ever registered, pushed at the head and never
+	 * freed, so a writer never looks at freed memory. An exiting thread
+	 * clears in_use and the next thread to register takes its counter.
+	 */
+	struct rcu_reader *readers;
+	pthread_mutex_t registry_lock;
+	pthread_key_t key;
+	pthread_once_t once;
+
+	/* one grace period at a time */
+	pthread_mutex_t gp_lock;
+
+	/* call_rcu() callbacks, queued at the tail */
+	pthread_mutex_t cb_lock;
+	pthread_cond_t cb_cond;
+	struct rcu_head *cb_head;
+	struct rcu_head **cb_tail;
+	unsigned long cb_queued;
+	unsigned long cb_done;
+	int cb_thread;
+};
+
+static void rcu_epoch_smp_mb_master(void)
+{
+	if (rcu_epoch_has_membarrier)
+		syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+	else
+		smp_mb();
+}
+
+static void rcu_qsbr_smp_mb_master(void)
+{
+	smp_mb();
+}
+
+static struct rcu_flavor rcu_epoch = {
+	.gp_ctr = &rcu_epoch_gp_ctr,
+	.smp_mb_master = rcu_epoch_smp_mb_master,
+	.registry_lock = PTHREAD_MUTEX_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+	.gp_lock = PTHREAD_MUTEX_INITIALIZER,
+	.cb_lock = PTHREAD_MUTEX_INITIALIZER,
+	.cb_cond = PTHREAD_COND_INITIALIZER,
+	.cb_tail = &rcu_epoch.cb_head,
+};
+
+static struct rcu_flavor rcu_qsbr = {
+	.gp_ctr = &rcu_qsbr_gp_ctr,
+	.smp_mb_master = rcu_qsbr_smp_mb_master,
+	.registry_lock = PTHREAD_MUTEX_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+	.gp_lock = PTHREAD_MUTEX_INITIALIZER,
+	.cb_lock = PTHREAD_MUTEX_INITIALIZER,
+	.cb_cond = PTHREAD_COND_INITIALIZER,
+	.cb_tail = &rcu_qsbr.cb_head,
+};
+
+/*
+ * rcu_reader_put - give the counter of an exiting thread back. It is
+ * outside of any read side critical section, or offline.
+ */
+static void rcu_reader_put(struct rcu_flavor *f, struct rcu_reader *r)
+{
+	__atomic_store_n(&r->ctr, 0, __ATOMIC_RELEASE);
+	r->nesting = 0;
+	pthread_mutex_lock(&f->registry_lock);
+	r->in_use = 0;
+	pthread_mutex_unlock(&f->registry_lock);
+}
+
+static void rcu_epoch_reader_put(void *arg)
+{
+	rcu_reader_put(&rcu_epoch, (struct rcu_reader *)arg);
+}
+
+static void rcu_qsbr_reader_put(void *arg)
+{
+	rcu_reader_put(&rcu_qsbr, (struct rcu_reader *)arg);
+}
+
+static void rcu_epoch_key_init(void)
+{
+	/*
+	 * Readers can do without smp_mb() only if every grace period can
+	 * force a barrier on all cpus running our threads.
+	 */
+	if (!syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0))
+		rcu_epoch_has_membarrier = 1;
+	pthread_key_create(&rcu_epoch.key, rcu_epoch_reader_put);
+}
+
+static void rcu_qsbr_key_init(void)
+{
+	pthread_key_create(&rcu_qsbr.key, rcu_qsbr_reader_put);
+}
+
+static void rcu_flavor_init(struct rcu_flavor *f)
+{
+	pthread_once(&f->once, f == &rcu_epoch ? rcu_epoch_key_init : rcu_qsbr_key_init);
+}
+
+static struct rcu_reader *rcu_reader_get(struct rcu_flavor *f)
+{
+	struct rcu_reader *r;
+
+	rcu_flavor_init(f);
+	pthread_mutex_lock(&f->registry_lock);
+	for (r = f->readers; r; r = r->next) {
+		if (!r->in_use)
+			break;
+	}
+	if (!r) {
+		/* not aligned_alloc(), list builds this as gnu99 */
+		if (posix_memalign((void **)&r, 64, sizeof(*r)))
+			abort();
+		*r = (struct rcu_reader){ 0 };
+		r->next = f->readers;
+		/* a writer that sees the new head sees the counter */
+		__atomic_store_n(&f->readers, r, __ATOMIC_RELEASE);
+	}
+	r->in_use = 1;
+	pthread_mutex_unlock(&f->registry_lock);
+
+	pthread_setspecific(f->key, r);
+	return r;
+}
+
+/**
+ * rcu_epoch_register_thread - give the calling thread an epoch counter
+ *
+ * rcu_epoch_read_lock() does this on first use.
+ *
+ * Return: the counter of the calling thread
+ */
+struct rcu_reader *rcu_epoch_register_thread(void)
+{
+	if (!rcu_epoch_self)
+		rcu_epoch_self = rcu_reader_get(&rcu_epoch);
+	return rcu_epoch_self;
+}
+
+void rcu_epoch_unregister_thread(void)
+{
+	if (!rcu_epoch_self)
+		return;
+
+	pthread_setspecific(rcu_epoch.key, NULL);
+	rcu_reader_put(&rcu_epoch, rcu_epoch_self);
+	rcu_epoch_self = NULL;
+}
+
+/**
+ * rcu_qsbr_register_thread - make the calling thread a QSBR reader
+ *
+ * The thread is online when this returns.
+ *
+ * Return: the counter of the calling thread
+ */
+struct rcu_reader *rcu_qsbr_register_thread(void)
+{
+	if (!rcu_qsbr_self)
+		rcu_qsbr_self = rcu_reader_get(&rcu_qsbr);
+	rcu_qsbr_thread_online();
+	return rcu_qsbr_self;
+}
+
+void rcu_qsbr_unregister_thread(void)
+{
+	if (!rcu_qsbr_self)
+		return;
+
+	rcu_qsbr_thread_offline();
+	pthread_setspecific(rcu_qsbr.key, NULL);
+	rcu_reader_put(&rcu_qsbr, rcu_qsbr_self);
+	rcu_qsbr_self = NULL;
+}
+
+/*
+ * rcu_synchronize - wait until every reader that may still hold a pointer
+ * removed before the call is done with it
+ *
+ * The counters are 64 bit on 64 bit machines and never wrap, one increment
+ * is enough: a reader with an older counter started before the grace
+ * period, one with the new counter or 0 does not matter. liburcu flips a
+ * phase bit twice instead to be safe with 32 bit counters.
+ */
+static void rcu_synchronize(struct rcu_flavor *f)
+{
+	struct rcu_reader *r;
+	unsigned long gp;
+
+	rcu_flavor_init(f);
+	/* removals before this are visible to readers that start after it */
+	f->smp_mb_master();
+
+	pthread_mutex_lock(&f->gp_lock);
+	gp = *f->gp_ctr + 1;
+	__atomic_store_n(f->gp_ctr, gp, __ATOMIC_RELAXED);
+	/* readers that report a quiescent state from now on copy the new one */
+	smp_mb();
+
+	for (r = __atomic_load_n(&f->readers, __ATOMIC_ACQUIRE); r; r = r->next) {
+		unsigned int spins = 0;
+		unsigned long c;
+
+		while ((c = __atomic_load_n(&r->ctr, __ATOMIC_RELAXED)) && c < gp)
+			spin_relax(&spins);
+	}
+	pthread_mutex_unlock(&f->gp_lock);
+
+	/* the readers we waited for are done before anything is freed */
+	f->smp_mb_master();
+}
+
+/**
+ * rcu_epoch_synchronize - wait for an epoch grace period
+ */
+void rcu_epoch_synchronize(void)
+{
+	rcu_synchronize(&rcu_epoch);
+}
+
+/**
+ * rcu_qsbr_synchronize - wait for a QSBR grace period
+ *
+ * A registered caller goes offline while it waits, so it does not wait
+ * for itself.
+ */
+void rcu_qsbr_synchronize(void)
+{
+	int online = rcu_qsbr_self && __atomic_load_n(&rcu_qsbr_self->ctr, __ATOMIC_RELAXED);
+
+	if (online)
+		rcu_qsbr_thread_offline();
+	rcu_synchronize(&rcu_qsbr);
+	if (online)
+		rcu_qsbr_thread_online();
+}
+
+/*
+ * The helper thread of a flavor: takes all queued callbacks, waits for one
+ * grace period and invokes them. Callbacks queued while it waits form the
+ * next batch.
+ */
+static void *rcu_cb_thread(void *arg)
+{
+	struct rcu_flavor *f = (struct rcu_flavor *)arg;
+
+	for (;;) {
+		struct rcu_head *list, *next;
+		unsigned long n = 0;
+
+		pthread_mutex_lock(&f->cb_lock);
+		while (!f->cb_head)
+			pthread_cond_wait(&f->cb_cond, &f->cb_lock);
+		list = f->cb_head;
+		f->cb_head = NULL;
+		f->cb_tail = &f->cb_head;
+		pthread_mutex_unlock(&f->cb_lock);
+
+		rcu_synchronize(f);
+		for (; list; list = next) {
+			next = list->next;
+			list->func(list);
+			n++;
+		}
+
+		pthread_mutex_lock(&f->cb_lock);
+		f->cb_done += n;
+		pthread_cond_broadcast(&f->cb_cond);
+		pthread_mutex_unlock(&f->cb_lock);
+	}
+	return NULL;
+}
+
+static void rcu_call(struct rcu_flavor *f, struct rcu_head *head,
+		     void (*func)(struct rcu_head *head))
+{
+	pthread_t tid;
+
+	head->next = NULL;
+	head->func = func;
+
+	pthread_mutex_lock(&f->cb_lock);
+	if (!f->cb_thread) {
+		if (pthread_create(&tid, NULL, rcu_cb_thread, f))
+			abort();
+		pthread_detach(tid);
+		f->cb_thread = 1;
+	}
+	*f->cb_tail = head;
+	f->cb_tail = &head->next;
+	f->cb_queued++;
+	pthread_cond_broadcast(&f->cb_cond);
+	pthread_mutex_unlock(&f->cb_lock);
+}
+
+static void rcu_barrier_wait(struct rcu_flavor *f)
+{
+	unsigned long queued;
+
+	pthread_mutex_lock(&f->cb_lock);
+	queued = f->cb_queued;
+	while (f->cb_done < queued)
+		pthread_cond_wait(&f->cb_cond, &f->cb_lock);
+	pthread_mutex_unlock(&f->cb_lock);
+}
+
+/**
+ * rcu_epoch_call - invoke @func(@head) after an epoch grace period
+ * @head: structure to be used for queueing the RCU updates
+ * @func: actual callback function to be invoked after the grace period
+ *
+ * @func runs in the helper thread of the flavor, it must not block for long.
+ */
+void rcu_epoch_call(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	rcu_call(&rcu_epoch, head, func);
+}
+
+/**
+ * rcu_epoch_barrier - wait for the callbacks queued by rcu_epoch_call()
+ */
+void rcu_epoch_barrier(void)
+{
+	rcu_barrier_wait(&rcu_epoch);
+}
+
+/**
+ * rcu_qsbr_call - invoke @func(@head) after a QSBR grace period
+ * @head: structure to be used for queueing the RCU updates
+ * @func: actual callback function to be invoked after the grace period
+ */
+void rcu_qsbr_call(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	rcu_call(&rcu_qsbr, head, func);
+}
+
+/**
+ * rcu_qsbr_barrier - wait for the callbacks queued by rcu_qsbr_call()
+ *
+ * A registered caller goes offline while it waits.
+ */
+void rcu_qsbr_barrier(void)
+{
+	int online = rcu_qsbr_self && __atomic_load_n(&rcu_qsbr_self->ctr, __ATOMIC_RELAXED);
+
+	if (online)
+		rcu_qsbr_thread_offline();
+	rcu_barrier_wait(&rcu_qsbr);
+	if (online)
+		rcu_qsbr_thread_online();
+}
@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Read-copy update in user space, with the interface of
+ * include/linux/rcupdate.h and the two flavors of liburcu that need no
+ * signals:
+ *
+ * rcu_epoch_*  Every thread has a counter on its own cache line. The outer
+ *              rcu_read_lock() copies the grace period counter into it and
+ *              the outer rcu_read_unlock() clears it, nothing else is
+ *              written. synchronize_rcu() bumps the grace period counter and
+ *              waits until no thread holds an older one. The barriers the
+ *              readers would need are done by the writer with the
+ *              membarrier() system call, readers only have a compiler
+ *              barrier; without membarrier() they use smp_mb().
+ *
+ * rcu_qsbr_*   Quiescent state based. rcu_read_lock() and rcu_read_unlock()
+ *              are empty, each registered thread instead calls
+ *              rcu_quiescent_state() from time to time outside of its read
+ *              side critical sections, or goes offline with
+ *              rcu_thread_offline() before it blocks. A grace period ends
+ *              when every online thread has passed a quiescent state. The
+ *              read side costs nothing, but a thread that forgets to report
+ *              stalls every writer.
+ *
+ * The kernel names map to the epoch flavor, or to QSBR when
+ * CONFIG_RCU_QSBR is defined. The QSBR calls exist in the epoch flavor as
+ * well and do nothing there, so code written for QSBR works with both.
+ * Epoch readers register on their first rcu_read_lock(). QSBR threads
+ * register on their first rcu_read_lock(), rcu_quiescent_state() or
+ * rcu_thread_online() and start online, so a thread that never reads is
+ * never waited for; rcu_register_thread() does it up front. All threads
+ * give their counter back when they exit.
+ *
+ * call_rcu() queues a callback that a helper thread of the flavor invokes
+ * after a grace period; the helper waits for one grace period per batch of
+ * callbacks, not per callback. rcu_barrier() waits for all callbacks queued
+ * before it. Calling synchronize_rcu() or rcu_barrier() inside a read side
+ * critical section deadlocks, like in the kernel.
+ *
+ * rcu_dereference() is a plain load: readers rely on the address
+ * dependency from the pointer to what it points to, which every cpu the
+ * barriers in barrier.h support keeps in order.
+ */
+#ifndef _LOCKING_RCUPDATE_H
+#define _LOCKING_RCUPDATE_H
+
+#include "barrier.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+/* the counter of one thread, only that thread writes it */
+struct rcu_reader {
+	/*
+	 * The grace period counter of the last rcu_read_lock() or quiescent
+	 * state, 0 while outside of a read side critical section (epoch) or
+	 * offline (QSBR).
+	 */
+	unsigned long ctr;
+	unsigned int nesting;	/* epoch, read locks held */
+	int in_use;
+	struct rcu_reader *next;
+} __attribute__((aligned(64)));
+
+/* starts at 1, 0 in a reader's ctr means no grace period to wait for */
+extern unsigned long rcu_epoch_gp_ctr;
+extern unsigned long rcu_qsbr_gp_ctr;
+extern int rcu_epoch_has_membarrier;
+
+extern __thread struct rcu_reader *rcu_epoch_self;
+extern __thread struct rcu_reader *rcu_qsbr_self;
+
+extern struct rcu_reader *rcu_epoch_register_thread(void);
+extern void rcu_epoch_unregister_thread(void);
+extern void rcu_epoch_synchronize(void);
+extern void rcu_epoch_call(struct rcu_head *head,
+			   void (*func)(struct rcu_head *head));
+extern void rcu_epoch_barrier(void);
+
+extern struct rcu_reader *rcu_qsbr_register_thread(void);
+extern void rcu_qsbr_unregister_thread(void);
+extern void rcu_qsbr_synchronize(void);
+extern void rcu_qsbr_call(struct rcu_head *head,
+			  void (*func)(struct rcu_head *head));
+extern void rcu_qsbr_barrier(void);
+
+/* the reader half of a barrier the writer may do with membarrier() */
+static inline void rcu_epoch_smp_mb_slave(void)
+{
+	if (__builtin_expect(rcu_epoch_has_membarrier, 1))
+		barrier();
+	else
+		smp_mb();
+}
+
+/**
+ * rcu_epoch_read_lock - enter an epoch read side critical section
+ *
+ * Nests. Registers the calling thread on its first use.
+ */
+static inline void rcu_epoch_read_lock(void)
+{
+	struct rcu_reader *r = rcu_epoch_self;
+
+	if (__builtin_expect(!r, 0))
+		r = rcu_epoch_register_thread();
+	if (r->nesting++)
+		return;
+
+	__atomic_store_n(&r->ctr,
+			 __atomic_load_n(&rcu_epoch_gp_ctr, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	/* the counter is visible before we load any protected pointer */
+	rcu_epoch_smp_mb_slave();
+}
+
+/**
+ * rcu_epoch_read_unlock - leave an epoch read side critical section
+ */
+static inline void rcu_epoch_read_unlock(void)
+{
+	struct rcu_reader *r = rcu_epoch_self;
+
+	if (--r->nesting)
+		return;
+
+	/* our loads are done before a writer sees us leave */
+	rcu_epoch_smp_mb_slave();
+	__atomic_store_n(&r->ctr, 0, __ATOMIC_RELAXED);
+}
+
+static inline void rcu_epoch_quiescent_state(void)
+{
+}
+
+static inline void rcu_epoch_thread_offline(void)
+{
+}
+
+static inline void rcu_epoch_thread_online(void)
+{
+}
+
+/**
+ * rcu_qsbr_read_lock - enter a QSBR read side critical section
+ *
+ * Empty apart from registering the calling thread on its first use, an
+ * unregistered reader would be invisible to writers.
+ */
+static inline void rcu_qsbr_read_lock(void)
+{
+	if (__builtin_expect(!rcu_qsbr_self, 0))
+		rcu_qsbr_register_thread();
+	barrier();
+}
+
+static inline void rcu_qsbr_read_unlock(void)
+{
+	barrier();
+}
+
+/**
+ * rcu_qsbr_quiescent_state - report that we hold no RCU protected pointer
+ *
+ * Must be called by every online QSBR thread from time to time, outside
+ * of read side critical sections. Costs two loads while no writer waits.
+ * Registers the calling thread on its first use, which is a quiescent
+ * state in itself.
+ */
+static inline void rcu_qsbr_quiescent_state(void)
+{
+	struct rcu_reader *r = rcu_qsbr_self;
+	unsigned long gp;
+
+	if (__builtin_expect(!r, 0)) {
+		rcu_qsbr_register_thread();
+		return;
+	}
+
+	gp = __atomic_load_n(&rcu_qsbr_gp_ctr, __ATOMIC_RELAXED);
+	if (gp == r->ctr)
+		return;
+
+	/* earlier loads of protected pointers are done */
+	smp_mb();
+	__atomic_store_n(&r->ctr, gp, __ATOMIC_RELAXED);
+	/* and later ones only start now */
+	smp_mb();
+}
+
+/**
+ * rcu_qsbr_thread_offline - stop taking part in grace periods
+ *
+ * For a thread that is about to block for a while. It must not use RCU
+ * protected pointers until rcu_qsbr_thread_online(), which registers the
+ * calling thread if it is not yet. An unregistered thread is offline
+ * already.
+ */
+static inline void rcu_qsbr_thread_offline(void)
+{
+	if (!rcu_qsbr_self)
+		return;
+
+	smp_mb();
+	__atomic_store_n(&rcu_qsbr_self->ctr, 0, __ATOMIC_RELAXED);
+}
+
+static inline void rcu_qsbr_thread_online(void)
+{
+	/* registering puts the thread online */
+	if (__builtin_expect(!rcu_qsbr_self, 0)) {
+		rcu_qsbr_register_thread();
+		return;
+	}
+
+	__atomic_store_n(&rcu_qsbr_self->ctr,
+			 __atomic_load_n(&rcu_qsbr_gp_ctr, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	smp_mb();
+}
+
+#ifdef CONFIG_RCU_QSBR
+#define __RCU_FLAVOR(op)	rcu_qsbr_##op
+#else
+#define __RCU_FLAVOR(op)	rcu_epoch_##op
+#endif
+
+#define rcu_read_lock()			__RCU_FLAVOR(read_lock)()
+#define rcu_read_unlock()		__RCU_FLAVOR(read_unlock)()
+#define rcu_quiescent_state()		__RCU_FLAVOR(quiescent_state)()
+#define rcu_thread_offline()		__RCU_FLAVOR(thread_offline)()
+#define rcu_thread_online()		__RCU_FLAVOR(thread_online)()
+#define rcu_register_thread()		((void)__RCU_FLAVOR(register_thread)())
+#define rcu_unregister_thread()		__RCU_FLAVOR(unregister_thread)()
+#define synchronize_rcu()		__RCU_FLAVOR(synchronize)()
+#define call_rcu(head, func)		__RCU_FLAVOR(call)(head, func)
+#define rcu_barrier()			__RCU_FLAVOR(barrier)()
+
+/**
+ * rcu_dereference - fetch an RCU protected pointer for dereferencing
+ * @p: The pointer to read
+ */
+#define rcu_dereference(p)	__atomic_load_n(&(p), __ATOMIC_RELAXED)
+
+/* for code ported from the kernel, no lockdep checks to skip here */
+#define rcu_dereference_raw(p)	rcu_dereference(p)
+
+/**
+ * rcu_access_pointer - fetch an RCU protected pointer without dereferencing it
+ * @p: The pointer to read
+ *
+ * For comparing against NULL or another pointer, also outside of read
+ * side critical sections.
+ */
+#define rcu_access_pointer(p)	__atomic_load_n(&(p), __ATOMIC_RELAXED)
+
+/**
+ * rcu_dereference_protected - fetch an RCU pointer when updates are prevented
+ * @p: The pointer to read
+ * @c: The conditions under which the dereference will take place
+ *
+ * @c is not checked, it documents the lock the caller holds.
+ */
+#define rcu_dereference_protected(p, c)	(p)
+
+/**
+ * rcu_assign_pointer - assign to an RCU protected pointer
+ * @p: pointer to assign to
+ * @v: value to assign (publish)
+ *
+ * The initialization of what @v points to is visible before @v.
+ */
+#define rcu_assign_pointer(p, v)	smp_store_release(&(p), v)
+
+/**
+ * RCU_INIT_POINTER - initialize an RCU protected pointer
+ * @p: The pointer to be initialized.
+ * @v: The value to initialized the pointer to.
+ *
+ * No ordering, for NULL or for a structure readers already can see.
+ */
+#define RCU_INIT_POINTER(p, v)	__atomic_store_n(&(p), v, __ATOMIC_RELAXED)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOCKING_RCUPDATE_H */
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include "brlock.h"
+#include "qrwlock.h"
+#include "rcupdate.h"
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 读写锁在不同读写比例下的吞吐量和写者的等待时间
+ *
+ * 所有线程反复加锁访问同一份配置，每次按比例决定读还是写，读者拷出整份配置，写者更新整份配置：
+ *   pthread    pthread_rwlock_t的默认属性，读者优先，读者源源不断时写者一直拿不到锁
+ *   pthread_w  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP，有写者在等时新来的读者让路
+ *   qrwlock    仿照内核的排队读写锁，拿不到锁的读者和写者在q自旋锁上排队
+ *   brlock     qrwlock加上读者偏向，读者只写自己线程的槽位，写者收回偏向后等所有槽位清空
+ *   rcu        读者不加锁，只在进出临界区时写自己线程的计数器；写者之间用mutex互斥，
+ *              拷一份新配置改好后换上去，旧的交给call_rcu在宽限期后释放
+ *   rcu_qsbr   读者什么都不写，每次循环报告一次静止状态
+ *
+ * 1. 只读：线程数从1翻倍加到所有的硬件线程，输出每个线程每秒的加锁次数，读者之间不互斥，
+ *    理想情况下不随线程数下降，读者计数所在的cache line在cpu之间来回搬时会下降
+ * 2. 读写混合：每种比例输出每秒的加锁次数、写者平均和最长等了多久，写者被饿死时最长等待会很大
+ *
+ * 用法：./rwlock_bench [每项的运行毫秒数] [线程数]
+ */
+
+#define BENCH_MAX_THREADS 256
+#define ROUTE_GATEWAYS 7
+/* 锁外做的事，模拟真实程序里两次加锁之间的工作 */
+#define BENCH_THINK 50
+
+struct route_config
+{
+    unsigned long version;
+    unsigned long gateway[ROUTE_GATEWAYS];
+};
+
+struct bench_thread
+{
+    pthread_t tid;
+    int cpu;
+    unsigned long long ops;
+    unsigned long long writes;
+    unsigned long long write_ns; /* 所有写加锁等待的时间 */
+    unsigned long long max_write_ns;
+} __attribute__((aligned(64)));
+
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+static struct route_config route __attribute__((aligned(64)));
+static volatile int bench_stop;
+static int bench_ms = 200;
+static int nr_threads;
+/* 每1000次里写几次 */
+static unsigned int write_permille;
+
+static pthread_rwlock_t bench_pthread_l;
+static pthread_rwlock_t bench_pthread_w_l;
+static struct qrwlock bench_qrwlock_l;
+static struct brlock bench_brlock_l;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 线程按顺序绑定到各个cpu上，cpu不够就轮着来 */
+static void bench_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static inline void bench_think(void)
+{
+    for (volatile int i = 0; i < BENCH_THINK; i++)
+        ;
+}
+
+/* xorshift，每个线程自己的随机数 */
+static inline unsigned long bench_rand(unsigned long *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* 每种锁生成一个线程函数，读写的临界区都一样 */
+#define DEFINE_RWLOCK_BENCH(lock, read_lock, read_unlock, write_lock, write_unlock) \
+    static void *bench_##lock(void *arg)                                           \
+    {                                                                              \
+        struct bench_thread *t = arg;                                              \
+        unsigned long x = 88172645463325252UL + t->cpu;                            \
+        struct route_config c;                                                     \
+                                                                                   \
+        bench_pin(t->cpu);                                                         \
+        while (!bench_stop)                                                        \
+        {                                                                          \
+            if (bench_rand(&x) % 1000 < write_permille)                            \
+            {                                                                      \
+                unsigned long long start = now_ns(), ns;                           \
+                                                                                   \
+                write_lock(&bench_##lock##_l);                                     \
+                ns = now_ns() - start;                                             \
+                route.version++;                                                   \
+                for (int i = 0; i < ROUTE_GATEWAYS; i++)                           \
+                    route.gateway[i] = route.version * (i + 1);                    \
+                write_unlock(&bench_##lock##_l);                                   \
+                                                                                   \
+                t->writes++;                                                       \
+                t->write_ns += ns;                                                 \
+                if (ns > t->max_write_ns)                                          \
+                    t->max_write_ns = ns;                                          \
+            }                                                                      \
+            else                                                                   \
+            {                                                                      \
+                read_lock(&bench_##lock##_l);                                      \
+                c = route;                                                         \
+                read_unlock(&bench_##lock##_l);                                    \
+                __asm__ __volatile__("" : : "r"(&c) : "memory");                   \
+            }                                                                      \
+            t->ops++;                                                              \
+            bench_think();                                                         \
+        }                                                                          \
+        return NULL;                                                               \
+    }
+
+DEFINE_RWLOCK_BENCH(pthread, pthread_rwlock_rdlock, pthread_rwlock_unlock, pthread_rwlock_wrlock,
+                    pthread_rwlock_unlock)
+DEFINE_RWLOCK_BENCH(pthread_w, pthread_rwlock_rdlock, pthread_rwlock_unlock, pthread_rwlock_wrlock,
+                    pthread_rwlock_unlock)
+DEFINE_RWLOCK_BENCH(qrwlock, queued_read_lock, queued_read_unlock, queued_write_lock,
+                    queued_write_unlock)
+DEFINE_RWLOCK_BENCH(brlock, brlock_read_lock, brlock_read_unlock, brlock_write_lock,
+                    brlock_write_unlock)
+
+/* rcu保护的配置，写者换指针，读者拷出整份配置 */
+struct route_config_rcu
+{
+    struct route_config c;
+    struct rcu_head rcu;
+};
+
+static struct route_config_rcu *route_rcu;
+static pthread_mutex_t route_rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void route_rcu_free(struct rcu_head *head)
+{
+    free((char *)head - offsetof(struct route_config_rcu, rcu));
+}
+
+/* 每种rcu生成一个线程函数，写者等待的时间是拿到route_rcu_lock的时间 */
+#define DEFINE_RCU_BENCH(flavor)                                                   \
+    static void *bench_##flavor(void *arg)                                         \
+    {                                                                              \
+        struct bench_thread *t = arg;                                              \
+        unsigned long x = 88172645463325252UL + t->cpu;                            \
+        struct route_config c;                                                     \
+                                                                                   \
+        bench_pin(t->cpu);                                                         \
+        flavor##_register_thread();                                                \
+        while (!bench_stop)                                                        \
+        {                                                                          \
+            if (bench_rand(&x) % 1000 < write_permille)                            \
+            {                                                                      \
+                unsigned long long start = now_ns(), ns;                           \
+                struct route_config_rcu *old, *n = malloc(sizeof(*n));             \
+                                                                                   \
+                pthread_mutex_lock(&route_rcu_lock);                               \
+                ns = now_ns() - start;                                             \
+                old = rcu_dereference_protected(route_rcu, 1);                     \
+                n->c.version = old->c.version + 1;                                 \
+                for (int i = 0; i < ROUTE_GATEWAYS; i++)                           \
+                    n->c.gateway[i] = n->c.version * (i + 1);                      \
+                rcu_assign_pointer(route_rcu, n);                                  \
+                pthread_mutex_unlock(&route_rcu_lock);                             \
+                flavor##_call(&old->rcu, route_rcu_free);                          \
+                                                                                   \
+                t->writes++;                                                       \
+                t->write_ns += ns;                                                 \
+                if (ns > t->max_write_ns)                                          \
+                    t->max_write_ns = ns;                                          \
+            }                                                                      \
+            else                                                                   \
+            {                                                                      \
+                flavor##_read_lock();                                              \
+                c = rcu_dereference(route_rcu)->c;                                 \
+                flavor##_read_unlock();                                            \
+                __asm__ __volatile__("" : : "r"(&c) : "memory");                   \
+            }                                                                      \
+            t->ops++;                                                              \
+            flavor##_quiescent_state();                                            \
+            bench_think();                                                         \
+        }                                                                          \
+        flavor##_unregister_thread();                                              \
+        return NULL;                                                               \
+    }
+
+DEFINE_RCU_BENCH(rcu_epoch)
+DEFINE_RCU_BENCH(rcu_qsbr)
+
+struct bench_impl
+{
+    const char *name;
+    void *(*fn)(void *);
+};
+
+static const struct bench_impl bench_impls[] = {
+    {"pthread", bench_pthread},
+    {"pthread_w", bench_pthread_w},
+    {"qrwlock", bench_qrwlock},
+    {"brlock", bench_brlock},
+    {"rcu", bench_rcu_epoch},
+    {"rcu_qsbr", bench_rcu_qsbr},
+};
+
+#define NR_BENCH_IMPLS (sizeof(bench_impls) / sizeof(bench_impls[0]))
+
+/* 一次bench_run的结果 */
+struct bench_result
+{
+    double mops;
+    unsigned long long writes;
+    double write_ns;     /* 写者平均等待的纳秒数 */
+    double max_write_us; /* 写者最长等待的微秒数 */
+};
+
+/* 跑nr个线程 */
+static struct bench_result bench_run(void *(*fn)(void *), int nr)
+{
+    unsigned long long start, ns, ops = 0, writes = 0, write_ns = 0, max_write_ns = 0;
+    struct bench_result r;
+    int i;
+
+    bench_stop = 0;
+    memset(bench_threads, 0, sizeof(bench_threads));
+
+    start = now_ns();
+    for (i = 0; i < nr; i++)
+    {
+        bench_threads[i].cpu = i;
+        pthread_create(&bench_threads[i].tid, NULL, fn, &bench_threads[i]);
+    }
+
+    usleep(bench_ms * 1000);
+    bench_stop = 1;
+    for (i = 0; i < nr; i++)
+    {
+        struct bench_thread *t = &bench_threads[i];
+
+        pthread_join(t->tid, NULL);
+        ops += t->ops;
+        writes += t->writes;
+        write_ns += t->write_ns;
+        if (t->max_write_ns > max_write_ns)
+            max_write_ns = t->max_write_ns;
+    }
+    ns = now_ns() - start;
+
+    r.mops = (double)ops * 1000 / ns;
+    r.writes = writes;
+    r.write_ns = writes ? (double)write_ns / writes : 0;
+    r.max_write_us = (double)max_write_ns / 1000;
+    return r;
+}
+
+/* 线程数按1、2、4……翻倍，最后一定跑一次nr_threads */
+static int next_threads(int nr)
+{
+    if (nr == nr_threads)
+        return 0;
+    return nr * 2 < nr_threads ? nr * 2 : nr_threads;
+}
+
+/* 只读，每行是一个线程数，每列是一种锁 */
+static void bench_read_table(void)
+{
+    unsigned int i;
+    int nr;
+
+    write_permille = 0;
+    printf("threads");
+    for (i = 0; i < NR_BENCH_IMPLS; i++)
+        printf(" %10s", bench_impls[i].name);
+    printf("\r\n");
+    for (nr = 1; nr; nr = next_threads(nr))
+    {
+        printf("%7d", nr);
+        for (i = 0; i < NR_BENCH_IMPLS; i++)
+        {
+            printf(" %10.2f", bench_run(bench_impls[i].fn, nr).mops / nr);
+            fflush(stdout);
+        }
+        printf("\r\n");
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    static const unsigned int ratios[] = {1, 10, 100, 500};
+    pthread_rwlockattr_t attr;
+
+    nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        bench_ms = atoi(argv[1]);
+    if (argc > 2)
+        nr_threads = atoi(argv[2]);
+    if (bench_ms <= 0 || nr_threads <= 0 || nr_threads > BENCH_MAX_THREADS)
+    {
+        printf("usage: %s [ms] [threads]\r\n", argv[0]);
+        exit(1);
+    }
+
+    pthread_rwlock_init(&bench_pthread_l, NULL);
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&bench_pthread_w_l, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    queued_rwlock_init(&bench_qrwlock_l);
+
+    brlock_init(&bench_brlock_l);
+    route_rcu = calloc(1, sizeof(*route_rcu));
+
+    printf("qrwlock %zu bytes, brlock %zu bytes, pthread_rwlock_t %zu bytes\r\n", sizeof(struct qrwlock),
+           sizeof(struct brlock), sizeof(pthread_rwlock_t));
+    printf("=====reads only, Mops/s per thread======\r\n");
+    bench_read_table();
+    for (unsigned int i = 0; i < sizeof(ratios) / sizeof(ratios[0]); i++)
+    {
+        write_permille = ratios[i];
+        printf("=====%d threads, %.1f%% writes======\r\n", nr_threads, ratios[i] / 10.0);
+        for (unsigned int j = 0; j < NR_BENCH_IMPLS; j++)
+        {
+            struct bench_result r = bench_run(bench_impls[j].fn, nr_threads);
+
+            printf("%-10s %8.2f Mops/s %10llu writes, write wait avg %8.0f ns, max %8.0f us\r\n",
+                   bench_impls[j].name, r.mops, r.writes, r.write_ns, r.max_write_us);
+        }
+    }
+
+    rcu_epoch_barrier();
+    rcu_qsbr_barrier();
+    free(route_rcu);
+    pthread_rwlock_destroy(&bench_pthread_l);
+    pthread_rwlock_destroy(&bench_pthread_w_l);
+    exit(0);
+}
@@ -0,0 +1,208 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Sequence counters and sequential locks, modelled on include/linux/seqlock.h
+ *
+ * A writer makes the sequence odd before it touches the data and even again
+ * afterwards. Readers take no lock at all: they remember the sequence, read
+ * the data and retry if the sequence changed in the meantime. Readers never
+ * write a shared cache line, so they scale with the number of cpus, but a
+ * reader can see the data half updated and must not act on it (follow a
+ * pointer, index an array) before read_seqretry() said the copy is good.
+ *
+ *   seqcount_t          the bare counter, writers serialize themselves
+ *   seqlock_t           a seqcount_t plus a spinlock_t for the writers
+ *   seqcount_latch_t    a seqcount_t for two copies of the data, readers
+ *                       never wait for a writer, see raw_write_seqcount_latch()
+ *
+ * The barriers are the C11 fences that match the kernel's smp_rmb() and
+ * smp_wmb(): a reader's acquire fence keeps its data loads before the
+ * second load of the sequence, a writer's release fence keeps the odd
+ * sequence before its data stores.
+ */
+#ifndef _LOCKING_SEQLOCK_H
+#define _LOCKING_SEQLOCK_H
+
+#include <stdbool.h>
+#include "processor.h"
+#include "spinlock.h"
+
+typedef struct seqcount {
+	unsigned int sequence;
+} seqcount_t;
+
+#define SEQCNT_ZERO(name)	{ .sequence = 0 }
+
+static inline void seqcount_init(seqcount_t *s)
+{
+	__atomic_store_n(&s->sequence, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * raw_read_seqcount - read the sequence without waiting for writers
+ * @s: seqcount_t
+ *
+ * Return: the sequence, odd while a writer is inside
+ */
+static inline unsigned int raw_read_seqcount(const seqcount_t *s)
+{
+	return __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * read_seqcount_begin - start a read section
+ * @s: seqcount_t
+ *
+ * Waits until no writer is inside, there is no point in reading data that
+ * is being changed.
+ *
+ * Return: the sequence to pass to read_seqcount_retry()
+ */
+static inline unsigned int read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned int spins = 0;
+	unsigned int seq;
+
+	while ((seq = raw_read_seqcount(s)) & 1)
+		spin_relax(&spins);
+	return seq;
+}
+
+/**
+ * read_seqcount_retry - end a read section
+ * @s: seqcount_t
+ * @start: the sequence returned by read_seqcount_begin()
+ *
+ * Return: true if a writer came by and the data read must be thrown away
+ */
+static inline bool read_seqcount_retry(const seqcount_t *s, unsigned int start)
+{
+	/* smp_rmb(), the data loads above stay above */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	unsigned int seq = __atomic_load_n(&s->sequence, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&s->sequence, seq + 1, __ATOMIC_RELAXED);
+	/* smp_wmb(), readers see the odd sequence before any new data */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	unsigned int seq = __atomic_load_n(&s->sequence, __ATOMIC_RELAXED);
+
+	/* the new data is visible before the even sequence */
+	__atomic_store_n(&s->sequence, seq + 1, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+	seqcount_t seqcount;
+	spinlock_t lock;
+} seqlock_t;
+
+#ifdef __SPIN_LOCK_UNLOCKED
+#define __SEQLOCK_UNLOCKED(name) \
+	{ .seqcount = SEQCNT_ZERO(name), .lock = __SPIN_LOCK_UNLOCKED }
+
+#define DEFINE_SEQLOCK(name)	seqlock_t name = __SEQLOCK_UNLOCKED(name)
+#endif
+
+static inline void seqlock_init(seqlock_t *sl)
+{
+	seqcount_init(&sl->seqcount);
+	spin_lock_init(&sl->lock);
+}
+
+static inline unsigned int read_seqbegin(const seqlock_t *sl)
+{
+	return read_seqcount_begin(&sl->seqcount);
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, unsigned int start)
+{
+	return read_seqcount_retry(&sl->seqcount, start);
+}
+
+static inline void write_seqlock(seqlock_t *sl)
+{
+	spin_lock(&sl->lock);
+	write_seqcount_begin(&sl->seqcount);
+}
+
+static inline void write_sequnlock(seqlock_t *sl)
+{
+	write_seqcount_end(&sl->seqcount);
+	spin_unlock(&sl->lock);
+}
+
+/*
+ * A reader that must not retry, because it has side effects or keeps
+ * failing under a stream of writers, takes the lock like a writer but
+ * leaves the sequence alone, lockless readers are not disturbed.
+ */
+static inline void read_seqlock_excl(seqlock_t *sl)
+{
+	spin_lock(&sl->lock);
+}
+
+static inline void read_sequnlock_excl(seqlock_t *sl)
+{
+	spin_unlock(&sl->lock);
+}
+
+/*
+ * The latch keeps two copies of the data, data[0] and data[1]. The low
+ * bit of the sequence says which copy readers should use; the writer
+ * always modifies the other one:
+ *
+ *	raw_write_seqcount_latch(&latch->seq);	// readers move to data[1]
+ *	modify(latch->data[0], ...);
+ *	raw_write_seqcount_latch(&latch->seq);	// readers move to data[0]
+ *	modify(latch->data[1], ...);
+ *
+ *	do {
+ *		seq = raw_read_seqcount_latch(&latch->seq);
+ *		entry = query(latch->data[seq & 1], ...);
+ *	} while (read_seqcount_latch_retry(&latch->seq, seq));
+ *
+ * A reader therefore always has a stable copy to read and never spins,
+ * which also makes it safe to read from a signal handler that interrupted
+ * the writer. It only retries when the writer switched copies under it.
+ * Writers must be serialized by the caller.
+ */
+typedef struct {
+	seqcount_t seqcount;
+} seqcount_latch_t;
+
+#define SEQCNT_LATCH_ZERO(name)	{ .seqcount = SEQCNT_ZERO(name.seqcount) }
+
+static inline void seqcount_latch_init(seqcount_latch_t *s)
+{
+	seqcount_init(&s->seqcount);
+}
+
+static inline unsigned int raw_read_seqcount_latch(const seqcount_latch_t *s)
+{
+	return raw_read_seqcount(&s->seqcount);
+}
+
+static inline bool read_seqcount_latch_retry(const seqcount_latch_t *s,
+					     unsigned int start)
+{
+	return read_seqcount_retry(&s->seqcount, start);
+}
+
+static inline void raw_write_seqcount_latch(seqcount_latch_t *s)
+{
+	unsigned int seq = __atomic_load_n(&s->seqcount.sequence, __ATOMIC_RELAXED);
+
+	/* the copy we finished is complete before readers move to it ... */
+	__atomic_store_n(&s->seqcount.sequence, seq + 1, __ATOMIC_RELEASE);
+	/* ... and the move is visible before we modify the other one */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+#endif /* _LOCKING_SEQLOCK_H */
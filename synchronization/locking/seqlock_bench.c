@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+#include "seqlock.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * 读多写少的数据，读者在写者不停更新时的吞吐量
+ *
+ * 共享的是一份路由配置，一个写者反复更新它，其余线程都是读者，每次读出整份配置并检查是不是写到一半的：
+ *   mutex    读者和写者都加pthread_mutex
+ *   rwlock   读者加读锁，写者加写锁，读者之间不互斥，但每次加锁都要改锁里的读者计数
+ *   seqlock  读者不加锁，读完检查序号，写者正在写或者写过就重读
+ *   latch    两份配置，写者轮流改不用的那份，读者总有一份完整的可读，不用等写者
+ *
+ * 输出读者每秒读到的次数、写者每秒更新的次数、平均每次读重试的次数和读到不一致配置的次数（应该是0）
+ *
+ * 用法：./seqlock_bench [每种实现的运行毫秒数] [读者个数] [写者两次更新之间空转的次数]
+ */
+
+#define BENCH_MAX_THREADS 256
+#define ROUTE_GATEWAYS 7
+
+/* 一份配置，gateway[i]都由version算出来，读者据此判断读到的配置是不是完整的 */
+struct route_config
+{
+    unsigned long version;
+    unsigned long gateway[ROUTE_GATEWAYS];
+};
+
+struct bench_thread
+{
+    pthread_t tid;
+    int cpu;
+    unsigned long long ops;
+    unsigned long long retries;
+    unsigned long long torn;
+} __attribute__((aligned(64)));
+
+static struct bench_thread bench_threads[BENCH_MAX_THREADS];
+static volatile int bench_stop;
+static int bench_ms = 200;
+static int nr_readers;
+static int writer_think = 1000;
+
+static struct route_config route __attribute__((aligned(64)));
+static struct route_config route_copies[2] __attribute__((aligned(64)));
+static pthread_mutex_t route_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t route_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static seqlock_t route_seqlock;
+static seqcount_latch_t route_latch;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 线程按顺序绑定到各个cpu上，cpu不够就轮着来 */
+static void bench_pin(int cpu)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    if (nr_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nr_cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* seqlock的读者会和写者同时访问配置，逐个字段用relaxed的原子读写，免得编译器把访问拆开或者合并 */
+static inline void route_read(struct route_config *dst, const struct route_config *src)
+{
+    dst->version = __atomic_load_n(&src->version, __ATOMIC_RELAXED);
+    for (int i = 0; i < ROUTE_GATEWAYS; i++)
+        dst->gateway[i] = __atomic_load_n(&src->gateway[i], __ATOMIC_RELAXED);
+}
+
+static inline void route_write(struct route_config *dst, unsigned long version)
+{
+    __atomic_store_n(&dst->version, version, __ATOMIC_RELAXED);
+    for (int i = 0; i < ROUTE_GATEWAYS; i++)
+        __atomic_store_n(&dst->gateway[i], version * (i + 1), __ATOMIC_RELAXED);
+}
+
+static inline int route_torn(const struct route_config *c)
+{
+    for (int i = 0; i < ROUTE_GATEWAYS; i++)
+        if (c->gateway[i] != c->version * (i + 1))
+            return 1;
+    return 0;
+}
+
+static inline void bench_think(void)
+{
+    for (volatile int i = 0; i < writer_think; i++)
+        ;
+}
+
+static void mutex_read(struct route_config *c, struct bench_thread *t)
+{
+    pthread_mutex_lock(&route_mutex);
+    route_read(c, &route);
+    pthread_mutex_unlock(&route_mutex);
+}
+
+static void mutex_write(unsigned long version)
+{
+    pthread_mutex_lock(&route_mutex);
+    route_write(&route, version);
+    pthread_mutex_unlock(&route_mutex);
+}
+
+static void rwlock_read(struct route_config *c, struct bench_thread *t)
+{
+    pthread_rwlock_rdlock(&route_rwlock);
+    route_read(c, &route);
+    pthread_rwlock_unlock(&route_rwlock);
+}
+
+static void rwlock_write(unsigned long version)
+{
+    pthread_rwlock_wrlock(&route_rwlock);
+    route_write(&route, version);
+    pthread_rwlock_unlock(&route_rwlock);
+}
+
+static void seqlock_read(struct route_config *c, struct bench_thread *t)
+{
+    unsigned int seq;
+
+    for (;;)
+    {
+        seq = read_seqbegin(&route_seqlock);
+        route_read(c, &route);
+        if (!read_seqretry(&route_seqlock, seq))
+            break;
+        t->retries++;
+    }
+}
+
+static void seqlock_write(unsigned long version)
+{
+    write_seqlock(&route_seqlock);
+    route_write(&route, version);
+    write_sequnlock(&route_seqlock);
+}
+
+static void latch_read(struct route_config *c, struct bench_thread *t)
+{
+    unsigned int seq;
+
+    for (;;)
+    {
+        seq = raw_read_seqcount_latch(&route_latch);
+        route_read(c, &route_copies[seq & 1]);
+        if (!read_seqcount_latch_retry(&route_latch, seq))
+            break;
+        t->retries++;
+    }
+}
+
+/* 只有一个写者，不用再加锁 */
+static void latch_write(unsigned long version)
+{
+    raw_write_seqcount_latch(&route_latch);
+    route_write(&route_copies[0], version);
+    raw_write_seqcount_latch(&route_latch);
+    route_write(&route_copies[1], version);
+}
+
+struct bench_impl
+{
+    const char *name;
+    void (*read)(struct route_config *c, struct bench_thread *t);
+    void (*write)(unsigned long version);
+};
+
+static const struct bench_impl bench_impls[] = {
+    {"mutex", mutex_read, mutex_write},
+    {"rwlock", rwlock_read, rwlock_write},
+    {"seqlock", seqlock_read, seqlock_write},
+    {"latch", latch_read, latch_write},
+};
+
+static const struct bench_impl *bench_impl;
+
+static void *bench_reader(void *arg)
+{
+    struct bench_thread *t = arg;
+    struct route_config c;
+
+    bench_pin(t->cpu);
+    while (!bench_stop)
+    {
+        bench_impl->read(&c, t);
+        t->torn += route_torn(&c);
+        t->ops++;
+    }
+    return NULL;
+}
+
+static void *bench_writer(void *arg)
+{
+    struct bench_thread *t = arg;
+
+    bench_pin(t->cpu);
+    while (!bench_stop)
+    {
+        bench_impl->write(++t->ops);
+        bench_think();
+    }
+    return NULL;
+}
+
+static void bench_run(const struct bench_impl *impl)
+{
+    unsigned long long start, ns, reads = 0, retries = 0, torn = 0;
+    struct bench_thread *w = &bench_threads[nr_readers];
+    int i;
+
+    bench_impl = impl;
+    bench_stop = 0;
+    memset(bench_threads, 0, sizeof(bench_threads));
+    memset(&route, 0, sizeof(route));
+    memset(route_copies, 0, sizeof(route_copies));
+    seqlock_init(&route_seqlock);
+    seqcount_latch_init(&route_latch);
+
+    start = now_ns();
+    for (i = 0; i <= nr_readers; i++)
+    {
+        bench_threads[i].cpu = i;
+        pthread_create(&bench_threads[i].tid, NULL, i < nr_readers ? bench_reader : bench_writer,
+                       &bench_threads[i]);
+    }
+
+    usleep(bench_ms * 1000);
+    bench_stop = 1;
+    for (i = 0; i <= nr_readers; i++)
+        pthread_join(bench_threads[i].tid, NULL);
+    ns = now_ns() - start;
+
+    for (i = 0; i < nr_readers; i++)
+    {
+        reads += bench_threads[i].ops;
+        retries += bench_threads[i].retries;
+        torn += bench_threads[i].torn;
+    }
+    printf("%-8s %10.2f Mreads/s %10.1f Kwrites/s %8.4f retries/read %6llu torn\r\n", impl->name,
+           (double)reads * 1000 / ns, (double)w->ops * 1000000 / ns, reads ? (double)retries / reads : 0,
+           torn);
+}
+
+int main(int argc, char const *argv[])
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    nr_readers = nr_cpus > 1 ? nr_cpus - 1 : 1;
+    if (argc > 1)
+        bench_ms = atoi(argv[1]);
+    if (argc > 2)
+        nr_readers = atoi(argv[2]);
+    if (argc > 3)
+        writer_think = atoi(argv[3]);
+    if (bench_ms <= 0 || nr_readers <= 0 || nr_readers >= BENCH_MAX_THREADS || writer_think < 0)
+    {
+        printf("usage: %s [ms] [readers] [writer think loops]\r\n", argv[0]);
+        exit(1);
+    }
+
+    printf("%d readers, 1 writer thinking %d loops between updates, %d ms each\r\n", nr_readers,
+           writer_think, bench_ms);
+    for (unsigned int i = 0; i < sizeof(bench_impls) / sizeof(bench_impls[0]); i++)
+        bench_run(&bench_impls[i]);
+    exit(0);
+}
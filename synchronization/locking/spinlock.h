@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Pluggable spinlock API for user space
+ *
+ * spin_lock() and friends pick the implementation from the type of the lock
+ * they are given, so every lock below can be passed to the kfifo
+ * *_spinlocked macros:
+ *
+ *   pthread_spinlock_t      test-and-set lock of glibc
+ *   struct ticket_spinlock  FIFO ticket lock, see ticket_spinlock.h
+ *   struct mcs_lock         MCS queue lock, see mcs_spinlock.h
+ *   struct clh_lock         CLH queue lock, see clh_spinlock.h
+ *   struct qspinlock        queued spinlock, see qspinlock.h
+ *   struct futex_mutex      sleeping lock, see futex_mutex.h
+ *
+ * spinlock_t is the lock configured at compile time, the ticket lock
+ * unless one of CONFIG_SPINLOCK_PTHREAD, CONFIG_SPINLOCK_MCS,
+ * CONFIG_SPINLOCK_CLH, CONFIG_SPINLOCK_QUEUED or CONFIG_SPINLOCK_FUTEX is
+ * defined.
+ *
+ * C++ has no _Generic, there the same names are overloaded functions.
+ */
+#ifndef _LOCKING_SPINLOCK_H
+#define _LOCKING_SPINLOCK_H
+
+#include <pthread.h>
+#include "clh_spinlock.h"
+#include "futex_mutex.h"
+#include "mcs_spinlock.h"
+#include "qspinlock.h"
+#include "ticket_spinlock.h"
+
+static inline void pthread_spin_lock_init(pthread_spinlock_t *lock)
+{
+	pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+static inline bool pthread_spin_trylock_bool(pthread_spinlock_t *lock)
+{
+	return !pthread_spin_trylock(lock);
+}
+
+#ifdef __cplusplus
+
+#define __SPIN_OPS(type, init_op, lock_op, trylock_op, unlock_op) \
+	static inline void spin_lock_init(type *lock) { init_op(lock); } \
+	static inline void spin_lock(type *lock) { (void)lock_op(lock); } \
+	static inline bool spin_trylock(type *lock) { return !!trylock_op(lock); } \
+	static inline void spin_unlock(type *lock) { (void)unlock_op(lock); }
+
+__SPIN_OPS(pthread_spinlock_t, pthread_spin_lock_init, pthread_spin_lock,
+	   pthread_spin_trylock_bool, pthread_spin_unlock)
+__SPIN_OPS(struct ticket_spinlock, ticket_spin_lock_init, ticket_spin_lock,
+	   ticket_spin_trylock, ticket_spin_unlock)
+__SPIN_OPS(struct mcs_lock, mcs_lock_init, mcs_lock, mcs_trylock, mcs_unlock)
+__SPIN_OPS(struct clh_lock, clh_lock_init, clh_lock, clh_trylock, clh_unlock)
+__SPIN_OPS(struct qspinlock, queued_spin_lock_init, queued_spin_lock,
+	   queued_spin_trylock, queued_spin_unlock)
+__SPIN_OPS(struct futex_mutex, futex_mutex_init, futex_mutex_lock,
+	   futex_mutex_trylock, futex_mutex_unlock)
+
+#else
+
+#define __spin_op(lock, pthread_op, ticket_op, mcs_op, clh_op, queued_op, \
+		  futex_op) \
+	_Generic((lock), \
+		pthread_spinlock_t *: pthread_op, \
+		struct ticket_spinlock *: ticket_op, \
+		struct mcs_lock *: mcs_op, \
+		struct clh_lock *: clh_op, \
+		struct qspinlock *: queued_op, \
+		struct futex_mutex *: futex_op)(lock)
+
+#define spin_lock_init(lock) \
+	__spin_op(lock, pthread_spin_lock_init, ticket_spin_lock_init, \
+		  mcs_lock_init, clh_lock_init, queued_spin_lock_init, \
+		  futex_mutex_init)
+
+#define spin_lock(lock) \
+	do { \
+		(void)__spin_op(lock, pthread_spin_lock, ticket_spin_lock, \
+				mcs_lock, clh_lock, queued_spin_lock, \
+				futex_mutex_lock); \
+	} while (0)
+
+#define spin_unlock(lock) \
+	do { \
+		(void)__spin_op(lock, pthread_spin_unlock, ticket_spin_unlock, \
+				mcs_unlock, clh_unlock, queued_spin_unlock, \
+				futex_mutex_unlock); \
+	} while (0)
+
+/* returns true if the lock was taken */
+#define spin_trylock(lock) \
+	(!!__spin_op(lock, pthread_spin_trylock_bool, ticket_spin_trylock, \
+		     mcs_trylock, clh_trylock, queued_spin_trylock, \
+		     futex_mutex_trylock))
+
+#endif /* __cplusplus */
+
+/* there are no interrupts to disable in user space, @flags is unused */
+#define spin_lock_irqsave(lock, flags) \
+	do { \
+		spin_lock(lock); \
+		(void)flags; \
+	} while (0)
+
+#define spin_unlock_irqrestore(lock, flags) \
+	do { \
+		spin_unlock(lock); \
+		(void)flags; \
+	} while (0)
+
+#if defined(CONFIG_SPINLOCK_PTHREAD)
+/*
+ * pthread_spinlock_t has no portable static initializer, glibc's x86 one
+ * is unlocked at 1 and everybody else's at 0. Use spin_lock_init().
+ */
+typedef pthread_spinlock_t spinlock_t;
+#elif defined(CONFIG_SPINLOCK_MCS)
+typedef struct mcs_lock spinlock_t;
+#define __SPIN_LOCK_UNLOCKED	__MCS_LOCK_UNLOCKED
+#elif defined(CONFIG_SPINLOCK_CLH)
+typedef struct clh_lock spinlock_t;
+#define __SPIN_LOCK_UNLOCKED	__CLH_LOCK_UNLOCKED
+#elif defined(CONFIG_SPINLOCK_QUEUED)
+typedef struct qspinlock spinlock_t;
+#define __SPIN_LOCK_UNLOCKED	__ARCH_SPIN_LOCK_UNLOCKED
+#elif defined(CONFIG_SPINLOCK_FUTEX)
+typedef struct futex_mutex spinlock_t;
+#define __SPIN_LOCK_UNLOCKED	__FUTEX_MUTEX_UNLOCKED
+#else
+typedef struct ticket_spinlock spinlock_t;
+#define __SPIN_LOCK_UNLOCKED	__TICKET_SPIN_LOCK_UNLOCKED
+#endif
+
+#define DEFINE_SPINLOCK(x)	spinlock_t x = __SPIN_LOCK_UNLOCKED
+
+#endif /* _LOCKING_SPINLOCK_H */
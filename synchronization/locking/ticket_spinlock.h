@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Ticket spinlock, modelled on the ARM arch_spinlock_t
+ *
+ * next is the number of the next ticket handed out, owner the number of
+ * the ticket allowed into the critical section. Waiters are served in the
+ * order they took their ticket, so unlike a test-and-set lock no thread
+ * can be starved by the others.
+ *
+ * All waiters spin on the same word, and every unlock pulls its cache line
+ * away from the owner once per waiter. A waiter that is n tickets away from
+ * the lock cannot get it before n unlocks have happened, so it backs off in
+ * proportion to n and only the next in line polls at full speed.
+ */
+#ifndef _LOCKING_TICKET_SPINLOCK_H
+#define _LOCKING_TICKET_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "processor.h"
+
+#define TICKET_SHIFT	16
+/* cpu_relax() rounds per ticket ahead of us between two polls */
+#define TICKET_BACKOFF_BASE	32
+
+/* declared outside of the union, C++ allows no types in anonymous unions */
+struct __raw_tickets {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	uint16_t next;
+	uint16_t owner;
+#else
+	uint16_t owner;
+	uint16_t next;
+#endif
+};
+
+struct ticket_spinlock {
+	union {
+		uint32_t slock;
+		struct __raw_tickets tickets;
+	};
+};
+
+#define __TICKET_SPIN_LOCK_UNLOCKED	{ { 0 } }
+
+static inline void ticket_spin_lock_init(struct ticket_spinlock *lock)
+{
+	__atomic_store_n(&lock->slock, 0, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_spin_lock(struct ticket_spinlock *lock)
+{
+	struct __raw_tickets lockval;
+	unsigned int spins = 0;
+	uint32_t slock;
+
+	/* take a ticket, next++ */
+	slock = __atomic_fetch_add(&lock->slock, 1 << TICKET_SHIFT,
+				   __ATOMIC_ACQUIRE);
+	lockval.next = slock >> TICKET_SHIFT;
+	lockval.owner = slock;
+
+	while (lockval.next != lockval.owner) {
+		/* the holder is one of the tickets ahead of us */
+		unsigned int delay = (uint16_t)(lockval.next - lockval.owner) - 1;
+
+		for (delay *= TICKET_BACKOFF_BASE; delay; delay--)
+			cpu_relax();
+		spin_relax(&spins);
+		lockval.owner = __atomic_load_n(&lock->tickets.owner,
+						__ATOMIC_ACQUIRE);
+	}
+}
+
+static inline bool ticket_spin_trylock(struct ticket_spinlock *lock)
+{
+	uint32_t slock = __atomic_load_n(&lock->slock, __ATOMIC_RELAXED);
+
+	if ((slock >> TICKET_SHIFT) != (slock & 0xffff))
+		return false;
+
+	return __atomic_compare_exchange_n(&lock->slock, &slock,
+					   slock + (1 << TICKET_SHIFT), false,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ticket_spin_unlock(struct ticket_spinlock *lock)
+{
+	/* only the owner writes owner, a plain increment is enough */
+	uint16_t owner = __atomic_load_n(&lock->tickets.owner, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&lock->tickets.owner, owner + 1, __ATOMIC_RELEASE);
+}
+
+static inline bool ticket_spin_is_locked(struct ticket_spinlock *lock)
+{
+	uint32_t slock = __atomic_load_n(&lock->slock, __ATOMIC_RELAXED);
+
+	return (slock >> TICKET_SHIFT) != (slock & 0xffff);
+}
+
+/* somebody is waiting besides the holder */
+static inline bool ticket_spin_is_contended(struct ticket_spinlock *lock)
+{
+	uint32_t slock = __atomic_load_n(&lock->slock, __ATOMIC_RELAXED);
+
+	return (uint16_t)((slock >> TICKET_SHIFT) - slock) > 1;
+}
+
+#endif /* _LOCKING_TICKET_SPINLOCK_H */